@@ -1047,7 +1047,7 @@ FileAddress *FileAddress::fromMetadata(const Metadata& m)
 }
 
 #if defined(OS_UNIX)
-UnixAddress::UnixAddress(struct sockaddr_un& saddr) : SocketAddress(class_type, filepath)
+UnixAddress::UnixAddress(struct sockaddr_un& saddr) : SocketAddress(class_type, NULL), filepath(NULL)
 {
 	if (strlen(saddr.sun_path) > 0) {
 		filepath = new char[strlen(saddr.sun_path) + 1];
@@ -1056,9 +1056,10 @@ UnixAddress::UnixAddress(struct sockaddr_un& saddr) : SocketAddress(class_type,
 			strcpy(const_cast<char *>(filepath), saddr.sun_path);
 		}
 	}
+	raw = reinterpret_cast<const unsigned char *>(filepath);
 }
 
-UnixAddress::UnixAddress(const char *path) : SocketAddress(class_type, filepath)
+UnixAddress::UnixAddress(const char *path) : SocketAddress(class_type, NULL), filepath(NULL)
 {
 	if (path && strlen(path) > 0) {
 		filepath = new char[strlen(path) + 1];
@@ -1067,9 +1068,10 @@ UnixAddress::UnixAddress(const char *path) : SocketAddress(class_type, filepath)
 			strcpy(const_cast<char *>(filepath), path);
 		}
 	}
+	raw = reinterpret_cast<const unsigned char *>(filepath);
 }
 
-UnixAddress::UnixAddress(const UnixAddress& a) : SocketAddress(a)
+UnixAddress::UnixAddress(const UnixAddress& a) : SocketAddress(a), filepath(NULL)
 {
 	if (a.filepath && strlen(a.filepath) > 0) {
 		filepath = new char[strlen(a.filepath) + 1];
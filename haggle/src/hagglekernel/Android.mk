@@ -18,6 +18,7 @@ LOCAL_SRC_FILES := \
 	Address.cpp \
 	ApplicationManager.cpp \
 	Attribute.cpp \
+	AttributeIndex.cpp \
 	BenchmarkManager.cpp \
 	ConnectivityBluetooth.cpp \
 	ConnectivityBluetoothLinux.cpp \
@@ -30,6 +31,7 @@ LOCAL_SRC_FILES := \
 	Certificate.cpp \
 	DataManager.cpp \
 	DataObject.cpp \
+	DataObjectCache.cpp \
 	DataStore.cpp \
 	Debug.cpp \
 	DebugManager.cpp \
@@ -66,6 +68,7 @@ LOCAL_SRC_FILES := \
 	Utility.cpp \
 	Metadata.cpp \
 	XMLMetadata.cpp \
+	BinaryMetadata.cpp \
 	jni.cpp 
 
 # Includes for the TI wlan driver API
@@ -353,6 +353,10 @@ void ApplicationManager::onDeletedDataObject(Event *e)
 		// This is a bit of a brute force approach, removing
 		// the deleted data object from all application's
 		// bloomfilter
+
+		// The copy for applications refers to the deleted data
+		if (appDataObjects.erase(dObj->getIdStr()) > 0)
+			appDataObjectsOrder.remove(dObj->getIdStr());
 	}
 }
 void ApplicationManager::sendToApplication(DataObjectRef& dObj, ApplicationNodeRef& app)
@@ -363,6 +367,20 @@ void ApplicationManager::sendToApplication(DataObjectRef& dObj, ApplicationNodeR
 	kernel->addEvent(new Event(EVENT_TYPE_DATAOBJECT_SEND, dObj, node));
 }
 
+/*
+	Sends one data object to several applications in one send event,
+	so that all applications share the same data object.
+*/
+void ApplicationManager::sendToApplications(DataObjectRef& dObj, NodeRefList& apps)
+{
+	for (NodeRefList::iterator it = apps.begin(); it != apps.end(); it++) {
+		ApplicationNodeRef app = *it;
+		pendingDOs.push_back(make_pair(app, dObj));
+	}
+	HAGGLE_DBG("Sending data object [%s] to %lu applications\n", dObj->getIdStr(), apps.size());
+	kernel->addEvent(new Event(EVENT_TYPE_DATAOBJECT_SEND, dObj, apps));
+}
+
 void ApplicationManager::onPrepareShutdown()
 {	
 	HAGGLE_DBG("Prepare shutdown! Notifying applications\n");
@@ -502,19 +520,17 @@ int ApplicationManager::sendToAllApplications(DataObjectRef& dObj, long eid)
 		HAGGLE_ERR("No applications to send to for event id=%ld\n", eid);
 		return 0;
 	}
-	for (NodeRefList::iterator it = apps.begin(); it != apps.end(); it++) {
-		ApplicationNodeRef app = *it;
-
-		DataObjectRef sendDO = dObj->copy();
 
+	// The data object is addressed to all applications, so they can 
+	// all be sent the same one.
 #ifdef DEBUG_APPLICATION_API
-		sendDO->print();
+	dObj->print();
 #endif
-		sendToApplication(sendDO, app);
-		numSent++;
-		HAGGLE_DBG("Sent event id=%ld to application %s [data object id=%s]\n", 
-			eid, app->getName().c_str(), sendDO->getIdStr());
-	}
+	sendToApplications(dObj, apps);
+	numSent = apps.size();
+
+	HAGGLE_DBG("Sent event id=%ld to %d applications [data object id=%s]\n", 
+		eid, numSent, dObj->getIdStr());
 
 	return numSent;
 }
@@ -564,21 +580,22 @@ void ApplicationManager::onApplicationFilterMatchEvent(Event *e)
 		HAGGLE_ERR("No applications matched filter\n");
 		return;
 	}
-	for (NodeRefList::iterator it = apps.begin(); it != apps.end(); it++) {
-		ApplicationNodeRef app = *it;
+	HAGGLE_DBG("%lu applications' filters matched %lu data objects\n", 
+		apps.size(), dObjs.size());
 
-		HAGGLE_DBG("Application %s's filter matched %lu data objects\n", 
-			app->getName().c_str(), dObjs.size());
+	for (DataObjectRefList::iterator it = dObjs.begin(); it != dObjs.end(); it++) {
+		DataObjectRef& dObj = *it;
+		NodeRefList targets;
+
+		// Do not give node descriptions to applications.
+		if (dObj->isNodeDescription()) {
+			HAGGLE_DBG("Data object [%s] is a node description, not sending to applications\n", 
+				dObj->getIdStr());
+			continue;
+		}
 
-		for (DataObjectRefList::iterator it = dObjs.begin(); it != dObjs.end(); it++) {
-			DataObjectRef& dObj = *it;
-
-			// Do not give node descriptions to applications.
-			if (dObj->isNodeDescription()) {
-				HAGGLE_DBG("Data object [%s] is a node description, not sending to %s\n", 
-					dObj->getIdStr(), app->getName().c_str());
-				continue;
-			}
+		for (NodeRefList::iterator jt = apps.begin(); jt != apps.end(); jt++) {
+			NodeRef& app = *jt;
 
 			// Have we already sent this data object to this app?
 			if (app->getBloomfilter()->has(dObj)) {
@@ -586,49 +603,82 @@ void ApplicationManager::onApplicationFilterMatchEvent(Event *e)
 				HAGGLE_DBG("Application %s already has data object. Not sending.\n", 
 					app->getName().c_str());
 			} else {
-				string dObjName = "DataObject[App:" + app->getName() + "]";
+				targets.push_back(app);
+			}
+		}
 
-				DataObjectRef dObjSend = dObj->copy();
-				
-				Metadata *ctrl_m = addControlMetadata(CTRL_TYPE_EVENT, app->getName(), dObjSend->getMetadata());
-				
-				if (!ctrl_m) {
-					HAGGLE_ERR("Failed to add control metadata\n");
-					continue;
-				}
-				Metadata *event_m = ctrl_m->addMetadata(DATAOBJECT_METADATA_APPLICATION_CONTROL_EVENT);
-				
-				if (!event_m) {
-					HAGGLE_ERR("Failed to add event metadata\n");
-					continue;
-				}
-				event_m->setParameter(DATAOBJECT_METADATA_APPLICATION_CONTROL_EVENT_TYPE_PARAM, intToStr(LIBHAGGLE_EVENT_NEW_DATAOBJECT));
-			
-				dObjSend->setPersistent(false);
-
-				/*
-				Indicate that this data object is for a
-				local application, which means the file path
-				to the local file will be added to the
-				metadata once the data object is transformed
-				to wire format.
-				*/
-				dObjSend->setIsForLocalApp();				
+		if (targets.empty())
+			continue;
+
+		DataObjectRef dObjSend = getApplicationDataObject(dObj);
+
+		if (!dObjSend)
+			continue;
+
+		sendToApplications(dObjSend, targets);
+	}
+}
+
+/*
+	Returns the copy of a data object that is sent to applications. The
+	control metadata of the copy is addressed to all applications rather
+	than to each application by name, so that the copy can be shared by
+	all of them. Each application only receives the data objects sent to
+	its own interface anyway.
+*/
+DataObjectRef ApplicationManager::getApplicationDataObject(DataObjectRef& dObj)
+{
+	ApplicationDataObjects_t::iterator it = appDataObjects.find(dObj->getIdStr());
+
+	if (it != appDataObjects.end())
+		return (*it).second;
+
+	DataObjectRef dObjSend = dObj->copy();
+	
+	Metadata *ctrl_m = addControlMetadata(CTRL_TYPE_EVENT, "All Applications", dObjSend->getMetadata());
+	
+	if (!ctrl_m) {
+		HAGGLE_ERR("Failed to add control metadata\n");
+		return NULL;
+	}
+	Metadata *event_m = ctrl_m->addMetadata(DATAOBJECT_METADATA_APPLICATION_CONTROL_EVENT);
+	
+	if (!event_m) {
+		HAGGLE_ERR("Failed to add event metadata\n");
+		return NULL;
+	}
+	event_m->setParameter(DATAOBJECT_METADATA_APPLICATION_CONTROL_EVENT_TYPE_PARAM, intToStr(LIBHAGGLE_EVENT_NEW_DATAOBJECT));
+
+	dObjSend->setPersistent(false);
+
+	/*
+	Indicate that this data object is for a
+	local application, which means the file path
+	to the local file will be added to the
+	metadata once the data object is transformed
+	to wire format.
+	*/
+	dObjSend->setIsForLocalApp();
 #if 0
-				unsigned char *raw;
-				size_t len;
+	unsigned char *raw;
+	size_t len;
 
-				dObjSend->getRawMetadataAlloc(&raw, &len);
+	dObjSend->getRawMetadataAlloc(&raw, &len);
 
-				if (raw) {
-					printf("App - DataObject METADATA:\n%s\n", raw);
-					free(raw);
-				}
+	if (raw) {
+		printf("App - DataObject METADATA:\n%s\n", raw);
+		free(raw);
+	}
 #endif
-				sendToApplication(dObjSend, app);
-			}
-		}
+	while (appDataObjectsOrder.size() >= MAX_APPLICATION_DATAOBJECTS) {
+		appDataObjects.erase(appDataObjectsOrder.front());
+		appDataObjectsOrder.pop_front();
 	}
+
+	appDataObjects.insert(make_pair(dObj->getIdStr(), dObjSend));
+	appDataObjectsOrder.push_back(dObj->getIdStr());
+
+	return dObjSend;
 }
 
 void ApplicationManager::onNeighborStatusChange(Event *e)
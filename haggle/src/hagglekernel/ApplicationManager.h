@@ -41,6 +41,9 @@ class ApplicationManager;
 
 typedef List< Pair<NodeRef, DataObjectRef> > SentToApplicationList;
 
+// The number of data objects kept ready for delivery to applications
+#define MAX_APPLICATION_DATAOBJECTS 100
+
 /** */
 class ApplicationHandle
 {
@@ -90,6 +93,17 @@ public:
 class ApplicationManager : public Manager
 {
 	SentToApplicationList pendingDOs;
+	/*
+		Copies of data objects with the control metadata that
+		applications need, indexed by data object id. The same copy
+		is sent to all applications that the data object matches,
+		so that each data object is copied and serialized once.
+		The oldest copies are dropped first.
+	*/
+	typedef Map<string, DataObjectRef> ApplicationDataObjects_t;
+	ApplicationDataObjects_t appDataObjects;
+	List<string> appDataObjectsOrder;
+	DataObjectRef getApplicationDataObject(DataObjectRef& dObj);
         unsigned long numClients;
 	unsigned long sessionid;
 	bool dataStoreFinishedProcessing;
@@ -100,6 +114,7 @@ class ApplicationManager : public Manager
 	void onDataStoreFinishedProcessing(Event *e);
         int deRegisterApplication(ApplicationNodeRef& app);
         void sendToApplication(DataObjectRef& dObj, ApplicationNodeRef& app);
+        void sendToApplications(DataObjectRef& dObj, NodeRefList& apps);
         int sendToAllApplications(DataObjectRef& dObj, long eid);
         int addApplicationEventInterest(ApplicationNodeRef& app, long eid);
         int updateApplicationInterests(ApplicationNodeRef& app);
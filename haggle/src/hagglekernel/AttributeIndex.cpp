@@ -0,0 +1,575 @@
+/* Copyright 2008-2009 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "AttributeIndex.h"
+
+/*
+	The weights and number of matching attributes of one data object,
+	node or filter, summed up while matching.
+*/
+struct MatchScore {
+	long weight;
+	unsigned long mcount;
+	bool no_match;
+	MatchScore() : weight(0), mcount(0), no_match(false) {}
+};
+
+typedef HashMap<sqlite_int64, MatchScore> ScoreMap;
+
+static inline void add_score(ScoreMap& scores, sqlite_int64 rowid, long weight)
+{
+	ScoreMap::iterator it = scores.find(rowid);
+
+	if (it == scores.end())
+		it = scores.insert(make_pair(rowid, MatchScore()));
+
+	(*it).second.weight += weight;
+	(*it).second.mcount++;
+
+	if (weight == ATTR_WEIGHT_NO_MATCH)
+		(*it).second.no_match = true;
+}
+
+/*
+	Orders matches by descending ratio and number of matching
+	attributes, and then by ascending rowid, i.e., oldest first.
+*/
+static int compare_matches(const void *a, const void *b)
+{
+	const AttributeIndex::Match *m1 = (const AttributeIndex::Match *)a;
+	const AttributeIndex::Match *m2 = (const AttributeIndex::Match *)b;
+
+	if (m1->ratio != m2->ratio)
+		return m1->ratio > m2->ratio ? -1 : 1;
+
+	if (m1->mcount != m2->mcount)
+		return m1->mcount > m2->mcount ? -1 : 1;
+
+	if (m1->rowid != m2->rowid)
+		return m1->rowid < m2->rowid ? -1 : 1;
+
+	return 0;
+}
+
+/*
+	Same as above, but newest (highest rowid) first.
+*/
+static int compare_matches_newest_first(const void *a, const void *b)
+{
+	const AttributeIndex::Match *m1 = (const AttributeIndex::Match *)a;
+	const AttributeIndex::Match *m2 = (const AttributeIndex::Match *)b;
+
+	if (m1->ratio != m2->ratio || m1->mcount != m2->mcount)
+		return compare_matches(a, b);
+
+	if (m1->rowid != m2->rowid)
+		return m1->rowid > m2->rowid ? -1 : 1;
+
+	return 0;
+}
+
+AttributeIndex::Matches::~Matches()
+{
+	if (matches)
+		free(matches);
+}
+
+void AttributeIndex::Matches::add(sqlite_int64 rowid, long ratio, unsigned long mcount)
+{
+	if (num == capacity) {
+		size_t new_capacity = capacity ? capacity * 2 : 16;
+		Match *new_matches = (Match *)realloc(matches, new_capacity * sizeof(Match));
+
+		if (!new_matches) {
+			HAGGLE_ERR("Could not allocate room for matches\n");
+			return;
+		}
+		matches = new_matches;
+		capacity = new_capacity;
+	}
+	matches[num].rowid = rowid;
+	matches[num].ratio = ratio;
+	matches[num].mcount = mcount;
+	num++;
+}
+
+void AttributeIndex::Matches::sort(int (*compare)(const void *, const void *))
+{
+	if (num > 1)
+		qsort(matches, num, sizeof(Match), compare);
+}
+
+AttributeIndex::AttributeIndex()
+{
+}
+
+AttributeIndex::~AttributeIndex()
+{
+	clear();
+}
+
+void AttributeIndex::clear()
+{
+	for (HashMap<sqlite_int64, IndexedDataObject *>::iterator it = dataobjects.begin(); it != dataobjects.end(); it++)
+		delete (*it).second;
+
+	for (HashMap<sqlite_int64, IndexedNode *>::iterator it = nodes.begin(); it != nodes.end(); it++)
+		delete (*it).second;
+
+	for (HashMap<sqlite_int64, IndexedFilter *>::iterator it = filters.begin(); it != filters.end(); it++)
+		delete (*it).second;
+
+	for (NameMap::iterator it = names.begin(); it != names.end(); it++) {
+		ValueMap *values = (*it).second;
+
+		for (ValueMap::iterator jt = values->begin(); jt != values->end(); jt++)
+			delete (*jt).second;
+
+		delete values;
+	}
+	dataobjects.clear();
+	nodes.clear();
+	filters.clear();
+	filter_events.clear();
+	names.clear();
+}
+
+AttributeIndex::Entry *AttributeIndex::findEntry(const string& name, const string& value) const
+{
+	NameMap::const_iterator it = names.find(name);
+
+	if (it == names.end())
+		return NULL;
+
+	ValueMap::const_iterator jt = (*it).second->find(value);
+
+	if (jt == (*it).second->end())
+		return NULL;
+
+	return (*jt).second;
+}
+
+AttributeIndex::Entry *AttributeIndex::getEntry(const string& name, const string& value)
+{
+	ValueMap *values;
+	NameMap::iterator it = names.find(name);
+
+	if (it == names.end()) {
+		values = new ValueMap();
+		names.insert(make_pair(name, values));
+	} else {
+		values = (*it).second;
+
+		ValueMap::iterator jt = values->find(value);
+
+		if (jt != values->end())
+			return (*jt).second;
+	}
+
+	Entry *e = new Entry(name, value);
+
+	values->insert(make_pair(value, e));
+
+	return e;
+}
+
+/*
+	Deletes the entry if no data object, node or filter has the
+	attribute any longer.
+*/
+void AttributeIndex::releaseEntry(Entry *e)
+{
+	if (!e->empty())
+		return;
+
+	NameMap::iterator it = names.find(e->name);
+
+	if (it != names.end()) {
+		ValueMap *values = (*it).second;
+
+		values->erase(e->value);
+
+		if (values->empty()) {
+			names.erase(e->name);
+			delete values;
+		}
+	}
+	delete e;
+}
+
+bool AttributeIndex::addDataObject(sqlite_int64 rowid, const DataObjectId_t id)
+{
+	if (dataobjects.find(rowid) != dataobjects.end())
+		return false;
+
+	IndexedDataObject *d = new IndexedDataObject();
+
+	memcpy(d->id, id, DATAOBJECT_ID_LEN);
+	dataobjects.insert(make_pair(rowid, d));
+
+	return true;
+}
+
+bool AttributeIndex::addDataObjectAttribute(sqlite_int64 rowid, const string& name, const string& value)
+{
+	HashMap<sqlite_int64, IndexedDataObject *>::iterator it = dataobjects.find(rowid);
+
+	if (it == dataobjects.end())
+		return false;
+
+	Entry *e = getEntry(name, value);
+
+	if (e->dataobjects.find(rowid) != e->dataobjects.end())
+		return false;
+
+	e->dataobjects.insert(make_pair(rowid, 0L));
+	(*it).second->attrs.push_back(e);
+
+	return true;
+}
+
+void AttributeIndex::removeDataObject(sqlite_int64 rowid)
+{
+	HashMap<sqlite_int64, IndexedDataObject *>::iterator it = dataobjects.find(rowid);
+
+	if (it == dataobjects.end())
+		return;
+
+	IndexedDataObject *d = (*it).second;
+
+	for (List<Entry *>::iterator jt = d->attrs.begin(); jt != d->attrs.end(); jt++) {
+		(*jt)->dataobjects.erase(rowid);
+		releaseEntry(*jt);
+	}
+	dataobjects.erase(rowid);
+	delete d;
+}
+
+const DataObjectId_t *AttributeIndex::getDataObjectId(sqlite_int64 rowid) const
+{
+	HashMap<sqlite_int64, IndexedDataObject *>::const_iterator it = dataobjects.find(rowid);
+
+	if (it == dataobjects.end())
+		return NULL;
+
+	return &(*it).second->id;
+}
+
+bool AttributeIndex::addNode(sqlite_int64 rowid, unsigned long threshold)
+{
+	if (nodes.find(rowid) != nodes.end())
+		return false;
+
+	nodes.insert(make_pair(rowid, new IndexedNode(threshold)));
+
+	return true;
+}
+
+bool AttributeIndex::addNodeAttribute(sqlite_int64 rowid, const string& name, const string& value, long weight)
+{
+	HashMap<sqlite_int64, IndexedNode *>::iterator it = nodes.find(rowid);
+
+	if (it == nodes.end())
+		return false;
+
+	Entry *e = getEntry(name, value);
+
+	if (e->nodes.find(rowid) != e->nodes.end())
+		return false;
+
+	e->nodes.insert(make_pair(rowid, weight));
+	(*it).second->attrs.push_back(e);
+	(*it).second->sum_weights += weight;
+
+	return true;
+}
+
+void AttributeIndex::removeNode(sqlite_int64 rowid)
+{
+	HashMap<sqlite_int64, IndexedNode *>::iterator it = nodes.find(rowid);
+
+	if (it == nodes.end())
+		return;
+
+	IndexedNode *n = (*it).second;
+
+	for (List<Entry *>::iterator jt = n->attrs.begin(); jt != n->attrs.end(); jt++) {
+		(*jt)->nodes.erase(rowid);
+		releaseEntry(*jt);
+	}
+	nodes.erase(rowid);
+	delete n;
+}
+
+bool AttributeIndex::addFilter(sqlite_int64 rowid, long event)
+{
+	if (filters.find(rowid) != filters.end())
+		return false;
+
+	filters.insert(make_pair(rowid, new IndexedFilter(event)));
+	filter_events.erase(event);
+	filter_events.insert(make_pair(event, rowid));
+
+	return true;
+}
+
+bool AttributeIndex::addFilterAttribute(sqlite_int64 rowid, const string& name, const string& value)
+{
+	HashMap<sqlite_int64, IndexedFilter *>::iterator it = filters.find(rowid);
+
+	if (it == filters.end())
+		return false;
+
+	Entry *e = getEntry(name, value);
+
+	if (e->filters.find(rowid) != e->filters.end())
+		return false;
+
+	e->filters.insert(make_pair(rowid, 0L));
+	(*it).second->attrs.push_back(e);
+
+	return true;
+}
+
+void AttributeIndex::removeFilter(sqlite_int64 rowid)
+{
+	HashMap<sqlite_int64, IndexedFilter *>::iterator it = filters.find(rowid);
+
+	if (it == filters.end())
+		return;
+
+	IndexedFilter *f = (*it).second;
+
+	for (List<Entry *>::iterator jt = f->attrs.begin(); jt != f->attrs.end(); jt++) {
+		(*jt)->filters.erase(rowid);
+		releaseEntry(*jt);
+	}
+
+	if (getFilterRowId(f->event) == rowid)
+		filter_events.erase(f->event);
+
+	filters.erase(rowid);
+	delete f;
+}
+
+sqlite_int64 AttributeIndex::getFilterRowId(long event) const
+{
+	HashMap<long, sqlite_int64>::const_iterator it = filter_events.find(event);
+
+	if (it == filter_events.end())
+		return -1;
+
+	return (*it).second;
+}
+
+long AttributeIndex::getFilterEvent(sqlite_int64 rowid) const
+{
+	HashMap<sqlite_int64, IndexedFilter *>::const_iterator it = filters.find(rowid);
+
+	if (it == filters.end())
+		return -1;
+
+	return (*it).second->event;
+}
+
+void AttributeIndex::filtersForDataObject(sqlite_int64 dataobject_rowid, Matches& m) const
+{
+	HashMap<sqlite_int64, IndexedDataObject *>::const_iterator it = dataobjects.find(dataobject_rowid);
+	ScoreMap scores;
+
+	if (it == dataobjects.end())
+		return;
+
+	const List<Entry *>& attrs = (*it).second->attrs;
+
+	for (List<Entry *>::const_iterator jt = attrs.begin(); jt != attrs.end(); jt++) {
+		const Entry *e = *jt;
+
+		for (Postings::const_iterator pt = e->filters.begin(); pt != e->filters.end(); pt++)
+			add_score(scores, (*pt).first, 1);
+
+		// Filters may also match the attribute with a wildcard
+		if (e->value != ATTR_WILDCARD) {
+			const Entry *w = findEntry(e->name, ATTR_WILDCARD);
+
+			if (w) {
+				for (Postings::const_iterator pt = w->filters.begin(); pt != w->filters.end(); pt++)
+					add_score(scores, (*pt).first, 1);
+			}
+		}
+	}
+
+	for (ScoreMap::iterator st = scores.begin(); st != scores.end(); st++) {
+		HashMap<sqlite_int64, IndexedFilter *>::const_iterator ft = filters.find((*st).first);
+		long ratio = (long)(100 * (*st).second.mcount / (*ft).second->attrs.size());
+
+		if (ratio > 0)
+			m.add((*st).first, ratio, (*st).second.mcount);
+	}
+	m.sort(compare_matches);
+}
+
+void AttributeIndex::dataObjectsForFilter(sqlite_int64 filter_rowid, Matches& m) const
+{
+	HashMap<sqlite_int64, IndexedFilter *>::const_iterator it = filters.find(filter_rowid);
+	ScoreMap scores;
+
+	if (it == filters.end())
+		return;
+
+	const List<Entry *>& attrs = (*it).second->attrs;
+
+	for (List<Entry *>::const_iterator jt = attrs.begin(); jt != attrs.end(); jt++) {
+		const Entry *e = *jt;
+
+		if (e->value == ATTR_WILDCARD) {
+			// Match all attributes with the same name
+			NameMap::const_iterator nt = names.find(e->name);
+
+			if (nt == names.end())
+				continue;
+
+			for (ValueMap::const_iterator vt = (*nt).second->begin(); vt != (*nt).second->end(); vt++) {
+				const Entry *v = (*vt).second;
+
+				for (Postings::const_iterator pt = v->dataobjects.begin(); pt != v->dataobjects.end(); pt++)
+					add_score(scores, (*pt).first, 1);
+			}
+		} else {
+			for (Postings::const_iterator pt = e->dataobjects.begin(); pt != e->dataobjects.end(); pt++)
+				add_score(scores, (*pt).first, 1);
+		}
+	}
+
+	for (ScoreMap::iterator st = scores.begin(); st != scores.end(); st++) {
+		long ratio = (long)(100 * (*st).second.mcount / attrs.size());
+
+		if (ratio > 0)
+			m.add((*st).first, ratio, (*st).second.mcount);
+	}
+	m.sort(compare_matches);
+}
+
+void AttributeIndex::dataObjectsForAttributes(const Attributes& attrs, Matches& m) const
+{
+	ScoreMap scores;
+
+	if (attrs.empty())
+		return;
+
+	for (Attributes::const_iterator it = attrs.begin(); it != attrs.end(); it++) {
+		const Attribute& a = (*it).second;
+
+		if (a.getValue() == ATTR_WILDCARD) {
+			// Match all attributes with the same name
+			NameMap::const_iterator nt = names.find(a.getName());
+
+			if (nt == names.end())
+				continue;
+
+			for (ValueMap::const_iterator vt = (*nt).second->begin(); vt != (*nt).second->end(); vt++) {
+				const Entry *v = (*vt).second;
+
+				for (Postings::const_iterator pt = v->dataobjects.begin(); pt != v->dataobjects.end(); pt++)
+					add_score(scores, (*pt).first, 1);
+			}
+		} else {
+			const Entry *e = findEntry(a.getName(), a.getValue());
+
+			if (!e)
+				continue;
+
+			for (Postings::const_iterator pt = e->dataobjects.begin(); pt != e->dataobjects.end(); pt++)
+				add_score(scores, (*pt).first, 1);
+		}
+	}
+
+	for (ScoreMap::iterator st = scores.begin(); st != scores.end(); st++) {
+		long ratio = (long)(100 * (*st).second.mcount / attrs.size());
+
+		if (ratio > 0)
+			m.add((*st).first, ratio, (*st).second.mcount);
+	}
+	m.sort(compare_matches);
+}
+
+void AttributeIndex::nodesForDataObject(sqlite_int64 dataobject_rowid, unsigned int attrMatch, Matches& m) const
+{
+	HashMap<sqlite_int64, IndexedDataObject *>::const_iterator it = dataobjects.find(dataobject_rowid);
+	ScoreMap scores;
+
+	if (it == dataobjects.end())
+		return;
+
+	const List<Entry *>& attrs = (*it).second->attrs;
+
+	for (List<Entry *>::const_iterator jt = attrs.begin(); jt != attrs.end(); jt++) {
+		const Entry *e = *jt;
+
+		for (Postings::const_iterator pt = e->nodes.begin(); pt != e->nodes.end(); pt++)
+			add_score(scores, (*pt).first, (*pt).second);
+	}
+
+	for (ScoreMap::iterator st = scores.begin(); st != scores.end(); st++) {
+		const MatchScore& s = (*st).second;
+		const IndexedNode *n = (*nodes.find((*st).first)).second;
+
+		if (s.no_match || s.mcount < attrMatch || n->sum_weights == 0)
+			continue;
+
+		long ratio = 100 * s.weight / n->sum_weights;
+
+		if (ratio >= (long)n->threshold)
+			m.add((*st).first, ratio, s.mcount);
+	}
+	m.sort(compare_matches);
+}
+
+void AttributeIndex::dataObjectsForNode(sqlite_int64 node_rowid, unsigned int threshold, unsigned int attrMatch, Matches& m) const
+{
+	HashMap<sqlite_int64, IndexedNode *>::const_iterator it = nodes.find(node_rowid);
+	ScoreMap scores;
+
+	if (it == nodes.end())
+		return;
+
+	const IndexedNode *n = (*it).second;
+
+	if (n->sum_weights == 0)
+		return;
+
+	for (List<Entry *>::const_iterator jt = n->attrs.begin(); jt != n->attrs.end(); jt++) {
+		const Entry *e = *jt;
+		long weight = (*e->nodes.find(node_rowid)).second;
+
+		for (Postings::const_iterator pt = e->dataobjects.begin(); pt != e->dataobjects.end(); pt++)
+			add_score(scores, (*pt).first, weight);
+	}
+
+	for (ScoreMap::iterator st = scores.begin(); st != scores.end(); st++) {
+		const MatchScore& s = (*st).second;
+
+		if (s.no_match || s.mcount < attrMatch)
+			continue;
+
+		long ratio = 100 * s.weight / n->sum_weights;
+
+		if (ratio >= (long)threshold)
+			m.add((*st).first, ratio, s.mcount);
+	}
+	m.sort(compare_matches_newest_first);
+}
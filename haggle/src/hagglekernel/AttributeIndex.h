@@ -0,0 +1,219 @@
+/* Copyright 2008-2009 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _ATTRIBUTEINDEX_H
+#define _ATTRIBUTEINDEX_H
+
+/*
+	Forward declarations of all data types declared in this file. This is to
+	avoid circular dependencies. If/when a data type is added to this file,
+	remember to add it here.
+*/
+class AttributeIndex;
+
+#include <libcpphaggle/HashMap.h>
+#include <libcpphaggle/List.h>
+#include <libcpphaggle/String.h>
+
+#include <sqlite3.h>
+
+#include "Attribute.h"
+#include "DataObject.h"
+
+using namespace haggle;
+
+/**
+	An in-memory inverted index from attributes to the data objects,
+	nodes and filters that have them, identified by their rowids in the
+	data store.
+
+	The SQLDataStore keeps the index in sync with its tables, and uses
+	it to match data objects against nodes and filters, instead of
+	joining the attribute link tables for every match. The matching
+	gives the same results as the matching views in the data store:
+
+	- a node matches a data object with the ratio 100 * (sum of the
+	  weights of the node's matching attributes) / (sum of the weights
+	  of all the node's attributes). A node attribute with weight
+	  ATTR_WEIGHT_NO_MATCH that matches excludes the data object.
+
+	- a filter matches a data object with the ratio 100 * (number of
+	  matching attributes) / (number of filter attributes). A filter
+	  attribute with the value ATTR_WILDCARD matches any attribute
+	  with the same name.
+
+	The index is not thread safe. The SQLDataStore only modifies it
+	from the data store thread, and protects it with a mutex against
+	its query workers.
+*/
+class AttributeIndex {
+public:
+	/**
+		A data object, node or filter that matched, and how well.
+	*/
+	struct Match {
+		sqlite_int64 rowid;
+		long ratio;
+		unsigned long mcount;
+	};
+	/**
+		The result of a match, ordered with the best match first.
+	*/
+	class Matches {
+		friend class AttributeIndex;
+		Match *matches;
+		size_t num, capacity;
+		void add(sqlite_int64 rowid, long ratio, unsigned long mcount);
+		void sort(int (*compare)(const void *, const void *));
+		Matches(const Matches &);
+		Matches& operator=(const Matches &);
+	public:
+		Matches() : matches(NULL), num(0), capacity(0) {}
+		~Matches();
+		size_t size() const { return num; }
+		bool empty() const { return num == 0; }
+		const Match& operator[](size_t i) const { return matches[i]; }
+	};
+private:
+	// rowid -> weight of the attribute for that data object, node or filter
+	typedef HashMap<sqlite_int64, long> Postings;
+
+	struct Entry {
+		string name;
+		string value;
+		Postings dataobjects;
+		Postings nodes;
+		Postings filters;
+		Entry(const string& _name, const string& _value) : name(_name), value(_value) {}
+		bool empty() const { return dataobjects.empty() && nodes.empty() && filters.empty(); }
+	};
+	typedef HashMap<string, Entry *> ValueMap;
+	typedef HashMap<string, ValueMap *> NameMap;
+
+	struct IndexedDataObject {
+		DataObjectId_t id;
+		List<Entry *> attrs;
+	};
+	struct IndexedNode {
+		unsigned long threshold;
+		long sum_weights;
+		List<Entry *> attrs;
+		IndexedNode(unsigned long _threshold) : threshold(_threshold), sum_weights(0) {}
+	};
+	struct IndexedFilter {
+		long event;
+		List<Entry *> attrs;
+		IndexedFilter(long _event) : event(_event) {}
+	};
+
+	NameMap names;
+	HashMap<sqlite_int64, IndexedDataObject *> dataobjects;
+	HashMap<sqlite_int64, IndexedNode *> nodes;
+	HashMap<sqlite_int64, IndexedFilter *> filters;
+	HashMap<long, sqlite_int64> filter_events;
+
+	Entry *findEntry(const string& name, const string& value) const;
+	Entry *getEntry(const string& name, const string& value);
+	void releaseEntry(Entry *e);
+public:
+	AttributeIndex();
+	~AttributeIndex();
+
+	/**
+		Removes all data objects, nodes and filters from the index.
+	*/
+	void clear();
+
+	/**
+		Adds a data object, without attributes, to the index.
+		@returns true if the data object was added, or false if there
+		already was a data object with the same rowid.
+	*/
+	bool addDataObject(sqlite_int64 rowid, const DataObjectId_t id);
+	/**
+		Adds an attribute to a data object in the index.
+		@returns true if the attribute was added, or false if there is no
+		such data object or it already has the attribute.
+	*/
+	bool addDataObjectAttribute(sqlite_int64 rowid, const string& name, const string& value);
+	void removeDataObject(sqlite_int64 rowid);
+	/**
+		Returns the id of the data object with the given rowid, or NULL
+		if it is not in the index.
+	*/
+	const DataObjectId_t *getDataObjectId(sqlite_int64 rowid) const;
+
+	/**
+		Adds a node with the given matching threshold, without
+		attributes, to the index.
+	*/
+	bool addNode(sqlite_int64 rowid, unsigned long threshold);
+	bool addNodeAttribute(sqlite_int64 rowid, const string& name, const string& value, long weight);
+	void removeNode(sqlite_int64 rowid);
+
+	/**
+		Adds a filter for the given event type, without attributes,
+		to the index.
+	*/
+	bool addFilter(sqlite_int64 rowid, long event);
+	bool addFilterAttribute(sqlite_int64 rowid, const string& name, const string& value);
+	void removeFilter(sqlite_int64 rowid);
+	/**
+		Returns the rowid of the filter for the given event type, or
+		-1 if there is no such filter.
+	*/
+	sqlite_int64 getFilterRowId(long event) const;
+	/**
+		Returns the event type of the filter with the given rowid, or
+		-1 if there is no such filter.
+	*/
+	long getFilterEvent(sqlite_int64 rowid) const;
+
+	size_t getNumDataObjects() const { return dataobjects.size(); }
+	size_t getNumNodes() const { return nodes.size(); }
+	size_t getNumFilters() const { return filters.size(); }
+
+	/**
+		Finds the filters that match a data object with a ratio
+		above zero, in order of descending ratio.
+	*/
+	void filtersForDataObject(sqlite_int64 dataobject_rowid, Matches& m) const;
+	/**
+		Finds the data objects that match a filter with a ratio above
+		zero, in order of descending ratio.
+	*/
+	void dataObjectsForFilter(sqlite_int64 filter_rowid, Matches& m) const;
+	/**
+		Finds the data objects that match a set of filter attributes
+		with a ratio above zero, in order of descending ratio, as if
+		they were the attributes of a filter in the index.
+	*/
+	void dataObjectsForAttributes(const Attributes& attrs, Matches& m) const;
+	/**
+		Finds the nodes that match a data object with at least their
+		own matching threshold and 'attrMatch' matching attributes,
+		in order of descending ratio and number of matching
+		attributes.
+	*/
+	void nodesForDataObject(sqlite_int64 dataobject_rowid, unsigned int attrMatch, Matches& m) const;
+	/**
+		Finds the data objects that match a node with at least the
+		ratio 'threshold' and 'attrMatch' matching attributes, in
+		order of descending ratio and number of matching attributes,
+		and newest first.
+	*/
+	void dataObjectsForNode(sqlite_int64 node_rowid, unsigned int threshold, unsigned int attrMatch, Matches& m) const;
+};
+
+#endif /* _ATTRIBUTEINDEX_H */
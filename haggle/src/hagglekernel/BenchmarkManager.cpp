@@ -46,6 +46,7 @@ BenchmarkManager::BenchmarkManager(HaggleKernel * _kernel, unsigned int _DataObj
 	Attr_Num = _Attr_Num;
 	DataObjects_Num = _DataObjects_Num;
 	Test_Num = _Test_Num;
+	DataObjects_Inserted = 0;
 }
 
 BenchmarkManager::~BenchmarkManager()
@@ -128,6 +129,7 @@ void BenchmarkManager::onTimeout(Event *e)	// start evaluation
 
 	// Generate and insert data objects
 	// insertDataobject() is called once from here, then with asynchronous callbacks from Datastore::insertDataobject() until DataObjects_Num is reached
+	insertStartTime = Timeval::now();
 	insertDataobject(NULL);
 #endif
 }
@@ -206,23 +208,31 @@ NodeRef BenchmarkManager::createNode(unsigned int numAttr)
 
 void BenchmarkManager::insertDataobject(Event* e) 
 {
-	static unsigned int n = 0;
-
-	n++;
+	/*
+	  Queue a batch of data objects at a time, so that the data
+	  store can insert them in one transaction. Only the last data
+	  object in the batch asks for a callback.
+	*/
+	for (unsigned int i = 1; i <= BENCHMARK_INSERT_BATCH_SIZE; i++) {
+		unsigned int n = ++DataObjects_Inserted;
 
-	DataObjectRef dObj = createDataObject(DataObjects_Attr);
-	HAGGLE_LOG("Generating and inserting dataobject %d\n", n);
+		DataObjectRef dObj = createDataObject(DataObjects_Attr);
+		HAGGLE_LOG("Generating and inserting dataobject %d\n", n);
 	
-	if (n == DataObjects_Num - 1) {
-		// mark last node to get evaluation starte
-		// after its insert
-		dObj->addAttribute("benchmark", "evaluate");
-		HAGGLE_LOG("Inserted final data object... "
-			  "waiting for the data store to finish before starting test. "
-			   "This may take a while.\n");
-		kernel->getDataStore()->insertDataObject(dObj);
-	} else {
-		kernel->getDataStore()->insertDataObject(dObj, newEventCallback(insertDataobject));
+		if (n == DataObjects_Num - 1) {
+			// mark last node to get evaluation starte
+			// after its insert
+			dObj->addAttribute("benchmark", "evaluate");
+			HAGGLE_LOG("Inserted final data object... "
+				   "waiting for the data store to finish before starting test. "
+				   "This may take a while.\n");
+			kernel->getDataStore()->insertDataObject(dObj);
+			return;
+		} else if (i == BENCHMARK_INSERT_BATCH_SIZE) {
+			kernel->getDataStore()->insertDataObject(dObj, newEventCallback(insertDataobject));
+		} else {
+			kernel->getDataStore()->insertDataObject(dObj);
+		}
 	}
 }
 
@@ -274,6 +284,14 @@ DataObjectRef BenchmarkManager::createDataObject(unsigned int numAttr)
 
 void BenchmarkManager::onEvaluate(Event *e)
 {
+	if (DataObjects_Inserted > 0) {
+		double insertTime = (Timeval::now() - insertStartTime).getTimeAsSecondsDouble();
+
+		HAGGLE_LOG("Inserted %u data objects in %.3lf seconds (%.1lf data objects/s)\n", 
+			   DataObjects_Inserted, insertTime, 
+			   insertTime > 0 ? DataObjects_Inserted / insertTime : 0);
+	}
+
 	HAGGLE_LOG("Got filter event: Starting evaluation in 3 secs...\n");
 
 	kernel->addEvent(new Event(queryCallback, NULL, 3.0));
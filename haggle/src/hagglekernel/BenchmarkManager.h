@@ -31,6 +31,12 @@ class BenchmarkManager;
 #include "DataObject.h"
 #include "Node.h"
 
+/*
+	The number of data objects that are queued in the data store at
+	once while the benchmark database is generated.
+*/
+#define BENCHMARK_INSERT_BATCH_SIZE 100
+
 /** */
 class BenchmarkManager : public Manager
 {
@@ -39,6 +45,8 @@ class BenchmarkManager : public Manager
         unsigned int Attr_Num;
         unsigned int DataObjects_Num;
         unsigned int Test_Num;
+        unsigned int DataObjects_Inserted;
+        Timeval insertStartTime;
         EventCallback<EventHandler> *queryCallback;
         NodeRefList queryNodes;
         EventType evaluateEType;
@@ -0,0 +1,305 @@
+#include "BinaryMetadata.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static inline void put_uint32(unsigned char *p, u_int32_t n)
+{
+	p[0] = (unsigned char)(n >> 24);
+	p[1] = (unsigned char)(n >> 16);
+	p[2] = (unsigned char)(n >> 8);
+	p[3] = (unsigned char)n;
+}
+
+static inline u_int32_t get_uint32(const unsigned char *p)
+{
+	return ((u_int32_t)p[0] << 24) | ((u_int32_t)p[1] << 16) | ((u_int32_t)p[2] << 8) | p[3];
+}
+
+static inline size_t varint_len(size_t n)
+{
+	size_t len = 1;
+
+	while (n >= 0x80) {
+		n >>= 7;
+		len++;
+	}
+	return len;
+}
+
+static inline unsigned char *put_varint(unsigned char *p, size_t n)
+{
+	while (n >= 0x80) {
+		*p++ = (unsigned char)(n | 0x80);
+		n >>= 7;
+	}
+	*p++ = (unsigned char)n;
+
+	return p;
+}
+
+static inline bool get_varint(const unsigned char **p, const unsigned char *end, size_t *n)
+{
+	const unsigned char *q = *p;
+	size_t val = 0;
+	unsigned int shift = 0;
+
+	while (q < end && shift < sizeof(size_t) * 8) {
+		unsigned char b = *q++;
+
+		val |= (size_t)(b & 0x7f) << shift;
+
+		if (!(b & 0x80)) {
+			*p = q;
+			*n = val;
+			return true;
+		}
+		shift += 7;
+	}
+	return false;
+}
+
+static inline size_t string_len(const string& s)
+{
+	return varint_len(s.length()) + s.length();
+}
+
+static inline unsigned char *put_string(unsigned char *p, const string& s)
+{
+	p = put_varint(p, s.length());
+	memcpy(p, s.c_str(), s.length());
+
+	return p + s.length();
+}
+
+static inline bool get_string(const unsigned char **p, const unsigned char *end, string& s)
+{
+	size_t len;
+
+	if (!get_varint(p, end, &len) || len > (size_t)(end - *p))
+		return false;
+
+	s.append((const char *)*p, len);
+	*p += len;
+
+	return true;
+}
+
+BinaryMetadata::BinaryMetadata(const string name, const string content, BinaryMetadata *parent) :
+	Metadata(name, content, parent)
+{
+}
+
+BinaryMetadata::BinaryMetadata(const BinaryMetadata& m) : Metadata(m)
+{
+}
+
+#if defined(OS_WINDOWS)
+// Make sure MSVSC does not complain about passing this pointer in
+// base member initialization list
+#pragma warning(disable : 4355)
+#endif
+BinaryMetadata::BinaryMetadata() : Metadata("", "", this)
+{
+}
+
+BinaryMetadata::~BinaryMetadata()
+{
+}
+
+BinaryMetadata *BinaryMetadata::copy() const
+{
+        return new BinaryMetadata(*this);
+}
+
+bool BinaryMetadata::initFromRaw(const unsigned char *raw, size_t len)
+{
+	return decode(this, raw, len);
+}
+
+ssize_t BinaryMetadata::getRaw(unsigned char *buf, size_t len)
+{
+	size_t rawLen;
+
+	if (!buf)
+		return -1;
+
+	rawLen = BINARY_METADATA_PREAMBLE_LEN + encodedLength(this, true);
+
+	if (rawLen > len)
+		return -3;
+
+	memcpy(buf, BINARY_METADATA_MAGIC, BINARY_METADATA_MAGIC_LEN);
+	put_uint32(buf + BINARY_METADATA_MAGIC_LEN, (u_int32_t)rawLen);
+	encodeMetadata(this, buf + BINARY_METADATA_PREAMBLE_LEN, true);
+
+	return rawLen;
+}
+
+bool BinaryMetadata::getRawAlloc(unsigned char **buf, size_t *len)
+{
+	return encode(this, buf, len);
+}
+
+bool BinaryMetadata::addMetadata(Metadata *m)
+{
+        return _addMetadata(m);
+}
+
+Metadata *BinaryMetadata::addMetadata(const string name, const string content)
+{
+        BinaryMetadata *m = new BinaryMetadata(name, content, this);
+
+        if (!m)
+                return NULL;
+
+        if (!addMetadata(m)) {
+                delete m;
+                return NULL;
+        }
+
+        return m;
+}
+
+bool BinaryMetadata::isBinary(const unsigned char *raw, size_t len)
+{
+	return raw && len > 0 && raw[0] == BINARY_METADATA_MAGIC[0];
+}
+
+ssize_t BinaryMetadata::getLength(const unsigned char *raw, size_t len)
+{
+	size_t rawLen;
+
+	if (len < BINARY_METADATA_PREAMBLE_LEN)
+		return 0;
+
+	if (memcmp(raw, BINARY_METADATA_MAGIC, BINARY_METADATA_MAGIC_LEN) != 0)
+		return -1;
+
+	rawLen = get_uint32(raw + BINARY_METADATA_MAGIC_LEN);
+
+	if (rawLen <= BINARY_METADATA_PREAMBLE_LEN)
+		return -1;
+
+	return rawLen;
+}
+
+size_t BinaryMetadata::encodedLength(const Metadata *m, bool root)
+{
+	size_t len = string_len(m->name) + (root ? 1 : string_len(m->content));
+
+	len += varint_len(m->param_registry.size());
+
+	for (parameter_registry_t::const_iterator it = m->param_registry.begin(); it != m->param_registry.end(); it++)
+		len += string_len((*it).first) + string_len((*it).second);
+
+	len += varint_len(m->registry.size());
+
+	for (registry_t::const_iterator it = m->registry.begin(); it != m->registry.end(); it++)
+		len += encodedLength((*it).second, false);
+
+	return len;
+}
+
+unsigned char *BinaryMetadata::encodeMetadata(const Metadata *m, unsigned char *p, bool root)
+{
+	p = put_string(p, m->name);
+	p = root ? put_varint(p, 0) : put_string(p, m->content);
+	p = put_varint(p, m->param_registry.size());
+
+	for (parameter_registry_t::const_iterator it = m->param_registry.begin(); it != m->param_registry.end(); it++) {
+		p = put_string(p, (*it).first);
+		p = put_string(p, (*it).second);
+	}
+
+	p = put_varint(p, m->registry.size());
+
+	for (registry_t::const_iterator it = m->registry.begin(); it != m->registry.end(); it++)
+		p = encodeMetadata((*it).second, p, false);
+
+	return p;
+}
+
+bool BinaryMetadata::decodeMetadata(Metadata *m, const unsigned char **p, const unsigned char *end, unsigned int depth)
+{
+	size_t num;
+
+	if (depth > BINARY_METADATA_MAX_DEPTH)
+		return false;
+
+	if (!get_varint(p, end, &num))
+		return false;
+
+	while (num--) {
+		string name, value;
+
+		if (!get_string(p, end, name) || !get_string(p, end, value))
+			return false;
+
+		m->setParameter(name, value);
+	}
+
+	if (!get_varint(p, end, &num))
+		return false;
+
+	while (num--) {
+		string name, content;
+		Metadata *child;
+
+		if (!get_string(p, end, name) || !get_string(p, end, content))
+			return false;
+
+		child = m->addMetadata(name, content);
+
+		if (!child || !decodeMetadata(child, p, end, depth + 1))
+			return false;
+	}
+	return true;
+}
+
+bool BinaryMetadata::encode(const Metadata *m, unsigned char **buf, size_t *len)
+{
+	size_t rawLen;
+
+	if (!m || !buf || !len)
+		return false;
+
+	rawLen = BINARY_METADATA_PREAMBLE_LEN + encodedLength(m, true);
+
+	*buf = (unsigned char *)malloc(rawLen);
+
+	if (!*buf) {
+		*len = 0;
+		return false;
+	}
+
+	memcpy(*buf, BINARY_METADATA_MAGIC, BINARY_METADATA_MAGIC_LEN);
+	put_uint32(*buf + BINARY_METADATA_MAGIC_LEN, (u_int32_t)rawLen);
+	encodeMetadata(m, *buf + BINARY_METADATA_PREAMBLE_LEN, true);
+
+	*len = rawLen;
+
+	return true;
+}
+
+bool BinaryMetadata::decode(Metadata *m, const unsigned char *raw, size_t len)
+{
+	ssize_t rawLen = getLength(raw, len);
+	const unsigned char *p, *end;
+	string name, content;
+
+	if (!m || rawLen <= 0 || (size_t)rawLen > len)
+		return false;
+
+	p = raw + BINARY_METADATA_PREAMBLE_LEN;
+	end = raw + rawLen;
+
+	if (!get_string(&p, end, name) || !get_string(&p, end, content))
+		return false;
+
+	m->name = name;
+	m->content = content;
+
+	// The whole metadata must be used, or it is corrupt
+	return decodeMetadata(m, &p, end, 0) && p == end;
+}
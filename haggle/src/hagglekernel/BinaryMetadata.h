@@ -0,0 +1,90 @@
+#ifndef _BINARYMETADATA_H
+#define _BINARYMETADATA_H
+
+#include "Metadata.h"
+
+using namespace haggle;
+
+/*
+	The binary wire format starts with a preamble of
+	BINARY_METADATA_PREAMBLE_LEN bytes: the magic bytes below, and the
+	total length of the metadata, including the preamble, as a 32-bit
+	integer in network byte order.
+
+	The first magic byte is zero, which can never start an XML
+	document, so the two formats can be told apart from the first
+	byte.
+*/
+#define BINARY_METADATA_MAGIC "\0HM\1"
+#define BINARY_METADATA_MAGIC_LEN 4
+#define BINARY_METADATA_PREAMBLE_LEN (BINARY_METADATA_MAGIC_LEN + 4)
+
+// The deepest nesting of metadata that we decode
+#define BINARY_METADATA_MAX_DEPTH 32
+
+/**
+   BinaryMetadata is a compact, length-prefixed wire format for
+   metadata, as an alternative to XML.
+
+   After the preamble comes the root metadata. Each metadata is
+   encoded as its name, its content, the number of parameters followed
+   by the name and value of each parameter, and the number of children
+   followed by each child. Strings are encoded as their length
+   followed by the bytes of the string, without a terminating zero.
+   Lengths and counts are unsigned variable length integers, seven
+   bits per byte with the least significant group first, and the high
+   bit set in all bytes but the last.
+
+   The content of the root metadata is always encoded as empty, as
+   it is not part of the XML format either (XMLMetadata sets it to
+   all the text of the document when parsing).
+
+   The format needs no parsing of text or escaping, and a receiver
+   knows the length of the metadata once it has the preamble.
+
+   The static encode() and decode() functions work on metadata of any
+   backend, so that, e.g., XML metadata can be sent in the binary
+   format without first converting it.
+ */
+class BinaryMetadata : public Metadata {
+	static size_t encodedLength(const Metadata *m, bool root);
+	static unsigned char *encodeMetadata(const Metadata *m, unsigned char *p, bool root);
+	static bool decodeMetadata(Metadata *m, const unsigned char **p, const unsigned char *end, unsigned int depth);
+    public:
+        BinaryMetadata(const string name, const string content = "", BinaryMetadata *parent = NULL);
+        BinaryMetadata(const BinaryMetadata& m);
+        BinaryMetadata();
+        ~BinaryMetadata();
+        BinaryMetadata *copy() const;
+	bool initFromRaw(const unsigned char *raw, size_t len);
+        ssize_t getRaw(unsigned char *buf, size_t len);
+        bool getRawAlloc(unsigned char **buf, size_t *len);
+        bool addMetadata(Metadata *m);
+        Metadata *addMetadata(const string name, const string content = "");
+
+	/**
+	   Returns true if the raw metadata starts like metadata in the
+	   binary format. At least one byte is needed.
+	*/
+	static bool isBinary(const unsigned char *raw, size_t len);
+	/**
+	   Returns the total length of the binary metadata that 'raw'
+	   starts with, 0 if 'len' is shorter than the preamble, or -1 if
+	   the preamble is invalid.
+	*/
+	static ssize_t getLength(const unsigned char *raw, size_t len);
+	/**
+	   Encodes the metadata 'm' in the binary format into a buffer
+	   allocated with malloc(), which the caller must free().
+	*/
+	static bool encode(const Metadata *m, unsigned char **buf, size_t *len);
+	/**
+	   Decodes binary metadata into the empty metadata 'm', which
+	   gets the name, content, parameters and children of the root
+	   metadata. Children are created with m->addMetadata(), and are
+	   hence of the same backend as 'm'.
+	*/
+	static bool decode(Metadata *m, const unsigned char *raw, size_t len);
+};
+
+#endif /* _BINARYMETADATA_H */
@@ -21,6 +21,8 @@
 
 double Bloomfilter::default_error_rate = DEFAULT_BLOOMFILTER_ERROR_RATE;
 unsigned int Bloomfilter::default_capacity = DEFAULT_BLOOMFILTER_CAPACITY;
+unsigned int Bloomfilter::max_filters = DEFAULT_BLOOMFILTER_MAX_FILTERS;
+unsigned int Bloomfilter::default_version = BLOOMFILTER_VERSION_DEFAULT;
 
 const char *Bloomfilter::type_str[] = {
 	"normal",
@@ -54,12 +56,14 @@ Bloomfilter::Bloomfilter(Type_t _type, double _error_rate, unsigned int _capacit
 	error_rate(_error_rate),
 	capacity(_capacity),
 	init_n(0),
-	raw(NULL)
+	raw(NULL),
+	next(NULL),
+	chain_raw(NULL)
 {
 	if (type == TYPE_COUNTING) {
-		cbf = counting_bloomfilter_new(error_rate, capacity);
+		cbf = counting_bloomfilter_new_version(error_rate, capacity, default_version);
 	} else {
-		bf = bloomfilter_new(error_rate, capacity);
+		bf = bloomfilter_new_version(error_rate, capacity, default_version);
 	}
 }
 
@@ -71,7 +75,9 @@ Bloomfilter::Bloomfilter(double _error_rate, unsigned int _capacity, struct bloo
 	error_rate(_error_rate),
 	capacity(_capacity),
 	init_n(_bf->n),
-	bf(_bf)
+	bf(_bf),
+	next(NULL),
+	chain_raw(NULL)
 {
 }
 
@@ -83,7 +89,9 @@ Bloomfilter::Bloomfilter(double _error_rate, unsigned int _capacity, struct coun
 	error_rate(_error_rate),
 	capacity(_capacity),
 	init_n(_cbf->n),
-	cbf(_cbf)
+	cbf(_cbf),
+	next(NULL),
+	chain_raw(NULL)
 {
 }
 
@@ -95,13 +103,18 @@ Bloomfilter::Bloomfilter(const Bloomfilter &_bf) :
 	error_rate(_bf.error_rate),
 	capacity(_bf.capacity),
 	init_n(_bf.init_n),
-	raw(NULL)
+	raw(NULL),
+	next(NULL),
+	chain_raw(NULL)
 {
 	if (type == TYPE_NORMAL) {
 		bf = bloomfilter_copy(_bf.bf);
 	} else {
 		cbf = counting_bloomfilter_copy(_bf.cbf);
 	} 
+
+	if (_bf.next)
+		next = new Bloomfilter(*_bf.next);
 }
 
 Bloomfilter *Bloomfilter::create(double error_rate, unsigned int capacity, struct bloomfilter *bf)
@@ -132,41 +145,112 @@ Bloomfilter *Bloomfilter::create(Type_t type, double error_rate, unsigned int ca
 	return bf;
 }
 
+/*
+	Returns the length of the filter of the given type at the start of
+	raw_bf, or 0 if len is too short for its header. The filter may not
+	be aligned, so its header is copied before it is read.
+*/
+size_t Bloomfilter::rawFilterLen(const unsigned char *raw_bf, size_t len, Type_t type)
+{
+	if (type == TYPE_NORMAL) {
+		struct bloomfilter hdr;
+
+		if (len < sizeof(hdr))
+			return 0;
+
+		memcpy(&hdr, raw_bf, sizeof(hdr));
+
+		return BLOOMFILTER_TOT_LEN(&hdr);
+	} else {
+		struct counting_bloomfilter hdr;
+
+		if (len < sizeof(hdr))
+			return 0;
+
+		memcpy(&hdr, raw_bf, sizeof(hdr));
+
+		return COUNTING_BLOOMFILTER_TOT_LEN(&hdr);
+	}
+}
+
+/*
+	Returns the length of the sub-filters of the given type at the start
+	of raw_bf, which is len if raw_bf holds nothing else. The sub-filters
+	follow each other without padding.
+*/
+size_t Bloomfilter::rawChainLen(const unsigned char *raw_bf, size_t len, Type_t type)
+{
+	size_t pos = 0;
+
+	while (pos < len) {
+		size_t filter_len = rawFilterLen(raw_bf + pos, len - pos, type);
+
+		if (filter_len == 0 || filter_len > len - pos)
+			break;
+
+		pos += filter_len;
+	}
+
+	return pos;
+}
+
 Bloomfilter *Bloomfilter::create(const unsigned char *raw_bf, size_t len)
 {
 	Bloomfilter *bf = NULL;
+	double error_rate = default_error_rate;
+	unsigned int capacity = default_capacity;
+	Type_t type;
+	size_t pos = 0;
 
-	if (BLOOMFILTER_TOT_LEN((struct bloomfilter *)raw_bf) == len) {
-		struct bloomfilter *c_bf = bloomfilter_copy((struct bloomfilter*)raw_bf);
-		
-		if (!c_bf)
-			return NULL;
-		
-		bf = create(default_error_rate, default_capacity, c_bf);
-		
-		if (!bf) {
-			bloomfilter_free(c_bf);
-			return NULL;
-		}
-		HAGGLE_DBG("Bloomfilter is non-counting and contains %lu objects\n", bloomfilter_get_n(bf->bf)); 
-	} else if (COUNTING_BLOOMFILTER_TOT_LEN((struct counting_bloomfilter *)raw_bf) == len){
-		struct counting_bloomfilter *c_cbf = counting_bloomfilter_copy((struct counting_bloomfilter*)raw_bf);
-		
-		if (!c_cbf)
-			return NULL;
+	if (rawChainLen(raw_bf, len, TYPE_NORMAL) == len) {
+		type = TYPE_NORMAL;
+	} else if (rawChainLen(raw_bf, len, TYPE_COUNTING) == len) {
+		type = TYPE_COUNTING;
+	} else {
+		HAGGLE_ERR("bloomfilter is neither counting nor non-counting\n");
+		return NULL;
+	}
 
-		bf = create(default_error_rate, default_capacity, c_cbf);
-		
-		if (!bf) {
-			counting_bloomfilter_free(c_cbf);
-			return NULL;
+	// The sub-filters after the first one have grown as in grow()
+	while (pos < len) {
+		Bloomfilter *sub = NULL;
+		size_t filter_len = rawFilterLen(raw_bf + pos, len - pos, type);
+
+		unsigned char *c_raw = (unsigned char *)malloc(filter_len);
+
+		if (!c_raw)
+			break;
+
+		memcpy(c_raw, raw_bf + pos, filter_len);
+
+		if (type == TYPE_NORMAL)
+			sub = create(error_rate, capacity, (struct bloomfilter *)c_raw);
+		else
+			sub = create(error_rate, capacity, (struct counting_bloomfilter *)c_raw);
+
+		if (!sub) {
+			free(c_raw);
+			break;
 		}
+
+		if (bf)
+			bf->append(sub);
+		else
+			bf = sub;
 		
-		HAGGLE_DBG("Bloomfilter is counting and contains %lu objects\n", counting_bloomfilter_get_n(bf->cbf)); 
-	} else {
-		HAGGLE_ERR("bloomfilter is neither counting nor non-counting\n");
+		error_rate *= BLOOMFILTER_SCALE_TIGHTENING;
+		capacity *= BLOOMFILTER_SCALE_GROWTH;
+		pos += filter_len;
+	}
+
+	if (pos < len) {
+		HAGGLE_ERR("Could not create bloomfilter\n");
+		delete bf;
 		return NULL;
 	}
+	
+	HAGGLE_DBG("Bloomfilter is %s and contains %lu objects in %u sub-filters\n", 
+		   bf->getTypeStr(), bf->numObjects(), bf->numFilters()); 
 
 	return bf;
 }
@@ -203,9 +287,11 @@ Bloomfilter *Bloomfilter::create(const Bloomfilter &bf)
 	if (!bf_copy)
 		return NULL;
 
-	if (!bf_copy->raw) {
-		delete bf_copy;
-		return NULL;
+	for (const Bloomfilter *sub = bf_copy; sub; sub = sub->next) {
+		if (!sub->raw) {
+			delete bf_copy;
+			return NULL;
+		}
 	}
 	return bf_copy;
 }
@@ -218,15 +304,91 @@ Bloomfilter::~Bloomfilter()
 		else
 			counting_bloomfilter_free(cbf);
 	}
+	if (next)
+		delete next;
+	
+	if (chain_raw)
+		free(chain_raw);
+}
+
+Bloomfilter *Bloomfilter::getLast()
+{
+	Bloomfilter *last = this;
+
+	while (last->next)
+		last = last->next;
+
+	return last;
 }
+
+bool Bloomfilter::setDefaultVersion(unsigned int version)
+{
+	if (version > BLOOMFILTER_VERSION_MAX)
+		return false;
+
+	default_version = version;
+
+	return true;
+}
+
+/*
+	Adds a sub-filter after the last one, see BLOOMFILTER_SCALE_GROWTH.
+*/
+bool Bloomfilter::grow()
+{
+	Bloomfilter *last = getLast();
+	unsigned int num = numFilters();
+
+	if (num >= max_filters)
+		return false;
+
+	Bloomfilter *sub = create(type, last->error_rate * BLOOMFILTER_SCALE_TIGHTENING, 
+				  last->capacity * BLOOMFILTER_SCALE_GROWTH);
+
+	if (!sub)
+		return false;
+
+	last->next = sub;
+
+	HAGGLE_DBG("Bloomfilter is full, added sub-filter %u with capacity %u and error rate %lf\n",
+		   num + 1, sub->capacity, sub->error_rate);
+
+	return true;
+}
+
+bool Bloomfilter::append(Bloomfilter *bf)
+{
+	if (!bf || bf == this || bf->type != type)
+		return false;
+
+	getLast()->next = bf;
+
+	return true;
+}
+
+unsigned int Bloomfilter::numFilters() const
+{
+	unsigned int num = 0;
+
+	for (const Bloomfilter *sub = this; sub; sub = sub->next)
+		num++;
+
+	return num;
+}
+
 bool Bloomfilter::add(const unsigned char *blob, size_t len)
 {
+	Bloomfilter *last = getLast();
 	int ret = 0;
 
+	// Objects go into the last sub-filter, until it is full
+	if (last->getFilterNumObjects() >= last->capacity && grow())
+		last = last->next;
+
 	if (type == TYPE_NORMAL) {
-		ret = bloomfilter_add(bf, (const char *)blob, len);
+		ret = bloomfilter_add(last->bf, (const char *)blob, len);
 	} else {
-		ret = counting_bloomfilter_add(cbf, (const char *)blob, len);
+		ret = counting_bloomfilter_add(last->cbf, (const char *)blob, len);
 	}
 	
 	return ret == 1;
@@ -247,7 +409,24 @@ bool Bloomfilter::remove(const unsigned char *blob, size_t len)
 	int ret = 0;
 
 	if (type == TYPE_COUNTING) {
-		ret = counting_bloomfilter_remove(cbf, (const char *)blob, len);
+		Bloomfilter *found = NULL;
+		unsigned int num_found = 0;
+
+		for (Bloomfilter *sub = this; sub; sub = sub->next) {
+			if (counting_bloomfilter_check(sub->cbf, (const char *)blob, len) == 1) {
+				found = sub;
+				num_found++;
+			}
+		}
+		/*
+		  When several sub-filters have the object, we do not know 
+		  which one it was added to. Removing it from the wrong one 
+		  would remove other objects too, so it is better to keep it.
+		*/
+		if (num_found == 1)
+			ret = counting_bloomfilter_remove(found->cbf, (const char *)blob, len);
+		else if (num_found > 1)
+			HAGGLE_DBG("Object is in %u sub-filters, cannot remove it\n", num_found);
 	} else {
 		HAGGLE_ERR("Cannot remove object from non counting bloomfilter\n");
 	}
@@ -267,11 +446,16 @@ bool Bloomfilter::remove(const DataObjectRef &dObj)
 
 bool Bloomfilter::has(const unsigned char *blob, size_t len) const
 {
-	if (type == TYPE_NORMAL) {
-		return bloomfilter_check(bf, (const char *)blob, len) == 1;
-	} else {
-		return counting_bloomfilter_check(cbf, (const char *)blob, len) == 1;
+	for (const Bloomfilter *sub = this; sub; sub = sub->next) {
+		if (type == TYPE_NORMAL) {
+			if (bloomfilter_check(sub->bf, (const char *)blob, len) == 1)
+				return true;
+		} else {
+			if (counting_bloomfilter_check(sub->cbf, (const char *)blob, len) == 1)
+				return true;
+		}
 	}
+	return false;
 }
 
 bool Bloomfilter::has(const DataObjectId_t& id) const
@@ -284,17 +468,38 @@ bool Bloomfilter::has(const DataObjectRef &dObj) const
 	return has(dObj->getId());
 }
 
+/*
+	Sub-filters are merged with the sub-filter in the same place, and
+	the sub-filters that only bf_merge has are added to this one.
+*/
 bool Bloomfilter::merge(const Bloomfilter& bf_merge)
 {
 	if (type == TYPE_NORMAL && bf_merge.type == TYPE_NORMAL){
+		const Bloomfilter *sub_merge;
+		Bloomfilter *sub;
+		bool res = true;
+
 		// Cannot merge a counting bloomfilter
-		if (BLOOMFILTER_TOT_LEN(bf) != BLOOMFILTER_TOT_LEN(bf_merge.bf)) {
-			HAGGLE_ERR("Cannot merge bloomfilters of different size\n");
-			return false;
+		for (sub = this, sub_merge = &bf_merge; sub && sub_merge; sub = sub->next, sub_merge = sub_merge->next) {
+			if (BLOOMFILTER_TOT_LEN(sub->bf) != BLOOMFILTER_TOT_LEN(sub_merge->bf)) {
+				HAGGLE_ERR("Cannot merge bloomfilters of different size\n");
+				return false;
+			}
 		}
-		bool res = bloomfilter_merge(bf, bf_merge.bf) == MERGE_RESULT_OK;
 		
+		for (sub = this, sub_merge = &bf_merge; sub && sub_merge; sub = sub->next, sub_merge = sub_merge->next) {
+			res &= bloomfilter_merge(sub->bf, sub_merge->bf) == MERGE_RESULT_OK;
+		}
 		bf->n -= init_n;
+		
+		if (sub_merge) {
+			Bloomfilter *rest = create(*sub_merge);
+			
+			if (!rest)
+				return false;
+			
+			append(rest);
+		}
 		return res;
 	} 
 	return false;
@@ -303,9 +508,10 @@ bool Bloomfilter::merge(const Bloomfilter& bf_merge)
 Bloomfilter *Bloomfilter::to_noncounting() const
 {
 	struct bloomfilter *bf_copy;
+	Bloomfilter *bf_noncounting;
 
 	if (type == TYPE_NORMAL) {
-		return new Bloomfilter(*this);	
+		return create(*this);	
 	} 
 
 	bf_copy = counting_bloomfilter_to_noncounting(cbf);
@@ -313,7 +519,18 @@ Bloomfilter *Bloomfilter::to_noncounting() const
 	if (!bf_copy)
 		return NULL;
 
-	return new Bloomfilter(error_rate, capacity, bf_copy);
+	bf_noncounting = new Bloomfilter(error_rate, capacity, bf_copy);
+
+	if (next) {
+		Bloomfilter *rest = next->to_noncounting();
+
+		if (!rest) {
+			delete bf_noncounting;
+			return NULL;
+		}
+		bf_noncounting->append(rest);
+	}
+	return bf_noncounting;
 }
 
 string Bloomfilter::toBase64(void) const
@@ -364,6 +581,11 @@ bool Bloomfilter::fromBase64(const string &b64)
 			cbf = tmp;
 		}
 	} 
+	// The string only holds one sub-filter
+	if (next) {
+		delete next;
+		next = NULL;
+	}
 	return true;
 }
 
@@ -411,7 +633,7 @@ Metadata *Bloomfilter::toMetadata(bool keep_counting) const
 	m->setParameter(BLOOMFILTER_METADATA_ERROR_RATE_PARAM, buf);
 	snprintf(buf, 40, "%u", capacity);
 	m->setParameter(BLOOMFILTER_METADATA_CAPACITY_PARAM, buf);
-	snprintf(buf, 40, "%lu", numObjects());
+	snprintf(buf, 40, "%lu", getFilterNumObjects());
 	m->setParameter(BLOOMFILTER_METADATA_NUM_OBJECTS_PARAM, buf);
 	
 	return m;
@@ -470,7 +692,216 @@ Bloomfilter *Bloomfilter::fromMetadata(const Metadata& m)
 	return create_from_base64(type, m.getContent().c_str(), error_rate, capacity);
 }
 
-unsigned long Bloomfilter::numObjects(void) const
+/*
+	The delta is the list of bins that were set, followed by the list of
+	bins that were cleared. Each list starts with its length and then
+	holds the distance from the previous bin in the list. All numbers are
+	written seven bits at a time, least significant first, with the top
+	bit set in all bytes but the last.
+*/
+static size_t delta_put_num(unsigned char *buf, u_int32_t num)
+{
+	size_t len = 0;
+
+	while (num >= 0x80) {
+		buf[len++] = (unsigned char)(num | 0x80);
+		num >>= 7;
+	}
+	buf[len++] = (unsigned char)num;
+
+	return len;
+}
+
+static bool delta_get_num(const unsigned char *buf, size_t buflen, size_t *pos, u_int32_t *num)
+{
+	unsigned int shift = 0;
+
+	*num = 0;
+
+	while (*pos < buflen && shift < 32) {
+		unsigned char c = buf[(*pos)++];
+
+		*num |= (u_int32_t)(c & 0x7f) << shift;
+
+		if (!(c & 0x80))
+			return true;
+
+		shift += 7;
+	}
+	return false;
+}
+
+/* Writes the bins that are set in 'from' but not in 'to' */
+static size_t delta_put_bins(unsigned char *buf, const bin_t *from, const bin_t *to, u_int32_t m)
+{
+	u_int32_t i, num = 0, prev = 0;
+	size_t len = 0;
+
+	for (i = 0; i < m / VALUES_PER_BIN; i++)
+		for (bin_t diff = from[i] & ~to[i]; diff; diff &= diff - 1)
+			num++;
+
+	len += delta_put_num(buf + len, num);
+
+	for (i = 0; i < m; i++) {
+		if ((from[i / VALUES_PER_BIN] & ~to[i / VALUES_PER_BIN]) & (1 << (i % VALUES_PER_BIN))) {
+			len += delta_put_num(buf + len, i - prev);
+			prev = i;
+		}
+	}
+	return len;
+}
+
+Metadata *Bloomfilter::toDeltaMetadata(const Bloomfilter& base, const string& base_id) const
+{
+	const bin_t *bins, *base_bins;
+	unsigned char *buf;
+	char *b64;
+	char param[40];
+	size_t len = 0;
+	u_int32_t i, num_changed = 0;
+
+	if (type != TYPE_NORMAL || base.type != TYPE_NORMAL)
+		return NULL;
+
+	if (next || base.next)
+		return NULL;
+
+	// The bins are only comparable if the hash functions are the same
+	if (bf->m != base.bf->m || bf->k != base.bf->k ||
+	    memcmp(BLOOMFILTER_GET_SALTS(bf), BLOOMFILTER_GET_SALTS(base.bf), SALTS_LEN(bf)) != 0)
+		return NULL;
+
+	bins = BLOOMFILTER_GET_FILTER(bf);
+	base_bins = BLOOMFILTER_GET_FILTER(base.bf);
+
+	for (i = 0; i < FILTER_LEN(bf); i++)
+		for (bin_t diff = bins[i] ^ base_bins[i]; diff; diff &= diff - 1)
+			num_changed++;
+
+	// Each changed bin takes at least one byte
+	if (num_changed >= FILTER_LEN(bf))
+		return NULL;
+
+	// Two counts, and at most five bytes per number
+	buf = (unsigned char *)malloc((num_changed + 2) * 5);
+
+	if (!buf)
+		return NULL;
+
+	len += delta_put_bins(buf + len, bins, base_bins, bf->m);
+	len += delta_put_bins(buf + len, base_bins, bins, bf->m);
+
+	if (len >= BLOOMFILTER_TOT_LEN(bf)) {
+		free(buf);
+		return NULL;
+	}
+
+	base64_encode_alloc((const char *)buf, len, &b64);
+
+	free(buf);
+
+	if (!b64)
+		return NULL;
+
+	Metadata *m = new XMLMetadata(BLOOMFILTER_METADATA);
+
+	if (!m) {
+		free(b64);
+		return NULL;
+	}
+
+	m->setContent(b64);
+	free(b64);
+
+	m->setParameter(BLOOMFILTER_METADATA_TYPE_PARAM, typeToStr(TYPE_NORMAL));
+	m->setParameter(BLOOMFILTER_METADATA_DELTA_BASE_PARAM, base_id);
+	snprintf(param, 40, "%lf", error_rate);
+	m->setParameter(BLOOMFILTER_METADATA_ERROR_RATE_PARAM, param);
+	snprintf(param, 40, "%u", capacity);
+	m->setParameter(BLOOMFILTER_METADATA_CAPACITY_PARAM, param);
+	snprintf(param, 40, "%u", bf->m);
+	m->setParameter(BLOOMFILTER_METADATA_BINS_PARAM, param);
+	snprintf(param, 40, "%lu", numObjects());
+	m->setParameter(BLOOMFILTER_METADATA_NUM_OBJECTS_PARAM, param);
+
+	return m;
+}
+
+bool Bloomfilter::isDeltaMetadata(const Metadata& m)
+{
+	return m.isName(BLOOMFILTER_METADATA) && m.getParameter(BLOOMFILTER_METADATA_DELTA_BASE_PARAM) != NULL;
+}
+
+bool Bloomfilter::applyDeltaMetadata(const Metadata& m, bool set_only)
+{
+	struct base64_decode_context b64_ctx;
+	const char *param;
+	char *buf;
+	size_t len, pos = 0;
+	bin_t *bins;
+	bool ret = false;
+
+	if (type != TYPE_NORMAL || !isDeltaMetadata(m))
+		return false;
+
+	param = m.getParameter(BLOOMFILTER_METADATA_BINS_PARAM);
+
+	if (!param || strtoul(param, NULL, 10) != bf->m) {
+		HAGGLE_DBG("Bloomfilter delta does not match the bloomfilter's size\n");
+		return false;
+	}
+
+	base64_decode_ctx_init(&b64_ctx);
+
+	if (!base64_decode_alloc(&b64_ctx, m.getContent().c_str(), m.getContent().length(), &buf, &len))
+		return false;
+
+	bins = BLOOMFILTER_GET_FILTER(bf);
+
+	// Check the whole delta before changing anything
+	for (int apply = 0; apply < 2; apply++) {
+		pos = 0;
+
+		// First the bins to set, then the bins to clear
+		for (int list = 0; list < 2; list++) {
+			u_int32_t num, index = 0;
+			
+			if (!delta_get_num((unsigned char *)buf, len, &pos, &num))
+				goto out;
+			
+			while (num--) {
+				u_int32_t dist;
+				
+				if (!delta_get_num((unsigned char *)buf, len, &pos, &dist) || dist >= bf->m - index)
+					goto out;
+				
+				index += dist;
+				
+				if (!apply)
+					continue;
+
+				if (list == 0)
+					bins[index / VALUES_PER_BIN] |= (1 << (index % VALUES_PER_BIN));
+				else if (!set_only)
+					bins[index / VALUES_PER_BIN] &= ~(1 << (index % VALUES_PER_BIN));
+			}
+		}
+	}
+
+	param = m.getParameter(BLOOMFILTER_METADATA_NUM_OBJECTS_PARAM);
+
+	if (param)
+		bf->n = strtoul(param, NULL, 10);
+
+	ret = true;
+out:
+	free(buf);
+
+	return ret;
+}
+
+unsigned long Bloomfilter::getFilterNumObjects(void) const
 {
 	if (type == TYPE_NORMAL) {
 		return bloomfilter_get_n(bf);
@@ -479,12 +910,42 @@ unsigned long Bloomfilter::numObjects(void) const
 	}
 }
 
+unsigned long Bloomfilter::numObjects(void) const
+{
+	unsigned long n = 0;
+
+	for (const Bloomfilter *sub = this; sub; sub = sub->next)
+		n += sub->getFilterNumObjects();
+
+	return n;
+}
+
 const unsigned char *Bloomfilter::getRaw(void) const
 {
-	return raw;
+	unsigned char *pos;
+
+	if (!next)
+		return raw;
+
+	if (chain_raw)
+		free(chain_raw);
+
+	chain_raw = (unsigned char *)malloc(getRawLen());
+
+	if (!chain_raw)
+		return NULL;
+
+	pos = chain_raw;
+
+	for (const Bloomfilter *sub = this; sub; sub = sub->next) {
+		memcpy(pos, sub->raw, sub->getFilterRawLen());
+		pos += sub->getFilterRawLen();
+	}
+
+	return chain_raw;
 }
 
-size_t Bloomfilter::getRawLen(void) const
+size_t Bloomfilter::getFilterRawLen(void) const
 {
 	if (type == TYPE_NORMAL) {
 		return (unsigned long)BLOOMFILTER_TOT_LEN(bf);
@@ -493,12 +954,38 @@ size_t Bloomfilter::getRawLen(void) const
 	}
 }
 
+size_t Bloomfilter::getRawLen(void) const
+{
+	size_t len = 0;
+
+	for (const Bloomfilter *sub = this; sub; sub = sub->next)
+		len += sub->getFilterRawLen();
+
+	return len;
+}
+
 bool Bloomfilter::setRaw(const unsigned char *_bf, size_t _bf_len)
 {
-	if (!_bf || _bf_len == 0)
+	Bloomfilter *rest = NULL;
+	struct bloomfilter hdr;
+
+	if (!_bf || _bf_len < sizeof(hdr))
+		return false;
+
+	if (rawChainLen(_bf, _bf_len, type) != _bf_len) {
+		HAGGLE_ERR("Raw bloomfilter is not a %s bloomfilter\n", getTypeStr());
 		return false;
+	}
 
+	memcpy(&hdr, _bf, sizeof(hdr));
+
+	// The first sub-filter replaces this one, the rest are appended
 	if (type == TYPE_NORMAL) {
+		if (BLOOMFILTER_TOT_LEN(&hdr) < _bf_len)
+			rest = create(_bf + BLOOMFILTER_TOT_LEN(&hdr), _bf_len - BLOOMFILTER_TOT_LEN(&hdr));
+
+		_bf_len = BLOOMFILTER_TOT_LEN(&hdr);
+
 		if (BLOOMFILTER_TOT_LEN(bf) != _bf_len) {
 			HAGGLE_DBG("Old and new bloomfilter differ in length: %lu vs. %lu!\n",
 				BLOOMFILTER_TOT_LEN(bf), (unsigned long)_bf_len);
@@ -508,11 +995,19 @@ bool Bloomfilter::setRaw(const unsigned char *_bf, size_t _bf_len)
 			
 			if (!bf) {
 				HAGGLE_ERR("Could not allocate memory for new bloomfilter\n");
+				delete rest;
 				return false;
 			}
 		} 
 		memcpy(bf, _bf, _bf_len);
 	} else {
+		struct counting_bloomfilter *chdr = (struct counting_bloomfilter *)&hdr;
+
+		if (COUNTING_BLOOMFILTER_TOT_LEN(chdr) < _bf_len)
+			rest = create(_bf + COUNTING_BLOOMFILTER_TOT_LEN(chdr), _bf_len - COUNTING_BLOOMFILTER_TOT_LEN(chdr));
+
+		_bf_len = COUNTING_BLOOMFILTER_TOT_LEN(chdr);
+
 		if (COUNTING_BLOOMFILTER_TOT_LEN(cbf) != _bf_len) {
 			HAGGLE_DBG("Old and new bloomfilter differ in length: %lu vs. %lu!!\n",
 				BLOOMFILTER_TOT_LEN(bf), (unsigned long)_bf_len);
@@ -522,11 +1017,32 @@ bool Bloomfilter::setRaw(const unsigned char *_bf, size_t _bf_len)
 
 			if (!cbf) {
 				HAGGLE_ERR("Could not allocate memory for new bloomfilter\n");
+				delete rest;
 				return false;
 			}
 		} 
 		memcpy(cbf, _bf, _bf_len);
 	}
+
+	if (next) {
+		delete next;
+		next = NULL;
+	}
+
+	if (rest) {
+		// The sub-filters have grown from this one
+		double sub_error_rate = error_rate;
+		unsigned int sub_capacity = capacity;
+
+		append(rest);
+
+		for (Bloomfilter *sub = next; sub; sub = sub->next) {
+			sub_error_rate *= BLOOMFILTER_SCALE_TIGHTENING;
+			sub_capacity *= BLOOMFILTER_SCALE_GROWTH;
+			sub->error_rate = sub_error_rate;
+			sub->capacity = sub_capacity;
+		}
+	}
 	return true;
 }
 
@@ -535,11 +1051,16 @@ void Bloomfilter::reset()
 	if (!raw)
 		return;
 	
+	if (next) {
+		delete next;
+		next = NULL;
+	}
+
 	if (type == TYPE_NORMAL) {
 		bloomfilter_free(bf);
-		bf = bloomfilter_new(error_rate, capacity);
+		bf = bloomfilter_new_version(error_rate, capacity, default_version);
 	} else {
 		counting_bloomfilter_free(cbf);
-		cbf = counting_bloomfilter_new(error_rate, capacity);
+		cbf = counting_bloomfilter_new_version(error_rate, capacity, default_version);
 	}
 }
@@ -32,11 +32,25 @@ using namespace haggle;
 #define DEFAULT_BLOOMFILTER_ERROR_RATE  (0.01)
 #define DEFAULT_BLOOMFILTER_CAPACITY    (2000)
 
+/*
+	A bloomfilter that holds as many objects as its capacity gets a new
+	sub-filter, with BLOOMFILTER_SCALE_GROWTH times the capacity and
+	BLOOMFILTER_SCALE_TIGHTENING times the error rate of the previous
+	one. The error rate of all sub-filters together thus stays below
+	error_rate / (1 - BLOOMFILTER_SCALE_TIGHTENING), however many
+	objects are added.
+*/
+#define BLOOMFILTER_SCALE_GROWTH        (2)
+#define BLOOMFILTER_SCALE_TIGHTENING    (0.5)
+#define DEFAULT_BLOOMFILTER_MAX_FILTERS (8)
+
 #define BLOOMFILTER_METADATA "Bloomfilter"
 #define BLOOMFILTER_METADATA_TYPE_PARAM "type"
 #define BLOOMFILTER_METADATA_ERROR_RATE_PARAM "error_rate"
 #define BLOOMFILTER_METADATA_CAPACITY_PARAM "capacity"
 #define BLOOMFILTER_METADATA_NUM_OBJECTS_PARAM "num_objects"
+#define BLOOMFILTER_METADATA_BINS_PARAM "bins"
+#define BLOOMFILTER_METADATA_DELTA_BASE_PARAM "delta_base"
 
 /** */
 #ifdef DEBUG_LEAKS
@@ -54,6 +68,8 @@ public:
 private:	
 	static double default_error_rate;
 	static unsigned int default_capacity;
+	static unsigned int max_filters;
+	static unsigned int default_version;
 	static const char *type_str[];
 	Type_t type;
 	double error_rate;
@@ -64,6 +80,16 @@ private:
 		struct counting_bloomfilter *cbf;
 		unsigned char *raw;
 	};
+	// The next, larger, sub-filter, if this one has been full
+	Bloomfilter *next;
+	// The sub-filters stored one after the other, see getRaw()
+	mutable unsigned char *chain_raw;
+	Bloomfilter *getLast();
+	bool grow();
+	unsigned long getFilterNumObjects() const;
+	size_t getFilterRawLen() const;
+	static size_t rawFilterLen(const unsigned char *raw_bf, size_t len, Type_t type);
+	static size_t rawChainLen(const unsigned char *raw_bf, size_t len, Type_t type);
 	/*
 	  Creates a bloomfilter with the given error rate and capacity.
 	*/
@@ -101,6 +127,36 @@ public:
 	static double getDefaultErrorRate() { return default_error_rate; }
 	static void setDefaultCapacity(unsigned int capacity) { if (capacity > 0) default_capacity = capacity; }
 	static unsigned int getDefaultCapacity() { return default_capacity; }
+	/**
+		Sets how new bloomfilters map keys to bins, see bloomfilter.h.
+		Nodes that predate versions only read version 0 filters, which
+		is therefore the default.
+	*/
+	static bool setDefaultVersion(unsigned int version);
+	static unsigned int getDefaultVersion() { return default_version; }
+	/**
+		Sets the largest number of sub-filters that a bloomfilter grows
+		to. Once there are that many, objects are added to the last
+		sub-filter, whose error rate will then increase. One sub-filter
+		means that bloomfilters do not grow.
+	*/
+	static void setMaxFilters(unsigned int num) { if (num > 0) max_filters = num; }
+	static unsigned int getMaxFilters() { return max_filters; }
+
+	/**
+		Returns the next sub-filter, or NULL if this is the last one.
+	*/
+	const Bloomfilter *getNext() const { return next; }
+	/**
+		Adds the given bloomfilter, which must be of the same type, as
+		the last sub-filter. The bloomfilter is owned by this one 
+		afterwards.
+	*/
+	bool append(Bloomfilter *bf);
+	/**
+		Returns the number of sub-filters.
+	*/
+	unsigned int numFilters() const;
 
 	bool add(const unsigned char *blob, size_t len);
 	bool add(const DataObjectId_t& id);
@@ -111,8 +167,9 @@ public:
 	bool add(const DataObjectRef &dObj);
 	/**
 	   Removes the given blob from the bloomfilter. Only works on 
-	   counting bloomfilters. For non-counting bloomfilters, this function 
-	   does nothing.
+	   counting bloomfilters. For non-counting bloomfilters, this function
+	   does nothing. A blob that is in several sub-filters is not removed,
+	   since it is unknown which one it was added to.
 	 */
 
 	bool remove(const unsigned char *blob, size_t len);
@@ -149,12 +206,12 @@ public:
 	Bloomfilter *to_noncounting() const;
 	/**
 		Returns a platform-independent representation of the bloomfilter in a
-		Base64 encoded string.
+		Base64 encoded string. Only the first sub-filter is included.
 	*/
 	string toBase64() const;
 	/**
 		Sets the bloomfilter to be the bloomfilter represented by the given
-		Base64 encoded string.
+		Base64 encoded string, which replaces all sub-filters.
 		
 		Can only set a non-counting bloomfilter to a non-counting bloomfilter
 		and a counting bloomfilter to a counting bloomfilter.
@@ -173,14 +230,43 @@ public:
 	*/
 	string toBase64NonCounting() const;
 	
+	/**
+		Returns metadata for this sub-filter only. The metadata of the
+		sub-filters that follow (see getNext()) goes next to it, and
+		they are put back together with append().
+	*/
 	Metadata *toMetadata(bool keep_counting = false) const;
 	static Bloomfilter *fromMetadata(const Metadata& m);
+	/**
+		Returns metadata that only holds the bins that were set and
+		cleared since the base bloomfilter, and base_id to identify the
+		base to the receiver.
+
+		Returns NULL if the bloomfilters are not both non-counting ones
+		with the same parameters and a single sub-filter, or if the 
+		changes would not be smaller than the bloomfilter itself.
+	*/
+	Metadata *toDeltaMetadata(const Bloomfilter& base, const string& base_id) const;
+	/**
+		Returns true iff the metadata was created by toDeltaMetadata().
+	*/
+	static bool isDeltaMetadata(const Metadata& m);
+	/**
+		Applies the changes in metadata created by toDeltaMetadata()
+		to this bloomfilter, which should be (a copy of) the base. If
+		set_only is true, the cleared bins are left as they are, which
+		is what to do when this bloomfilter is not the base. Only the
+		first sub-filter is changed.
+	*/
+	bool applyDeltaMetadata(const Metadata& m, bool set_only = false);
 	/**
 		Returns the number of data objects in the bloomfilter.
 	*/
 	unsigned long numObjects() const;
 	
 	/**
+		Returns the sub-filters one after the other, each in the
+		format of the bloomfilter library.
 	*/
 	const unsigned char *getRaw() const;
 	/**
@@ -192,7 +278,8 @@ public:
 	bool setRaw(const unsigned char *bf, size_t bf_len);
 	
 	/**
-		Clears the bloomfilter.
+		Clears the bloomfilter, and removes all but the first
+		sub-filter.
 	*/
 	void reset();
 };
@@ -123,7 +123,7 @@ void DataHelper::cleanup()
 }
 
 DataManager::DataManager(HaggleKernel * _kernel, const bool _setCreateTimeOnBloomfilterUpdate) : 
-	Manager("DataManager", _kernel), localBF(NULL), 
+	Manager("DataManager", _kernel), localBF(NULL), buildingLocalBF(false),
 	setCreateTimeOnBloomfilterUpdate(_setCreateTimeOnBloomfilterUpdate), 
 	keepInBloomfilterOnAging(true)
 {	
@@ -173,6 +173,7 @@ bool DataManager::init_derived()
 #endif
 	onInsertedDataObjectCallback = newEventCallback(onInsertedDataObject);
 	onAgedDataObjectsCallback = newEventCallback(onAgedDataObjects);
+	onBuiltLocalBFCallback = newEventCallback(onBuiltLocalBF);
 
 	// Insert time stamp for when haggle starts up into the data store:
 	RepositoryEntryRef timestamp = RepositoryEntryRef(new RepositoryEntry("DataManager", "Startup timestamp", Timeval::now().getAsString().c_str()));
@@ -228,6 +229,9 @@ DataManager::~DataManager()
 	if (onGetLocalBFCallback)
 		delete onGetLocalBFCallback;
 	
+	if (onBuiltLocalBFCallback)
+		delete onBuiltLocalBFCallback;
+	
 	if (localBF)
 		delete localBF;
 }
@@ -356,7 +360,7 @@ void DataManager::onVerifiedDataObject(Event *e)
 		// This data object had a bad signature, we should remove
 		// it from the bloomfilter
 		HAGGLE_DBG("Data object [%s] had bad signature, removing from bloomfilter\n", dObj->getIdStr());
-		localBF->remove(dObj);
+		removeFromLocalBF(dObj);
 		kernel->getThisNode()->setBloomfilter(*localBF, setCreateTimeOnBloomfilterUpdate);
 		return;
 	}
@@ -365,7 +369,7 @@ void DataManager::onVerifiedDataObject(Event *e)
 		HAGGLE_ERR("Data in data object flagged as bad! -- discarding\n");
 		if (localBF->has(dObj)) {
 			// Remove the data object from the bloomfilter since it was bad.
-			localBF->remove(dObj);
+			removeFromLocalBF(dObj);
 			kernel->getThisNode()->setBloomfilter(*localBF, setCreateTimeOnBloomfilterUpdate);
 		}
 		return;
@@ -476,12 +480,81 @@ void DataManager::onIncomingDataObject(Event *e)
 			dObj->setDuplicate();
 		} else {
 			HAGGLE_DBG("Adding data object [%s] to our bloomfilter\n", dObj->getIdStr());
-			localBF->add(dObj);
+			addToLocalBF(dObj);
 			kernel->getThisNode()->setBloomfilter(*localBF, setCreateTimeOnBloomfilterUpdate);
 		}
 	}
 }
 
+void DataManager::addToLocalBF(const DataObjectRef& dObj)
+{
+	localBF->add(dObj);
+
+	if (buildingLocalBF) {
+		localBFChanges.push_back(Pair<DataObjectRef, bool>(dObj, true));
+	} else if (localBF->numFilters() > 1 && !keepInBloomfilterOnAging) {
+		/*
+		  The bloomfilter cannot be built from the data store when it
+		  should also hold data objects that have been aged out of the 
+		  data store. It then keeps growing sub-filters instead.
+		*/
+		HAGGLE_DBG("Bloomfilter has %u sub-filters, building a new one from the data store\n", 
+			   localBF->numFilters());
+		buildingLocalBF = true;
+		kernel->getDataStore()->buildBloomfilter(onBuiltLocalBFCallback);
+	}
+}
+
+void DataManager::removeFromLocalBF(const DataObjectRef& dObj)
+{
+	localBF->remove(dObj);
+
+	if (buildingLocalBF)
+		localBFChanges.push_back(Pair<DataObjectRef, bool>(dObj, false));
+}
+
+void DataManager::onBuiltLocalBF(Event *e)
+{
+	if (!e || !e->hasData())
+		return;
+
+	Bloomfilter *bf = static_cast<Bloomfilter *>(e->getData());
+
+	buildingLocalBF = false;
+
+	if (kernel->isShuttingDown()) {
+		delete bf;
+		localBFChanges.clear();
+		return;
+	}
+	
+	for (List<KeptId>::iterator it = localBFKeptIds.begin(); it != localBFKeptIds.end(); it++) {
+		if (!bf->has((*it).id))
+			bf->add((*it).id);
+	}
+
+	// Apply what happened since the data store was read
+	while (!localBFChanges.empty()) {
+		DataObjectRef& dObj = localBFChanges.front().first;
+
+		if (localBFChanges.front().second) {
+			if (!bf->has(dObj))
+				bf->add(dObj);
+		} else if (bf->has(dObj)) {
+			bf->remove(dObj);
+		}
+		localBFChanges.pop_front();
+	}
+
+	HAGGLE_DBG("New bloomfilter has %lu data objects, the old one %lu in %u sub-filters\n", 
+		   bf->numObjects(), localBF->numObjects(), localBF->numFilters());
+
+	delete localBF;
+	localBF = bf;
+
+	kernel->getThisNode()->setBloomfilter(*localBF, setCreateTimeOnBloomfilterUpdate);
+}
+
 void DataManager::handleVerifiedDataObject(DataObjectRef& dObj)
 {
 	// insert into database (including filtering)
@@ -524,10 +597,16 @@ void DataManager::onDeletedDataObject(Event * e)
 		*/
 		if (!(*it)->isNodeDescription() && !e->getFlags()) {
 			HAGGLE_DBG("Removing deleted data object [id=%s] from bloomfilter\n", (*it)->getIdStr());
-			localBF->remove(*it);
+			removeFromLocalBF(*it);
 			n_removed++;
 		} else {
 			HAGGLE_DBG("Keeping deleted data object [id=%s] in bloomfilter\n", (*it)->getIdStr());
+			// Only needed if the bloomfilter is ever built from the data store
+			if (!keepInBloomfilterOnAging) {
+				KeptId kept;
+				memcpy(kept.id, (*it)->getId(), DATAOBJECT_ID_LEN);
+				localBFKeptIds.push_back(kept);
+			}
 		}
 	}
 	
@@ -646,6 +725,36 @@ void DataManager::onConfig(Metadata *m)
 			}
 		}
 		
+		// Only nodes that have the same bloomfilter versions can read
+		// anything but version 0 filters in our node descriptions
+		param = dm->getParameter("default_version");
+
+		if (param) {
+			char *endptr = NULL;
+			unsigned int version = (unsigned int)strtoul(param, &endptr, 10);
+			
+			if (endptr && endptr != param && Bloomfilter::setDefaultVersion(version)) {
+				HAGGLE_DBG("config default bloomfilter version %u\n", 
+					   Bloomfilter::getDefaultVersion());
+				reset_bloomfilter = true;
+			}
+		}
+		
+		// The number of sub-filters a bloomfilter may grow to, where 1
+		// means that bloomfilters have a fixed capacity
+		param = dm->getParameter("max_filters");
+
+		if (param) {
+			char *endptr = NULL;
+			unsigned int num = (unsigned int)strtoul(param, &endptr, 10);
+			
+			if (endptr && endptr != param) {
+				Bloomfilter::setMaxFilters(num);
+				HAGGLE_DBG("config bloomfilter max filters %u\n", 
+					   Bloomfilter::getMaxFilters());
+			}
+		}
+		
 		if (reset_bloomfilter) {
 			if (localBF)
 				delete localBF;
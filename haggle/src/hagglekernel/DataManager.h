@@ -63,6 +63,7 @@ class DataManager : public Manager
 	EventCallback <EventHandler> *onInsertedDataObjectCallback;
 	EventCallback <EventHandler> *onGetLocalBFCallback;
 	EventCallback <EventHandler> *onAgedDataObjectsCallback;
+	EventCallback <EventHandler> *onBuiltLocalBFCallback;
 	EventType dataTaskEvent;
 	EventType agingEvent;
 	DataHelper *helper;
@@ -74,6 +75,22 @@ class DataManager : public Manager
 	 in the node description.
 	 */
 	Bloomfilter *localBF;
+	/*
+	 When the local bloomfilter has grown a sub-filter, we build a new one 
+	 from the data store, which is right sized and no longer holds data 
+	 objects that were removed. The data objects added and removed (true and 
+	 false) while it is built are kept here, so that the new one gets them too.
+	 */
+	bool buildingLocalBF;
+	List< Pair<DataObjectRef, bool> > localBFChanges;
+	/*
+	 Deleted data objects that we keep in the local bloomfilter (old node 
+	 descriptions and those deleted with the keep flag) are no longer in the
+	 data store, so a bloomfilter built from it would not have them. Their 
+	 ids are kept here and added to the new bloomfilter.
+	 */
+	struct KeptId { DataObjectId_t id; };
+	List<KeptId> localBFKeptIds;
 	bool setCreateTimeOnBloomfilterUpdate;
 	bool keepInBloomfilterOnAging;
 	unsigned long agingMaxAge;
@@ -89,6 +106,9 @@ public:
         ~DataManager();
         void onGetLocalBF(Event *e);
 private:
+	void addToLocalBF(const DataObjectRef& dObj);
+	void removeFromLocalBF(const DataObjectRef& dObj);
+	void onBuiltLocalBF(Event *e);
 	void handleVerifiedDataObject(DataObjectRef& dObj);
         void onVerifiedDataObject(Event *e);
 	void onInsertedDataObject(Event *e);
@@ -25,6 +25,7 @@
 #endif
 
 #include "XMLMetadata.h"
+#include "BinaryMetadata.h"
 #include "DataObject.h"
 #include "Trace.h"
 
@@ -42,12 +43,171 @@ typedef struct pDd_s {
 	size_t header_len;
 	// The current length of the metadata header pointer (above):
 	size_t header_alloc_len;
+	// Where to continue looking for the end of the metadata header:
+	size_t scan_pos;
+	// What part of the metadata header scan_pos is in:
+	int scan_state;
 	// File pointer to the file where the data object's data is stored:
 	FILE *fp;
 	// The amount of data left to write to the data file:
 	size_t bytes_left;
+	// Whether the data is hashed as it is written, to verify it:
+	bool hashing;
+	// The hash of the data written so far:
+	SHA_CTX ctx;
 } *pDd;
 
+// The parts of the metadata header that find_header_end() passes through
+enum {
+	HEADER_SCAN_PROLOG, // Before the root element
+	HEADER_SCAN_SKIP, // In an XML declaration or comment before the root element
+	HEADER_SCAN_ROOT_TAG, // In the start tag of the root element
+	HEADER_SCAN_BODY, // After the start tag of the root element
+	HEADER_SCAN_BINARY, // In a header in the binary format
+};
+
+#define HEADER_END_TAG "</haggle>"
+#define HEADER_END_TAG_LEN 9
+
+// Case insensitive match of the end tag (strncasecmp() is not portable)
+static inline bool is_header_end_tag(const unsigned char *p)
+{
+	if (p[0] != '<' || p[1] != '/' || p[HEADER_END_TAG_LEN - 1] != '>')
+		return false;
+
+	// The name is all letters, and they only differ in case in bit 0x20
+	for (int i = 2; i < HEADER_END_TAG_LEN - 1; i++) {
+		if ((p[i] | 0x20) != HEADER_END_TAG[i])
+			return false;
+	}
+	return true;
+}
+
+/*
+	Looks for the end of the metadata header in the bytes that have been
+	put into the header so far. The header ends either with the end tag
+	</haggle>, or with the root element's start tag if it is of the
+	<haggle ... /> form. A header in the binary format ends where the
+	length in its preamble says.
+
+	The scan continues where the previous call stopped, and uses memchr()
+	to skip to the next interesting character, so that each byte is only
+	looked at once no matter how the header is split over calls.
+
+	Returns the length of the header including the end tag, or 0 if the
+	end has not been seen yet.
+*/
+static size_t find_header_end(pDd data)
+{
+	const unsigned char *buf = data->header;
+	const unsigned char *p;
+	size_t len = data->header_len;
+	size_t pos = data->scan_pos;
+	size_t end = 0;
+
+	if (pos == 0 && data->scan_state == HEADER_SCAN_PROLOG && BinaryMetadata::isBinary(buf, len))
+		data->scan_state = HEADER_SCAN_BINARY;
+
+	if (data->scan_state == HEADER_SCAN_BINARY) {
+		// The preamble of a binary header has its length
+		ssize_t binLen = BinaryMetadata::getLength(buf, len);
+
+		// End an invalid header after the preamble, so that it fails to parse
+		if (binLen < 0)
+			return BINARY_METADATA_PREAMBLE_LEN;
+
+		if (binLen > 0 && (size_t)binLen <= len)
+			return binLen;
+
+		return 0;
+	}
+
+	while (pos < len) {
+		switch (data->scan_state) {
+		case HEADER_SCAN_PROLOG:
+			p = (const unsigned char *)memchr(buf + pos, '<', len - pos);
+			
+			if (!p) {
+				pos = len;
+				break;
+			}
+			pos = p - buf;
+
+			// We need the character after '<' to know what this is
+			if (pos + 1 == len)
+				goto out;
+			
+			if (buf[pos + 1] == '?' || buf[pos + 1] == '!')
+				data->scan_state = HEADER_SCAN_SKIP;
+			else
+				data->scan_state = HEADER_SCAN_ROOT_TAG;
+			pos++;
+			break;
+		case HEADER_SCAN_SKIP:
+			p = (const unsigned char *)memchr(buf + pos, '>', len - pos);
+
+			if (!p) {
+				pos = len;
+				break;
+			}
+			pos = p - buf + 1;
+			data->scan_state = HEADER_SCAN_PROLOG;
+			break;
+		case HEADER_SCAN_ROOT_TAG:
+			/*
+			  Attribute values may not contain '>' unescaped in
+			  anything we generate, so the first '>' ends the tag.
+			*/
+			p = (const unsigned char *)memchr(buf + pos, '>', len - pos);
+
+			if (!p) {
+				pos = len;
+				break;
+			}
+			pos = p - buf + 1;
+
+			if (buf[pos - 2] == '/') {
+				end = pos;
+				goto out;
+			}
+			data->scan_state = HEADER_SCAN_BODY;
+			break;
+		case HEADER_SCAN_BODY:
+			p = (const unsigned char *)memchr(buf + pos, '<', len - pos);
+
+			if (!p) {
+				pos = len;
+				break;
+			}
+			pos = p - buf;
+
+			// Wait for the rest of a tag that may be the end tag
+			if (len - pos < HEADER_END_TAG_LEN)
+				goto out;
+			
+			if (is_header_end_tag(buf + pos)) {
+				end = pos + HEADER_END_TAG_LEN;
+				goto out;
+			}
+			pos++;
+			break;
+		}
+	}
+out:
+	data->scan_pos = pos;
+
+	return end;
+}
+
+// Initializes metadata from a raw metadata header in either wire format.
+static inline bool init_metadata_from_raw(Metadata *m, const unsigned char *raw, size_t len)
+{
+	if (BinaryMetadata::isBinary(raw, len))
+		return BinaryMetadata::decode(m, raw, len);
+
+	return m->initFromRaw(raw, len);
+}
+
 // Creates and initializes a pDd data structure.
 static pDd create_pDd(void)
 {
@@ -61,8 +221,11 @@ static pDd create_pDd(void)
 	retval->header = NULL;
 	retval->header_len = 0;
 	retval->header_alloc_len = 0;
+	retval->scan_pos = 0;
+	retval->scan_state = HEADER_SCAN_PROLOG;
 	retval->fp = NULL;
 	retval->bytes_left = 0;
+	retval->hashing = false;
 	
 	return retval;
 }
@@ -75,6 +238,8 @@ static void free_pDd_header(pDd data)
 
 	data->header_len = 0;
 	data->header_alloc_len = 0;
+	data->scan_pos = 0;
+	data->scan_state = HEADER_SCAN_PROLOG;
 	free(data->header);
 	// Let's not have any lingering pointers to dead data:
 	data->header = NULL;
@@ -102,7 +267,7 @@ DataObject::DataObject(InterfaceRef _localIface, InterfaceRef _remoteIface, cons
 #endif
                 signatureStatus(DataObject::SIGNATURE_MISSING),
                 signee(""), signature(NULL), signature_len(0), num(totNum++), 
-                metadata(NULL), filename(""), filepath(""), isForLocalApp(false), 
+                metadata(NULL), metadataOutdated(true), filename(""), filepath(""), isForLocalApp(false), 
 		storagepath(_storagepath), dataLen(0), createTime(-1), receiveTime(-1), 
                 localIface(_localIface), remoteIface(_remoteIface), rxTime(0), 
                 persistent(true), duplicate(false), stored(false), isNodeDesc(false), 
@@ -110,6 +275,8 @@ DataObject::DataObject(InterfaceRef _localIface, InterfaceRef _remoteIface, cons
 		dataState(DATA_STATE_UNKNOWN)
 {
 	memset(id, 0, sizeof(DataObjectId_t));
+	idOutdated = true;
+	memset(rawMetadata, 0, sizeof(rawMetadata));
 }
 
 // Copy constructor
@@ -120,7 +287,7 @@ DataObject::DataObject(const DataObject& dObj) :
                 signatureStatus(dObj.signatureStatus),
                 signee(dObj.signee), signature(NULL), signature_len(dObj.signature_len), 
 		num(totNum++), metadata(dObj.metadata ? dObj.metadata->copy() : NULL), 
-                attrs(dObj.attrs), filename(dObj.filename), filepath(dObj.filepath), 
+                metadataOutdated(true), attrs(dObj.attrs), filename(dObj.filename), filepath(dObj.filepath), 
                 isForLocalApp(dObj.isForLocalApp), storagepath(dObj.storagepath),
                 dataLen(dObj.dataLen), createTime(dObj.createTime), 
 		receiveTime(dObj.receiveTime), localIface(dObj.localIface), 
@@ -130,9 +297,11 @@ DataObject::DataObject(const DataObject& dObj) :
 		isThisNodeDesc(dObj.isThisNodeDesc),
 		controlMessage(false), putData_data(NULL), dataState(dObj.dataState)
 {
-	memcpy(id, dObj.id, DATAOBJECT_ID_LEN);
-	memcpy(idStr, dObj.idStr, MAX_DATAOBJECT_ID_STR_LEN);
+	memcpy(id, dObj.getId(), DATAOBJECT_ID_LEN);
+	memcpy(idStr, dObj.getIdStr(), MAX_DATAOBJECT_ID_STR_LEN);
+	idOutdated = false;
 	memcpy(dataHash, dObj.dataHash, sizeof(DataHash_t));
+	memset(rawMetadata, 0, sizeof(rawMetadata));
 	
 	if (dObj.signature && signature_len) {
 		signature = (unsigned char *)malloc(signature_len);
@@ -317,7 +486,7 @@ DataObject *DataObject::create(const unsigned char *raw, size_t len, InterfaceRe
 			goto out_failure;
 		}
 
-		if (!dObj->metadata->initFromRaw(raw, len) || dObj->metadata->getName() != "Haggle") {
+		if (!init_metadata_from_raw(dObj->metadata, raw, len) || dObj->metadata->getName() != "Haggle") {
 			HAGGLE_ERR("Could not create metadata\n");
 			delete dObj->metadata;
 			dObj->metadata = NULL;
@@ -353,6 +522,8 @@ DataObject::~DataObject()
 	if (signature)
 		free(signature);
 
+	freeRawMetadata();
+
 	if (!stored) {
 		deleteData();
 	}
@@ -363,7 +534,7 @@ void DataObject::deleteData()
 	if (filepath.size() > 0) {
 
 		HAGGLE_DBG("Deleting file \'%s\' associated with data object [%s]\n", 
-			filepath.c_str(), idStr);
+			filepath.c_str(), getIdStr());
 #if defined(OS_WINDOWS_MOBILE)
 		wchar_t *wpath = strtowstr_alloc(filepath.c_str());
 
@@ -378,6 +549,7 @@ void DataObject::deleteData()
 	filepath = "";
 	dataLen = 0;
 	dataState = DATA_STATE_NO_DATA;
+	metadataOutdated = true;
 }
 
 DataObject *DataObject::copy() const 
@@ -412,6 +584,7 @@ void DataObject::setSignature(const string signee, unsigned char *sig, size_t si
 	signature = sig;
 	signature_len = siglen;
 	signatureStatus = DataObject::SIGNATURE_UNVERIFIED;
+	metadataOutdated = true;
 	
 	//HAGGLE_DBG("Set signature on data object, siglen=%lu\n", siglen);
 }
@@ -422,6 +595,7 @@ bool DataObject::setFilePath(const string _filepath,
 {
 	filepath = _filepath;
 	dataLen = data_len;
+	metadataOutdated = true;
 
 	if (from_network)
 		return true;
@@ -512,6 +686,7 @@ bool DataObject::createFilePath()
         // Make sure the file path is the same as the file path
         // written to:
         filepath = path;
+	metadataOutdated = true;
 
 	return duplicate;
 }
@@ -553,6 +728,7 @@ void DataObject::setThumbnail(char *data, long len)
 void DataObject::setIsForLocalApp(const bool val)
 {
         isForLocalApp = val;
+	metadataOutdated = true;
 }
 
 ssize_t DataObject::putData(void *_data, size_t len, size_t *remaining)
@@ -579,91 +755,92 @@ ssize_t DataObject::putData(void *_data, size_t len, size_t *remaining)
         // Has the metadata been filled in yet?
         if (metadata == NULL) {
                 
+                size_t header_end, n = len;
+                
                 // No. Insert the bytes given into the header buffer first:
                 /*
-                  FIXME: this function searches for the XML end tag </haggle> (or
-                  <haggle ... />) to determine where the metadata ends. This REQUIRES
-                  the use of XML as metadata, or this function will never stop adding
-                  to the header.
+                  The header is either XML, in which case this function searches for
+                  the end tag </haggle> (or <haggle ... />) to determine where the
+                  metadata ends, or binary, in which case its length is given up
+                  front.
                 */
 
-		if (info->header_len + len >= DATAOBJECT_MAX_METADATA_SIZE) {
-			HAGGLE_ERR("Header length %lu exceeds maximum length %lu\n", 
-				info->header_len + len, DATAOBJECT_MAX_METADATA_SIZE);
-			return -1;
-		} 
-		if (info->header_len + len > info->header_alloc_len) {
+		// The data may continue past the header, so only take what fits
+		if (info->header_len + n >= DATAOBJECT_MAX_METADATA_SIZE)
+			n = DATAOBJECT_MAX_METADATA_SIZE - info->header_len - 1;
+
+		if (info->header_len + n > info->header_alloc_len) {
 			unsigned char *tmp;
 			/* We allocate a larger chunk of memory to put the header data into 
 			and then hope the header fits. If the chunk proves to be too small, 
 			we increase the size in a future put call.
 			*/
-			tmp = (unsigned char *)realloc(info->header, info->header_len + len + 1024);
+			tmp = (unsigned char *)realloc(info->header, info->header_len + n + 1024);
 			
                         if (tmp == NULL)
                                 return -1;
 
                         info->header = tmp;
-                        info->header_alloc_len = info->header_len + len + 1024;
+                        info->header_alloc_len = info->header_len + n + 1024;
 		}
 		
-                // Add the data, byte for byte:
-                while (len > 0 && !metadata) {
-                        // Insert another byte into the header:
-                        info->header[info->header_len] = data[0];
-                        info->header_len++;
-                        data++;
-                        putLen++;
-                        len--;
-			
-                        // Is this the end of the header?
-                        // FIXME: find a way to search for the <haggle ... /> style header.
-                        if (info->header_len >= 9) {
-                                if (info->header[info->header_len - 9] == '<' && info->header[info->header_len - 8] == '/'
-                                    && (info->header[info->header_len - 7] == 'H' || info->header[info->header_len - 7] == 'h')
-                                    && (info->header[info->header_len - 6] == 'A' || info->header[info->header_len - 6] == 'a')
-                                    && (info->header[info->header_len - 5] == 'G' || info->header[info->header_len - 5] == 'g')
-                                    && (info->header[info->header_len - 4] == 'G' || info->header[info->header_len - 4] == 'g')
-                                    && (info->header[info->header_len - 3] == 'L' || info->header[info->header_len - 3] == 'l')
-                                    && (info->header[info->header_len - 2] == 'E' || info->header[info->header_len - 2] == 'e')
-                                    && info->header[info->header_len - 1] == '>') {
-                                        // Yes. Yay!
-
-                                        metadata = new XMLMetadata();
-
-                                        if (!metadata) {
-						free_pDd_header(info);
-                                                HAGGLE_ERR("Could not create metadata\n");
-                                                return -1;
-                                        }
-
-					if (!metadata->initFromRaw(info->header, info->header_len)) {
-						free_pDd_header(info);
-                                                HAGGLE_ERR("data object header not could not be parsed\n");
-                                                delete metadata;
-						metadata = NULL;
-                                                return -1;
-					}
-
-                                        if (metadata->getName() != "Haggle") {
-						free_pDd_header(info);
-                                                HAGGLE_ERR("Metadata not recognized\n");
-                                                delete metadata;
-						metadata = NULL;
-                                                return -1;
-                                        }
-
-                                        if (parseMetadata(true) < 0) {
-						free_pDd_header(info);
-                                                HAGGLE_ERR("Parse metadata on new data object failed\n");
-						delete metadata;
-						metadata = NULL;
-                                                return -1;
-                                        }
-					free_pDd_header(info);
-                                }
+                /*
+                  Add all the data, and then look for the end of the header. Any
+                  bytes after the end are given back, as they belong to the data
+                  object's data (or the next data object).
+                */
+                memcpy(info->header + info->header_len, data, n);
+                info->header_len += n;
+
+                header_end = find_header_end(info);
+
+                if (header_end == 0) {
+                        if (n < len) {
+                                HAGGLE_ERR("Header length %lu exceeds maximum length %lu\n", 
+                                           info->header_len + len - n, DATAOBJECT_MAX_METADATA_SIZE);
+                                return -1;
                         }
+                        return len;
+                }
+
+                // Give back the bytes that were not part of the header
+                putLen = n - (info->header_len - header_end);
+                data += putLen;
+                len -= putLen;
+                info->header_len = header_end;
+
+                metadata = new XMLMetadata();
+
+                if (!metadata) {
+                        free_pDd_header(info);
+                        HAGGLE_ERR("Could not create metadata\n");
+                        return -1;
                 }
+
+                if (!init_metadata_from_raw(metadata, info->header, info->header_len)) {
+                        free_pDd_header(info);
+                        HAGGLE_ERR("data object header not could not be parsed\n");
+                        delete metadata;
+                        metadata = NULL;
+                        return -1;
+                }
+
+                if (metadata->getName() != "Haggle") {
+                        free_pDd_header(info);
+                        HAGGLE_ERR("Metadata not recognized\n");
+                        delete metadata;
+                        metadata = NULL;
+                        return -1;
+                }
+
+                if (parseMetadata(true) < 0) {
+                        free_pDd_header(info);
+                        HAGGLE_ERR("Parse metadata on new data object failed\n");
+                        delete metadata;
+                        metadata = NULL;
+                        return -1;
+                }
+                free_pDd_header(info);
         }	
         // Is the file to write into already open?
         if (info->fp == NULL && metadata) {
@@ -697,6 +874,18 @@ ssize_t DataObject::putData(void *_data, size_t len, size_t *remaining)
                                    filepath.c_str());
                         return -1;
                 }
+
+		// Use large writes, as the data usually arrives in small pieces
+		setvbuf(info->fp, NULL, _IOFBF, DATAOBJECT_WRITE_BUFFER_SIZE);
+
+		/*
+		  Hash the data as it is written, so that it can be verified
+		  without reading the file back once it is complete.
+		*/
+		if (dataIsVerifiable()) {
+			SHA1_Init(&info->ctx);
+			info->hashing = true;
+		}
         }
         // If we just finished putting the metadata header, then len will be
         // zero and we should return the amount put.
@@ -716,10 +905,14 @@ ssize_t DataObject::putData(void *_data, size_t len, size_t *remaining)
                         return -1;
                 }
 
-                putLen = len;
+                if (info->hashing)
+                        SHA1_Update(&info->ctx, data, len);
+
+                // Count any header bytes that were put in this call as well
+                putLen += len;
 
                 // Decrease the amount of data left:
-                info->bytes_left -= putLen;
+                info->bytes_left -= len;
                 // Return the number of bytes left to write:
                 *remaining = info->bytes_left;
         } else if (info->bytes_left > 0) {
@@ -738,9 +931,24 @@ ssize_t DataObject::putData(void *_data, size_t len, size_t *remaining)
                 fclose(info->fp);
                 info->fp = NULL;
 		
-                putLen = info->bytes_left;
+                putLen += info->bytes_left;
+
+		if (info->hashing) {
+			DataHash_t digest;
 
-                info->bytes_left -= putLen;
+			SHA1_Update(&info->ctx, data, info->bytes_left);
+			SHA1_Final(digest, &info->ctx);
+			info->hashing = false;
+			
+			if (memcmp(dataHash, digest, sizeof(DataHash_t)) == 0) {
+				dataState = DATA_STATE_VERIFIED_OK;
+			} else {
+				HAGGLE_ERR("Verification failed: The data hash is not the same as the one in the data object\n");
+				dataState = DATA_STATE_VERIFIED_BAD;
+			}
+		}
+
+                info->bytes_left = 0;
                 *remaining = info->bytes_left;
 
 		free_pDd();
@@ -768,14 +976,16 @@ class DataObjectDataRetrieverImplementation : public DataObjectDataRetriever {
         /// The amount of data left to read from the data file:
         size_t bytes_left;
 	
-        DataObjectDataRetrieverImplementation(const DataObjectRef _dObj);
+        DataObjectDataRetrieverImplementation(const DataObjectRef _dObj, MetadataFormat_t format);
         ~DataObjectDataRetrieverImplementation();
 	
         ssize_t retrieve(void *data, size_t len, bool getHeaderOnly);
 	bool isValid() const;
+	int getDataFile(off_t *offset, size_t *len);
+	bool skipData(size_t len);
 };
 
-DataObjectDataRetrieverImplementation::DataObjectDataRetrieverImplementation(const DataObjectRef _dObj) :
+DataObjectDataRetrieverImplementation::DataObjectDataRetrieverImplementation(const DataObjectRef _dObj, MetadataFormat_t format) :
                 dObj(_dObj), header(NULL), header_len(0), fp(NULL), header_bytes_left(0), bytes_left(0)
 { 
 	if (dObj->getDataLen() > 0 && !dObj->isForLocalApp) {
@@ -810,13 +1020,13 @@ DataObjectDataRetrieverImplementation::DataObjectDataRetrieverImplementation(con
         }
 
         // Find header size:
-        if (!dObj->getRawMetadataAlloc(&header, &header_len)) {
+        if (!dObj->getRawMetadataAlloc(&header, &header_len, format)) {
                 HAGGLE_ERR("ERROR: Unable to retrieve header.\n");
                 goto fail_header;
         }
 	
-        // Remove trailing characters up to the end of the metadata:
-        while (header_len && (char)header[header_len-1] != '>') {
+        // Remove trailing characters up to the end of the XML metadata:
+        while (format == METADATA_FORMAT_XML && header_len && (char)header[header_len-1] != '>') {
                 header_len--;
         }
 	
@@ -855,9 +1065,45 @@ bool DataObjectDataRetrieverImplementation::isValid() const
 	return (header != NULL && header_len > 0);
 }
 
-DataObjectDataRetrieverRef DataObject::getDataObjectDataRetriever(void) const
+int DataObjectDataRetrieverImplementation::getDataFile(off_t *offset, size_t *len)
+{
+#if defined(OS_UNIX)
+	long pos;
+
+	if (!fp || header_bytes_left || bytes_left == 0)
+		return -1;
+
+	// Anything read so far may be buffered by the stream
+	pos = ftell(fp);
+
+	if (pos < 0)
+		return -1;
+
+	*offset = pos;
+	*len = bytes_left;
+
+	return fileno(fp);
+#else
+	return -1;
+#endif
+}
+
+bool DataObjectDataRetrieverImplementation::skipData(size_t len)
+{
+	if (!fp || len > bytes_left)
+		return false;
+
+	if (fseek(fp, len, SEEK_CUR) != 0)
+		return false;
+
+	bytes_left -= len;
+
+	return true;
+}
+
+DataObjectDataRetrieverRef DataObject::getDataObjectDataRetriever(MetadataFormat_t format) const
 {
-       DataObjectDataRetrieverImplementation *retriever = new DataObjectDataRetrieverImplementation(this);
+       DataObjectDataRetrieverImplementation *retriever = new DataObjectDataRetrieverImplementation(this, format);
 
        if (!retriever  || !retriever->isValid())
 	       return NULL;
@@ -958,7 +1204,7 @@ void DataObject::setCreateTime(Timeval t)
 	if (createTime.isValid())
 		metadata->setParameter(DATAOBJECT_CREATE_TIME_PARAM, createTime.getAsString());
 
-        calcId();
+	idOutdated = true;
 }
 
 bool DataObject::addAttribute(const Attribute& a)
@@ -968,7 +1214,8 @@ bool DataObject::addAttribute(const Attribute& a)
 	
         bool ret = attrs.add(a);
        
-        calcId();
+	metadataOutdated = true;
+	idOutdated = true;
 
         return ret;
 }
@@ -984,8 +1231,10 @@ size_t DataObject::removeAttribute(const Attribute& a)
 {
         size_t n = attrs.erase(a);
 
-        if (n > 0)
-                calcId();
+        if (n > 0) {
+		metadataOutdated = true;
+		idOutdated = true;
+	}
 
         return n;
 }
@@ -1001,8 +1250,10 @@ size_t DataObject::removeAttribute(const string name, const string value)
                 n = attrs.erase(attr);
         }
         
-        if (n > 0)
-                calcId();
+        if (n > 0) {
+		metadataOutdated = true;
+		idOutdated = true;
+	}
 
         return n;
 }
@@ -1264,6 +1515,9 @@ int DataObject::parseMetadata(bool from_network)
 		
                 mattr = metadata->getNextMetadata();
         }
+	// Write back the state in the form that toMetadata() produces
+	metadataOutdated = true;
+
         return calcId();
 }
 /*
@@ -1277,8 +1531,19 @@ int DataObject::parseMetadata(bool from_network)
   same data objects -- in a true data-centric fashion.
  */
 int DataObject::calcId()
+{
+	Mutex::AutoLocker l(idMutex);
+
+	return _calcId();
+}
+
+/*
+  Calculates the id. Must be called with idMutex held.
+ */
+int DataObject::_calcId()
 {
         SHA_CTX ctxt;  
+	DataObjectId_t newId;
         
         SHA1_Init(&ctxt);
 		
@@ -1303,7 +1568,8 @@ int DataObject::calcId()
 	// If this data object has a create time:
 	if (createTime.isValid()) {
 		// Add the create time to make sure the id is unique:
-		SHA1_Update(&ctxt, (unsigned char *)createTime.getAsString().c_str(), createTime.getAsString().length());
+		string createTimeStr = createTime.getAsString();
+		SHA1_Update(&ctxt, (unsigned char *)createTimeStr.c_str(), createTimeStr.length());
 	}
 
 	/*
@@ -1319,46 +1585,65 @@ int DataObject::calcId()
 
 	}
 	// Create the final hash value:
-        SHA1_Final(this->id, &ctxt);
+        SHA1_Final(newId, &ctxt);
+	memcpy(id, newId, sizeof(DataObjectId_t));
 
         // Also save as a string:
-        calcIdStr();
+	buf2str((const char *)id, idStr, DATAOBJECT_ID_LEN);
+
+	// Only now is the id valid for readers
+	idOutdated = false;
 
 	return 0;
 }
 
 void DataObject::calcIdStr()
 {
-        int len = 0;
+	Mutex::AutoLocker l(idMutex);
 
         // Generate a readable string of the Id
-        for (int i = 0; i < DATAOBJECT_ID_LEN; i++) {
-                len += sprintf(idStr + len, "%02x", id[i] & 0xff);
-        }
+	buf2str((const char *)id, idStr, DATAOBJECT_ID_LEN);
+}
+
+const DataObjectId_t &DataObject::getId() const
+{
+	Mutex::AutoLocker l(idMutex);
+
+	if (idOutdated)
+		const_cast<DataObject *>(this)->_calcId();
+
+	return id;
+}
+
+const char *DataObject::getIdStr() const
+{
+	Mutex::AutoLocker l(idMutex);
+
+	if (idOutdated)
+		const_cast<DataObject *>(this)->_calcId();
+
+	return idStr;
 }
 
 bool operator==(const DataObject&a, const DataObject&b)
 {
-        return memcmp(a.id, b.id, sizeof(DataObjectId_t)) == 0;
+        return memcmp(a.getId(), b.getId(), sizeof(DataObjectId_t)) == 0;
 }
 
 
 bool operator!=(const DataObject&a, const DataObject&b)
 {
-        return memcmp(a.id, b.id, sizeof(DataObjectId_t)) != 0;
+        return memcmp(a.getId(), b.getId(), sizeof(DataObjectId_t)) != 0;
 }
 
 /*
-  NOTE: Currently, the metadata is recreated/updated (at least
-  partly), every time we do a getMetadata(). This is obviously not
-  very efficient, but something we have to live with if we want to
-  have some metadata that the data object understands and at the same
-  time allow others to add their own metadata to the data object (for
-  example, the "Node" tag added by the NodeManager).
-
-  Ideally, the data object would only have one internal
-  representation, and then that state is converted once to metadata at
-  the time the data object goes onto the wire.
+  NOTE: The metadata is updated from the state of the data object in
+  getMetadata(), but only if that state has changed since the last
+  update (metadataOutdated). Others may add their own metadata to the
+  data object (for example, the "Node" tag added by the
+  NodeManager), which steps the version of the metadata tree so that
+  the serialized metadata cached by getRawMetadataAlloc() is not
+  reused.
  */
 Metadata *DataObject::getMetadata()
 {
@@ -1380,6 +1665,9 @@ Metadata *DataObject::toMetadata()
 {
 	if (!metadata)
 		return NULL;
+
+	if (!metadataOutdated)
+		return metadata;
 	
 	metadata->setParameter(DATAOBJECT_PERSISTENT_PARAM, persistent ? "yes" : "no");
 	
@@ -1470,23 +1758,96 @@ Metadata *DataObject::toMetadata()
 			}
                 }      
         }
+	metadataOutdated = false;
+
         return metadata;
 }
 
-ssize_t DataObject::getRawMetadata(unsigned char *raw, size_t len) const
+void DataObject::freeRawMetadata()
+{
+	for (int i = 0; i < _METADATA_FORMAT_MAX; i++) {
+		if (rawMetadata[i]) {
+			free(rawMetadata[i]);
+			rawMetadata[i] = NULL;
+		}
+	}
+}
+
+/*
+  Makes sure that rawMetadata holds the current metadata in the given
+  format. Must be called with rawMetadataMutex held.
+ */
+bool DataObject::serializeMetadata(MetadataFormat_t format) const
 {
+	unsigned char *raw;
+	size_t len;
+	bool ret;
+
         if (!toMetadata())
+                return false;
+
+	if (rawMetadata[format] && rawMetadataVersion[format] == metadata->getVersion())
+		return true;
+
+	if (format == METADATA_FORMAT_BINARY)
+		ret = BinaryMetadata::encode(metadata, &raw, &len);
+	else
+		ret = metadata->getRawAlloc(&raw, &len);
+
+	if (!ret)
+		return false;
+
+	if (rawMetadata[format])
+		free(rawMetadata[format]);
+
+	rawMetadata[format] = raw;
+	rawMetadataLen[format] = len;
+	rawMetadataVersion[format] = metadata->getVersion();
+
+	return true;
+}
+
+ssize_t DataObject::getRawMetadata(unsigned char *raw, size_t len) const
+{
+	Mutex::AutoLocker l(rawMetadataMutex);
+
+	if (!raw || !serializeMetadata(METADATA_FORMAT_XML))
                 return -1;
 
-        return metadata->getRaw(raw, len);
+	if (rawMetadataLen[METADATA_FORMAT_XML] > len)
+		return -3;
+
+	memset(raw, 0, len);
+	memcpy(raw, rawMetadata[METADATA_FORMAT_XML], rawMetadataLen[METADATA_FORMAT_XML]);
+
+        return rawMetadataLen[METADATA_FORMAT_XML];
 } 
 
-bool DataObject::getRawMetadataAlloc(unsigned char **raw, size_t *len) const
+bool DataObject::getRawMetadataAlloc(unsigned char **raw, size_t *len, MetadataFormat_t format) const
 {
-        if (!toMetadata())
+	Mutex::AutoLocker l(rawMetadataMutex);
+
+	if (!raw || !len || format >= _METADATA_FORMAT_MAX)
+		return false;
+
+	if (!serializeMetadata(format))
                 return false;
 
-        return metadata->getRawAlloc(raw, len);
+	/*
+	  Callers own the returned buffer, so hand out a copy of the
+	  cached one. Copying is much cheaper than serializing.
+	*/
+	*raw = (unsigned char *)malloc(rawMetadataLen[format] + 1);
+
+	if (!*raw)
+		return false;
+
+	memcpy(*raw, rawMetadata[format], rawMetadataLen[format]);
+	// Keep the XML string terminated, as in XMLMetadata::getRawAlloc()
+	(*raw)[rawMetadataLen[format]] = '\0';
+	*len = rawMetadataLen[format];
+
+        return true;
 } 
 
 void DataObject::print(FILE *fp) const
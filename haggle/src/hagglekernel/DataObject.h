@@ -25,6 +25,7 @@ class DataObjectDataRetriever;
 
 #include <libcpphaggle/Reference.h>
 #include <libcpphaggle/String.h>
+#include <libcpphaggle/Mutex.h>
 #include "Trace.h"
 #include <openssl/sha.h>
 #include <stdio.h>
@@ -87,6 +88,12 @@ typedef unsigned char DataHash_t[SHA_DIGEST_LENGTH];
 */
 #define DATAOBJECT_MAX_DATA_SIZE (1LL<<32)
 
+/*
+	The size of the buffer used when writing a received data object's data
+	to file.
+*/
+#define DATAOBJECT_WRITE_BUFFER_SIZE (65536)
+
 /*
 	This macro is meant to be used by managers to determine if a data object
 	that contains configuration data can be trusted.
@@ -141,6 +148,23 @@ class DataObjectDataRetriever {
 	*/
 	virtual ssize_t retrieve(void *data, size_t len, bool getHeaderOnly) = 0;
 	virtual bool isValid() const = 0;
+	/**
+	   Get the file that holds the data that is left to retrieve, so that
+	   the caller can send it without copying it through its own buffer 
+	   (e.g., with sendfile()). This is only possible once the header has 
+	   been retrieved. A caller that takes data from the file must call
+	   skipData() with the number of bytes it took.
+
+	   Returns: the file descriptor of the file, or -1 if there is no
+	   file to get the data from. On success, 'offset' is set to where
+	   the data left to retrieve begins, and 'len' to its length.
+	*/
+	virtual int getDataFile(off_t *offset, size_t *len) { return -1; }
+	/**
+	   Skip 'len' bytes of the data, because the caller has taken them
+	   from the file returned by getDataFile().
+	*/
+	virtual bool skipData(size_t len) { return false; }
 };
 
 /**
@@ -153,13 +177,13 @@ typedef ReferenceList<DataObject> DataObjectRefList;
 /** */
 #if OMNETPP
 #include <omnetpp.h>
-class DataObject : public cObject
+class DataObject : public cObject, public Refcountable
 {
 #else
 #ifdef DEBUG_LEAKS
-class DataObject : public LeakMonitor
+class DataObject : public LeakMonitor, public Refcountable
 #else
-class DataObject
+class DataObject : public Refcountable
 #endif
 {
 #endif /* OMNETPP */
@@ -186,6 +210,24 @@ class DataObject
         static unsigned int totNum;
         unsigned int num;
         Metadata* metadata; // The metadata part of the data object
+	/*
+	  Set when the state of the data object (attributes, data,
+	  signature, etc.) has changed since it was last written to the
+	  metadata by toMetadata().
+	*/
+	bool metadataOutdated;
+	/*
+	  The metadata serialized in each wire format, which is reused as
+	  long as the version of the metadata is the one it was serialized
+	  from. This way, a data object sent to many neighbors, or stored
+	  and delivered to applications, is only serialized once.
+	*/
+	mutable unsigned char *rawMetadata[_METADATA_FORMAT_MAX];
+	mutable size_t rawMetadataLen[_METADATA_FORMAT_MAX];
+	mutable unsigned long rawMetadataVersion[_METADATA_FORMAT_MAX];
+	mutable Mutex rawMetadataMutex;
+	bool serializeMetadata(MetadataFormat_t format) const;
+	void freeRawMetadata();
         Attributes attrs; // The attributes of this data object
         string filename;
         string filepath;
@@ -246,6 +288,16 @@ class DataObject
         bool initMetadata();
 	DataObjectId_t id;
 	char idStr[MAX_DATAOBJECT_ID_STR_LEN];
+	/*
+	  Set when the id no longer matches the attributes or create
+	  time. The id is calculated again when it is next read, so that
+	  adding many attributes to a data object hashes them only once.
+	  The id is read from several threads, so idMutex is held while
+	  it is calculated and read.
+	*/
+	bool idOutdated;
+	mutable Mutex idMutex;
+	int _calcId();
 	DataHash_t dataHash;
 	DataState_t dataState;
 
@@ -291,6 +343,9 @@ public:
            This function checks if there is a file with this data object, and if 
            there is a hash attribute in the data object. If so, it checks the hash
            to see if it is correct.
+
+           Data objects received through putData() are verified as their data
+           is written, in which case this function just returns the result.
 		
            Returns: The data state after verification.
 	*/
@@ -305,7 +360,7 @@ public:
 	SignatureStatus_t getSignatureStatus() const { return signatureStatus; }
 	void setSignatureStatus(const SignatureStatus_t s) { signatureStatus = s; }
 	const string &getSignee() const { return signee; }
-	void setSignee(const string s) { signee = s; }
+	void setSignee(const string s) { signee = s; metadataOutdated = true; }
 	bool hasValidSignature() const { return signatureStatus == SIGNATURE_VALID; }
 	bool signatureIsUnverified() const { return signatureStatus == SIGNATURE_UNVERIFIED; }
 	bool isSigned() const { return signatureStatus != SIGNATURE_MISSING; }
@@ -314,12 +369,8 @@ public:
 	void setSignature(const string signee, unsigned char *sig, size_t siglen);
 	bool shouldSign() const;
 	
-	const DataObjectId_t &getId() const {
-		return id;
-	}
-	const char *getIdStr() const {
-		return idStr;
-	}
+	const DataObjectId_t &getId() const;
+	const char *getIdStr() const;
 	unsigned int getNum() const {
 		return num;
 	}
@@ -341,7 +392,16 @@ public:
         Metadata *getMetadata();
         const Metadata *getMetadata() const;
         ssize_t getRawMetadata(unsigned char *raw, size_t len) const;
-	bool getRawMetadataAlloc(unsigned char **raw, size_t *len) const;
+	/**
+	   Get the metadata in the given wire format, in a buffer allocated
+	   with malloc(). Applications and the data store only understand
+	   XML, so the binary format is only for peers that accept it.
+
+	   The metadata is only serialized again if it has changed since
+	   the last call, otherwise the buffer is a copy of the previous
+	   serialization.
+	*/
+	bool getRawMetadataAlloc(unsigned char **raw, size_t *len, MetadataFormat_t format = METADATA_FORMAT_XML) const;
         
 		// Thumbnail functions
         /**
@@ -384,6 +444,7 @@ public:
 	void setPersistent(bool _persistent = true)
 	{
 		persistent = _persistent;
+		metadataOutdated = true;
 	}
 	/**
            This function inserts data into a data object. The data object must
@@ -397,6 +458,7 @@ public:
            If the data object has auxiliary data, the metadata header will have a data 
            length attribute which is automatically read once the metadata has been 
            completely put. Before that happens, "remaining" will be set to 1.
+           The metadata header may be in either the XML or the binary format.
 
            The advantage of using this function is that the one creating the data
            object does not need to know/assume anything about how a data object is
@@ -426,8 +488,10 @@ public:
            can be used to retrieve data.
            NULL: this function was not successful, meaning that the returned boject
            can (of course) not be used to retrieve data.
+
+           The metadata header is retrieved in the given wire format.
 	*/
-	DataObjectDataRetrieverRef getDataObjectDataRetriever(void) const;
+	DataObjectDataRetrieverRef getDataObjectDataRetriever(MetadataFormat_t format = METADATA_FORMAT_XML) const;
 
 	
         // Attribute functions
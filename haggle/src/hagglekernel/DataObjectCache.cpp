@@ -0,0 +1,130 @@
+/* Copyright 2008-2009 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdlib.h>
+
+#include "DataObjectCache.h"
+
+/*
+	A candidate for eviction. Data objects that are referenced outside
+	the cache are evicted last.
+*/
+struct EvictCandidate {
+	sqlite_int64 rowid;
+	unsigned long last_use;
+	bool in_use;
+};
+
+static int compare_candidates(const void *a, const void *b)
+{
+	const EvictCandidate *c1 = (const EvictCandidate *)a;
+	const EvictCandidate *c2 = (const EvictCandidate *)b;
+
+	if (c1->in_use != c2->in_use)
+		return c1->in_use ? 1 : -1;
+
+	if (c1->last_use != c2->last_use)
+		return c1->last_use < c2->last_use ? -1 : 1;
+
+	return 0;
+}
+
+DataObjectCache::DataObjectCache(unsigned long _max_size) :
+	max_size(_max_size > 0 ? _max_size : 1), clock(0), hits(0), misses(0), evictions(0)
+{
+}
+
+DataObjectCache::~DataObjectCache()
+{
+	clear();
+}
+
+DataObjectRef DataObjectCache::get(sqlite_int64 rowid)
+{
+	EntryMap::iterator it = entries.find(rowid);
+
+	if (it == entries.end()) {
+		misses++;
+		return NULL;
+	}
+
+	hits++;
+	(*it).second.last_use = ++clock;
+
+	return (*it).second.dObj;
+}
+
+void DataObjectCache::put(sqlite_int64 rowid, const DataObjectRef& dObj)
+{
+	EntryMap::iterator it = entries.find(rowid);
+
+	if (!dObj)
+		return;
+
+	if (it != entries.end()) {
+		(*it).second.dObj = dObj;
+		(*it).second.last_use = ++clock;
+		return;
+	}
+
+	entries.insert(make_pair(rowid, Entry(dObj, ++clock)));
+
+	if (entries.size() > max_size)
+		evict();
+}
+
+void DataObjectCache::remove(sqlite_int64 rowid)
+{
+	entries.erase(rowid);
+}
+
+void DataObjectCache::clear()
+{
+	entries.clear();
+}
+
+/*
+	Evicts a quarter of the cache at once, so that the cost of sorting
+	the candidates is spread over many insertions.
+*/
+void DataObjectCache::evict()
+{
+	unsigned long num = 0, target = max_size - max_size / 4;
+	EvictCandidate *candidates;
+
+	candidates = (EvictCandidate *)malloc(entries.size() * sizeof(EvictCandidate));
+
+	if (!candidates) {
+		HAGGLE_ERR("Could not allocate eviction candidates, clearing cache\n");
+		evictions += entries.size();
+		entries.clear();
+		return;
+	}
+
+	for (EntryMap::iterator it = entries.begin(); it != entries.end(); it++) {
+		candidates[num].rowid = (*it).first;
+		candidates[num].last_use = (*it).second.last_use;
+		candidates[num].in_use = (*it).second.dObj.refcount() > 1;
+		num++;
+	}
+
+	qsort(candidates, num, sizeof(EvictCandidate), compare_candidates);
+
+	for (unsigned long i = 0; i < num && entries.size() > target; i++) {
+		entries.erase(candidates[i].rowid);
+		evictions++;
+	}
+
+	free(candidates);
+}
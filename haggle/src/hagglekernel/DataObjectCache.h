@@ -0,0 +1,101 @@
+/* Copyright 2008-2009 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _DATAOBJECTCACHE_H
+#define _DATAOBJECTCACHE_H
+
+/*
+	Forward declarations of all data types declared in this file. This is to
+	avoid circular dependencies. If/when a data type is added to this file,
+	remember to add it here.
+*/
+class DataObjectCache;
+
+#include <libcpphaggle/HashMap.h>
+
+#include <sqlite3.h>
+
+#include "DataObject.h"
+
+using namespace haggle;
+
+// The default maximum number of data objects in the cache
+#define DATAOBJECT_CACHE_DEFAULT_SIZE 256
+
+/**
+	A bounded cache of data objects that have been decoded from the
+	data store, indexed by their rowid.
+
+	Creating a data object from the data store means parsing its
+	metadata, so the data store keeps the data objects it has created
+	and hands out the same data object the next time the same rowid
+	matches a query. A data object in the cache is never changed by
+	the data store, since a data object is never updated in the data
+	store once it is inserted. It must be removed from the cache when
+	it is deleted from the data store.
+
+	When the cache grows above its maximum size, it evicts the least
+	recently used data objects that are not referenced outside the
+	cache first, since only those free any memory.
+
+	The cache is not thread safe. The SQLDataStore protects it with
+	the same mutex as its attribute index, since the query workers
+	also put the data objects they create into the cache.
+*/
+class DataObjectCache {
+	struct Entry {
+		DataObjectRef dObj;
+		unsigned long last_use;
+		Entry(const DataObjectRef& _dObj = NULL, unsigned long _last_use = 0) :
+			dObj(_dObj), last_use(_last_use) {}
+	};
+	typedef HashMap<sqlite_int64, Entry> EntryMap;
+
+	EntryMap entries;
+	unsigned long max_size;
+	unsigned long clock;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+
+	void evict();
+public:
+	DataObjectCache(unsigned long _max_size = DATAOBJECT_CACHE_DEFAULT_SIZE);
+	~DataObjectCache();
+
+	/**
+		Returns the data object with the given rowid, or a NULL
+		reference if it is not in the cache.
+	*/
+	DataObjectRef get(sqlite_int64 rowid);
+	/**
+		Adds a data object to the cache, possibly evicting other
+		data objects.
+	*/
+	void put(sqlite_int64 rowid, const DataObjectRef& dObj);
+	/**
+		Removes the data object with the given rowid, if it is in
+		the cache.
+	*/
+	void remove(sqlite_int64 rowid);
+	void clear();
+
+	unsigned long size() const { return entries.size(); }
+	unsigned long getMaxSize() const { return max_size; }
+	unsigned long getHits() const { return hits; }
+	unsigned long getMisses() const { return misses; }
+	unsigned long getEvictions() const { return evictions; }
+};
+
+#endif /* _DATAOBJECTCACHE_H */
@@ -136,6 +136,7 @@ const char *DataStoreTask::taskName[_TASK_MAX] = {
 	"TASK_INSERT_REPOSITORY",
 	"TASK_READ_REPOSITORY",
 	"TASK_DELETE_REPOSITORY",
+	"TASK_BUILD_BLOOMFILTER",
 	"TASK_DUMP_DATASTORE",
 	"TASK_DUMP_DATASTORE_TO_FILE",
 #ifdef DEBUG_DATASTORE
@@ -296,6 +297,8 @@ DataStoreTask::DataStoreTask(TaskType _type, void *_data,
 	} else if (type == TASK_DUMP_DATASTORE_TO_FILE ||
 		type == TASK_DELETE_FILTER) {
 		priority = TASK_PRIORITY_HIGH;
+	} else if (type == TASK_BUILD_BLOOMFILTER) {
+		priority = TASK_PRIORITY_LOW;
 	} else {
 		HAGGLE_ERR("Tried to create a data store task with the wrong task for the data. (task type = %s)\n", taskName[type]);
 	}
@@ -381,6 +384,7 @@ DataStoreTask::~DataStoreTask()
 		delete static_cast<long *>(data);
 		break;
 #endif
+	case TASK_BUILD_BLOOMFILTER:
 	case TASK_DUMP_DATASTORE:
 		break;
 	case TASK_DUMP_DATASTORE_TO_FILE:
@@ -403,6 +407,11 @@ DataStore::~DataStore()
 		
 		delete task;
 	}
+
+	while (!queryQ.empty()) {
+		delete queryQ.front();
+		queryQ.pop_front();
+	}
 }
 
 void DataStore::TaskQueue::insert(DataStoreTask *task)
@@ -703,12 +712,14 @@ int DataStore::cancelDataObjectQueries(const NodeRef& node)
 	while (it != taskQ.end()) {
 		if ((*it)->getType() == TASK_DATAOBJECT_QUERY) {
 			if ((*it)->DOQuery->getNode() == node) {
+				delete *it;
 				it = taskQ.erase(it);	
 				count++;
 				continue;
 			}
 		} else if ((*it)->getType() == TASK_DATAOBJECT_FOR_NODES_QUERY) {
 			if ((*it)->DOForNodesQuery->getNode() == node) {
+				delete *it;
 				it = taskQ.erase(it);	
 				count++;
 				continue;
@@ -717,6 +728,24 @@ int DataStore::cancelDataObjectQueries(const NodeRef& node)
 		it++;
 	}
 
+	// Also cancel the queries that wait for a query worker
+	synchronized(queryMutex) {
+		List<DataStoreTask *>::iterator qt = queryQ.begin();
+
+		while (qt != queryQ.end()) {
+			if (((*qt)->getType() == TASK_DATAOBJECT_QUERY && 
+			     (*qt)->DOQuery->getNode() == node) ||
+			    ((*qt)->getType() == TASK_DATAOBJECT_FOR_NODES_QUERY && 
+			     (*qt)->DOForNodesQuery->getNode() == node)) {
+				delete *qt;
+				qt = queryQ.erase(qt);
+				count++;
+				continue;
+			}
+			qt++;
+		}
+	}
+
 	return count;
 }
 
@@ -730,6 +759,15 @@ void DataStore::dump(const EventCallback<EventHandler> *callback)
 	cond.signal();
 }
 
+void DataStore::buildBloomfilter(const EventCallback<EventHandler> *callback)
+{
+        Mutex::AutoLocker l(mutex);
+                
+	taskQ.insert(new DataStoreTask(TASK_BUILD_BLOOMFILTER, NULL, callback));
+	
+	cond.signal();
+}
+
 void DataStore::dumpToFile(const char *filename)
 {
         Mutex::AutoLocker l(mutex);
@@ -749,15 +787,189 @@ void DataStore::hookCancel()
 	cond.signal();
 }
 
+void DataStore::setTaskBatchSize(unsigned long size)
+{
+	Mutex::AutoLocker l(mutex);
+
+	if (size > 0)
+		taskBatchSize = size;
+}
+
+void DataStore::setNumQueryWorkers(unsigned int num)
+{
+	Mutex::AutoLocker l(mutex);
+
+	numQueryWorkers = num;
+}
+
+/*
+	Tasks that only read or write the data store can be executed
+	together in one batch. Dumps and the exit task must see the data
+	store with all previous tasks committed.
+*/
+static bool task_is_batchable(TaskType type)
+{
+	switch (type) {
+	case TASK_DUMP_DATASTORE:
+	case TASK_DUMP_DATASTORE_TO_FILE:
+	case TASK_EXIT:
+#ifdef DEBUG_DATASTORE
+	case TASK_DEBUG_PRINT:
+#endif
+		return false;
+	default:
+		break;
+	}
+	return true;
+}
+
+/*
+	Queries that only read the data store, and that can therefore be
+	executed by a query worker.
+*/
+static bool task_is_query(TaskType type)
+{
+	switch (type) {
+	case TASK_FILTER_QUERY:
+	case TASK_DATAOBJECT_QUERY:
+	case TASK_DATAOBJECT_FOR_NODES_QUERY:
+	case TASK_NODE_QUERY:
+	case TASK_READ_REPOSITORY:
+	case TASK_BUILD_BLOOMFILTER:
+		return true;
+	default:
+		break;
+	}
+	return false;
+}
+
+void DataStore::startQueryWorkers()
+{
+	unsigned int num;
+
+	synchronized(mutex) {
+		num = numQueryWorkers;
+	}
+
+	for (unsigned int i = 0; i < num; i++) {
+		DataStoreQueryWorker *worker = _createQueryWorker(i);
+
+		if (!worker)
+			break;
+
+		if (!worker->init() || !worker->start()) {
+			HAGGLE_ERR("Could not start data store query worker %u\n", i);
+			delete worker;
+			break;
+		}
+		queryWorkers.push_back(worker);
+	}
+
+	HAGGLE_DBG("Data store uses %lu query workers\n", (unsigned long)queryWorkers.size());
+}
+
+void DataStore::stopQueryWorkers()
+{
+	while (!queryWorkers.empty()) {
+		DataStoreQueryWorker *worker = queryWorkers.front();
+
+		queryWorkers.pop_front();
+		worker->stop();
+		delete worker;
+	}
+
+	// Queries that no worker got to are not executed, like the 
+	// queries left when the data store thread exits.
+	synchronized(queryMutex) {
+		while (!queryQ.empty()) {
+			delete queryQ.front();
+			queryQ.pop_front();
+		}
+	}
+}
+
+bool DataStoreQueryWorker::run()
+{
+	DataStoreTask *task;
+
+	ds->queryMutex.lock();
+
+	while (ds->queryQ.empty() && !shouldExit())
+		ds->queryCond.wait(&ds->queryMutex);
+
+	if (shouldExit()) {
+		ds->queryMutex.unlock();
+		return false;
+	}
+
+	task = ds->queryQ.front();
+	ds->queryQ.pop_front();
+
+	ds->queryMutex.unlock();
+
+	if (!ds->shouldExit()) {
+		switch (task->getType()) {
+		case TASK_FILTER_QUERY:
+			_doFilterQuery(task->query);
+			break;
+		case TASK_DATAOBJECT_QUERY:
+			_doDataObjectQuery(task->DOQuery);
+			break;
+		case TASK_DATAOBJECT_FOR_NODES_QUERY:
+			_doDataObjectForNodesQuery(task->DOForNodesQuery);
+			break;
+		case TASK_NODE_QUERY:
+			_doNodeQuery(task->NodeQuery);
+			break;
+		case TASK_READ_REPOSITORY:
+			_readRepository(task->RepositoryQuery);
+			break;
+		case TASK_BUILD_BLOOMFILTER:
+			_buildBloomfilter(task->callback);
+			break;
+		default:
+			HAGGLE_ERR("Query worker got a task that is not a query\n");
+			break;
+		}
+	}
+	delete task;
+
+	return true;
+}
+
+void DataStoreQueryWorker::cleanup()
+{
+	HAGGLE_DBG("%s cleanup\n", getName());
+}
+
+void DataStoreQueryWorker::hookCancel()
+{
+	// Wake up the worker if it waits for a query
+	Mutex::AutoLocker l(ds->queryMutex);
+
+	ds->queryCond.broadcast();
+}
+
 // This function is the thread
 bool DataStore::run()
 {
+	unsigned long batched = 0, batchSize;
 #if defined (DEBUG)
 	static unsigned short count = 0;
 #endif
+	startQueryWorkers();
+
 	while (true) {
 		mutex.lock();
 
+		if (taskQ.empty() && batched > 0) {
+			// Finish the current batch before waiting for more tasks
+			mutex.unlock();
+			_endTaskBatch();
+			batched = 0;
+			continue;
+		}
+
 		// Check if we should quit. 
                 if (taskQ.empty()) {
 			if (shouldExit()) {
@@ -775,6 +987,7 @@ bool DataStore::run()
 		DataStoreTask *task = static_cast<DataStoreTask *>(taskQ.front());
 
 		taskQ.pop_front();
+		batchSize = taskBatchSize;
 #if defined(DEBUG)
 		// Log the queue length every tenth time we
 		// execute a task
@@ -786,6 +999,31 @@ bool DataStore::run()
 #endif
 		mutex.unlock();
 
+		if (!queryWorkers.empty() && task_is_query(task->getType())) {
+			// Commit the tasks queued before the query, so that 
+			// the worker sees them
+			if (batched > 0) {
+				_endTaskBatch();
+				batched = 0;
+			}
+			queryMutex.lock();
+			queryQ.push_back(task);
+			queryCond.signal();
+			queryMutex.unlock();
+			continue;
+		}
+
+		if (batched > 0 && (batched >= batchSize || 
+				    !task_is_batchable(task->getType()))) {
+			_endTaskBatch();
+			batched = 0;
+		}
+
+		if (batchSize > 1 && task_is_batchable(task->getType())) {
+			if (batched == 0)
+				_beginTaskBatch();
+			batched++;
+		}
 
 		//HAGGLE_DBG("Executing task with priority=%u timestamp=%s\n", 
 		//	   task->getPriority(), task->getTimestamp().getAsString().c_str());
@@ -849,6 +1087,10 @@ bool DataStore::run()
 		case TASK_DELETE_REPOSITORY:
 			_deleteRepository(task->RepositoryQuery);
 			break;
+		case TASK_BUILD_BLOOMFILTER:
+			if (!shouldExit())
+				_buildBloomfilter(task->callback);
+			break;
                 case TASK_DUMP_DATASTORE:
 			_dump(task->callback);
 			break;
@@ -886,4 +1128,9 @@ bool DataStore::run()
 void DataStore::cleanup()
 {
 	HAGGLE_DBG("DataStore thread cleanup\n");
+	
+	// Do not lose the tasks in a batch that was interrupted
+	_endTaskBatch();
+
+	stopQueryWorkers();
 }
@@ -28,6 +28,7 @@ class DataStoreDataObjectQuery;
 class DataStoreDataObjectForNodesQuery;
 class DataStoreRepositoryQuery;
 class DataStoreTask;
+class DataStoreQueryWorker;
 class DataStore;
 
 #include <libcpphaggle/Timeval.h>
@@ -48,6 +49,20 @@ class DataStore;
 
 #define DATASTORE_MAX_DATAOBJECTS_AGED_AT_ONCE 3
 
+/*
+	The default maximum number of queued tasks that the data store
+	thread executes in one transaction. A batch size of one executes
+	every task in a transaction of its own.
+*/
+#define DEFAULT_DATASTORE_TASK_BATCH_SIZE 100
+
+/*
+	The default number of worker threads that execute read-only
+	queries next to the data store thread, if the data store supports
+	it. Zero executes all tasks in the data store thread.
+*/
+#define DEFAULT_DATASTORE_QUERY_WORKERS 2
+
 class HaggleKernel;
 
 // Result returned from a query
@@ -253,6 +268,7 @@ typedef enum {
 	TASK_INSERT_REPOSITORY,
 	TASK_READ_REPOSITORY,
 	TASK_DELETE_REPOSITORY,
+	TASK_BUILD_BLOOMFILTER,
 	TASK_DUMP_DATASTORE,
 	TASK_DUMP_DATASTORE_TO_FILE,
 #ifdef DEBUG_DATASTORE
@@ -278,6 +294,7 @@ class DataStoreTask
 	static unsigned long totNum;
 	static const char *taskName[_TASK_MAX];
 	friend class DataStore;
+	friend class DataStoreQueryWorker;
 	TaskType type;
 	Priority_t priority;
 	unsigned long num;
@@ -326,6 +343,41 @@ public:
 };
 
 
+/**
+	A thread that executes read-only queries next to the data store
+	thread, so that a slow query does not hold up the tasks that change
+	the data store. A data store that can be read from several threads
+	at once creates its workers in DataStore::_createQueryWorker(), and
+	implements the queries in the worker, e.g., against a database
+	connection of the worker's own.
+*/
+class DataStoreQueryWorker : public Runnable
+{
+	friend class DataStore;
+	DataStore *ds;
+	bool run();
+	void cleanup();
+	void hookCancel();
+protected:
+	virtual int _doFilterQuery(DataStoreFilterQuery *q) = 0;
+	virtual int _doDataObjectQuery(DataStoreDataObjectQuery *q) = 0;
+	virtual int _doDataObjectForNodesQuery(DataStoreDataObjectForNodesQuery *q) = 0;
+	virtual int _doNodeQuery(DataStoreNodeQuery *q) = 0;
+	virtual int _readRepository(DataStoreRepositoryQuery *q) = 0;
+	virtual int _buildBloomfilter(const EventCallback<EventHandler> *callback) = 0;
+public:
+	DataStoreQueryWorker(DataStore *_ds, const string name = "DataStoreQueryWorker") : 
+		Runnable(name), ds(_ds) {}
+	virtual ~DataStoreQueryWorker() {}
+
+	/**
+	  Initializes the worker before it is started.
+
+	  Returns: true if the initialization was successful, or false otherwise.
+	*/
+	virtual bool init() { return true; }
+};
+
 // This is an abstract DataStore class. From this it should be
 // possible to implement several backends, e.g., based on XML or SQL
 /** */
@@ -342,6 +394,17 @@ class DataStore :
 		~TaskQueue() {}
 		void insert(DataStoreTask *task);
 	} taskQ;
+	unsigned long taskBatchSize;
+	friend class DataStoreQueryWorker;
+	// Queries waiting for a query worker. Protected by queryMutex.
+	List<DataStoreTask *> queryQ;
+	Mutex queryMutex;
+	Condition queryCond;
+	// Only used by the data store thread
+	List<DataStoreQueryWorker *> queryWorkers;
+	unsigned int numQueryWorkers;
+	void startQueryWorkers();
+	void stopQueryWorkers();
         // run() is the function executed by the thread
         bool run();
         // cleanup() is called when the thread is stopped or cancelled
@@ -370,9 +433,26 @@ protected:
 	virtual int _insertRepository(DataStoreRepositoryQuery* q) = 0;
 	virtual int _readRepository(DataStoreRepositoryQuery* q, const EventCallback<EventHandler> *callback = NULL) = 0;
 	virtual int _deleteRepository(DataStoreRepositoryQuery* q) = 0;
+	virtual int _buildBloomfilter(const EventCallback<EventHandler> *callback) = 0;
 	virtual int _dump(const EventCallback<EventHandler> *callback = NULL) = 0;
 	virtual int _dumpToFile(const char *filename) = 0;
 
+	/*
+		Called by the data store thread before the first and
+		after the last task in a batch of queued tasks, so that a
+		derived class can execute the whole batch in one
+		transaction.
+	*/
+	virtual void _beginTaskBatch() {}
+	virtual void _endTaskBatch() {}
+
+	/*
+		Called by the data store thread when it starts, to create
+		the query workers. A derived class that cannot execute
+		queries outside the data store thread returns NULL.
+	*/
+	virtual DataStoreQueryWorker *_createQueryWorker(unsigned int num) { return NULL; }
+
 #ifdef DEBUG_DATASTORE
 	virtual void _print() {};
 #endif
@@ -382,7 +462,8 @@ public:
 #ifdef DEBUG_LEAKS
 			LeakMonitor(LEAK_TYPE_DATASTORE),
 #endif
-			Runnable(name)
+			Runnable(name), taskBatchSize(DEFAULT_DATASTORE_TASK_BATCH_SIZE), 
+			numQueryWorkers(DEFAULT_DATASTORE_QUERY_WORKERS)
 		{}
         virtual ~DataStore();
 
@@ -395,6 +476,21 @@ public:
 	*/
 	virtual bool init() { return true; }
 
+	/**
+	  Set the maximum number of queued tasks that the data store
+	  thread executes in one batch.
+	*/
+	void setTaskBatchSize(unsigned long size);
+	unsigned long getTaskBatchSize() const { return taskBatchSize; }
+
+	/**
+	  Set the number of worker threads that execute read-only
+	  queries. Must be called before the data store thread is
+	  started. Zero executes all tasks in the data store thread.
+	*/
+	void setNumQueryWorkers(unsigned int num);
+	unsigned int getNumQueryWorkers() const { return numQueryWorkers; }
+
 	// These functions provide the interface to interact with the
 	// DataStore. They wrap the functions in the derived class and
 	// provides thread locking. They interact with the data store
@@ -442,6 +538,14 @@ public:
 	void insertRepository(RepositoryEntryRef re);
 	void readRepository(RepositoryEntryRef re, EventCallback < EventHandler > *callback);
 	void deleteRepository(RepositoryEntryRef re);
+	/**
+	   Build a counting bloomfilter that holds the data objects in the
+	   data store, with room for as many more. The bloomfilter is
+	   returned in a callback, which must delete it.
+
+	   @param callback the callback context to return the bloomfilter to
+	 */
+	void buildBloomfilter(const EventCallback<EventHandler> *callback);
 
 	// Query cancel functions. Returns the number of queries removed, or -1 on error.
 	int cancelDataObjectQueries(const NodeRef& node);
@@ -513,6 +513,10 @@ void DebugManager::onWatchableEvent(const Watchable& wbl)
 				LeakMonitor::reportLeaks();
 				break;
 #endif
+			case 'e':
+				kernel->printEventBatchStatistics();
+				kernel->printEventLatencyStatistics();
+				break;
 			case 'm':
 				kernel->printRegisteredManagers();
 				break;
@@ -555,6 +559,7 @@ void DebugManager::onWatchableEvent(const Watchable& wbl)
 #ifdef DEBUG_DATASTORE
 				printf("d: list data store tables\n");
 #endif
+				printf("e: Event batch and dispatch latency statistics\n");
 				printf("g: list data data objects sent and received\n");
 				printf("i: Interface list\n");
 #ifdef DEBUG_LEAKS
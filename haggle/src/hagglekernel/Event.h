@@ -29,6 +29,7 @@ typedef int EventType;
 #include <haggleutils.h>
 
 #include <libcpphaggle/Heap.h>
+#include <libcpphaggle/TimerWheel.h>
 #include <libcpphaggle/Timeval.h>
 
 #include "DataObject.h"
@@ -276,6 +277,7 @@ protected:
 				delete callback;
 			} else {
 				callbacks[type] = callback;
+				onEventInterestChanged(type);
 				return 0;
 			}
 		}
@@ -285,10 +287,17 @@ protected:
 		if (EVENT_TYPE_PUBLIC(type)) {
 			delete callbacks[type];
 			callbacks[type] = NULL;
+			onEventInterestChanged(type);
 			return 0;
 		}
 		return -1;
 	}
+	/*
+		Called whenever the handler adds or removes its interest in
+		a public event type. Derived classes that need to keep track
+		of their interests, e.g., for dispatching, can override it.
+	*/
+	virtual void onEventInterestChanged(EventType type) {}
 };
 
 /*
@@ -322,11 +331,12 @@ protected:
 	} while(0)
 /** */
 #ifdef DEBUG_LEAKS
-class Event : public LeakMonitor, public HeapItem
+class Event : public LeakMonitor, public HeapItem, public TimerWheelItem
 #else
-class Event : public HeapItem
+class Event : public HeapItem, public TimerWheelItem
 #endif
 {
+	friend class EventQueue;
 private:
         static const char *eventNames[MAX_NUM_EVENT_TYPES];
         static EventCallback<EventHandler> *privCallbacks[MAX_NUM_PRIVATE_EVENT_TYPES];
@@ -335,6 +345,8 @@ private:
 	Timeval timeout;
 	bool scheduled;
 	bool autoDelete;
+	// Link in the event queue's inbox. Set when the event is added.
+	Event *inboxNext;
         const EventCallback<EventHandler> *callback;
         /*
         	Data type contained in events:
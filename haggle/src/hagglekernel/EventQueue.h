@@ -29,9 +29,12 @@ class EventQueue;
 #include <time.h>
 
 #include <libcpphaggle/Platform.h>
+#include <libcpphaggle/Atomic.h>
 #include <libcpphaggle/Heap.h>
+#include <libcpphaggle/List.h>
 #include <libcpphaggle/Thread.h>
 #include <libcpphaggle/Timeval.h>
+#include <libcpphaggle/TimerWheel.h>
 #include <libcpphaggle/Watch.h>
 #include <haggleutils.h>
 
@@ -45,7 +48,16 @@ typedef enum {
 	EQ_EVENT_SHUTDOWN
 } EQEvent_t;
 
-// Locking is provided by a mutex, so the queue should be thread safe
+/*
+	Locking of the heap is provided by a mutex, so the queue should be
+	thread safe. Events that are due immediately do not touch the mutex
+	when added. Instead, they are pushed onto a lock-free inbox, which
+	the kernel thread merges into the heap before it looks at the heap.
+
+	Delayed events are kept in a timer wheel with millisecond ticks
+	until they are due, and are then moved to the heap. This keeps the
+	heap small, and makes it cheap to add and cancel many timers.
+*/
 /** */
 class EventQueue : public Heap
 {
@@ -53,20 +65,94 @@ private:
         Mutex mutex;
         Mutex shutdown_mutex;
         bool shutdownEvent;
+	/*
+		The inbox is a stack of events linked through their inboxNext
+		pointer. Any thread may push an event with a compare-and-swap,
+		but only the kernel thread removes events, and it always takes
+		the whole stack at once. Hence, a push can never see a head
+		that has been removed and pushed again (the ABA problem).
+	 */
+	Event * volatile inbox;
+	TimerWheel wheel;
+	static int64_t getTick(const Timeval& t) { return t.getTimeAsMilliSeconds(); }
+	void insertInHeap(Event *e) {
+		if (!insert(e)) {
+			HAGGLE_ERR("Could not insert event %s in queue\n", e->getName());
+			e->setScheduled(false);
+			
+			if (e->shouldDelete())
+				delete e;
+		}
+	}
+	/*
+		Move the events in the timer wheel that are due at the given
+		time to the heap, or all events if the time is NULL. Must be
+		called with the queue mutex held.
+	 */
+	void advanceWheel(const Timeval *due) {
+		List<TimerWheelItem *> expired;
+		
+		if (wheel.empty())
+			return;
+		
+		if (due)
+			wheel.advance(getTick(*due), expired);
+		else
+			wheel.removeAll(expired);
+		
+		for (List<TimerWheelItem *>::iterator it = expired.begin(); it != expired.end(); it++) {
+			insertInHeap(static_cast<Event *>(*it));
+		}
+	}
+	/*
+		Move all events in the inbox into the heap. Must be called
+		with the queue mutex held.
+	 */
+	void mergeInbox() {
+		Event *e = atomic_swap_ptr(&inbox, (Event *)NULL);
+		Event *fifo = NULL;
+		
+		// Reverse the stack, so that events are inserted in the order they were added
+		while (e) {
+			Event *next = e->inboxNext;
+			e->inboxNext = fifo;
+			fifo = e;
+			e = next;
+		}
+		
+		while (fifo) {
+			e = fifo;
+			fifo = fifo->inboxNext;
+			insertInHeap(e);
+		}
+	}
 protected:
 	Signal signal;
 public:
         EventQueue() : Heap(),
-                       shutdownEvent(false) {}
+                       shutdownEvent(false), inbox(NULL),
+		       wheel(getTick(Timeval::now())) {}
         ~EventQueue() {
                 Event *e;
 
+		mergeInbox();
+		advanceWheel(NULL);
+		
                 while ((e = static_cast<Event *>(extractFirst())))
                         delete e;
         }
 	EQEvent_t hasNextEvent() { 
                 Mutex::AutoLocker l(mutex);		
-                return shutdownEvent ? EQ_EVENT_SHUTDOWN : (empty() ? EQ_EMPTY : EQ_EVENT); 
+		mergeInbox();
+                return shutdownEvent ? EQ_EVENT_SHUTDOWN : (empty() && wheel.empty() ? EQ_EMPTY : EQ_EVENT); 
+	}
+	/**
+		The number of events in the queue, not counting events in
+		the inbox that the kernel has not seen yet.
+	 */
+	unsigned long size() {
+                Mutex::AutoLocker l(mutex);
+		return Heap::size() + wheel.size();
 	}
         EQEvent_t getNextEventTime(Timeval *tv) {
                 Mutex::AutoLocker l(mutex);
@@ -74,7 +160,17 @@ public:
 		if (!tv)
 			return EQ_ERROR;
 
+		/* 
+		 Lower the signal before we merge the inbox. Events pushed
+		 after the merge will raise it again.
+		 */
 		signal.lower();
+		mergeInbox();
+		
+		Timeval now = Timeval::now();
+		int64_t tick;
+		
+		advanceWheel(&now);
 		
                 if (shutdownEvent) {
 			tv->zero();
@@ -82,41 +178,123 @@ public:
 		} else if (!empty()) {
                         *tv = static_cast<Event *>(front())->getTimeout();
                         return EQ_EVENT;
-                }
+                } else if (wheel.getNextExpiry(tick)) {
+			/*
+			 This may be earlier than the first delayed event,
+			 in which case there will be nothing to do at that
+			 time, except to advance the wheel.
+			 */
+			*tv = Timeval((long)(tick / 1000), (long)(tick % 1000) * 1000);
+			return EQ_EVENT;
+		}
                 return EQ_EMPTY;
         }
-        Event *getNextEvent() {
-                Event *e = NULL;
-	
+	/**
+		Move the events that are due from the queue to a list, in
+		the order they are due. All events are moved under a single
+		acquisition of the queue lock. If a shutdown event is pending, it is moved first.
+		
+		The events remain marked as scheduled, so that they are
+		not added to the queue again before they are handled. The
+		caller should clear the mark as it handles each event.
+		
+		@param el the list to add the events to.
+		@param due the time at which events are due, or NULL if all
+		events in the queue should be considered due.
+		@param max the maximum number of events to move, or 0 for
+		no limit.
+		@returns the number of events added to the list.
+	 */
+	unsigned long getNextEvents(List<Event *>& el, const Timeval *due = NULL, unsigned long max = 0) {
+		unsigned long n = 0;
+		
                 synchronized(shutdown_mutex) {
                         if (shutdownEvent) {
                                 shutdownEvent = false;
                                 signal.lower();
-                                return new Event(EVENT_TYPE_SHUTDOWN, 0);
+				el.push_back(new Event(EVENT_TYPE_SHUTDOWN, 0));
+				n++;
                         }
                 }
-
-                mutex.lock();
-                e = static_cast<Event *>(extractFirst());
-		e->setScheduled(false);
-                mutex.unlock();
-
-                return e;
-        }
+		
+                Mutex::AutoLocker l(mutex);
+		
+		mergeInbox();
+		advanceWheel(due);
+		
+		while (!empty() && (max == 0 || n < max)) {
+			Event *e = static_cast<Event *>(front());
+			
+			if (due && e->getTimeout() > *due)
+				break;
+			
+			extractFirst();
+			el.push_back(e);
+			n++;
+		}
+		
+		return n;
+	}
         void enableShutdownEvent() {
                 Mutex::AutoLocker l(shutdown_mutex);
                 shutdownEvent = true;
 		HAGGLE_DBG("Setting shutdown event\n");
 		signal.raise();
         }
+	/**
+		Add an event to the queue. Events that are due already are
+		pushed onto the inbox without taking any lock, except for
+		raising the queue signal when the inbox was empty. Delayed
+		events are inserted in the timer wheel.
+	 */
         void addEvent(Event *e) {
-                Mutex::AutoLocker l(mutex);
+		if (!e)
+			return;
 		
-                if (e && insert(e)) {
+		if (e->getTimeout() <= Timeval::now()) {
+			Event *head;
+			
+			// The kernel may handle the event as soon as it is pushed
 			e->setScheduled(true);
-			signal.raise();
+			
+			do {
+				head = inbox;
+				e->inboxNext = head;
+			} while (!atomic_cas_ptr(&inbox, head, e));
+			
+			/*
+			 Only the thread that made the inbox non-empty needs
+			 to wake up the kernel.
+			 */
+			if (!head)
+				signal.raise();
+			return;
 		}
+		
+                Mutex::AutoLocker l(mutex);
+		
+		wheel.insert(e, getTick(e->getTimeout()));
+		e->setScheduled(true);
+		signal.raise();
         }
+	/**
+		Cancel a delayed event that has not yet become due. The event
+		is not deleted.
+		
+		@returns true if the event was removed from the queue, or
+		false if it was not found among the delayed events (e.g.,
+		because it is about to be handled).
+	 */
+	bool cancelEvent(Event *e) {
+                Mutex::AutoLocker l(mutex);
+		
+		if (!e || !wheel.remove(e))
+			return false;
+		
+		e->setScheduled(false);
+		
+		return true;
+	}
 };
 
 #endif /* _EVENTQUEUE_H */
@@ -156,7 +156,14 @@ ForwardingManager::~ForwardingManager()
 	// Empty the list of forwarded data objects.
 	while (!forwardedObjects.empty()) {
 		HAGGLE_ERR("Clearing unsent data object.\n");
-		forwardedObjects.pop_front();
+		forwardingMap::iterator it = forwardedObjects.begin();
+		removeFromSendList((*it).second);
+	}
+	
+	while (!forwardingQueues.empty()) {
+		forwardingQueueMap::iterator it = forwardingQueues.begin();
+		delete (*it).second;
+		forwardingQueues.erase(it);
 	}
 	if (nodeQueryCallback)
 		delete nodeQueryCallback;
@@ -170,7 +177,8 @@ ForwardingManager::~ForwardingManager()
 	Event::unregisterType(moduleEventType);
 
 	if (periodicDataObjectQueryEvent) {
-		if (periodicDataObjectQueryEvent->isScheduled())
+		if (periodicDataObjectQueryEvent->isScheduled() && 
+		    !kernel->cancelEvent(periodicDataObjectQueryEvent))
 			periodicDataObjectQueryEvent->setAutoDelete(true);
 		else
 			delete periodicDataObjectQueryEvent;
@@ -396,9 +404,24 @@ void ForwardingManager::onDebugCmd(Event *e)
 				forwardingModule->printRoutingTable();
 			else
 				printf("No forwarding module");
+
+			printSendList();
 		}
 	}
 }
+
+void ForwardingManager::printSendList()
+{
+	printf("Send list: %lu data objects in flight\n", (unsigned long)forwardedObjects.size());
+
+	for (forwardingQueueMap::iterator it = forwardingQueues.begin(); it != forwardingQueues.end(); it++) {
+		ForwardingQueue *fq = (*it).second;
+
+		printf("  %s: pending=%lu sent=%lu failed=%lu retried=%lu\n", 
+		       (*it).first.c_str(), (unsigned long)fq->pending.size(), 
+		       fq->num_sent, fq->num_failed, fq->num_retried);
+	}
+}
 #endif
 
 /*
@@ -442,24 +465,110 @@ bool ForwardingManager::isNeighbor(const NodeRef& node)
 bool ForwardingManager::addToSendList(DataObjectRef& dObj, const NodeRef& node, int repeatCount)
 {
  	// Check if the data object/node pair is already in our send list:
-        for (forwardingList::iterator it = forwardedObjects.begin();
-             it != forwardedObjects.end(); it++) {
-                // Is this it?
-                if ((*it).first.first == dObj &&
-                    (*it).first.second == node) {
-                        // Yep. Do not forward this.
-                        HAGGLE_DBG("Data object already in send list for node '%s'\n",
-                                   node->getName().c_str());
-                        return false;
-                }
-        }
-	
+	if (findInSendList(dObj, node)) {
+		// Yep. Do not forward this.
+		HAGGLE_DBG("Data object already in send list for node '%s'\n",
+			   node->getName().c_str());
+		return false;
+	}
+
+	ForwardingQueue *fq = getForwardingQueue(node, true);
+
+	if (!fq)
+		return false;
+
+	// The node may be back
+	fq->gone = false;
+
         // Remember that we tried to send this:
-        forwardedObjects.push_front(Pair< Pair<const DataObjectRef, const NodeRef>,int>(Pair<const DataObjectRef, const NodeRef>(dObj,node), repeatCount));
+	ForwardingRecord *fr = new ForwardingRecord(dObj, node, repeatCount);
+
+	forwardedObjects.insert(make_pair(string(dObj->getIdStr()), fr));
+	fq->pending.push_back(fr);
+
+	if (repeatCount > 0)
+		fq->num_retried++;
         
         return true;
 }
 
+/*
+  Finds the record of a data object that is being sent to a node. The
+  data object id narrows the search down to the nodes the data object
+  is being sent to, which are compared with the node's == operator so
+  that nodes of undefined type match on their interfaces.
+ */
+ForwardingRecord *ForwardingManager::findInSendList(const DataObjectRef& dObj, const NodeRef& node)
+{
+	Pair<forwardingMap::iterator, forwardingMap::iterator> r = 
+		forwardedObjects.equal_range(string(dObj->getIdStr()));
+
+	for (; r.first != r.second; r.first++) {
+		if ((*r.first).second->node == node)
+			return (*r.first).second;
+	}
+
+	return NULL;
+}
+
+void ForwardingManager::removeFromSendList(ForwardingRecord *fr)
+{
+	Pair<forwardingMap::iterator, forwardingMap::iterator> r = 
+		forwardedObjects.equal_range(string(fr->dObj->getIdStr()));
+
+	for (; r.first != r.second; r.first++) {
+		if ((*r.first).second == fr) {
+			forwardedObjects.erase(r.first);
+			break;
+		}
+	}
+
+	forwardingQueueMap::iterator it = forwardingQueues.find(string(fr->node->getIdStr()));
+
+	if (it != forwardingQueues.end()) {
+		ForwardingQueue *fq = (*it).second;
+
+		fq->pending.remove(fr);
+
+		// The node went away, and nothing more is being sent to it
+		if (fq->gone && fq->pending.empty()) {
+			forwardingQueues.erase(it);
+			delete fq;
+		}
+	}
+
+	delete fr;
+}
+
+/*
+  Returns the send queue of a node. Nodes of undefined type have no
+  id, so they share one queue.
+ */
+ForwardingQueue *ForwardingManager::getForwardingQueue(const NodeRef& node, bool create)
+{
+	string id = node->getIdStr();
+	forwardingQueueMap::iterator it = forwardingQueues.find(id);
+
+	if (it != forwardingQueues.end())
+		return (*it).second;
+
+	if (!create)
+		return NULL;
+
+	ForwardingQueue *fq = new ForwardingQueue();
+
+	forwardingQueues.insert(make_pair(id, fq));
+
+	return fq;
+}
+
+size_t ForwardingManager::numPendingSends(const NodeRef& node)
+{
+	ForwardingQueue *fq = getForwardingQueue(node);
+
+	return fq ? fq->pending.size() : 0;
+}
+
 bool ForwardingManager::shouldForward(const DataObjectRef& dObj, const NodeRef& node)
 {
         NodeRef peer;
@@ -559,41 +668,43 @@ void ForwardingManager::onSendDataObjectResult(Event *e)
         HAGGLE_DBG("Checking data object results\n");
 
 	// Find the data object in our send list:
-	for (forwardingList::iterator it = forwardedObjects.begin();
-		it != forwardedObjects.end(); it++) {
-		
-		if ((*it).first.first == dObj && (*it).first.second == node) {
-			if (e->getType() == EVENT_TYPE_DATAOBJECT_SEND_SUCCESSFUL) {
-				// Remove the data object - it has been forwarded.
-				forwardedObjects.erase(it);
-			} else if (e->getType() == EVENT_TYPE_DATAOBJECT_SEND_FAILURE) {
-				int repeatCount;
-				repeatCount = (*it).second + 1;
-				// Remove this from the list. It may be reinserted later.
-				forwardedObjects.erase(it);
-				switch (repeatCount) {
-					case 1:
-						// This was the first attempt. Try resending the 
-						// data object:
-						if (isNeighbor(node) && shouldForward(dObj, node) && addToSendList(dObj, node, repeatCount)) {
-							kernel->addEvent(new Event(EVENT_TYPE_DATAOBJECT_SEND, dObj, node));
-						}
-					break;
-					
-					default:
-						// Do nothing. This object has already failed once 
-						// before - give up.
-					break;
+	ForwardingRecord *fr = findInSendList(dObj, node);
+
+	if (!fr) {
+		HAGGLE_DBG("Data object result done\n");
+		return;
+	}
+
+	ForwardingQueue *fq = getForwardingQueue(fr->node);
+
+	if (e->getType() == EVENT_TYPE_DATAOBJECT_SEND_SUCCESSFUL) {
+		if (fq)
+			fq->num_sent++;
+		// Remove the data object - it has been forwarded.
+		removeFromSendList(fr);
+	} else if (e->getType() == EVENT_TYPE_DATAOBJECT_SEND_FAILURE) {
+		int repeatCount = fr->repeatCount + 1;
+
+		if (fq)
+			fq->num_failed++;
+		// Remove this from the list. It may be reinserted later.
+		removeFromSendList(fr);
+
+		switch (repeatCount) {
+			case 1:
+				// This was the first attempt. Try resending the 
+				// data object:
+				if (isNeighbor(node) && shouldForward(dObj, node) && addToSendList(dObj, node, repeatCount)) {
+					kernel->addEvent(new Event(EVENT_TYPE_DATAOBJECT_SEND, dObj, node));
 				}
-			}
-			// No need to search this list further (the "it" variable is 
-			// garbage anyway...)
-			goto found_it;
+			break;
+			
+			default:
+				// Do nothing. This object has already failed once 
+				// before - give up.
+			break;
 		}
 	}
-
-        HAGGLE_DBG("Data object result done\n");
-found_it:;
 	// Done.
 }
 
@@ -829,6 +940,24 @@ void ForwardingManager::onEndNeighbor(Event *e)
 	// needed
 	kernel->getDataStore()->cancelDataObjectQueries(node);
 
+	// The pending sends are removed when their results arrive
+	HAGGLE_DBG("%s - node %s went away with %lu pending sends\n", 
+		   getName(), node->getName().c_str(), (unsigned long)numPendingSends(node));
+
+	forwardingQueueMap::iterator fit = forwardingQueues.find(string(node->getIdStr()));
+
+	if (fit != forwardingQueues.end()) {
+		ForwardingQueue *fq = (*fit).second;
+
+		// Otherwise the queue goes when the last pending send has its result
+		if (fq->pending.empty()) {
+			forwardingQueues.erase(fit);
+			delete fq;
+		} else {
+			fq->gone = true;
+		}
+	}
+
 	// Also remove from pending query list so that
 	// onDelayedDataObjectQuery won't generate a delayed query
 	// after the node went away
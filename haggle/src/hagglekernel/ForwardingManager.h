@@ -21,9 +21,13 @@
 	remember to add it here.
 */
 class ForwardingManager;
+class ForwardingRecord;
+class ForwardingQueue;
 
 #include <libcpphaggle/List.h>
 #include <libcpphaggle/Pair.h>
+#include <libcpphaggle/String.h>
+#include <libcpphaggle/HashMap.h>
 
 using namespace haggle;
 
@@ -36,7 +40,37 @@ using namespace haggle;
 #define MAX_NODES_TO_FIND_FOR_NEW_DATAOBJECTS	(10)
 #define ENABLE_RECURSIVE_ROUTING_UPDATES 1
 
-typedef List< Pair< Pair<const DataObjectRef, const NodeRef>, int> > forwardingList;
+/*
+	A data object that has been sent to a node, but for which there is
+	no send result yet, and the number of times sending it has failed.
+*/
+class ForwardingRecord {
+public:
+	const DataObjectRef dObj;
+	const NodeRef node;
+	int repeatCount;
+	ForwardingRecord(const DataObjectRef& _dObj, const NodeRef& _node, int _repeatCount) : 
+		dObj(_dObj), node(_node), repeatCount(_repeatCount) {}
+};
+
+/*
+	The records of the sends to a node in the order they were made, and
+	statistics over the sends to the node. A queue is deleted when the
+	node is no longer a neighbor, or when the last pending send to a
+	node that went away has its result.
+*/
+class ForwardingQueue {
+public:
+	List<ForwardingRecord *> pending;
+	unsigned long num_sent;
+	unsigned long num_failed;
+	unsigned long num_retried;
+	bool gone; // The node is no longer a neighbor
+	ForwardingQueue() : num_sent(0), num_failed(0), num_retried(0), gone(false) {}
+};
+
+typedef HashMap<string, ForwardingRecord *> forwardingMap;
+typedef HashMap<string, ForwardingQueue *> forwardingQueueMap;
 
 /** */
 class ForwardingManager : public Manager
@@ -53,7 +87,10 @@ class ForwardingManager : public Manager
 	
 	Event *periodicDataObjectQueryEvent;
 	unsigned long periodicDataObjectQueryInterval;
-	forwardingList forwardedObjects;
+	// The send list, indexed by the id of the data object
+	forwardingMap forwardedObjects;
+	// The send list queued per node, indexed by the id of the node
+	forwardingQueueMap forwardingQueues;
 	Forwarder *forwardingModule;
 	List<NodeRef> pendingQueryList;
 #if defined(ENABLE_RECURSIVE_ROUTING_UPDATES)
@@ -69,6 +106,14 @@ class ForwardingManager : public Manager
         // See comment in ForwardingManager.cpp about isNeighbor()
         bool isNeighbor(const NodeRef& node);
         bool addToSendList(DataObjectRef& dObj, const NodeRef& node, int repeatCount = 0);
+	ForwardingRecord *findInSendList(const DataObjectRef& dObj, const NodeRef& node);
+	void removeFromSendList(ForwardingRecord *fr);
+	ForwardingQueue *getForwardingQueue(const NodeRef& node, bool create = false);
+	/**
+		Returns the number of data objects that are being sent to
+		the given node.
+	*/
+	size_t numPendingSends(const NodeRef& node);
 	/**
 		This function changes out the current forwarding module (initially none)
 		to the given forwarding module.
@@ -110,6 +155,7 @@ class ForwardingManager : public Manager
 	void findMatchingDataObjectsAndTargets(NodeRef& node);
 #ifdef DEBUG
 	void onDebugCmd(Event *e);
+	void printSendList();
 #endif
 #if defined(ENABLE_RECURSIVE_ROUTING_UPDATES)
 	size_t metadataToRecurseList(Metadata *m, NodeRefList& trigger_list);
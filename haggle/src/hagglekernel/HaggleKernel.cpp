@@ -36,8 +36,18 @@ void HaggleKernel::setThisNode(NodeRef &_thisNode)
 
 HaggleKernel::HaggleKernel(DataStore *ds , const string _storagepath) :
 	dataStore(ds), starttime(Timeval::now()), shutdownCalled(false),
-	running(false), storagepath(_storagepath)
+	running(false), eventBatchSize(DEFAULT_EVENT_BATCH_SIZE), 
+	numEventBatches(0), numEventsDispatched(0), maxEventBatch(0), 
+	numEventBatchesCapped(0), dispatchingType(EVENT_TYPE_INVALID), 
+	subscribersDirty(false), storagepath(_storagepath)
 {
+	memset(eventBatchHistogram, 0, sizeof(eventBatchHistogram));
+	memset(eventLatency, 0, sizeof(eventLatency));
+	
+	/*
+	 Add the Signal that is raised whenever something is added to the event queue.
+	 */
+	watchSet.add(signal);
 }
 
 bool HaggleKernel::init()
@@ -171,6 +181,16 @@ int HaggleKernel::registerManager(Manager *m)
 		return -1;
 	}
 
+	/*
+		The manager has most likely set some event handlers
+		already, so pick those up here. Later changes are
+		reported through updateEventInterest().
+	 */
+	for (EventType type = 0; type < MAX_NUM_PUBLIC_EVENT_TYPES; type++) {
+		if (m->getEventInterest(type))
+			addSubscriber(m, type);
+	}
+
 	HAGGLE_DBG("Manager \'%s\' registered\n", m->getName());
 
 	return registry.size();
@@ -181,13 +201,26 @@ int HaggleKernel::unregisterManager(Manager *m)
 	if (!m)
 		return -1;
 	
-	if (registry.erase(m) != 1) {
+	registry_t::iterator it = registry.find(m);
+
+	if (it == registry.end()) {
 		HAGGLE_ERR("Manager \'%s\' not registered\n", m->getName());
 		return 0;
 	}
+	
+	wregistry_t& wr = (*it).second;
+	
+	for (wregistry_t::iterator itt = wr.begin(); itt != wr.end(); itt++) {
+		watchSet.remove((*itt).first);
+	}
+	
+	registry.erase(it);
+
+	for (EventType type = 0; type < MAX_NUM_PUBLIC_EVENT_TYPES; type++) {
+		removeSubscriber(m, type);
+	}
 
 #ifdef DEBUG
-        registry_t::iterator it;
         string registeredManagers;
 	
 	for (it = registry.begin(); it != registry.end(); it++) {
@@ -206,6 +239,53 @@ int HaggleKernel::unregisterManager(Manager *m)
 	return registry.size();
 }
 
+void HaggleKernel::addSubscriber(Manager *m, EventType type)
+{
+	subscriber_list_t& sl = subscribers[type];
+	subscriber_list_t::iterator it = sl.begin();
+	
+	// Keep the list sorted, so that the dispatch order is stable
+	for (; it != sl.end(); it++) {
+		if (*it == m)
+			return;
+		if (*it && m < *it)
+			break;
+	}
+	sl.insert(it, m);
+}
+
+void HaggleKernel::removeSubscriber(Manager *m, EventType type)
+{
+	subscriber_list_t& sl = subscribers[type];
+	
+	if (type != dispatchingType) {
+		sl.remove(m);
+		return;
+	}
+	
+	for (subscriber_list_t::iterator it = sl.begin(); it != sl.end(); it++) {
+		if (*it == m) {
+			*it = NULL;
+			subscribersDirty = true;
+		}
+	}
+}
+
+void HaggleKernel::updateEventInterest(Manager *m, EventType type)
+{
+	if (!m || !EVENT_TYPE_PUBLIC(type))
+		return;
+	
+	// Unregistered managers are picked up when they register
+	if (registry.find(m) == registry.end())
+		return;
+	
+	if (m->getEventInterest(type))
+		addSubscriber(m, type);
+	else
+		removeSubscriber(m, type);
+}
+
 int HaggleKernel::registerWatchable(Watchable wbl, Manager *m)
 {
 	if (!m)
@@ -229,6 +309,12 @@ int HaggleKernel::registerWatchable(Watchable wbl, Manager *m)
                 return -1;
         }
 	
+	if (watchSet.add(wbl, WATCH_STATE_READ, m) < 0) {
+		HAGGLE_ERR("Could not add %s to the kernel watch set\n", wbl.getStr());
+		wr.erase(wbl);
+		return -1;
+	}
+	
 	HAGGLE_DBG("Manager \'%s\' registered %s\n", m->getName(), wbl.getStr());
 
 	return wr.size();
@@ -241,7 +327,8 @@ int HaggleKernel::unregisterWatchable(Watchable wbl)
 	for (it = registry.begin(); it != registry.end(); it++) {
 		wregistry_t& wr = (*it).second;
 		
-		if (wr.erase(wbl) == 1) {			
+		if (wr.erase(wbl) == 1) {
+			watchSet.remove(wbl);
 			HAGGLE_DBG("Manager \'%s\' unregistered %s\n", (*it).first->getName(), wbl.getStr());
 			return wr.size();
 		}
@@ -304,6 +391,53 @@ void HaggleKernel::printRegisteredManagers()
 }
 #endif
 
+#ifdef DEBUG
+void HaggleKernel::printEventBatchStatistics()
+{
+	unsigned long i, low = 1;
+	
+	printf("============= Event batches =================\n");
+	printf("Batch size limit: %lu\n", eventBatchSize);
+	printf("Batches: %lu (%lu reached the limit)\n", numEventBatches, numEventBatchesCapped);
+	printf("Events dispatched: %lu\n", numEventsDispatched);
+	printf("Average batch size: %.2lf\n", numEventBatches ? 
+	       (double)numEventsDispatched / numEventBatches : 0.0);
+	printf("Largest batch: %lu\n", maxEventBatch);
+	
+	for (i = 0; i < EVENT_BATCH_HISTOGRAM_SIZE; i++) {
+		if (i == EVENT_BATCH_HISTOGRAM_SIZE - 1)
+			printf("%5lu-     : %lu\n", low, eventBatchHistogram[i]);
+		else
+			printf("%5lu-%-5lu: %lu\n", low, (low << 1) - 1, eventBatchHistogram[i]);
+		low <<= 1;
+	}
+	printf("=============================================\n");
+}
+
+void HaggleKernel::printEventLatencyStatistics()
+{
+	printf("============= Event dispatch latency ========\n");
+	printf("%-40s %8s %10s %10s  %s\n", "Event", "Count", "Avg(us)", "Max(us)", 
+	       "<10us <100us <1ms <10ms <100ms >=100ms");
+	
+	for (EventType type = 0; type < MAX_NUM_PUBLIC_EVENT_TYPES; type++) {
+		const EventLatencyStats& stats = eventLatency[type];
+		
+		if (stats.count == 0)
+			continue;
+		
+		printf("%-40s %8lu %10.1lf %10lld ", Event::getPublicName(type), stats.count, 
+		       (double)stats.totalUsecs / stats.count, (long long)stats.maxUsecs);
+		
+		for (unsigned int i = 0; i < EVENT_LATENCY_HISTOGRAM_SIZE; i++) {
+			printf(" %lu", stats.histogram[i]);
+		}
+		printf(" (%lu subscribers)\n", subscribers[type].size());
+	}
+	printf("=============================================\n");
+}
+#endif
+
 Manager *HaggleKernel::getManager(char *name)
 {
 	for (registry_t::iterator it = registry.begin(); it != registry.end(); it++) {
@@ -454,6 +588,119 @@ bool HaggleKernel::readStartupDataObjectFile(string cfgObjPath)
 	return ret;
 }
 
+void HaggleKernel::dispatchEvent(Event *e)
+{
+	LOG_ADD("%s: %s\n", Timeval::now().getAsString().c_str(), e->getDescription().c_str());
+	
+	if (e->isPrivate()) {
+		//HAGGLE_DBG("Doing private event callback: %s\n", e->getName());
+		e->doPrivateCallback();
+	} else if (e->isCallback()) {
+		//HAGGLE_DBG("Doing callback\n");
+		e->doCallback();
+	} else {
+		/* 
+		 Loop through the managers that are interested in this
+		 event. Managers that unregister, or remove their interest,
+		 in their event handler are set to NULL in the list until
+		 we are done.
+		 */
+		EventType type = e->getType();
+		subscriber_list_t& sl = subscribers[type];
+		Timeval start = Timeval::now();
+		
+		//HAGGLE_DBG("Doing public event %s\n", e->getName());
+		
+		dispatchingType = type;
+		
+		for (subscriber_list_t::iterator it = sl.begin(); it != sl.end(); it++) {
+			Manager *m = *it;
+			
+			if (!m)
+				continue;
+			
+			EventCallback < EventHandler > *callback = m->getEventInterest(type);
+			
+			if (callback) {
+				(*callback) (e);
+			}
+		}
+		
+		dispatchingType = EVENT_TYPE_INVALID;
+		
+		if (subscribersDirty) {
+			sl.remove(NULL);
+			subscribersDirty = false;
+		}
+		
+		Timeval elapsed = Timeval::now() - start;
+		int64_t usecs = (int64_t)elapsed.getSeconds() * 1000000 + elapsed.getMicroSeconds();
+		EventLatencyStats& stats = eventLatency[type];
+		unsigned int i = 0;
+		
+		stats.count++;
+		stats.totalUsecs += usecs;
+		
+		if (usecs > stats.maxUsecs)
+			stats.maxUsecs = usecs;
+		
+		for (int64_t limit = 10; i < EVENT_LATENCY_HISTOGRAM_SIZE - 1 && usecs >= limit; i++)
+			limit *= 10;
+		
+		stats.histogram[i]++;
+	}
+	
+	/*
+		Delete the event object. This may also delete
+		data associated with the event. Data passed in public events 
+		should be reference counted with the Reference class. Data in
+		private events and callback events may not be reference counted,
+		but the associated event data will not be deleted in that case.
+		It is up to the private handlers to manage that data.
+	 */
+	if (e->shouldDelete())
+		delete e;
+}
+
+unsigned long HaggleKernel::dispatchEvents(bool shutdownmode)
+{
+	List<Event *> events;
+	Timeval now = Timeval::now();
+	unsigned long i, n;
+	
+	/*
+	 In shutdown mode, we do not care about the timeouts of the events,
+	 and process the queue as quickly as we can.
+	 */
+	n = getNextEvents(events, shutdownmode ? NULL : &now, eventBatchSize);
+	
+	if (n == 0)
+		return 0;
+	
+	numEventBatches++;
+	numEventsDispatched += n;
+	
+	if (n > maxEventBatch)
+		maxEventBatch = n;
+	
+	if (n == eventBatchSize)
+		numEventBatchesCapped++;
+	
+	for (i = 0; i < EVENT_BATCH_HISTOGRAM_SIZE - 1 && (n >> (i + 1)); i++)
+		;
+	
+	eventBatchHistogram[i]++;
+	
+	while (!events.empty()) {
+		Event *e = events.front();
+		events.pop_front();
+		e->setScheduled(false);
+		dispatchEvent(e);
+	}
+	
+	return n;
+}
+
 void HaggleKernel::run()
 {
 	bool shutdownmode = false;
@@ -466,21 +713,12 @@ void HaggleKernel::run()
 	readStartupDataObjectFile();
 	
 	while (registry.size()) {
-		Watch w;
 		Timeval now = Timeval::now();
-		int signalIndex, res;
+		int res;
+		unsigned int i;
 		EQEvent_t ee;
 		Timeval timeout, *t = NULL;
-		Event *e = NULL;
 		
-		/*
-		 We make a copy of the registry each time we loop. This is because a manager
-		 can unregister sockets, or itself, in the event (or socket) it processes.
-		 Therefore, if we'd use the original registry, it might become inconsistent as 
-		 we iterate it in the event loop.
-		 */
-		registry_t reg = registry;
-
 		/* 
 		   Get the time until the next event and check the status of
 		   the event.
@@ -521,104 +759,54 @@ void HaggleKernel::run()
 		}
 		
 		/*
-			Iterate through the registered sockets and add them to our Watch. The registry
-			does not require locking, as only managers and manager modules running 
-			in the same thread as the kernel may register sockets. Modules running
-			in separate threads do not need to register sockets, as they can easily 
-			implement their own run-loop.
-		 
+			Wait on the registered watchables and the event queue
+			signal. The watch set is kept up to date by
+			registerWatchable() and unregisterWatchable(), so
+			there is no need to rebuild it here. The registry
+			does not require locking, as only managers and
+			manager modules running in the same thread as the
+			kernel may register sockets. Modules running in
+			separate threads do not need to register sockets, as
+			they can easily implement their own run-loop.
 		 */
-		registry_t::iterator it = reg.begin();
-		
-		for (; it != reg.end(); it++) {
-			wregistry_t& wr = (*it).second;
-			wregistry_t::iterator itt = wr.begin();
-			for (; itt != wr.end(); itt++) {
-				(*itt).second = w.add((*itt).first);
-				//HAGGLE_DBG("watchable %s added to watch with index %d\n", (*itt).first.getStr(), (*itt).second);
-			}
-		}
-		
-		/*
-		 Add the Signal that is raised whenever something is added to the event queue.
-		 */
-		signalIndex = w.add(signal);
-				
 		//HAGGLE_DBG("Waiting on kernel watch with timeout %s\n", t ? t->getAsString().c_str() : "INFINATE");
 		
-		res = w.wait(t);
+		res = watchSet.wait(t);
 		
-		if (res == Watch::TIMEOUT) {
-			// Timeout occurred -> Process event from EventQueue
-			e = getNextEvent();
-
-                        LOG_ADD("%s: %s\n", Timeval::now().getAsString().c_str(), e->getDescription().c_str());
-			
-			if (e->isPrivate()) {
-				//HAGGLE_DBG("Doing private event callback: %s\n", e->getName());
-				e->doPrivateCallback();
-			} else if (e->isCallback()) {
-				//HAGGLE_DBG("Doing callback\n");
-				e->doCallback();
-			} else {
-				/* 
-				 Loop through all registered managers and check whether they are 
-				 interested in this event.
-				 */
-				registry_t::iterator it = reg.begin();
-				
-				//HAGGLE_DBG("Doing public event %s\n", e->getName());
-				
-				for (; it != reg.end(); it++) {
-					Manager *m = (*it).first;
-					EventCallback < EventHandler > *callback = m->getEventInterest(e->getType());
-					if (callback) {
-						(*callback) (e);
-					}
-				}
-			}
-			
-			/*
-				Delete the event object. This may also delete
-				data associated with the event. Data passed in public events 
-				should be reference counted with the Reference class. Data in
-				private events and callback events may not be reference counted,
-				but the associated event data will not be deleted in that case.
-				It is up to the private handlers to manage that data.
-			 */
-			if (e->shouldDelete())
-				delete e;
-		} else if (res == Watch::FAILED) {
+		if (res == Watch::FAILED) {
 			HAGGLE_ERR("Main run-loop error on Watch : %s\n", STRERROR(ERRNO));
 			continue;
 		}
 		
-		//HAGGLE_DBG("%d objects are set\n", res);
-		
-		if (w.isSet(signalIndex)) {
-			/* Something was added to the queue. We do not
-			   need to do anyting here as this signal is
-			   only a trigger for us to check the queue
-			   again. */  
-
-			//HAGGLE_DBG("Queue signal was set\n");
-		}
-		// Check and handle readable watchables. 
-		it = reg.begin();
+		/*
+		   Dispatch the events that are due. At most eventBatchSize
+		   events are dispatched before we check the watchables
+		   again, so that a busy event queue does not starve them.
+		 */
+		if (ee == EQ_EVENT || ee == EQ_EVENT_SHUTDOWN)
+			dispatchEvents(shutdownmode);
 		
-		for (; it != reg.end(); it++) {
-			Manager *m = (*it).first;
-			wregistry_t& wr = (*it).second;
-			wregistry_t::iterator itt = wr.begin();
+		/* 
+		   Check and handle set watchables. The event queue signal
+		   has no manager associated with it. It does not need
+		   handling here, as it is only a trigger for us to check
+		   the queue again.
+		   
+		   A manager may unregister watchables in its callback,
+		   in which case the watch set reports them as NULL.
+		*/
+		for (i = 0; i < watchSet.getNumSet(); i++) {
+			const Watchable *wbl = watchSet.getSetObject(i);
+			Manager *m = static_cast<Manager *>(watchSet.getSetData(i));
 			
-			for (; itt != wr.end(); itt++) {				
-				//HAGGLE_DBG("Checking if watchable %s with watch index %d is set\n", (*itt).first.getStr(), (*itt).second);
-
-				if (w.isSet((*itt).second)) {
-					//HAGGLE_DBG("Watchable %s with watch index %d is set\n", (*itt).first.getStr(), (*itt).second);
-					m->onWatchableEvent((*itt).first);
-				}
-			}
+			if (!wbl || !m)
+				continue;
+			
+			//HAGGLE_DBG("Watchable %s is set\n", wbl->getStr());
+			
+			// Make a copy, as the watchable may be removed from the 
+			// watch set in the callback
+			m->onWatchableEvent(Watchable(*wbl));
 		}
 	}
 	HAGGLE_DBG("Kernel exits from main loop\n");
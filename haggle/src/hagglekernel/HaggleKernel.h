@@ -46,6 +46,12 @@ using namespace haggle;
 #include "Utility.h"
 #include "Policy.h"
 
+/*
+	The default maximum number of events that the kernel dispatches
+	from its event queue before it checks registered watchables again.
+*/
+#define DEFAULT_EVENT_BATCH_SIZE 50
+
 /** 
 	HaggleKernel:
  
@@ -68,6 +74,64 @@ class HaggleKernel : public EventQueue
 	typedef Map<Watchable, int> wregistry_t;
 	typedef Map<Manager *, wregistry_t> registry_t;
 	registry_t registry;
+	/*
+	 The persistent set of watchables that the kernel waits on in
+	 its run-loop. It is updated as watchables are registered and
+	 unregistered, and the data pointer of each watchable is the
+	 manager that registered it.
+	 */
+	WatchSet watchSet;
+	/*
+	 The maximum number of events dispatched in one batch, before
+	 the kernel checks the watchables again. This bounds the time
+	 that sockets have to wait when the event queue is busy.
+	 */
+	unsigned long eventBatchSize;
+	/*
+	 Statistics on the event batches dispatched in the run-loop.
+	 The histogram counts batches in buckets of power of two
+	 sizes, i.e., 1, 2-3, 4-7, 8-15, etc.
+	 */
+#define EVENT_BATCH_HISTOGRAM_SIZE 8
+	unsigned long numEventBatches;
+	unsigned long numEventsDispatched;
+	unsigned long maxEventBatch;
+	unsigned long numEventBatchesCapped;
+	unsigned long eventBatchHistogram[EVENT_BATCH_HISTOGRAM_SIZE];
+	/*
+	 For each public event type, the list of registered managers
+	 that have an interest in the type. This allows the kernel to
+	 dispatch a public event only to its subscribers, instead of
+	 asking every registered manager. The lists are kept in the
+	 same order as the registry.
+	 
+	 A manager that loses its interest in the type currently being
+	 dispatched (e.g., because it unregisters in its handler) is
+	 only set to NULL in the list, and the list is purged once the
+	 dispatch is done.
+	 */
+	typedef List<Manager *> subscriber_list_t;
+	subscriber_list_t subscribers[MAX_NUM_PUBLIC_EVENT_TYPES];
+	EventType dispatchingType;
+	bool subscribersDirty;
+	void addSubscriber(Manager *m, EventType type);
+	void removeSubscriber(Manager *m, EventType type);
+	/*
+	 Dispatch latency statistics for each public event type, i.e.,
+	 the time it takes for all subscribers to handle an event. The
+	 histogram counts events in buckets of power of ten
+	 microseconds, i.e., 0-9us, 10-99us, 100-999us, etc.
+	 */
+#define EVENT_LATENCY_HISTOGRAM_SIZE 6
+	struct EventLatencyStats {
+		unsigned long count;
+		int64_t totalUsecs;
+		int64_t maxUsecs;
+		unsigned long histogram[EVENT_LATENCY_HISTOGRAM_SIZE];
+	};
+	EventLatencyStats eventLatency[MAX_NUM_PUBLIC_EVENT_TYPES];
+	void dispatchEvent(Event *e);
+	unsigned long dispatchEvents(bool shutdownmode);
 	const string storagepath; // Path to where we can write files, etc.
 	void closeAllSockets();
 	
@@ -114,6 +178,13 @@ public:
 		the kernel, and -1 on failure.
 	 */
         int unregisterManager(Manager *m);
+	/**
+		Update the kernel's dispatch table after a registered manager
+		has added or removed its interest in a public event type. This
+		is called automatically when managers set or remove event
+		handlers.
+	 */
+	void updateEventInterest(Manager *m, EventType type);
 	/**
 		Register a watchable with the kernel. This allows a manager to run
 		in the same thread as the kernel and still be able to watch, e.g.,
@@ -175,8 +246,19 @@ public:
 	
 	Timeval getStartTime() const { return starttime; }
 	
+	/**
+		Set the maximum number of events that the kernel dispatches
+		from the event queue before it checks registered watchables
+		again. A batch size of 1 makes the kernel check watchables
+		between every event. Zero is not a valid batch size.
+	 */
+	void setEventBatchSize(unsigned long size) { if (size > 0) eventBatchSize = size; }
+	unsigned long getEventBatchSize() const { return eventBatchSize; }
+	
 #ifdef DEBUG
 	void printRegisteredManagers();
+	void printEventBatchStatistics();
+	void printEventLatencyStatistics();
 #endif
 	/**
 	 
@@ -372,6 +372,56 @@ Metadata *Interface::toMetadata() const
 	return m;
 }
 
+size_t Interface::identifierLen(Type_t type, const void *identifier)
+{
+	switch (type) {
+	case TYPE_APPLICATION_PORT:
+		return sizeof(unsigned short);
+	case TYPE_APPLICATION_LOCAL:
+		return strlen(static_cast<const char *>(identifier));
+	case TYPE_ETHERNET:
+		return ETH_MAC_LEN;
+	case TYPE_WIFI:
+		return ETH_MAC_LEN;
+	case TYPE_BLUETOOTH:
+		return BT_MAC_LEN;
+	case TYPE_MEDIA:
+		return strlen(static_cast<const char *>(identifier));
+	default:
+		break;
+	}
+	return 0;
+}
+
+/* The "One-at-a-Time" hash, as hash_cstr() in libcpphaggle */
+static unsigned long identifier_hash(Interface::Type_t type, const unsigned char *identifier, size_t len)
+{
+	unsigned long hash = type;
+
+	for (size_t i = 0; identifier && i < len; i++) {
+		hash += identifier[i];
+		hash += (hash << 10);
+		hash ^= (hash >> 6);
+	}
+	hash += (hash << 3);
+	hash ^= (hash >> 11);
+
+	return hash + (hash << 15);
+}
+
+unsigned long Interface::hash() const
+{
+	return identifier_hash(type, identifier, identifier_len);
+}
+
+unsigned long Interface::hash(Type_t type, const unsigned char *identifier)
+{
+	if (!identifier)
+		return identifier_hash(type, NULL, 0);
+
+	return identifier_hash(type, identifier, identifierLen(type, identifier));
+}
+
 bool Interface::equal(const Interface::Type_t type, const unsigned char *identifier) const
 {
 	if (type != this->type)
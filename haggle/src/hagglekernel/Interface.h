@@ -60,9 +60,9 @@ using namespace haggle;
 	This is the class that keeps interface information. 
  */
 #ifdef DEBUG_LEAKS
-class Interface : public LeakMonitor
+class Interface : public LeakMonitor, public Refcountable
 #else
-class Interface
+class Interface : public Refcountable
 #endif
 {
 public:
@@ -158,6 +158,20 @@ public:
 		Gets the identifier as a human readable C-string.
 	*/
 	const char *getIdentifierStr() const { return identifier_str.c_str(); }
+	/**
+		Gets the length of the identifier of an interface of the given 
+		type, or zero if the type is unknown.
+	*/
+	static size_t identifierLen(Type_t type, const void *identifier);
+	/**
+		Gets a hash of the type and identifier, which is the same for 
+		all interfaces that are equal.
+	*/
+	unsigned long hash() const;
+	/**
+		Gets the hash of an interface with the given type and identifier.
+	*/
+	static unsigned long hash(Type_t type, const unsigned char *identifier);
 	
 	/**
 		Gets the flags as a human readable C-string.
@@ -409,34 +423,11 @@ typedef ReferenceList<Interface> InterfaceRefList;
 template<typename T>
 inline T *Interface::create(const void *identifier, const char *name, flag_t flags)
 {
-	size_t identifier_len = 0;
+	size_t identifier_len = identifierLen(T::class_type, identifier);
 	
 	if (!name)
 		name = DEFAULT_INTERFACE_NAME;
 
-	switch (T::class_type) {
-	case TYPE_APPLICATION_PORT:
-		identifier_len = sizeof(unsigned short);
-		break;
-	case TYPE_APPLICATION_LOCAL:
-		identifier_len = strlen(static_cast<const char *>(identifier));
-		break;
-	case TYPE_ETHERNET:
-		identifier_len = ETH_MAC_LEN;
-		break;
-	case TYPE_WIFI:
-		identifier_len = ETH_MAC_LEN;
-		break;
-	case TYPE_BLUETOOTH:
-		identifier_len = BT_MAC_LEN;
-		break;
-	case TYPE_MEDIA:
-		identifier_len = strlen(static_cast<const char *>(identifier));
-		break;
-	default:
-		return NULL;
-	}
-
 	return new T(identifier, identifier_len, name, flags);
 }
 
@@ -33,31 +33,117 @@ InterfaceStore::~InterfaceStore()
 	HAGGLE_DBG("Deleted %d interface records in interface store\n", n);
 }
 
-InterfaceStore::size_type InterfaceStore::remove_children(const InterfaceRef &parent, InterfaceRefList *ifl)
+void InterfaceStore::_add(InterfaceRecord *ir)
 {
-	InterfaceStore::iterator it = begin();
-	InterfaceRefList children;
-        int removed = 0;
+	push_back(ir);
+	ids.insert(make_pair(ir->iface->hash(), ir));
 
-	while (it != end()) {
-		InterfaceRecord *ir = *it;
+	if (ir->parent)
+		children.insert(make_pair(ir->parent.getObj(), ir));
+}
 
-		if (ir->parent && ir->parent == parent) {
-                        if (ifl)
-                                ifl->add(ir->iface);
+/*
+	Removes the given record from the list and the indexes. The record
+	is deleted, so the caller should hold a reference to the interface 
+	if it is still needed.
+*/
+void InterfaceStore::_remove(InterfaceRecord *ir)
+{
+	Pair<HashMap<unsigned long, InterfaceRecord *>::iterator, HashMap<unsigned long, InterfaceRecord *>::iterator> r = 
+		ids.equal_range(ir->iface->hash());
 
-			ir->iface->resetFlag(IFFLAG_STORED);
-			children.push_front(ir->iface);
-			it = erase(it);
-			delete ir;
-                        removed++;
-			continue;
+	for (; r.first != r.second; r.first++) {
+		if ((*r.first).second == ir) {
+			ids.erase(r.first);
+			break;
 		}
-		it++;
 	}
-	
-	while (!children.empty()) {
-		removed += remove_children(children.pop(), ifl);
+
+	_setParent(ir, NULL);
+
+	List<InterfaceRecord *>::remove(ir);
+	ir->iface->resetFlag(IFFLAG_STORED);
+	delete ir;
+}
+
+void InterfaceStore::_setParent(InterfaceRecord *ir, const InterfaceRef &parent)
+{
+	if (ir->parent) {
+		Pair<HashMap<const Interface *, InterfaceRecord *>::iterator, HashMap<const Interface *, InterfaceRecord *>::iterator> r = 
+			children.equal_range(ir->parent.getObj());
+
+		for (; r.first != r.second; r.first++) {
+			if ((*r.first).second == ir) {
+				children.erase(r.first);
+				break;
+			}
+		}
+	}
+
+	ir->parent = parent;
+
+	if (ir->parent)
+		children.insert(make_pair(ir->parent.getObj(), ir));
+}
+
+InterfaceRecord *InterfaceStore::_retrieve(const Interface &iface)
+{
+	Pair<HashMap<unsigned long, InterfaceRecord *>::iterator, HashMap<unsigned long, InterfaceRecord *>::iterator> r = 
+		ids.equal_range(iface.hash());
+
+	for (; r.first != r.second; r.first++) {
+		InterfaceRecord *ir = (*r.first).second;
+
+		if (ir->iface == iface)
+			return ir;
+	}
+
+	return NULL;
+}
+
+InterfaceRecord *InterfaceStore::_retrieve(Interface::Type_t type, const unsigned char *identifier)
+{
+	Pair<HashMap<unsigned long, InterfaceRecord *>::iterator, HashMap<unsigned long, InterfaceRecord *>::iterator> r = 
+		ids.equal_range(Interface::hash(type, identifier));
+
+	for (; r.first != r.second; r.first++) {
+		InterfaceRecord *ir = (*r.first).second;
+
+		if (ir->iface->equal(type, identifier))
+			return ir;
+	}
+
+	return NULL;
+}
+
+/*
+	The parent must be the reference to the interface in the store.
+*/
+InterfaceStore::size_type InterfaceStore::remove_children(const InterfaceRef &parent, InterfaceRefList *ifl)
+{
+	List<InterfaceRecord *> records;
+        size_type removed = 0;
+
+	if (!parent)
+		return 0;
+
+	Pair<HashMap<const Interface *, InterfaceRecord *>::iterator, HashMap<const Interface *, InterfaceRecord *>::iterator> r = 
+		children.equal_range(parent.getObj());
+
+	for (; r.first != r.second; r.first++)
+		records.push_back((*r.first).second);
+
+	while (!records.empty()) {
+		InterfaceRecord *ir = records.front();
+		InterfaceRef iface = ir->iface;
+
+		records.pop_front();
+
+		if (ifl)
+			ifl->add(iface);
+
+		_remove(ir);
+		removed += remove_children(iface, ifl) + 1;
 	}
 	
 	return removed;
@@ -65,50 +151,29 @@ InterfaceStore::size_type InterfaceStore::remove_children(const InterfaceRef &pa
 
 bool InterfaceStore::stored(const Interface &iface)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
 	
-	for (InterfaceStore::iterator it = begin(); it != end(); it++) {
-		InterfaceRecord *ir = *it;
-
-		if (ir->iface == iface) 
-			return true;
-	}
-
-	return false;
+	return _retrieve(iface) != NULL;
 }
 
 bool InterfaceStore::stored(const InterfaceRef &iface)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
 
 	if (!iface)
 		return false;
 	
-	for (InterfaceStore::iterator it = begin(); it != end(); it++) {
-		InterfaceRecord *ir = *it;
-
-		if (ir->iface == iface)
-			return true;
-	}
-
-	return false;
+	return _retrieve(*iface.getObj()) != NULL;
 }
 
 bool InterfaceStore::stored(Interface::Type_t type, const unsigned char *identifier)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
 
 	if (!identifier)
 		return false;
 	
-	for (InterfaceStore::iterator it = begin(); it != end(); it++) {
-		InterfaceRecord *ir = *it;
-
-		if (ir->iface->equal(type, identifier))
-			return true;
-	}
-
-	return false;
+	return _retrieve(type, identifier) != NULL;
 }
 
 InterfaceRef InterfaceStore::addupdate(InterfaceRef &iface, const InterfaceRef& parent, ConnectivityInterfacePolicy *policy, bool *was_added)
@@ -131,32 +196,28 @@ InterfaceRef InterfaceStore::addupdate(InterfaceRef &iface, const InterfaceRef&
 			return NULL;
 	}
 	
-        Mutex::AutoLocker l(mutex);
-
-	for (InterfaceStore::iterator it = begin(); it != end(); it++) {
-		InterfaceRecord *ir = *it;
-		InterfaceRef& ifaceStore = ir->iface;
-
-		if (ir->iface == iface) {
-			if (ir->cip) 
-				delete ir->cip;
-			
-			ir->cip = policy;
-			
-			if (ir->iface->isSnooped()) {
-				ir->iface->resetFlag(IFFLAG_SNOOPED);
-				ir->parent = parentStore;
-			}
+	RWMutex::WriteLocker l(mutex);
 
-			if (ir->cip) 
-				ir->cip->update();
+	InterfaceRecord *ir = _retrieve(*iface.getObj());
 
-			return ifaceStore;
+	if (ir) {
+		if (ir->cip) 
+			delete ir->cip;
+		
+		ir->cip = policy;
+		
+		if (ir->iface->isSnooped()) {
+			ir->iface->resetFlag(IFFLAG_SNOOPED);
+			_setParent(ir, parentStore);
 		}
+
+		if (ir->cip) 
+			ir->cip->update();
+
+		return ir->iface;
 	}
 
-	InterfaceRecord *ir = new InterfaceRecord(iface, parentStore, policy);
-	push_back(ir);
+	_add(new InterfaceRecord(iface, parentStore, policy));
 	
 	if (was_added) {
 		iface->setFlag(IFFLAG_STORED);
@@ -180,34 +241,30 @@ InterfaceRef InterfaceStore::addupdate(Interface *iface, const InterfaceRef &par
 	if (parent)
 		parentRef = retrieve(parent);
 
-        Mutex::AutoLocker l(mutex);
-
-	for (InterfaceStore::iterator it = begin(); it != end(); it++) {
-		InterfaceRecord *ir = *it;
-		InterfaceRef& ifaceInStore = ir->iface;
-
-		if (ir->iface == *iface) {
-			if (ir->cip) 
-				delete ir->cip;
-			
-			ir->cip = policy;
-			
-			if (ir->iface->isSnooped()) {
-				ir->iface->resetFlag(IFFLAG_SNOOPED);
-				ir->parent = parentRef;
-			}
+	RWMutex::WriteLocker l(mutex);
 
-			if (ir->cip) 
-				ir->cip->update();
+	InterfaceRecord *ir = _retrieve(*iface);
 
-			return ifaceInStore;
+	if (ir) {
+		if (ir->cip) 
+			delete ir->cip;
+		
+		ir->cip = policy;
+		
+		if (ir->iface->isSnooped()) {
+			ir->iface->resetFlag(IFFLAG_SNOOPED);
+			_setParent(ir, parentRef);
 		}
+
+		if (ir->cip) 
+			ir->cip->update();
+
+		return ir->iface;
 	}
 
 	InterfaceRef ifaceRef = iface->copy();
 	ifaceRef->setFlag(IFFLAG_STORED);
-	InterfaceRecord *ir = new InterfaceRecord(ifaceRef, parentRef, policy);
-	push_back(ir);
+	_add(new InterfaceRecord(ifaceRef, parentRef, policy));
 	
 	if (was_added)
 		*was_added = true;
@@ -235,33 +292,29 @@ InterfaceRef InterfaceStore::addupdate(Interface *iface, const Interface *parent
 			return NULL;
 	}
 
-        Mutex::AutoLocker l(mutex);
+	RWMutex::WriteLocker l(mutex);
 
-	for (InterfaceStore::iterator it = begin(); it != end(); it++) {
-		InterfaceRecord *ir = *it;
-		InterfaceRef& ifaceStore = ir->iface;
-
-		if (ir->iface == *iface) {
-			if (ir->cip) 
-				delete ir->cip;
-			
-			ir->cip = policy;
-			
-			if (ir->iface->isSnooped()) {
-				ir->iface->resetFlag(IFFLAG_SNOOPED);
-				ir->parent = parentStore;
-			}
-
-			if (ir->cip) 
-				ir->cip->update();
+	InterfaceRecord *ir = _retrieve(*iface);
 
-			return ifaceStore;
+	if (ir) {
+		if (ir->cip) 
+			delete ir->cip;
+		
+		ir->cip = policy;
+		
+		if (ir->iface->isSnooped()) {
+			ir->iface->resetFlag(IFFLAG_SNOOPED);
+			_setParent(ir, parentStore);
 		}
+
+		if (ir->cip) 
+			ir->cip->update();
+
+		return ir->iface;
 	}
 
 	InterfaceRef ifaceRef = iface->copy();
-	InterfaceRecord *ir = new InterfaceRecord(ifaceRef, parentStore, policy);
-	push_back(ir);
+	_add(new InterfaceRecord(ifaceRef, parentStore, policy));
 	
 	if (was_added) {
 		ifaceRef->setFlag(IFFLAG_STORED);
@@ -273,41 +326,34 @@ InterfaceRef InterfaceStore::addupdate(Interface *iface, const Interface *parent
 
 InterfaceRef InterfaceStore::retrieve(const InterfaceRef &iface)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
 
 	if (!iface)
 		return NULL;
 	
-	for (InterfaceStore::iterator it = begin(); it != end(); it++) {
-		InterfaceRecord *ir = *it;
-		InterfaceRef &ifaceStore = ir->iface;
+	InterfaceRecord *ir = _retrieve(*iface.getObj());
 
-		if (ifaceStore == iface)
-			return ifaceStore;
-	}
+	if (!ir)
+		return NULL;
 
-	return NULL;
+	return ir->iface;
 }
 
 InterfaceRef InterfaceStore::retrieve(const Interface &iface)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
 	
-	for (InterfaceStore::iterator it = begin(); it != end(); it++) {
-		InterfaceRecord *ir = *it;
-		InterfaceRef &ifaceRef = ir->iface;
+	InterfaceRecord *ir = _retrieve(iface);
 
-		if (ifaceRef == iface) {
-			return ifaceRef;
-		}
-	}
+	if (!ir)
+		return NULL;
 
-	return NULL;
+	return ir->iface;
 }
 
 InterfaceRef InterfaceStore::retrieve(const Address &add)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
 	
 	for (InterfaceStore::iterator it = begin(); it != end(); it++) {
 		InterfaceRecord *ir = *it;
@@ -323,25 +369,37 @@ InterfaceRef InterfaceStore::retrieve(const Address &add)
 
 InterfaceRef InterfaceStore::retrieve(Interface::Type_t type, const unsigned char *identifier)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
 
 	if (!identifier)
 		return NULL;
 	
-	for (InterfaceStore::iterator it = begin(); it != end(); it++) {
-		InterfaceRecord *ir = *it;
-		InterfaceRef &iface = ir->iface;
+	InterfaceRecord *ir = _retrieve(type, identifier);
 
-		if (iface->equal(type, identifier)) 
-			return iface;
-	}
+	if (!ir)
+		return NULL;
 
-	return NULL;
+	return ir->iface;
 }
 
-InterfaceStore::size_type InterfaceStore::retrieve(const Criteria crit, InterfaceRefList& ifl)
+InterfaceRef InterfaceStore::retrieveParent(const InterfaceRef &iface)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
+
+	if (!iface)
+		return NULL;
+	
+	InterfaceRecord *ir = _retrieve(*iface.getObj());
+
+	if (!ir)
+		return NULL;
+
+	return ir->parent;
+}
+
+InterfaceStore::size_type InterfaceStore::retrieve(const Criteria& crit, InterfaceRefList& ifl)
+{
+	RWMutex::ReadLocker l(mutex);
         size_type n = 0;
 
 	for (InterfaceStore::iterator it = begin(); it != end(); it++) {
@@ -358,36 +416,29 @@ InterfaceStore::size_type InterfaceStore::retrieve(const Criteria crit, Interfac
 
 InterfaceStore::size_type InterfaceStore::remove(const string name, InterfaceRefList *ifl)
 {
-        Mutex::AutoLocker l(mutex);
-        size_type removed = 0;
-
-	InterfaceStore::iterator it = begin();
+	RWMutex::WriteLocker l(mutex);
 
-	while (it != end()) {
+	for (InterfaceStore::iterator it = begin(); it != end(); it++) {
 		InterfaceRecord *ir = *it;
 		
 		if (ir->iface->getName() == name) {	
-			it = erase(it);	
+			InterfaceRef iface = ir->iface;
                       
                         if (ifl)
-                                ifl->add(ir->iface);
+                                ifl->add(iface);
 
-			removed += remove_children(ir->iface, ifl) + 1;
+			_remove(ir);
 
-			ir->iface->resetFlag(IFFLAG_STORED);
-			delete ir;
-			return removed;
+			return remove_children(iface, ifl) + 1;
 		}
-		it++;
 	}
 	
-	return removed;
+	return 0;
 }
 
 InterfaceStore::size_type InterfaceStore::remove(const Interface *iface, InterfaceRefList *ifl)
 {
-        Mutex::AutoLocker l(mutex);
-        size_type removed = 0;
+	RWMutex::WriteLocker l(mutex);
 
 	if (!iface) {
 		// This must be a request to remove children discovered by 
@@ -395,244 +446,174 @@ InterfaceStore::size_type InterfaceStore::remove(const Interface *iface, Interfa
 		return remove_children(NULL, ifl);
 	}
 
-	InterfaceStore::iterator it = begin();
+	InterfaceRecord *ir = _retrieve(*iface);
 
-	while (it != end()) {
-		InterfaceRecord *ir = *it;
-		
-		if (ir->iface == *iface) {			
-			it = erase(it);	
+	if (!ir)
+		return 0;
 
-			if (ifl)
-                                ifl->add(ir->iface);
+	InterfaceRef ifaceStore = ir->iface;
 
-			removed += remove_children(ir->iface, ifl) + 1;
+	if (ifl)
+		ifl->add(ifaceStore);
 
-			ir->iface->resetFlag(IFFLAG_STORED);
-			delete ir;
-			return removed;
-		}
-		it++;
-	}
+	_remove(ir);
 
-	return removed;
+	return remove_children(ifaceStore, ifl) + 1;
 }
 
 InterfaceStore::size_type InterfaceStore::remove(const InterfaceRef &iface, InterfaceRefList *ifl)
 {
-        Mutex::AutoLocker l(mutex);
-        size_type removed = 0;
-
 	if (!iface) {
+		RWMutex::WriteLocker l(mutex);
+
 		// This must be a request to remove children discovered by 
 		// a local connectivity, i.e., local interfaces.
 		return remove_children(iface, ifl);
 	}
 
-	InterfaceStore::iterator it = begin();
-
-	while (it != end()) {
-		InterfaceRecord *ir = *it;
-		
-		if (ir->iface == iface) {	
-			it = erase(it);	
-
-                        if (ifl)
-                                ifl->add(ir->iface);
-
-			removed += remove_children(ir->iface, ifl) + 1;
-
-			ir->iface->resetFlag(IFFLAG_STORED);
-			delete ir;
-			return removed;
-		}
-		it++;
-	}
-
-	return removed;
+	return remove(iface.getObj(), ifl);
 }
 
 InterfaceStore::size_type InterfaceStore::remove(Interface::Type_t type, const unsigned char *identifier, InterfaceRefList *ifl)
 {
-        Mutex::AutoLocker l(mutex);
-        size_type removed = 0;
+	RWMutex::WriteLocker l(mutex);
 
 	if (!identifier) {
 		// This must be a request to remove children discovered by 
 		// a local connectivity, i.e., local interfaces.
 		return remove_children(NULL, ifl);
 	}
-	InterfaceStore::iterator it = begin();
 
-	while (it != end()) {
-		InterfaceRecord *ir = *it;
-		
-		if (ir->iface->equal(type, identifier)) {
-			it = erase(it);	
+	InterfaceRecord *ir = _retrieve(type, identifier);
 
-			removed += remove_children(ir->iface, ifl) + 1;
+	if (!ir)
+		return 0;
 
-                        if (ifl)
-                                ifl->add(ir->iface);
+	InterfaceRef ifaceStore = ir->iface;
 
-			ir->iface->resetFlag(IFFLAG_STORED);
-			delete ir;
-			return removed;
-		}
-		it++;
-	}
+	_remove(ir);
+
+	size_type removed = remove_children(ifaceStore, ifl) + 1;
+
+	if (ifl)
+		ifl->add(ifaceStore);
 
 	return removed;
 }
 
-InterfaceStore::size_type InterfaceStore::age(const Interface *parent, InterfaceRefList *ifl, Timeval *lifetime)
+/*
+	Ages the interfaces discovered on the given parent, which must be the 
+	reference to the interface in the store, or the local interfaces if 
+	there is no parent.
+*/
+InterfaceStore::size_type InterfaceStore::_age(const InterfaceRef &parent, InterfaceRefList *ifl, Timeval *lifetime)
 {
-        Mutex::AutoLocker l(mutex);
-	InterfaceRefList children;
+	List<InterfaceRecord *> records;
+	InterfaceRefList dead;
         size_type removed = 0;
 	
 	// Initialize the lifetime to an "invalid" number
 	if (lifetime)
 		*lifetime = Timeval(-1);
 
-	InterfaceStore::iterator it = begin();
+	if (parent) {
+		Pair<HashMap<const Interface *, InterfaceRecord *>::iterator, HashMap<const Interface *, InterfaceRecord *>::iterator> r = 
+			children.equal_range(parent.getObj());
 
-	while (it != end()) {
-		InterfaceRecord *ir = *it;
+		for (; r.first != r.second; r.first++) {
+			if (!(*r.first).second->iface->isSnooped())
+				records.push_back((*r.first).second);
+		}
+	} else {
+		for (InterfaceStore::iterator it = begin(); it != end(); it++) {
+			if ((*it)->iface->isLocal())
+				records.push_back(*it);
+		}
+	}
+
+	while (!records.empty()) {
+		InterfaceRecord *ir = records.front();
 		
-		if ((ir->iface->isLocal() && !parent) || 
-		    (parent && ir->parent && ir->parent == parent && !ir->iface->isSnooped())) {
-			
-			if (ir->cip->isDead()) {
-				if (ifl)
-                                        ifl->add(ir->iface);
-                                removed++;
-
-				ir->iface->resetFlag(IFFLAG_STORED);
-				it = erase(it);	
-				children.push_front(ir->iface);
-				
-				delete ir;
-				continue;
-			}
-			ir->cip->age();
-			
-			if (lifetime && ir->cip->lifetime().isValid()) {
-				if (!lifetime->isValid() || ir->cip->lifetime() < *lifetime) {
-					*lifetime = ir->cip->lifetime();
-				}
+		records.pop_front();
+
+		if (ir->cip->isDead()) {
+			if (ifl)
+				ifl->add(ir->iface);
+			removed++;
+
+			dead.push_front(ir->iface);
+			_remove(ir);
+			continue;
+		}
+		ir->cip->age();
+		
+		if (lifetime && ir->cip->lifetime().isValid()) {
+			if (!lifetime->isValid() || ir->cip->lifetime() < *lifetime) {
+				*lifetime = ir->cip->lifetime();
 			}
 		}
-		it++;
 	}
 	
-	while (!children.empty()) {
-		removed += remove_children(children.pop(), ifl);
+	while (!dead.empty()) {
+		removed += remove_children(dead.pop(), ifl);
 	}
 
 	return removed;
 }
 
-InterfaceStore::size_type InterfaceStore::age(Interface::Type_t type, const unsigned char *identifier, InterfaceRefList *ifl, Timeval *lifetime)
+InterfaceStore::size_type InterfaceStore::age(const Interface *parent, InterfaceRefList *ifl, Timeval *lifetime)
 {
-        Mutex::AutoLocker l(mutex);
-	InterfaceRefList children;
-        size_type removed = 0;
-
-	// Initialize the lifetime to an "invalid" number
-	if (lifetime)
-		*lifetime = Timeval(-1);
-	
-	InterfaceStore::iterator it = begin();
+	RWMutex::WriteLocker l(mutex);
+	InterfaceRef parentStore;
 
-	while (it != end()) {
-		InterfaceRecord *ir = *it;
+	if (parent) {
+		InterfaceRecord *ir = _retrieve(*parent);
 
-		if ((ir->iface->isLocal() && !identifier) || 
-		    ((identifier && ir->parent) && ir->parent->equal(type, identifier) && !ir->iface->isSnooped())) {
-			
-			if (ir->cip->isDead()) {
-				if (ifl)
-                                        ifl->add(ir->iface);
-                                
-                                removed++;
-				ir->iface->resetFlag(IFFLAG_STORED);
-				it = erase(it);
-				children.push_front(ir->iface);
-				
-				delete ir;
-				continue;
-			}
-			ir->cip->age();
-			
-			if (lifetime && ir->cip->lifetime().isValid()) {
-				if (!lifetime->isValid() || ir->cip->lifetime() < *lifetime) {
-					*lifetime = ir->cip->lifetime();
-				}
-			}
+		// Interfaces are removed together with their parent
+		if (!ir) {
+			if (lifetime)
+				*lifetime = Timeval(-1);
+			return 0;
 		}
-		it++;
-	}
-	
-	while (!children.empty()) {
-		removed += remove_children(children.pop(), ifl);
+		parentStore = ir->iface;
 	}
 
-	return removed;
+	return _age(parentStore, ifl, lifetime);
 }
 
-
-InterfaceStore::size_type InterfaceStore::age(const InterfaceRef &parent, InterfaceRefList *ifl, Timeval *lifetime)
+InterfaceStore::size_type InterfaceStore::age(Interface::Type_t type, const unsigned char *identifier, InterfaceRefList *ifl, Timeval *lifetime)
 {
-        Mutex::AutoLocker l(mutex);
-	InterfaceRefList children;
-        size_type removed = 0;
-	
-	// Initialize the lifetime to an "invalid" number
-	if (lifetime)
-		*lifetime = Timeval(-1);
-	
-	InterfaceStore::iterator it = begin();
+	RWMutex::WriteLocker l(mutex);
+	InterfaceRef parentStore;
 
-	while (it != end()) {
-		InterfaceRecord *ir = *it;
+	if (identifier) {
+		InterfaceRecord *ir = _retrieve(type, identifier);
 
-		if ((ir->iface->isLocal() && !parent) || 
-		    (parent && ir->parent && ir->parent == parent && !ir->iface->isSnooped())) {
-			
-			if (ir->cip->isDead()) {
-				if (ifl)
-                                        ifl->add(ir->iface);
-
-                                removed++;
-				ir->iface->resetFlag(IFFLAG_STORED);
-				it = erase(it);
-				children.push_front(ir->iface);
-				
-				delete ir;
-				continue;
-			}
-			ir->cip->age();
-			
-			if (lifetime && ir->cip->lifetime().isValid()) {
-				if (!lifetime->isValid() || ir->cip->lifetime() < *lifetime) {
-					*lifetime = ir->cip->lifetime();
-				}
-			}
+		if (!ir) {
+			if (lifetime)
+				*lifetime = Timeval(-1);
+			return 0;
 		}
-		it++;
+		parentStore = ir->iface;
 	}
-	
-	while (!children.empty()) {
-		removed += remove_children(children.pop(), ifl);
+
+	return _age(parentStore, ifl, lifetime);
+}
+
+InterfaceStore::size_type InterfaceStore::age(const InterfaceRef &parent, InterfaceRefList *ifl, Timeval *lifetime)
+{
+	if (!parent) {
+		RWMutex::WriteLocker l(mutex);
+
+		return _age(NULL, ifl, lifetime);
 	}
 
-	return removed;
+	return age(parent.getObj(), ifl, lifetime);
 }
 
 void InterfaceStore::print()
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
 	InterfaceStore::iterator it = begin();
 
 	printf("====== Interfaces ======\n");
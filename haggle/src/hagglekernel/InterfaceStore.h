@@ -16,6 +16,7 @@
 #define _INTERFACESTORE_H
 
 #include <libcpphaggle/List.h>
+#include <libcpphaggle/HashMap.h>
 #include <libcpphaggle/Mutex.h>
 
 using namespace haggle;
@@ -29,7 +30,22 @@ class InterfaceRecord;
 class InterfaceStore : protected List<InterfaceRecord *>
 {
 	//friend class ConnectivityManager;
-	Mutex mutex;
+	RWMutex mutex;
+	/*
+	  The records are indexed by the hash of their interface, and by 
+	  the parent interface in the store that they were discovered on. 
+	*/
+	HashMap<unsigned long, InterfaceRecord *> ids;
+	HashMap<const Interface *, InterfaceRecord *> children;
+	/*
+	  Internal, unlocked functions.
+	*/
+	void _add(InterfaceRecord *ir);
+	void _remove(InterfaceRecord *ir);
+	void _setParent(InterfaceRecord *ir, const InterfaceRef &parent);
+	InterfaceRecord *_retrieve(const Interface &iface);
+	InterfaceRecord *_retrieve(Interface::Type_t type, const unsigned char *identifier);
+	size_type _age(const InterfaceRef &parent, InterfaceRefList *ifl, Timeval *lifetime);
 	size_type remove_children(const InterfaceRef &parent, InterfaceRefList *ifl = NULL);
 public:
 	InterfaceStore();
@@ -46,9 +62,8 @@ public:
 		virtual ~Criteria() {}
 	};
 	// Locking
-	void lock() { mutex.lock(); }
+	void lock() { mutex.writeLock(); }
 	void unlock() { mutex.unlock(); }
-	bool trylock() { return mutex.trylock(); }
 	/**
 		Check if an Interface is in the store.
 		Returns: true if it is in the store, otherwise false.
@@ -143,6 +158,16 @@ public:
 		interface reference while calling this function.
 	*/
 	InterfaceRef retrieve(Interface::Type_t type, const unsigned char *identifier);
+	/**
+		Retrieve the parent of an interface, i.e., the interface in the 
+		store on which it was discovered.
+		Returns: A valid interface reference if the interface and its 
+		parent were found in the store, otherwise InterfaceRef::null.
+		
+		DEADLOCK WARNING: the calling thread may not hold the lock on an 
+		interface reference while calling this function.
+	*/
+	InterfaceRef retrieveParent(const InterfaceRef& iface);
 	/**
 		Retrieve all interfaces that match the given
 		criteria. The interfaces that match the criteria will
@@ -155,7 +180,7 @@ public:
 		DEADLOCK WARNING: the calling thread may not hold the lock on an 
 		interface reference while calling this function.
 	*/
-	size_type retrieve(const Criteria c, InterfaceRefList& ifl);
+	size_type retrieve(const Criteria& c, InterfaceRefList& ifl);
 	/**
 		Remove an interface from the store matching a given an interface name.
 		Any children interfaces are also removed.
@@ -127,6 +127,11 @@ bool Manager::unregisterWithKernel()
 	return false;
 }
 
+void Manager::onEventInterestChanged(EventType type)
+{
+	kernel->updateEventInterest(this, type);
+}
+
 void Manager::_onPrepareStartup(Event *e)
 {
 	state = MANAGER_STATE_PREPARE_STARTUP;
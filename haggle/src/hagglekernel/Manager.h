@@ -135,6 +135,11 @@ protected:
 	  Returns: true if the initialization is successful, or false otherwise.
 	*/
 	virtual bool init_derived() { return true; }
+	/*
+	  Keeps the kernel's event dispatch table up to date when the
+	  manager's event interests change.
+	 */
+	void onEventInterestChanged(EventType type);
 public:
         Manager(const char *_name, HaggleKernel *_kernel = haggleKernel);
         ~Manager();
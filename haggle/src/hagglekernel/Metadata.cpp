@@ -2,14 +2,14 @@
 #include <stdio.h>
 
 Metadata::Metadata(const string _name, const string _content, Metadata *_parent) :
-                parent(_parent), name(_name), content(_content)
+                parent(_parent), name(_name), content(_content), version(0)
 {
 }
 
 Metadata::Metadata(const Metadata& m) : 
-                parent(m.parent), name(m.name), content(m.content), 
+                parent(m.parent == &m ? this : m.parent), name(m.name), content(m.content), 
                 param_registry(m.param_registry), 
-                registry()
+                registry(), version(0)
 {
         for (registry_t::const_iterator it = m.registry.begin(); it != m.registry.end(); it++) {
                 const Metadata *m = (*it).second;
@@ -34,12 +34,34 @@ bool Metadata::isName(const string _name) const
 	return name == _name;
 }
 
+void Metadata::modified()
+{
+	Metadata *m = this;
+
+	// The root is its own parent, or has no parent
+	while (m->parent && m->parent != m)
+		m = m->parent;
+
+	m->version++;
+}
+
+unsigned long Metadata::getVersion() const
+{
+	const Metadata *m = this;
+
+	while (m->parent && m->parent != m)
+		m = m->parent;
+
+	return m->version;
+}
+
 bool Metadata::_addMetadata(Metadata *m)
 { 
         if (!m)
                 return false;
 
         registry.insert(make_pair(m->name, m));
+	modified();
 
         return true;
 }
@@ -59,6 +81,9 @@ bool Metadata::removeMetadata(const string name)
                  delete m;
                  ret = true;
          }
+	 if (ret)
+		 modified();
+
          return ret;
 }
 
@@ -132,6 +157,8 @@ string& Metadata::setParameter(const string name, const string value)
                 // Update value
                 (*p.first).second = value;
         }
+	modified();
+
         return (*p.first).second;
 }
 
@@ -144,7 +171,12 @@ string& Metadata::setParameter(const string name, const unsigned int value)
 
 bool Metadata::removeParameter(const string name)
 {
-        return param_registry.erase(name) == 1;
+        if (param_registry.erase(name) != 1)
+		return false;
+
+	modified();
+
+	return true;
 }
 
 const char *Metadata::getParameter(const string name) const
@@ -163,6 +195,8 @@ const char *Metadata::getParameter(const string name) const
 string& Metadata::setContent(const string _content)
 {
         content = _content;
+	modified();
+
         return content;
 }
 
@@ -9,6 +9,15 @@
 
 using namespace haggle;
 
+/*
+	The wire formats of metadata.
+*/
+typedef enum {
+	METADATA_FORMAT_XML,
+	METADATA_FORMAT_BINARY,
+	_METADATA_FORMAT_MAX
+} MetadataFormat_t;
+
 /**
    Metadata implements an abstract representation for hierarchical
    metadata in data objects, along with an interface.
@@ -29,7 +38,9 @@ using namespace haggle;
 
    One reason for this class is to implement a backend independent
    interface for metadata, so that it is simple to replace the wire
-   format with something else than XML, if one so wishes.
+   format with something else than XML, if one so wishes. The
+   BinaryMetadata backend is such a wire format, which data objects
+   use between nodes that support it.
 
    Another reason is that the interface provided by the Metadata class
    is much simpler than the one provided by XML. The interface is
@@ -38,6 +49,8 @@ using namespace haggle;
  */
 class Metadata
 {
+	// The binary codec encodes and decodes metadata of any backend
+	friend class BinaryMetadata;
     public:
         typedef Pair<string, string> parameter_t;
     protected:
@@ -48,6 +61,10 @@ class Metadata
         typedef HashMap<string, Metadata *> registry_t;
         parameter_registry_t param_registry;
         registry_t registry;
+        // Counts the modifications of the tree, only kept in the root
+        unsigned long version;
+        // Called on every modification, to step the version of the tree
+        void modified();
         Metadata(const string _name, const string _content = "", Metadata *_parent = NULL);
         Metadata(const Metadata& m);
         // This function should be called by addMetadata() in the
@@ -68,6 +85,13 @@ class Metadata
         virtual Metadata *addMetadata(const string name, const string content = "") = 0;
 	virtual bool initFromRaw(const unsigned char *raw, size_t len) { return false; }
 	bool isName(const string _name) const;
+	/**
+	   Returns the version of the tree that this metadata is part
+	   of. The version changes whenever any metadata in the tree is
+	   modified through this interface, so that serialized copies of
+	   the tree can be reused until it changes.
+	*/
+	unsigned long getVersion() const;
         string getName() const { return name; }
         const string& getName() { return name; }
         bool removeMetadata(const string name);
@@ -98,6 +98,10 @@ inline bool Node::init_node(const unsigned char *_id)
 		if (pval)
 			name = pval;
 
+		pval = nm->getParameter(NODE_METADATA_BLOOMFILTER_DELTAS_PARAM);
+
+		bloomfilterDeltas = (pval && strcmp(pval, "yes") == 0);
+
 		pval = nm->getParameter(NODE_METADATA_THRESHOLD_PARAM);
 
 		if (pval)
@@ -118,11 +122,25 @@ inline bool Node::init_node(const unsigned char *_id)
 
 		Metadata *bm = nm->getMetadata(BLOOMFILTER_METADATA);
 
-		if (bm) {
+		// A bloomfilter delta can only be applied by someone who knows
+		// the base, i.e., the NodeManager
+		if (bm && !Bloomfilter::isDeltaMetadata(*bm)) {
 			if (!setBloomfilter(Bloomfilter::fromMetadata(*bm))) {
 				HAGGLE_ERR("Bad bloomfilter metadata\n");
 				return false;
 			}
+
+			// The sub-filters that the bloomfilter has grown
+			for (unsigned int i = 1; (bm = nm->getMetadata(BLOOMFILTER_METADATA, i)); i++) {
+				Bloomfilter *sub = Bloomfilter::fromMetadata(*bm);
+
+				if (!doBF->append(sub)) {
+					HAGGLE_ERR("Bad bloomfilter metadata\n");
+					if (sub)
+						delete sub;
+					return false;
+				}
+			}
 		}
 
 		Metadata *im = nm->getMetadata(INTERFACE_METADATA);
@@ -168,7 +186,8 @@ Node::Node(const Type_t _type, const string _name, Timeval _nodeDescriptionCreat
 	createTime(Timeval::now()),
 	lastDataObjectQueryTime(-1, -1),
 	matchThreshold(NODE_DEFAULT_MATCH_THRESHOLD), 
-	numberOfDataObjectsPerMatch(NODE_DEFAULT_DATAOBJECTS_PER_MATCH)
+	numberOfDataObjectsPerMatch(NODE_DEFAULT_DATAOBJECTS_PER_MATCH),
+	bloomfilterDeltas(false)
 {
 	
 }
@@ -187,7 +206,8 @@ Node::Node(const Node& n) :
 	createTime(n.createTime),
 	lastDataObjectQueryTime(n.lastDataObjectQueryTime),
 	matchThreshold(n.matchThreshold),
-	numberOfDataObjectsPerMatch(n.numberOfDataObjectsPerMatch)
+	numberOfDataObjectsPerMatch(n.numberOfDataObjectsPerMatch),
+	bloomfilterDeltas(n.bloomfilterDeltas)
 {
 	memcpy(id, n.id, NODE_ID_LEN);
 	strncpy(idStr, n.idStr, MAX_NODE_ID_STR_LEN);
@@ -512,6 +532,9 @@ Metadata *Node::toMetadata(bool withBloomfilter) const
 
         nm->setParameter(NODE_METADATA_MAX_DATAOBJECTS_PARAM, numberOfDataObjectsPerMatch);
 
+	if (acceptsBloomfilterDeltas())
+		nm->setParameter(NODE_METADATA_BLOOMFILTER_DELTAS_PARAM, "yes");
+
         for (InterfaceRefList::const_iterator it = interfaces.begin(); it != interfaces.end(); it++) {
 		Metadata *im = (*it)->toMetadata();
 		
@@ -519,8 +542,12 @@ Metadata *Node::toMetadata(bool withBloomfilter) const
 			nm->addMetadata(im);
 	}
 
-        if (withBloomfilter)
-                nm->addMetadata(getBloomfilter()->toMetadata());
+        // Each sub-filter of the bloomfilter has metadata of its own.
+        // Nodes that do not know about sub-filters only read the first.
+        if (withBloomfilter) {
+		for (const Bloomfilter *bf = getBloomfilter(); bf; bf = bf->getNext())
+			nm->addMetadata(bf->toMetadata());
+	}
 
         return nm;        
 }
@@ -802,12 +829,8 @@ void Node::calcId()
 
 void Node::calcIdStr()
 {
-	int len = 0;
-
 	// Generate a readable string of the Id
-	for (int i = 0; i < NODE_ID_LEN; i++) {
-		len += sprintf(idStr + len, "%02x", id[i] & 0xff);
-	}
+	buf2str((const char *)id, idStr, NODE_ID_LEN);
 }
 
 #ifdef DEBUG
@@ -45,15 +45,17 @@ using namespace haggle;
 #define NODE_METADATA_NAME_PARAM "name"
 #define NODE_METADATA_THRESHOLD_PARAM "resolution_threshold"
 #define NODE_METADATA_MAX_DATAOBJECTS_PARAM "resolution_limit"
+// Set to "yes" by nodes that can apply bloomfilter deltas
+#define NODE_METADATA_BLOOMFILTER_DELTAS_PARAM "bloomfilter_deltas"
 
 #define NODE_DEFAULT_DATAOBJECTS_PER_MATCH 10
 #define NODE_DEFAULT_MATCH_THRESHOLD 10
 
 /** */
 #ifdef DEBUG_LEAKS
-class Node: public LeakMonitor
+class Node: public LeakMonitor, public Refcountable
 #else
-class Node
+class Node : public Refcountable
 #endif
 {
 public:
@@ -166,6 +168,7 @@ protected:
 	inline bool init_node(const Node::Id_t _id);
 	unsigned long matchThreshold;
 	unsigned long numberOfDataObjectsPerMatch;
+	bool bloomfilterDeltas; // The node can apply bloomfilter deltas
 
         Node(Type_t _type, const string name = "Unnamed node", 
 	     Timeval _nodeDescriptionCreateTime = -1);
@@ -265,6 +268,11 @@ public:
 
 	void setMatchingThreshold(unsigned long value) { matchThreshold = value; }
 	void setMaxDataObjectsInMatch(unsigned long value) { numberOfDataObjectsPerMatch = value; }
+	/**
+		Returns true if the node's node description says that it can
+		apply bloomfilter deltas. This node always can.
+	*/
+	bool acceptsBloomfilterDeltas() const { return bloomfilterDeltas || type == TYPE_LOCAL_DEVICE; }
 
         // Wrappers for adding, removing and updating attributes in
         // the node description associated with this node
@@ -42,12 +42,21 @@ NodeManager::NodeManager(HaggleKernel * _haggle) :
 	Manager("NodeManager", _haggle), 
 	thumbnail_size(0), thumbnail(NULL),
 	nodeDescriptionRetries(DEFAULT_NODE_DESCRIPTION_RETRIES),
-	nodeDescriptionRetryWait(DEFAULT_NODE_DESCRIPTION_RETRY_WAIT)
+	nodeDescriptionRetryWait(DEFAULT_NODE_DESCRIPTION_RETRY_WAIT),
+	sendBloomfilterDeltas(true)
 {
 }
 
 NodeManager::~NodeManager()
 {
+	while (!sendList.empty()) {
+		delete sendList.front().second.bloomfilter;
+		sendList.pop_front();
+	}
+
+	for (SentBloomfilters_t::iterator it = sentBloomfilters.begin(); it != sentBloomfilters.end(); it++)
+		delete (*it).second.bloomfilter;
+
 	if (onRetrieveNodeCallback)
 		delete onRetrieveNodeCallback;
 	
@@ -218,6 +227,68 @@ bool NodeManager::isInSendList(const NodeRef& node, const DataObjectRef& dObj)
 	return false;
 }
 
+/*
+	Undefined neighbors have no id yet, so we remember them by their
+	reference until we get their node description.
+*/
+static string sentBloomfilterKey(const NodeRef& neigh)
+{
+	char key[40];
+
+	if (neigh->getType() != Node::TYPE_UNDEFINED)
+		return neigh->getIdStr();
+
+	snprintf(key, sizeof(key), "undefined-%lu", neigh.getId());
+
+	return key;
+}
+
+/*
+	Returns a node description that only carries the changes to our
+	bloomfilter since the one the neighbor has acknowledged, or NULL if
+	the neighbor should get the whole bloomfilter. Old nodes drop node
+	descriptions with deltas, so only neighbors that say they can apply
+	them get deltas.
+*/
+DataObjectRef NodeManager::getNodeDescriptionDelta(const NodeRef& neigh, const Bloomfilter& bf)
+{
+	if (!sendBloomfilterDeltas || !neigh->acceptsBloomfilterDeltas())
+		return NULL;
+
+	SentBloomfilters_t::iterator it = sentBloomfilters.find(sentBloomfilterKey(neigh));
+
+	if (it == sentBloomfilters.end())
+		return NULL;
+
+	Metadata *bm = bf.toDeltaMetadata(*(*it).second.bloomfilter, (*it).second.dObjId);
+
+	if (!bm)
+		return NULL;
+
+	DataObjectRef dObj = kernel->getThisNode()->getDataObject(false);
+
+	if (!dObj || !dObj->getMetadata()->getMetadata(NODE_METADATA) ||
+	    !dObj->getMetadata()->getMetadata(NODE_METADATA)->addMetadata(bm)) {
+		delete bm;
+		return NULL;
+	}
+
+	if (thumbnail != NULL)
+		dObj->setThumbnail(thumbnail, thumbnail_size);
+
+	return dObj;
+}
+
+void NodeManager::forgetSentBloomfilter(const NodeRef& neigh)
+{
+	SentBloomfilters_t::iterator it = sentBloomfilters.find(sentBloomfilterKey(neigh));
+
+	if (it != sentBloomfilters.end()) {
+		delete (*it).second.bloomfilter;
+		sentBloomfilters.erase(it);
+	}
+}
+
 int NodeManager::sendNodeDescription(NodeRefList& neighList)
 {
 	NodeRefList targetList;
@@ -225,6 +296,7 @@ int NodeManager::sendNodeDescription(NodeRefList& neighList)
 	HAGGLE_DBG("Pushing node description to %lu neighbors\n", neighList.size());
 
 	DataObjectRef dObj = kernel->getThisNode()->getDataObject();
+	const Bloomfilter *bf = kernel->getThisNode()->getBloomfilter();
 
 	if (thumbnail != NULL)
 		dObj->setThumbnail(thumbnail, thumbnail_size);
@@ -235,13 +307,21 @@ int NodeManager::sendNodeDescription(NodeRefList& neighList)
 		if (neigh->getBloomfilter()->has(dObj)) {
 			HAGGLE_DBG("Neighbor %s already has our most recent node description\n", neigh->getName().c_str());
 		} else if (!isInSendList(neigh, dObj)) {
-			HAGGLE_DBG("Sending node description [%s] to \'%s\', bloomfilter #objs=%lu\n", 
-				   dObj->getIdStr(), neigh->getName().c_str(), kernel->getThisNode()->getBloomfilter()->numObjects());
-			targetList.push_back(neigh);
+			DataObjectRef dObjDelta = getNodeDescriptionDelta(neigh, *bf);
+			SendEntry_t se = { dObjDelta ? dObjDelta : dObj, 0, Bloomfilter::create(*bf) };
 
-			SendEntry_t se = { dObj, 0 };
 			// Remember that we tried to send our node description to this node:
 			sendList.push_back(Pair<NodeRef, SendEntry_t>(neigh, se));
+
+			if (dObjDelta) {
+				HAGGLE_DBG("Sending node description [%s] with bloomfilter delta to \'%s\', bloomfilter #objs=%lu\n", 
+					   dObj->getIdStr(), neigh->getName().c_str(), bf->numObjects());
+				kernel->addEvent(new Event(EVENT_TYPE_DATAOBJECT_SEND, dObjDelta, neigh));
+			} else {
+				HAGGLE_DBG("Sending node description [%s] to \'%s\', bloomfilter #objs=%lu\n", 
+					   dObj->getIdStr(), neigh->getName().c_str(), bf->numObjects());
+				targetList.push_back(neigh);
+			}
 		} else {
 			HAGGLE_DBG("Node description [%s] is already in send list for neighbor %s\n",
 				dObj->getIdStr(), neigh->getName().c_str());
@@ -252,7 +332,7 @@ int NodeManager::sendNodeDescription(NodeRefList& neighList)
 		HAGGLE_DBG("Pushing node description [%s] to %lu neighbors\n", dObj->getIdStr(), targetList.size());
 		kernel->addEvent(new Event(EVENT_TYPE_DATAOBJECT_SEND, dObj, targetList));
 	} else {
-		HAGGLE_DBG("All neighbors already had our most recent node description\n");
+		HAGGLE_DBG("No neighbors need our whole node description\n");
 	}
 	
 	return 1;
@@ -284,7 +364,13 @@ void NodeManager::onSendResult(Event *e)
 				
 				HAGGLE_DBG("Successfully sent node description [%s] to neighbor %s [%s], after %lu retries\n", dObj->getIdStr(), neigh->getName().c_str(), neigh->getIdStr(), (*it).second.retries);
 				//dObj->print();
-				
+
+				if ((*it).second.bloomfilter) {
+					forgetSentBloomfilter(neigh);
+					SentBloomfilter_t& sbf = sentBloomfilters[sentBloomfilterKey(neigh)];
+					sbf.dObjId = dObj->getIdStr();
+					sbf.bloomfilter = (*it).second.bloomfilter;
+				}
 				sendList.erase(it);
 			} else if (e->getType() == EVENT_TYPE_DATAOBJECT_SEND_FAILURE) {
 				// No. Unset the flag.
@@ -302,6 +388,7 @@ void NodeManager::onSendResult(Event *e)
 					// Remove this entry from the list:
 					HAGGLE_DBG("FAILED to send node description to neighbor %s [%s] after %u retries...\n",
 						neigh->getName().c_str(), neigh->getIdStr(), (*it).second.retries);
+					delete (*it).second.bloomfilter;
 					sendList.erase(it);
 				}
 			}
@@ -313,7 +400,8 @@ void NodeManager::onSendResult(Event *e)
 
 void NodeManager::onLocalInterfaceUp(Event * e)
 {
-	kernel->getThisNode()->addInterface(e->getInterface());
+	// This node is in the node store, which must index the interface
+	kernel->getNodeStore()->addInterface(kernel->getThisNode(), e->getInterface());
 }
 
 void NodeManager::onLocalInterfaceDown(Event *e)
@@ -399,6 +487,10 @@ void NodeManager::onNeighborInterfaceDown(Event *e)
 		if (!node->isAvailable()) {
 			kernel->getNodeStore()->remove(node);
 
+			// The neighbor may lose its copy of our bloomfilter
+			// before we meet again, so start over with a whole one
+			forgetSentBloomfilter(node);
+
 			/*
 				We need to update the node information in the data store 
 				since the bloomfilter might have been updated during the 
@@ -564,6 +656,8 @@ void NodeManager::onReceiveNodeDescription(Event *e)
 			}
 		} 
 
+		applyBloomfilterDelta(node, neighbor);
+
 		HAGGLE_DBG("New node description from node %s -- createTime %s receiveTime %s, bloomfilter #objs=%lu\n", 
 			node->getName().c_str(), 
 			dObj->getCreateTime().getAsString().c_str(), 
@@ -595,6 +689,56 @@ void NodeManager::onReceiveNodeDescription(Event *e)
 	}
 }
 
+/*
+	Node descriptions may only carry the changes to the bloomfilter since
+	an earlier node description. If we have that node description, the
+	changes are applied to our copy of the neighbor's bloomfilter, which
+	also holds the data objects that we have sent to it since.
+	Otherwise, we only set the bins that the delta sets. Bins that the
+	neighbor has cleared since our copy was made then stay set, so the
+	bloomfilter may claim data objects that the neighbor no longer has,
+	and we will not send them to it until it sends a full bloomfilter.
+*/
+void NodeManager::applyBloomfilterDelta(NodeRef& node, const NodeRef& neighbor)
+{
+	Metadata *nm = node->getDataObject()->getMetadata()->getMetadata(NODE_METADATA);
+	Metadata *bm = nm ? nm->getMetadata(BLOOMFILTER_METADATA) : NULL;
+
+	if (!bm || !Bloomfilter::isDeltaMetadata(*bm))
+		return;
+
+	const char *base = bm->getParameter(BLOOMFILTER_METADATA_DELTA_BASE_PARAM);
+	Bloomfilter *bf;
+	bool set_only;
+
+	if (!base)
+		return;
+
+	if (neighbor && neighbor->getType() != Node::TYPE_UNDEFINED) {
+		bf = Bloomfilter::create(*neighbor->getBloomfilter());
+		set_only = strcmp(neighbor->getDataObject()->getIdStr(), base) != 0;
+	} else {
+		// The bloomfilter merged from an undefined neighbor, if any
+		bf = Bloomfilter::create(*node->getBloomfilter());
+		set_only = true;
+	}
+
+	if (!bf)
+		return;
+
+	if (set_only) {
+		HAGGLE_DBG("Do not have the base [%s] of the bloomfilter delta from %s, only setting bins, which may leave stale ones\n",
+			   base, node->getName().c_str());
+	}
+
+	// The bloomfilter is left as it was if the delta does not fit it
+	if (!bf->applyDeltaMetadata(*bm, set_only)) {
+		HAGGLE_ERR("Could not apply bloomfilter delta from %s\n", node->getName().c_str());
+	}
+
+	node->setBloomfilter(bf, false);
+}
+
 void NodeManager::nodeUpdate(NodeRef& node)
 {
 	NodeRefList nl;
@@ -603,6 +747,20 @@ void NodeManager::nodeUpdate(NodeRef& node)
 	if (kernel->getNodeStore()->update(node, &nl)) {
 		HAGGLE_DBG("Neighbor node %s [id=%s] was updated in node store\n", 
 			   node->getName().c_str(), node->getIdStr());
+
+		// Now we know the id of neighbors that were undefined
+		for (NodeRefList::iterator it = nl.begin(); it != nl.end(); it++) {
+			if ((*it)->getType() != Node::TYPE_UNDEFINED)
+				continue;
+
+			SentBloomfilters_t::iterator jt = sentBloomfilters.find(sentBloomfilterKey(*it));
+
+			if (jt != sentBloomfilters.end()) {
+				forgetSentBloomfilter(node);
+				sentBloomfilters[node->getIdStr()] = (*jt).second;
+				sentBloomfilters.erase(jt);
+			}
+		}
 	} else {
 		// This is the path for node descriptions received via a third party, i.e.,
 		// the node description does not belong to the neighbor node we received it
@@ -704,6 +862,20 @@ void NodeManager::onConfig(Metadata *m)
 				LOG_ADD("# %s: max data objects in match=%lu\n", getName(), maxDataObjectsInMatch);
 			}
 		}
+
+		// Nodes that do not understand bloomfilter deltas ignore node
+		// descriptions that carry them
+		param = nm->getParameter("bloomfilter_deltas");
+
+		if (param) {
+			if (strcmp(param, "true") == 0)
+				sendBloomfilterDeltas = true;
+			else if (strcmp(param, "false") == 0)
+				sendBloomfilterDeltas = false;
+
+			HAGGLE_DBG("Bloomfilter deltas in node descriptions are %s\n", sendBloomfilterDeltas ? "on" : "off");
+			LOG_ADD("# %s: bloomfilter deltas=%s\n", getName(), sendBloomfilterDeltas ? "true" : "false");
+		}
 	}
 
 	nm = m->getMetadata("NodeDescriptionRetry");
@@ -23,9 +23,12 @@
 
 class NodeManager;
 
+#include <libcpphaggle/Map.h>
+
 #include "Event.h"
 #include "Manager.h"
 #include "Filter.h"
+#include "Bloomfilter.h"
 
 
 /** */
@@ -34,19 +37,35 @@ class NodeManager : public Manager
 	typedef struct {
 		DataObjectRef dObj;
 		unsigned long retries;
+		Bloomfilter *bloomfilter; // The bloomfilter in the node description
 	} SendEntry_t;
 	typedef List< Pair<NodeRef, SendEntry_t> > SendList_t;
+	/*
+		The bloomfilter that a neighbor has acknowledged, and the id of
+		the node description that carried it. Later node descriptions to
+		the neighbor only carry the changes since this bloomfilter.
+	*/
+	typedef struct {
+		string dObjId;
+		Bloomfilter *bloomfilter;
+	} SentBloomfilter_t;
+	typedef Map<string, SentBloomfilter_t> SentBloomfilters_t;
 
 	size_t thumbnail_size;
 	char *thumbnail;
 	unsigned long nodeDescriptionRetries;
 	double nodeDescriptionRetryWait;
+	bool sendBloomfilterDeltas;
 	SendList_t sendList;
+	SentBloomfilters_t sentBloomfilters;
 	EventCallback<EventHandler> *onRetrieveNodeCallback;
 	EventCallback<EventHandler> *onRetrieveThisNodeCallback;
 	EventCallback<EventHandler> *onInsertedNodeCallback;
         EventType nodeDescriptionEType;
 	bool isInSendList(const NodeRef& node, const DataObjectRef& dObj);
+	DataObjectRef getNodeDescriptionDelta(const NodeRef& neigh, const Bloomfilter& bf);
+	void forgetSentBloomfilter(const NodeRef& neigh);
+	void applyBloomfilterDelta(NodeRef& node, const NodeRef& neighbor);
         int sendNodeDescription(NodeRefList& neighList);
         void onApplicationFilterMatchEvent(Event *e);
         void onSendNodeDescription(Event *e);
@@ -14,10 +14,12 @@
  */
 #include <string.h>
 
+#include <haggleutils.h>
+
 #include "NodeStore.h"
 #include "Trace.h"
 
-NodeStore::NodeStore()
+NodeStore::NodeStore() : num_added(0)
 {
 }
 
@@ -35,69 +37,153 @@ NodeStore::~NodeStore()
 	HAGGLE_DBG("Deleted %d node records in node store\n", n);
 }
 
-bool NodeStore::_stored(const NodeRef &node, bool mustBeNeighbor)
+void NodeStore::_add(NodeRef &node)
 {
-	for (NodeStore::iterator it = begin(); it != end(); it++) {
-		NodeRecord *nr = *it;
+	NodeRecord *nr = new NodeRecord(node, num_added++);
+	const InterfaceRefList *ifl = node->getInterfaces();
 
-		if (mustBeNeighbor && !nr->node->isNeighbor())
-			continue;
+	node->setStored(true);
+	push_back(nr);
+
+	ids.insert(make_pair(string(node->getIdStr()), nr));
+
+	for (InterfaceRefList::const_iterator it = ifl->begin(); it != ifl->end(); it++) {
+		unsigned long hash = (*it)->hash();
+
+		nr->ifaceHashes.push_back(hash);
+		ifaces.insert(make_pair(hash, nr));
+	}
+}
+
+/*
+	Removes the given record from the list and the indexes. The
+	record is deleted.
+*/
+void NodeStore::_remove(NodeRecord *nr)
+{
+	Pair<HashMap<string, NodeRecord *>::iterator, HashMap<string, NodeRecord *>::iterator> r = 
+		ids.equal_range(string(nr->node->getIdStr()));
 
-		if (nr->node == node) {
-			return true;
+	for (; r.first != r.second; r.first++) {
+		if ((*r.first).second == nr) {
+			ids.erase(r.first);
+			break;
 		}
 	}
-	return false;
+
+	// The node may have lost interfaces since it was indexed
+	for (List<unsigned long>::iterator it = nr->ifaceHashes.begin(); it != nr->ifaceHashes.end(); it++) {
+		Pair<HashMap<unsigned long, NodeRecord *>::iterator, HashMap<unsigned long, NodeRecord *>::iterator> ri = 
+			ifaces.equal_range(*it);
+
+		for (; ri.first != ri.second; ri.first++) {
+			if ((*ri.first).second == nr) {
+				ifaces.erase(ri.first);
+				break;
+			}
+		}
+	}
+
+	List<NodeRecord *>::remove(nr);
+	nr->node->setStored(false);
+	delete nr;
 }
-bool NodeStore::_stored(const Node &node, bool mustBeNeighbor)
+
+/*
+	Defined nodes are equal when their ids are, and undefined nodes when 
+	they share an interface, so both indexes are searched.
+*/
+NodeRecord *NodeStore::_retrieve(const Node &node, bool mustBeNeighbor)
 {
+	NodeRecord *found = NULL;
 
-	for (NodeStore::iterator it = begin(); it != end(); it++) {
-		NodeRecord *nr = *it;
+	if (node.getType() != Node::TYPE_UNDEFINED) {
+		Pair<HashMap<string, NodeRecord *>::iterator, HashMap<string, NodeRecord *>::iterator> r = 
+			ids.equal_range(string(node.getIdStr()));
 
-		if (mustBeNeighbor && !nr->node->isNeighbor())
-			continue;
+		for (; r.first != r.second; r.first++) {
+			NodeRecord *nr = (*r.first).second;
 
-		if (nr->node == node) {
-			return true;
+			if (found && found->seq < nr->seq)
+				continue;
+
+			if (mustBeNeighbor && !nr->node->isNeighbor())
+				continue;
+
+			if (nr->node == node)
+				found = nr;
 		}
 	}
-	return false;
+
+	const InterfaceRefList *ifl = node.getInterfaces();
+
+	for (InterfaceRefList::const_iterator it = ifl->begin(); it != ifl->end(); it++) {
+		Pair<HashMap<unsigned long, NodeRecord *>::iterator, HashMap<unsigned long, NodeRecord *>::iterator> r = 
+			ifaces.equal_range((*it)->hash());
+
+		for (; r.first != r.second; r.first++) {
+			NodeRecord *nr = (*r.first).second;
+
+			if (found && found->seq < nr->seq)
+				continue;
+
+			if (mustBeNeighbor && !nr->node->isNeighbor())
+				continue;
+
+			if (nr->node == node)
+				found = nr;
+		}
+	}
+
+	return found;
 }
 
-bool NodeStore::_stored(const Node::Id_t id, bool mustBeNeighbor)
+NodeRecord *NodeStore::_retrieve(const char *idStr, bool mustBeNeighbor)
 {
-	for (NodeStore::iterator it = begin(); it != end(); it++) {
-		NodeRecord *nr = *it;
+	NodeRecord *found = NULL;
+	Pair<HashMap<string, NodeRecord *>::iterator, HashMap<string, NodeRecord *>::iterator> r = 
+		ids.equal_range(string(idStr));
+
+	for (; r.first != r.second; r.first++) {
+		NodeRecord *nr = (*r.first).second;
+
+		if (found && found->seq < nr->seq)
+			continue;
 
 		if (mustBeNeighbor && !nr->node->isNeighbor())
 			continue;
 
-		if (memcmp(id, nr->node->getId(), NODE_ID_LEN) == 0) {
-			return true;
-		}
+		found = nr;
 	}
-	return false;
+
+	return found;
 }
 
-bool NodeStore::_stored(const string idStr, bool mustBeNeighbor)
+NodeRecord *NodeStore::_retrieve(const InterfaceRef &iface, bool mustBeNeighbor)
 {
-	for (NodeStore::iterator it = begin(); it != end(); it++) {
-		NodeRecord *nr = *it;
+	NodeRecord *found = NULL;
+	Pair<HashMap<unsigned long, NodeRecord *>::iterator, HashMap<unsigned long, NodeRecord *>::iterator> r = 
+		ifaces.equal_range(iface->hash());
+
+	for (; r.first != r.second; r.first++) {
+		NodeRecord *nr = (*r.first).second;
+
+		if (found && found->seq < nr->seq)
+			continue;
 
 		if (mustBeNeighbor && !nr->node->isNeighbor())
 			continue;
 
-		if (strcmp(idStr.c_str(), nr->node->getIdStr()) == 0) {
-			return true;
-		}
+		if (nr->node->hasInterface(iface))
+			found = nr;
 	}
-	return false;
+
+	return found;
 }
 
 bool NodeStore::stored(const NodeRef& node, bool mustBeNeighbor)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
 
 	bool ret;
 	
@@ -105,7 +191,7 @@ bool NodeStore::stored(const NodeRef& node, bool mustBeNeighbor)
 		return false;
 
 	node.lock();
-	ret = _stored(node, mustBeNeighbor);
+	ret = _retrieve(*node.getObj(), mustBeNeighbor) != NULL;
 	node.unlock();
 
 	return ret;
@@ -113,52 +199,57 @@ bool NodeStore::stored(const NodeRef& node, bool mustBeNeighbor)
 
 bool NodeStore::stored(const Node &node, bool mustBeNeighbor)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
 
-	return _stored(node, mustBeNeighbor);
+	return _retrieve(node, mustBeNeighbor) != NULL;
 }
 
 bool NodeStore::stored(const Node::Id_t id, bool mustBeNeighbor)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
+	char idStr[MAX_NODE_ID_STR_LEN];
+
+	if (!id)
+		return false;
 
-	return (id ? _stored(id, mustBeNeighbor) : false);
+	buf2str((const char *)id, idStr, NODE_ID_LEN);
+
+	return _retrieve(idStr, mustBeNeighbor) != NULL;
 }
 
 bool NodeStore::stored(const string idStr, bool mustBeNeighbor)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
 
-	return _stored(idStr, mustBeNeighbor);
+	return _retrieve(idStr.c_str(), mustBeNeighbor) != NULL;
 }
 
 bool NodeStore::add(NodeRef &node)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::WriteLocker l(mutex);
 
 	if (!node)
 		return false;;
 
-	if (_stored(node)) {
+	if (_retrieve(*node.getObj())) {
 		HAGGLE_DBG("Node %s is already in node store\n", node->getIdStr());
 		return false;
 	}
 
 	HAGGLE_DBG("Adding new node to node store %s\n", node->getIdStr());
-	node->setStored();
-	push_back(new NodeRecord(node));
+	_add(node);
 
 	return true;
 }
 
 NodeRef NodeStore::add(Node *node)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::WriteLocker l(mutex);
 
 	if (!node)
 		return NULL;
 
-	if (_stored(*node)) {
+	if (_retrieve(*node)) {
 		HAGGLE_DBG("Node %s is already in node store\n", node->getIdStr());
 		return NULL;
 	}
@@ -166,109 +257,108 @@ NodeRef NodeStore::add(Node *node)
 	HAGGLE_DBG("Adding new node to node store %s\n", node->getIdStr());
 
 	NodeRef nodeRef(node);
-	nodeRef->setStored();
-	push_back(new NodeRecord(nodeRef));
+	_add(nodeRef);
 
 	return nodeRef;
 }
 
-NodeRef NodeStore::retrieve(const NodeRef &node, bool mustBeNeighbor)
+bool NodeStore::addInterface(NodeRef& node, const InterfaceRef& iface)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::WriteLocker l(mutex);
 
-	if (!node)
-		return NULL;
+	if (!node || !iface)
+		return false;
+
+	if (!node->addInterface(iface))
+		return false;
 
 	for (NodeStore::iterator it = begin(); it != end(); it++) {
 		NodeRecord *nr = *it;
 
-		if (mustBeNeighbor && !nr->node->isNeighbor())
-			continue;
+		if (nr->node.getObj() == node.getObj()) {
+			unsigned long hash = iface->hash();
 
-		if (nr->node == node)
-			return nr->node;
+			nr->ifaceHashes.push_back(hash);
+			ifaces.insert(make_pair(hash, nr));
+			break;
+		}
 	}
 
-	return NULL;
+	return true;
 }
 
-NodeRef NodeStore::retrieve(const Node& node, bool mustBeNeighbor)
+NodeRef NodeStore::retrieve(const NodeRef &node, bool mustBeNeighbor)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
 
-	for (NodeStore::iterator it = begin(); it != end(); it++) {
-		NodeRecord *nr = *it;
+	if (!node)
+		return NULL;
 
-		if (mustBeNeighbor && !nr->node->isNeighbor())
-			continue;
+	NodeRecord *nr = _retrieve(*node.getObj(), mustBeNeighbor);
 
-		if (nr->node == node)
-			return nr->node;
-	}
+	if (!nr)
+		return NULL;
+
+	return nr->node;
+}
+
+NodeRef NodeStore::retrieve(const Node& node, bool mustBeNeighbor)
+{
+	RWMutex::ReadLocker l(mutex);
 
-	return NULL;
+	NodeRecord *nr = _retrieve(node, mustBeNeighbor);
+
+	if (!nr)
+		return NULL;
+
+	return nr->node;
 }
 
 NodeRef NodeStore::retrieve(const Node::Id_t id, bool mustBeNeighbor)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
+	char idStr[MAX_NODE_ID_STR_LEN];
 
-	for (NodeStore::iterator it = begin(); it != end(); it++) {
-		NodeRecord *nr = *it;
-		NodeRef node = nr->node;
+	buf2str((const char *)id, idStr, NODE_ID_LEN);
 
-		if (mustBeNeighbor && !node->isNeighbor())
-			continue;
+	NodeRecord *nr = _retrieve(idStr, mustBeNeighbor);
 
-		if (memcmp(id, node->getId(), NODE_ID_LEN) == 0) 
-			return node;
-	}
+	if (!nr)
+		return NULL;
 
-	return NULL;
+	return nr->node;
 }
 
 NodeRef NodeStore::retrieve(const string &id, bool mustBeNeighbor)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
 
-	for (NodeStore::iterator it = begin(); it != end(); it++) {
-		NodeRecord *nr = *it;
-		NodeRef node = nr->node;
-
-		if (mustBeNeighbor && !node->isNeighbor())
-			continue;
+	NodeRecord *nr = _retrieve(id.c_str(), mustBeNeighbor);
 
-		if (memcmp(id.c_str(), node->getIdStr(), MAX_NODE_ID_STR_LEN) == 0) 
-			return node;
-	}
+	if (!nr)
+		return NULL;
 
-	return NULL;
+	return nr->node;
 }
 
 NodeRef NodeStore::retrieve(const InterfaceRef &iface, bool mustBeNeighbor)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
 
         if (!iface)
 	        return NULL;
 
-	for (NodeStore::iterator it = begin(); it != end(); it++) {
-		NodeRecord *nr = *it;
-		NodeRef node = nr->node;
-
-		if (mustBeNeighbor && !node->isNeighbor())
-			continue;
+	NodeRecord *nr = _retrieve(iface, mustBeNeighbor);
 
-		if (node->hasInterface(iface)) 
-			return node;
-	}
+	if (!nr)
+		return NULL;
 
-	return NULL;
+	return nr->node;
 }
 
 NodeStore::size_type NodeStore::retrieve(Node::Type_t type, NodeRefList& nl)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
 	size_type n = 0;
 	
 	for (NodeStore::iterator it = begin(); it != end(); it++) {
@@ -285,7 +375,7 @@ NodeStore::size_type NodeStore::retrieve(Node::Type_t type, NodeRefList& nl)
 
 NodeStore::size_type NodeStore::retrieve(const Criteria& crit, NodeRefList& nl)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
 	size_type n = 0;
 
 	for (NodeStore::iterator it = begin(); it != end(); it++) {
@@ -303,7 +393,7 @@ NodeStore::size_type NodeStore::retrieve(const Criteria& crit, NodeRefList& nl)
 
 NodeStore::size_type NodeStore::retrieveNeighbors(NodeRefList& nl)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
 	size_type n = 0;
 
 	for (NodeStore::iterator it = begin(); it != end(); it++) {
@@ -320,7 +410,7 @@ NodeStore::size_type NodeStore::retrieveNeighbors(NodeRefList& nl)
 
 NodeStore::size_type NodeStore::numNeighbors()
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
 	size_type n = 0;
 
 	for (NodeStore::iterator it = begin(); it != end(); it++) {
@@ -336,105 +426,107 @@ NodeStore::size_type NodeStore::numNeighbors()
 
 bool NodeStore::update(NodeRef &node, NodeRefList *nl)
 {
-        Mutex::AutoLocker l(mutex);
-	bool found = false;
+	RWMutex::WriteLocker l(mutex);
+	List<NodeRecord *> found;
 	
 	if (!node)
 		return false;
 
 	// There may be undefined nodes in the node store that should
 	// be removed/merged with a 'defined' node that we create from a 
-	// node description. We loop through all nodes in the store and
-	// compare their interface lists with the one in the 'defined' node.
-	// If any interfaces match, we remove the matching nodes in the store 
-	// and eventually replace them with the new one.
-	for (NodeStore::iterator it = begin(); it != end();) {
+	// node description. We look up the nodes in the store that share 
+	// an interface with the 'defined' node, remove them and 
+	// eventually replace them with the new one.
+	const InterfaceRefList *ifl = node->getInterfaces();
+
+	for (InterfaceRefList::const_iterator it = ifl->begin(); it != ifl->end(); it++) {
+		Pair<HashMap<unsigned long, NodeRecord *>::iterator, HashMap<unsigned long, NodeRecord *>::iterator> r = 
+			ifaces.equal_range((*it)->hash());
+
+		for (; r.first != r.second; r.first++) {
+			NodeRecord *nr = (*r.first).second;
+			List<NodeRecord *>::iterator jt = found.begin();
+
+			if (!nr->node->hasInterface(*it))
+				continue;
+
+			// Keep the nodes in the order they were added
+			while (jt != found.end() && (*jt)->seq < nr->seq)
+				jt++;
+
+			if (jt == found.end() || *jt != nr)
+				found.insert(jt, nr);
+		}
+	}
+
+	for (List<NodeRecord *>::iterator it = found.begin(); it != found.end(); it++) {
 		NodeRecord *nr = *it;
-		bool found_now = false;
 		
 		nr->node.lock();
 
-		const InterfaceRefList *ifaces = nr->node->getInterfaces();
+		const InterfaceRefList *stored_ifl = nr->node->getInterfaces();
 
-		for (InterfaceRefList::const_iterator it2 = ifaces->begin(); it2 != ifaces->end(); it2++) {
+		for (InterfaceRefList::const_iterator it2 = stored_ifl->begin(); it2 != stored_ifl->end(); it2++) {
 			InterfaceRef iface = *it2;
 
-			if (node->hasInterface(iface)) {
-				// Transfer all the "up" interface states to the updated node
-				if (iface->isUp())
-					node->setInterfaceUp(iface);
-
-				found_now = true;
-			}
+			// Transfer all the "up" interface states to the updated node
+			if (node->hasInterface(iface) && iface->isUp())
+				node->setInterfaceUp(iface);
 		}
 		nr->node.unlock();
 
-		if (found_now) {
-			if (nl)
-				nl->push_back(nr->node);
-			
-			nr->node->setStored(false);
-
-			node->setExchangedNodeDescription(nr->node->hasExchangedNodeDescription());
-				
-			it = erase(it);
-			delete nr;
-			found = true;
-		} else {
-			it++;
-		}
-	}
-	if (found) {
-		node->setStored(true);
-		push_back(new NodeRecord(node));
+		if (nl)
+			nl->push_back(nr->node);
+
+		node->setExchangedNodeDescription(nr->node->hasExchangedNodeDescription());
+
+		_remove(nr);
 	}
 
-	return found;
+	if (found.empty())
+		return false;
+
+	_add(node);
+
+	return true;
 }
 
 
 // Remove neighbor with a specified interface
 NodeRef NodeStore::remove(const InterfaceRef &iface)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::WriteLocker l(mutex);
 
 	if (!iface)
 		return NULL;
 
-	for (NodeStore::iterator it = begin(); it != end(); it++) {
-		NodeRecord *nr = *it;
+	NodeRecord *nr = _retrieve(iface);
 
-		if (nr->node->hasInterface(iface)) {
-			NodeRef node = nr->node;
-			erase(it);
-			node->setStored(false);
-			delete nr;
-			return node;
-		}
-	}
+	if (!nr)
+		return NULL;
+
+	NodeRef node = nr->node;
+	_remove(nr);
 
-	return NULL;
+	return node;
 }
 
 // Remove all nodes of a specific type
 int NodeStore::remove(const Node::Type_t type)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::WriteLocker l(mutex);
+	List<NodeRecord *> matching;
 	int n = 0;
 
-	NodeStore::iterator it = begin();
-
-	while (it != end()) {
-		NodeRecord *nr = *it;
+	for (NodeStore::iterator it = begin(); it != end(); it++) {
+		if ((*it)->node->getType() == type)
+			matching.push_back(*it);
+	}
 
-		if (nr->node->getType() == type) {
-			it = erase(it);
-			n++;
-			nr->node->setStored(false);
-			delete nr;
-			continue;
-		}
-		it++;
+	while (!matching.empty()) {
+		_remove(matching.front());
+		matching.pop_front();
+		n++;
 	}
 
 	return n;
@@ -443,29 +535,25 @@ int NodeStore::remove(const Node::Type_t type)
 // Remove neighbor with a specified interface
 bool NodeStore::remove(const NodeRef &node)
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::WriteLocker l(mutex);
 
 	if (!node)
 		return false;
 
-	for (NodeStore::iterator it = begin(); it != end(); it++) {
-		NodeRecord *nr = *it;
+	NodeRecord *nr = _retrieve(*node.getObj());
 
-		if (nr->node == node) {
-			erase(it);
-			nr->node->setStored(false);
-			delete nr;
-			return true;
-		}
-	}
+	if (!nr)
+		return false;
 
-	return false;
+	_remove(nr);
+
+	return true;
 }
 
 #ifdef DEBUG
 void NodeStore::print()
 {
-        Mutex::AutoLocker l(mutex);
+	RWMutex::ReadLocker l(mutex);
 	int n = 0;
 
 	printf("======== Node store list ========\n\n");
@@ -16,17 +16,21 @@
 #define _NODESTORE_H
 
 #include <libcpphaggle/List.h>
+#include <libcpphaggle/HashMap.h>
 #include <libcpphaggle/Mutex.h>
 
 #include "Node.h"
 
 /**
-	The node record only holds a node now, but it may be expanded in the future.
+	The node record holds a node, the order in which it was added to 
+	the store, and the interface hashes it was indexed with.
 */
 class NodeRecord {
 public:
 	NodeRef node;
-	NodeRecord(const NodeRef &_node) : node(_node) {}
+	unsigned long seq;
+	List<unsigned long> ifaceHashes;
+	NodeRecord(const NodeRef &_node, unsigned long _seq) : node(_node), seq(_seq) {}
 	~NodeRecord() {}
 	bool operator==(const NodeRef &n) { return node == n; }
 };
@@ -92,14 +96,33 @@ public:
 
 class NodeStore : protected List<NodeRecord *>
 {
-	Mutex mutex;
+	/*
+	  Lookups only read the store, so they may run at the same time.
+	 */
+	RWMutex mutex;
+	unsigned long num_added;
+	/*
+	  The records are indexed by the id string of their node, and
+	  by the hash of each of the node's interfaces. Records that 
+	  share a hash are told apart by checking the node itself, and 
+	  when several nodes match, the one added first is returned, as 
+	  if the list was searched.
+
+	  The interfaces of a node are indexed when it is added or 
+	  updated in the store. An interface that a stored node gains
+	  later must be added with addInterface(), or lookups by that
+	  interface will not find the node.
+	 */
+	HashMap<string, NodeRecord *> ids;
+	HashMap<unsigned long, NodeRecord *> ifaces;
 	/*
 	  Internal, unlocked versions of functions below.
 	 */
-        bool _stored(const NodeRef &node, bool mustBeNeighbor = false);
-        bool _stored(const Node &node, bool mustBeNeighbor = false);
-        bool _stored(const Node::Id_t id, bool mustBeNeighbor = false);
-	bool _stored(const string idStr, bool mustBeNeighbor = false);
+	void _add(NodeRef &node);
+	void _remove(NodeRecord *nr);
+	NodeRecord *_retrieve(const Node &node, bool mustBeNeighbor = false);
+	NodeRecord *_retrieve(const char *idStr, bool mustBeNeighbor = false);
+	NodeRecord *_retrieve(const InterfaceRef &iface, bool mustBeNeighbor = false);
 public:
 	/**
 		The Critiera class is a matching functor that can be
@@ -120,9 +143,8 @@ public:
 	~NodeStore();
 
 	// Locking for the store
-	void lock() { mutex.lock(); }
+	void lock() { mutex.writeLock(); }
 	void unlock() { mutex.unlock(); }
-	bool trylock() { return mutex.trylock(); }
 	/**
 		Check if a node is currently stored in the store. The caller
 		may optionally specify whether the given node must be marked
@@ -251,7 +273,7 @@ public:
 	template<typename T>
 	size_type retrieve(ReferenceList<T>& nl)
 	{
-		Mutex::AutoLocker l(mutex);
+		RWMutex::ReadLocker l(mutex);
 		size_type n = 0;
 		
 		for (NodeStore::iterator it = begin(); it != end(); it++) {
@@ -320,6 +342,16 @@ public:
 		reference or an interface reference while calling this function.
 	*/
         bool update(NodeRef &inNode, NodeRefList *nl = NULL);
+	/**
+		Add an interface to a node, and index it if the node is in 
+		the store. Stored nodes must gain interfaces this way, see 
+		the indexes above.
+		Returns: true if the node did not already have the interface.
+		
+		DEADLOCK WARNING: the calling thread may not hold the lock on a object 
+		reference or an interface reference while calling this function.
+	*/
+	bool addInterface(NodeRef& node, const InterfaceRef& iface);
 
 	
 #ifdef DEBUG
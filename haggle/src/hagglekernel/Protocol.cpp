@@ -80,12 +80,77 @@ static inline char *create_name(const char *name, const unsigned long id, const
 	return tmpStr;
 }
 
+// Sequence number zero means "not pipelined", so skip it on wrap around
+static inline u_int16_t next_seqno(u_int16_t seqno)
+{
+	return (seqno == 0xffff) ? 1 : seqno + 1;
+}
+
+// Version 1 control messages carry the type in network byte order
+static inline u_int32_t ctrlmsg_type_to_wire(u_int32_t type, bool version1)
+{
+	return version1 ? htonl(type) : type;
+}
+
+static inline u_int32_t ctrlmsg_type_from_wire(u_int32_t type, bool version1)
+{
+	return version1 ? ntohl(type) : type;
+}
+
+// The offers are in the prolog, so there is no need to look far
+#define OFFER_SEARCH_LEN 128
+
+static bool has_offer(const unsigned char *buf, size_t len, const char *offer, size_t offer_len)
+{
+	const unsigned char *p = buf, *end;
+
+	if (len > OFFER_SEARCH_LEN)
+		len = OFFER_SEARCH_LEN;
+
+	end = buf + len;
+
+	while ((p = (const unsigned char *)memchr(p, '<', end - p)) != NULL) {
+		if ((size_t)(end - p) < offer_len)
+			return false;
+		if (memcmp(p, offer, offer_len) == 0)
+			return true;
+		p++;
+	}
+	return false;
+}
+
+/*
+	Insert an offer after the XML declaration of the metadata header
+	at the start of the buffer, or first in the buffer if there is no
+	declaration. The buffer must have room for 'offer_len' more bytes.
+*/
+static bool insert_offer(unsigned char *buf, size_t len, const char *offer, size_t offer_len)
+{
+	size_t pos = 0;
+
+	if (len >= 5 && memcmp(buf, "<?xml", 5) == 0) {
+		while (pos + 1 < len && !(buf[pos] == '?' && buf[pos + 1] == '>'))
+			pos++;
+
+		if (pos + 1 >= len)
+			return false;
+
+		pos += 2;
+	}
+
+	memmove(buf + pos + offer_len, buf + pos, len - pos);
+	memcpy(buf + pos, offer, offer_len);
+
+	return true;
+}
+
 Protocol::Protocol(const ProtType_t _type, const string _name, const InterfaceRef& _localIface, 
 		   const InterfaceRef& _peerIface, const int _flags, ProtocolManager *_m, size_t _bufferSize) : 
 	ManagerModule<ProtocolManager>(_m, create_name(_name.c_str(), num + 1,  _flags)),
 	isRegistered(false), type(_type), id(num++), error(PROT_ERROR_UNKNOWN), flags(_flags), 
 	mode(PROT_MODE_IDLE), localIface(_localIface), peerIface(_peerIface), peerNode(NULL),
-	buffer(NULL), bufferSize(_bufferSize), bufferDataLen(0)
+	buffer(NULL), bufferSize(_bufferSize), bufferDataLen(0), pipelineOffered(false), 
+	txPipelined(false), rxPipelined(false), txBinaryMetadata(false), txSeqno(0), rxSeqno(0), rxUnacked(0), rxAckSeqno(0)
 {
 	HAGGLE_DBG("%s Buffer size is %lu\n", getName(), bufferSize);
 }
@@ -148,6 +213,7 @@ Protocol::~Protocol()
 	// they are here, they have not been sent. So send an
 	// EVENT_TYPE_DATAOBJECT_SEND_FAILURE for each of them:
 	closeAndClearQueue();
+	failInFlight();
 }
 
 unsigned long Protocol::closeAndClearQueue()
@@ -484,7 +550,7 @@ ProtocolEvent Protocol::getData(size_t *bytesRead)
 				return PROT_EVENT_ERROR;
 			}
                         
-                        pEvent = receiveData(buffer, readLen, 0, bytesRead);
+                        pEvent = receiveData(buffer + bufferDataLen, readLen, 0, bytesRead);
                         
                         if (pEvent == PROT_EVENT_ERROR) {
                                 switch (getProtocolError()) {
@@ -558,8 +624,6 @@ ProtocolEvent Protocol::getData(size_t *bytesRead)
 
 void Protocol::removeData(size_t len)
 {
-	size_t i;
-	
 	// Make sure there is something to do:
 	if (len <= 0)
 		return;
@@ -572,8 +636,7 @@ void Protocol::removeData(size_t len)
 	}
 	
 	// Move the bytes left over to where they should be:
-	for (i = 0; i < bufferDataLen-len; i++)
-		buffer[i] = buffer[i+len];
+	memmove(buffer, buffer + len, bufferDataLen - len);
 	// Adjust bufferDataLen:
 	bufferDataLen -= len;
 }
@@ -583,6 +646,16 @@ const string Protocol::ctrlmsgToStr(struct ctrlmsg *m) const
         if (!m)
                 return "Bad control message";
 
+        // Pipelined data objects have a sequence number:
+        if (CTRLMSG_SEQNO(m)) {
+                char buf[40];
+                struct ctrlmsg tmp = *m;
+
+                CTRLMSG_SET_TYPE(&tmp, CTRLMSG_TYPE(m), 0);
+                snprintf(buf, 40, "%s seqno=%u", ctrlmsgToStr(&tmp).c_str(), CTRLMSG_SEQNO(m));
+                return buf;
+        }
+
         // Return the right string based on type:
         switch (m->type) {
                 case CTRLMSG_TYPE_ACK:
@@ -593,6 +666,10 @@ const string Protocol::ctrlmsgToStr(struct ctrlmsg *m) const
 			return "REJECT";
 		case CTRLMSG_TYPE_TERMINATE:
 			return "TERMINATE";
+		case CTRLMSG_TYPE_PIPELINE:
+			return "PIPELINE";
+		case CTRLMSG_TYPE_BINARY_METADATA:
+			return "BINARY_METADATA";
 		default:
 		{
 			char buf[30];
@@ -610,6 +687,7 @@ ProtocolEvent Protocol::sendControlMessage(struct ctrlmsg *m)
 	ProtocolEvent pEvent;
 	size_t bytesRead;
 	Timeval waitTimeout = PROTOCOL_RECVSEND_TIMEOUT; // FIXME: Set suitable timeout
+	struct ctrlmsg wm = *m;
 
 	HAGGLE_DBG("%s Waiting for writable event\n", getName());
 	pEvent = waitForEvent(&waitTimeout, true);
@@ -617,7 +695,9 @@ ProtocolEvent Protocol::sendControlMessage(struct ctrlmsg *m)
 	if (pEvent == PROT_EVENT_WRITEABLE) {
 		HAGGLE_DBG("%s sending control message %s\n", getName(), ctrlmsgToStr(m).c_str());
 
-		pEvent = sendData(m, sizeof(struct ctrlmsg), 0, &bytesRead);
+		// The messages we send are about the data objects we receive
+		wm.type = ctrlmsg_type_to_wire(m->type, rxPipelined);
+		pEvent = sendData(&wm, sizeof(struct ctrlmsg), 0, &bytesRead);
 		
 		if (pEvent == PROT_EVENT_SUCCESS) {
 			HAGGLE_DBG("Sent %u bytes control message '%s'\n", bytesRead, ctrlmsgToStr(m).c_str());
@@ -650,6 +730,19 @@ ProtocolEvent Protocol::receiveControlMessage(struct ctrlmsg *m)
 	int blockCount = 0;
 	ProtocolEvent pEvent = PROT_EVENT_SUCCESS;
 	Timeval waitTimeout;
+	size_t offset = 0;
+
+	// The run loop may already have read control messages into the buffer
+	if (bufferDataLen > 0) {
+		offset = bufferDataLen < sizeof(struct ctrlmsg) ? bufferDataLen : sizeof(struct ctrlmsg);
+		memcpy(m, buffer, offset);
+		removeData(offset);
+
+		if (offset == sizeof(struct ctrlmsg)) {
+			m->type = ctrlmsg_type_from_wire(m->type, txPipelined);
+			return PROT_EVENT_SUCCESS;
+		}
+	}
 	
 	// Repeat until we get a byte/"message" or permanently fail:
 	while (pEvent == PROT_EVENT_SUCCESS) {
@@ -665,17 +758,18 @@ ProtocolEvent Protocol::receiveControlMessage(struct ctrlmsg *m)
 			size_t bytesReceived;
 			
 			// Get the message:
-			pEvent = receiveData(m, sizeof(struct ctrlmsg), 0, &bytesReceived);
+			pEvent = receiveData((char *)m + offset, sizeof(struct ctrlmsg) - offset, 0, &bytesReceived);
 
 			// Did we get it?
 			if (pEvent == PROT_EVENT_SUCCESS) {
-				if (bytesReceived != sizeof(struct ctrlmsg)) {
+				if (bytesReceived != sizeof(struct ctrlmsg) - offset) {
 					pEvent = PROT_EVENT_ERROR;
 					HAGGLE_ERR("Control message has bad size %lu, expected %lu\n", 
-						bytesReceived, sizeof(struct ctrlmsg));
+						offset + bytesReceived, sizeof(struct ctrlmsg));
 				} else {
+					m->type = ctrlmsg_type_from_wire(m->type, txPipelined);
 					HAGGLE_DBG("Got control message '%s', %lu bytes\n", 
-						ctrlmsgToStr(m).c_str(), bytesReceived);
+						ctrlmsgToStr(m).c_str(), offset + bytesReceived);
 				}
                                 break;
                         } else if (pEvent == PROT_EVENT_ERROR) {
@@ -735,9 +829,14 @@ ProtocolEvent Protocol::receiveDataObject()
 	ProtocolEvent pEvent;
 	DataObjectRef dObj;
         struct ctrlmsg m;
+	bool pipelined = rxPipelined, offered = false, binaryOffered = false;
+	u_int16_t seqno = 0;
 
 	HAGGLE_DBG("%s receiving data object\n", getName());
 
+	if (pipelined)
+		seqno = rxSeqno = next_seqno(rxSeqno);
+
 	dObj = DataObject::create_for_putting(localIface, 
 					      peerIface, 
 					      getKernel()->getStoragePath());
@@ -751,20 +850,36 @@ ProtocolEvent Protocol::receiveDataObject()
 	bytesRemaining = DATAOBJECT_METADATA_PENDING;
 	
 	do {
-		pEvent = getData(&bytesRead);
+		// A pipelining peer may already have sent us the start of 
+		// this data object along with the previous one
+		if (bufferDataLen == 0) {
+			pEvent = getData(&bytesRead);
 
-		switch (pEvent) {
-		case PROT_EVENT_PEER_CLOSED:
-			HAGGLE_DBG("Peer [%s] closed connection\n", 
-				   peerDescription().c_str());
-			return pEvent;
-		case PROT_EVENT_ERROR_FATAL:
-			return pEvent;
-		case PROT_EVENT_ERROR:
-		default:
-			break;
+			switch (pEvent) {
+			case PROT_EVENT_PEER_CLOSED:
+				HAGGLE_DBG("Peer [%s] closed connection\n", 
+					   peerDescription().c_str());
+				return pEvent;
+			case PROT_EVENT_ERROR_FATAL:
+				return pEvent;
+			case PROT_EVENT_ERROR:
+			default:
+				break;
+			}
+		} else {
+			bytesRead = bufferDataLen;
+			pEvent = PROT_EVENT_SUCCESS;
 		}
 		
+		// Does the peer offer to pipeline the data objects that follow, 
+		// or to send their headers in the binary format?
+		if (totBytesPut == 0 && !rxPipelined && !isApplication()) {
+			offered = has_offer(buffer, bufferDataLen, 
+					    PROT_PIPELINE_OFFER, PROT_PIPELINE_OFFER_LEN);
+			binaryOffered = has_offer(buffer, bufferDataLen, 
+						  PROT_BINARY_METADATA_OFFER, PROT_BINARY_METADATA_OFFER_LEN);
+		}
+
 		if (bufferDataLen == 0) {
 			HAGGLE_DBG("No data to put into data object!\n");
 		} else {
@@ -810,11 +925,49 @@ ProtocolEvent Protocol::receiveDataObject()
 						getName(), dObj->getIdStr(), 
 						   peerDescription().c_str());
 
+					if (binaryOffered) {
+						// Let the peer send binary headers from now on
+						HAGGLE_DBG("Sending BINARY_METADATA control message to peer %s\n", 
+							   peerDescription().c_str());
+						CTRLMSG_SET_TYPE(&m, CTRLMSG_TYPE_BINARY_METADATA, 0);
+
+						pEvent = sendControlMessage(&m);
+
+						if (pEvent != PROT_EVENT_SUCCESS)
+							return pEvent;
+					}
+
+					if (offered) {
+						// Let the peer pipeline the data objects that follow this one
+						HAGGLE_DBG("Sending PIPELINE control message to peer %s\n", 
+							   peerDescription().c_str());
+						CTRLMSG_SET_TYPE(&m, CTRLMSG_TYPE_PIPELINE, 0);
+
+						pEvent = sendControlMessage(&m);
+
+						if (pEvent != PROT_EVENT_SUCCESS)
+							return pEvent;
+
+						rxPipelined = true;
+						rxSeqno = 0;
+					}
+
 					// Check if we already have this data object (FIXME: or are 
 					// otherwise not willing to accept it).
 					if (getKernel()->getThisNode()->getBloomfilter()->has(dObj)) {
+						/*
+						  The peer waits for an ACK of the data objects
+						  received before this one, and will not get one
+						  until another data object is accepted.
+						*/
+						if (rxUnacked > 0) {
+							pEvent = sendPipelineAck();
+
+							if (pEvent != PROT_EVENT_SUCCESS)
+								return pEvent;
+						}
 						// Reject the data object:
-                                                m.type = CTRLMSG_TYPE_REJECT;
+                                                CTRLMSG_SET_TYPE(&m, CTRLMSG_TYPE_REJECT, seqno);
                                                 HAGGLE_DBG("Sending REJECT control message to peer %s\n", 
                                                            peerDescription().c_str());
 
@@ -830,7 +983,7 @@ ProtocolEvent Protocol::receiveDataObject()
 						
                                                 return pEvent;
 					} else {
-                                                m.type = CTRLMSG_TYPE_ACCEPT;
+                                                CTRLMSG_SET_TYPE(&m, CTRLMSG_TYPE_ACCEPT, seqno);
 						// Tell the other side to continue sending the data object:
                                                 
 						/*
@@ -846,15 +999,21 @@ ProtocolEvent Protocol::receiveDataObject()
 						*/
 						getKernel()->getThisNode()->getBloomfilter()->add(dObj);
 
-						HAGGLE_DBG("Sending ACCEPT control message to peer [%s]\n", peerDescription().c_str());
+						/*
+						  A pipelining sender does not wait for the ACCEPT if there
+						  is no data to follow the header.
+						*/
+						if (!pipelined || bytesRemaining != 0) {
+							HAGGLE_DBG("Sending ACCEPT control message to peer [%s]\n", peerDescription().c_str());
 
-                                                pEvent = sendControlMessage(&m);
+							pEvent = sendControlMessage(&m);
 
-						if (pEvent == PROT_EVENT_SUCCESS) {
+							if (pEvent == PROT_EVENT_SUCCESS) {
 
-							LOG_ADD("%s: %s\t%s\t%s\n", 
-								Timeval::now().getAsString().c_str(), ctrlmsgToStr(&m).c_str(), 
-								dObj->getIdStr(), peerNode ? peerNode->getIdStr() : "unknown");
+								LOG_ADD("%s: %s\t%s\t%s\n", 
+									Timeval::now().getAsString().c_str(), ctrlmsgToStr(&m).c_str(), 
+									dObj->getIdStr(), peerNode ? peerNode->getIdStr() : "unknown");
+							}
 						}
 					}
 					
@@ -879,11 +1038,25 @@ ProtocolEvent Protocol::receiveDataObject()
 		   totBytesRead, t_end.getTimeAsSecondsDouble(),
 		   ((double) totBytesRead) / dObj->getRxTime());
 	
-	// Send ACK message back:	
-	HAGGLE_DBG("Sending ACK control message to peer %s\n", peerDescription().c_str());
-        m.type = CTRLMSG_TYPE_ACK;
+	if (pipelined) {
+		Timeval zero(0, 0);
+
+		/*
+		  The ACK covers all data objects received before it, so
+		  we hold it back while more data objects are arriving.
+		*/
+		rxAckSeqno = seqno;
+
+		if (++rxUnacked >= PROT_PIPELINE_ACK_INTERVAL || 
+		    (bufferDataLen == 0 && waitForEvent(&zero) != PROT_EVENT_INCOMING_DATA))
+			sendPipelineAck();
+	} else {
+		// Send ACK message back:	
+		HAGGLE_DBG("Sending ACK control message to peer %s\n", peerDescription().c_str());
+		m.type = CTRLMSG_TYPE_ACK;
 
-	sendControlMessage(&m);
+		sendControlMessage(&m);
+	}
 
 	dObj->setReceiveTime(Timeval::now());
 
@@ -896,6 +1069,85 @@ ProtocolEvent Protocol::receiveDataObject()
 	return pEvent;
 }
 
+ProtocolEvent Protocol::handleSendError(int *blockCount)
+{
+	switch (getProtocolError()) {
+	case PROT_ERROR_BAD_HANDLE:
+	case PROT_ERROR_NOT_CONNECTED:
+	case PROT_ERROR_NOT_A_SOCKET:
+	case PROT_ERROR_CONNECTION_RESET:
+		return PROT_EVENT_ERROR_FATAL;
+	case PROT_ERROR_WOULD_BLOCK:
+		if ((*blockCount)++ > PROT_BLOCK_TRY_MAX)
+			break;
+
+		// Return success so that the send loop does not quit
+
+		HAGGLE_DBG("Sending would block, try number %d/%d in %.3lf seconds\n",
+			*blockCount, PROT_BLOCK_TRY_MAX, 
+			(double)PROT_BLOCK_SLEEP_TIME_MSECS / 1000);
+
+		cancelableSleep(PROT_BLOCK_SLEEP_TIME_MSECS);
+
+		return PROT_EVENT_SUCCESS;
+	default:
+		HAGGLE_ERR("Protocol error : %s\n", getProtocolErrorStr());
+		break;
+	}
+	return PROT_EVENT_ERROR;
+}
+
+ProtocolEvent Protocol::sendDataFromFile(DataObjectDataRetrieverRef& retriever, size_t *bytesSent)
+{
+	ProtocolEvent pEvent = PROT_EVENT_SUCCESS;
+	Timeval waitTimeout;
+	int blockCount = 0;
+	off_t offset;
+	size_t len;
+	int fd = retriever->getDataFile(&offset, &len);
+
+	*bytesSent = 0;
+
+	// Without a file, the data is retrieved the usual way
+	if (fd == -1)
+		return PROT_EVENT_SUCCESS;
+
+	while (*bytesSent < len && pEvent == PROT_EVENT_SUCCESS) {
+		size_t bytes = 0;
+		waitTimeout = PROTOCOL_RECVSEND_TIMEOUT;
+
+		pEvent = waitForEvent(&waitTimeout, true);
+
+		if (pEvent == PROT_EVENT_TIMEOUT) {
+			HAGGLE_DBG("Protocol timed out while waiting to write data\n");
+			break;
+		} else if (pEvent != PROT_EVENT_WRITEABLE) {
+			HAGGLE_ERR("Protocol was not writeable, event=%d\n", pEvent);
+			break;
+		}
+
+		pEvent = sendFileData(fd, offset + *bytesSent, len - *bytesSent, &bytes);
+
+		if (pEvent == PROT_EVENT_ERROR) {
+			pEvent = handleSendError(&blockCount);
+		} else if (bytes == 0) {
+			// The file was truncated after the header was sent
+			HAGGLE_ERR("Could not read the data of the data object from its file\n");
+			pEvent = PROT_EVENT_ERROR;
+		} else {
+			blockCount = 0;
+			*bytesSent += bytes;
+		}
+	}
+
+	// Let the retriever continue after the data we sent
+	if (*bytesSent > 0 && !retriever->skipData(*bytesSent)) {
+		HAGGLE_ERR("Could not skip the data sent from file\n");
+		return PROT_EVENT_ERROR;
+	}
+	return pEvent;
+}
+
 ProtocolEvent Protocol::sendDataObjectNow(const DataObjectRef& dObj)
 {
 	int blockCount = 0;
@@ -906,21 +1158,48 @@ ProtocolEvent Protocol::sendDataObjectNow(const DataObjectRef& dObj)
 	bool hasSentHeader = false;
 	ssize_t len;
         struct ctrlmsg m;
+	bool pipelined = txPipelined && !isApplication();
+	bool offer = !txPipelined && !pipelineOffered && !isApplication();
+	u_int16_t seqno = 0;
 
 	HAGGLE_DBG("%s : Sending data object [%s] to peer \'%s\'\n", 
 			getName(), dObj->getIdStr(), peerDescription().c_str());
 	
-	DataObjectDataRetrieverRef retriever = dObj->getDataObjectDataRetriever();
+	DataObjectDataRetrieverRef retriever = dObj->getDataObjectDataRetriever(txBinaryMetadata && !isApplication() ? 
+										METADATA_FORMAT_BINARY : METADATA_FORMAT_XML);
 
 	if (!retriever || !retriever->isValid()) {
 		HAGGLE_ERR("%s unable to start reading data\n", getName());
 		return PROT_EVENT_ERROR;
 	}
+
+	if (pipelined) {
+		// Wait until there is room for one more data object in flight
+		pEvent = waitForPipelineAcks(PROT_PIPELINE_WINDOW - 1);
+
+		if (pEvent != PROT_EVENT_SUCCESS)
+			return pEvent;
+
+		seqno = txSeqno = next_seqno(txSeqno);
+	}
+
 	// Repeat until the data object is completely sent:
 	do {
-		// Get the data:
-		len = retriever->retrieve(buffer, bufferSize, !hasSentHeader);
+		// Get the data, leaving room for the offers in the header:
+		len = retriever->retrieve(buffer, offer ? bufferSize - PROT_PIPELINE_OFFER_LEN - PROT_BINARY_METADATA_OFFER_LEN : bufferSize, 
+					  !hasSentHeader);
 		
+		if (offer && len > 0) {
+			if (insert_offer(buffer, len, PROT_PIPELINE_OFFER, PROT_PIPELINE_OFFER_LEN)) {
+				len += PROT_PIPELINE_OFFER_LEN;
+				pipelineOffered = true;
+			}
+			if (insert_offer(buffer, len, PROT_BINARY_METADATA_OFFER, PROT_BINARY_METADATA_OFFER_LEN))
+				len += PROT_BINARY_METADATA_OFFER_LEN;
+
+			offer = false;
+		}
+
 		if (len < 0) {
 			HAGGLE_ERR("Could not retrieve data from data object\n");
 			pEvent = PROT_EVENT_ERROR;
@@ -945,31 +1224,7 @@ ProtocolEvent Protocol::sendDataObjectNow(const DataObjectRef& dObj)
 				pEvent = sendData(buffer + totBytes, len - totBytes, 0, &bytesSent);
 
 				if (pEvent == PROT_EVENT_ERROR) {
-					switch (getProtocolError()) {
-					case PROT_ERROR_BAD_HANDLE:
-					case PROT_ERROR_NOT_CONNECTED:
-					case PROT_ERROR_NOT_A_SOCKET:
-					case PROT_ERROR_CONNECTION_RESET:
-						pEvent = PROT_EVENT_ERROR_FATAL;
-						break;
-					case PROT_ERROR_WOULD_BLOCK:
-						if (blockCount++ > PROT_BLOCK_TRY_MAX)
-                                                        break;
-
-						// Set event to success so that the loop does not quit
-
-						HAGGLE_DBG("Sending would block, try number %d/%d in %.3lf seconds\n",
-							blockCount, PROT_BLOCK_TRY_MAX, 
-							(double)PROT_BLOCK_SLEEP_TIME_MSECS / 1000);
-
-						cancelableSleep(PROT_BLOCK_SLEEP_TIME_MSECS);
-
-						pEvent = PROT_EVENT_SUCCESS;
-						break;
-					default:
-						HAGGLE_ERR("Protocol error : %s\n", getProtocolErrorStr());
-						break;
-					}
+					pEvent = handleSendError(&blockCount);
 				} else {
 					// Reset the block count since we successfully sent some data
 					blockCount = 0;						
@@ -989,26 +1244,62 @@ ProtocolEvent Protocol::sendDataObjectNow(const DataObjectRef& dObj)
                                 return pEvent;
 			
 			hasSentHeader = true;
+
+			// The receiver will not ACCEPT/REJECT a pipelined data object without data
+			if (pipelined && dObj->getDataLen() == 0)
+				break;
 			
                         HAGGLE_DBG("Getting accept/reject control message\n");
 			// Get the accept/reject "message":
-			pEvent = receiveControlMessage(&m);
+			while ((pEvent = (pipelined ? receivePipelineControlMessage(&m) : 
+					  receiveControlMessage(&m))) == PROT_EVENT_SUCCESS) {
+				if (!pipelined && CTRLMSG_TYPE(&m) == CTRLMSG_TYPE_PIPELINE) {
+					// The peer accepted our offer, so pipeline the next data objects
+					HAGGLE_DBG("%s Peer [%s] accepts pipelined data objects\n", 
+						   getName(), peerDescription().c_str());
+					txPipelined = true;
+					txSeqno = 0;
+					continue;
+				}
+				if (!pipelined && CTRLMSG_TYPE(&m) == CTRLMSG_TYPE_BINARY_METADATA) {
+					// The peer decodes binary headers, so use them for the next data objects
+					HAGGLE_DBG("%s Peer [%s] accepts binary metadata headers\n", 
+						   getName(), peerDescription().c_str());
+					txBinaryMetadata = true;
+					continue;
+				}
+				// ACKs and REJECTs of earlier pipelined data objects may come first
+				if (!pipelined || CTRLMSG_SEQNO(&m) == seqno)
+					break;
+
+				if (!handlePipelineControlMessage(&m)) {
+					pEvent = PROT_EVENT_ERROR;
+					break;
+				}
+			}
 
 			// Did we get it?                        
 			if (pEvent == PROT_EVENT_SUCCESS) {
                                 HAGGLE_DBG("Received control message '%s'\n", ctrlmsgToStr(&m).c_str());
 				// Yes, check it:
-				if (m.type == CTRLMSG_TYPE_ACCEPT) {
+				if (CTRLMSG_TYPE(&m) == CTRLMSG_TYPE_ACCEPT) {
 					// ACCEPT message. Keep on going.
+                                        HAGGLE_DBG("%s Got ACCEPT control message, continue sending\n", getName());
+
+					if (canSendFileData()) {
+						size_t bytesSent = 0;
+
+						pEvent = sendDataFromFile(retriever, &bytesSent);
+						totBytesSent += bytesSent;
+					}
                                         // This is to make the while loop start over, in case there was
                                         // more of the data object to send.
                                         len = 1;
-                                        HAGGLE_DBG("%s Got ACCEPT control message, continue sending\n", getName());
-				} else if (m.type == CTRLMSG_TYPE_REJECT) {
+				} else if (CTRLMSG_TYPE(&m) == CTRLMSG_TYPE_REJECT) {
 					// Reject message. Stop sending this data object:
                                         HAGGLE_DBG("%s Got REJECT control message, stop sending\n", getName());
                                         return PROT_EVENT_REJECT;
-				} else if (m.type == CTRLMSG_TYPE_TERMINATE) {
+				} else if (CTRLMSG_TYPE(&m) == CTRLMSG_TYPE_TERMINATE) {
 					// Terminate message. Stop sending this data object, and all queued ones:
                                         HAGGLE_DBG("%s Got TERMINATE control message, purging queue\n", getName());
                                         return PROT_EVENT_TERMINATE;
@@ -1031,6 +1322,12 @@ ProtocolEvent Protocol::sendDataObjectNow(const DataObjectRef& dObj)
                    getName(), totBytesSent, tx_time.getTimeAsSecondsDouble(), 
                    (double)totBytesSent / (1000*tx_time.getTimeAsSecondsDouble()));
 #endif
+
+	if (pipelined) {
+		// The result is reported when the peer ACKs the data object
+		inFlight.push_back(make_pair(seqno, dObj));
+		return PROT_EVENT_PENDING;
+	}
         
 	HAGGLE_DBG("Waiting %d seconds for ACK from peer [%s]\n", 
                    PROTOCOL_RECVSEND_TIMEOUT, peerDescription().c_str());
@@ -1038,7 +1335,7 @@ ProtocolEvent Protocol::sendDataObjectNow(const DataObjectRef& dObj)
         pEvent = receiveControlMessage(&m);
 
         if (pEvent == PROT_EVENT_SUCCESS) {
-                if (m.type == CTRLMSG_TYPE_ACK) {
+                if (CTRLMSG_TYPE(&m) == CTRLMSG_TYPE_ACK) {
                         HAGGLE_DBG("Received '%s'\n", ctrlmsgToStr(&m).c_str());
                 } else {
                         HAGGLE_ERR("Control message malformed: expected 'ACK', got '%s'\n", ctrlmsgToStr(&m).c_str());
@@ -1050,6 +1347,194 @@ ProtocolEvent Protocol::sendDataObjectNow(const DataObjectRef& dObj)
 	return pEvent;
 }
 
+bool Protocol::handlePipelineControlMessage(struct ctrlmsg *m)
+{
+	u_int16_t seqno = CTRLMSG_SEQNO(m);
+
+	if (CTRLMSG_TYPE(m) == CTRLMSG_TYPE_ACK) {
+		bool found = false;
+
+		// An ACK covers all data objects sent up to and including this one
+		for (List<InFlightDataObject>::iterator it = inFlight.begin(); it != inFlight.end(); it++) {
+			if ((*it).first == seqno) {
+				found = true;
+				break;
+			}
+		}
+
+		if (!found)
+			return false;
+
+		while (!inFlight.empty()) {
+			InFlightDataObject ifd = inFlight.front();
+			
+			inFlight.pop_front();
+			handleSendResult(ifd.second, PROT_EVENT_SUCCESS);
+
+			if (ifd.first == seqno)
+				break;
+		}
+		return true;
+	} else if (CTRLMSG_TYPE(m) == CTRLMSG_TYPE_REJECT) {
+		for (List<InFlightDataObject>::iterator it = inFlight.begin(); it != inFlight.end(); it++) {
+			if ((*it).first == seqno) {
+				DataObjectRef dObj = (*it).second;
+
+				inFlight.erase(it);
+				handleSendResult(dObj, PROT_EVENT_REJECT);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+ProtocolEvent Protocol::peekControlMessage(bool *isCtrlMsg)
+{
+	ProtocolEvent pEvent = PROT_EVENT_SUCCESS;
+	u_int32_t type;
+
+	while (bufferDataLen < sizeof(type)) {
+		size_t bytesRead = 0;
+
+		pEvent = getData(&bytesRead);
+
+		if (pEvent != PROT_EVENT_SUCCESS)
+			return pEvent;
+	}
+
+	memcpy(&type, buffer, sizeof(type));
+	type = ctrlmsg_type_from_wire(type, txPipelined) & 0xffff;
+
+	*isCtrlMsg = (type >= CTRLMSG_TYPE_ACK && type <= CTRLMSG_TYPE_BINARY_METADATA);
+
+	return pEvent;
+}
+
+ProtocolEvent Protocol::receivePipelineControlMessage(struct ctrlmsg *m)
+{
+	ProtocolEvent pEvent;
+	bool isCtrlMsg = false;
+
+	while ((pEvent = peekControlMessage(&isCtrlMsg)) == PROT_EVENT_SUCCESS && !isCtrlMsg) {
+		HAGGLE_DBG("%s Incoming data object from [%s] while data objects are in flight\n", 
+			   getName(), peerDescription().c_str());
+
+		pEvent = receiveDataObject();
+
+		if (pEvent != PROT_EVENT_SUCCESS)
+			return pEvent;
+	}
+
+	if (pEvent != PROT_EVENT_SUCCESS)
+		return pEvent;
+
+	return receiveControlMessage(m);
+}
+
+ProtocolEvent Protocol::waitForPipelineAcks(unsigned long max)
+{
+	ProtocolEvent pEvent = PROT_EVENT_SUCCESS;
+	struct ctrlmsg m;
+
+	while (inFlight.size() > max) {
+		pEvent = receivePipelineControlMessage(&m);
+
+		if (pEvent != PROT_EVENT_SUCCESS)
+			break;
+
+		if (!handlePipelineControlMessage(&m)) {
+			HAGGLE_ERR("%s Unexpected control message '%s' from [%s]\n", 
+				   getName(), ctrlmsgToStr(&m).c_str(), peerDescription().c_str());
+			pEvent = PROT_EVENT_ERROR;
+			break;
+		}
+	}
+
+	// Without the ACKs, we do not know what the peer got
+	if (pEvent != PROT_EVENT_SUCCESS)
+		failInFlight();
+
+	return pEvent;
+}
+
+void Protocol::failInFlight()
+{
+	while (!inFlight.empty()) {
+		getKernel()->addEvent(new Event(EVENT_TYPE_DATAOBJECT_SEND_FAILURE, 
+						inFlight.front().second, peerNode));
+		inFlight.pop_front();
+	}
+}
+
+ProtocolEvent Protocol::sendPipelineAck()
+{
+	struct ctrlmsg m;
+
+	HAGGLE_DBG("Sending ACK control message for %u data objects to peer %s\n", 
+		   rxUnacked, peerDescription().c_str());
+
+	CTRLMSG_SET_TYPE(&m, CTRLMSG_TYPE_ACK, rxAckSeqno);
+	memset(m.dobj_id, 0, sizeof(DataObjectId_t));
+	rxUnacked = 0;
+
+	return sendControlMessage(&m);
+}
+
+void Protocol::handleSendResult(const DataObjectRef& dObj, ProtocolEvent pEvent)
+{
+	Queue *q = getQueue();
+
+	if (pEvent == PROT_EVENT_SUCCESS || pEvent == PROT_EVENT_REJECT) {
+		// Treat reject as SUCCESS, since it probably means the peer already has the
+		// data object and we should therefore not try to send it again.
+		getKernel()->addEvent(new Event(EVENT_TYPE_DATAOBJECT_SEND_SUCCESSFUL, 
+						dObj, peerNode, 
+						(pEvent == PROT_EVENT_REJECT) ? 1 : 0));
+	} else {
+		// Send success/fail event with this data object
+		switch (pEvent) {
+			case PROT_EVENT_TERMINATE:
+				// TODO: What to do here?
+				// We should stop sending completely, but if we just
+				// close the connection we might just connect and start
+				// sending again. We need a way to signal that we should 
+				// not try to send to this peer again -- at least not
+				// until next time he is our neighbor. For now, treat
+				// the same way as if the peer closed the connection.
+			case PROT_EVENT_PEER_CLOSED:
+				HAGGLE_DBG("%s Peer [%s] closed connection.\n", 
+					getName(), peerDescription().c_str());
+				q->close();
+				setMode(PROT_MODE_DONE);
+				closeConnection();
+				break;
+			case PROT_EVENT_ERROR:
+				HAGGLE_ERR("%s Data object send to [%s] failed...\n", 
+					getName(), peerDescription().c_str());
+				if (txPipelined) {
+					// We cannot know how much of the data object the peer
+					// got, so the sequence numbers are out of sync
+					q->close();
+					setMode(PROT_MODE_DONE);
+					closeConnection();
+				}
+				break;
+			case PROT_EVENT_ERROR_FATAL:
+				HAGGLE_ERR("%s Fatal error when sending to %s!\n", 
+					getName(), peerDescription().c_str());
+				q->close();
+				setMode(PROT_MODE_DONE);
+				break;
+			default:
+				q->close();
+				setMode(PROT_MODE_DONE);
+		}
+		getKernel()->addEvent(new Event(EVENT_TYPE_DATAOBJECT_SEND_FAILURE, 
+						dObj, peerNode));
+	}
+}
+
 bool Protocol::run()
 {
 	ProtocolEvent pEvent;
@@ -1120,7 +1605,11 @@ bool Protocol::run()
 		HAGGLE_DBG("%s Waiting for data object or timeout...\n", 
 			   getName());
 
-		pEvent = waitForEvent(dObj, &timeout);
+		// A pipelining peer may have sent more than we have handled
+		if (bufferDataLen > 0)
+			pEvent = PROT_EVENT_INCOMING_DATA;
+		else
+			pEvent = waitForEvent(dObj, &timeout);
 		
 		timeout = Timeval::now() - t_start;
 
@@ -1145,49 +1634,32 @@ bool Protocol::run()
 				
 				pEvent = sendDataObjectNow(dObj);
 				
-				if (pEvent == PROT_EVENT_SUCCESS || pEvent == PROT_EVENT_REJECT) {
-					// Treat reject as SUCCESS, since it probably means the peer already has the
-					// data object and we should therefore not try to send it again.
-					getKernel()->addEvent(new Event(EVENT_TYPE_DATAOBJECT_SEND_SUCCESSFUL, 
-									dObj, peerNode, 
-									(pEvent == PROT_EVENT_REJECT) ? 1 : 0));
-				} else {
-					// Send success/fail event with this data object
-					switch (pEvent) {
-						case PROT_EVENT_TERMINATE:
-							// TODO: What to do here?
-							// We should stop sending completely, but if we just
-							// close the connection we might just connect and start
-							// sending again. We need a way to signal that we should 
-							// not try to send to this peer again -- at least not
-							// until next time he is our neighbor. For now, treat
-							// the same way as if the peer closed the connection.
-						case PROT_EVENT_PEER_CLOSED:
-							HAGGLE_DBG("%s Peer [%s] closed connection.\n", 
-								getName(), peerDescription().c_str());
-							q->close();
-							setMode(PROT_MODE_DONE);
-							closeConnection();
-							break;
-						case PROT_EVENT_ERROR:
-							HAGGLE_ERR("%s Data object send to [%s] failed...\n", 
-								getName(), peerDescription().c_str());
-							break;
-						case PROT_EVENT_ERROR_FATAL:
-							HAGGLE_ERR("%s Fatal error when sending to %s!\n", 
-								getName(), peerDescription().c_str());
-							q->close();
-							setMode(PROT_MODE_DONE);
-							break;
-						default:
-							q->close();
-							setMode(PROT_MODE_DONE);
-					}
-					getKernel()->addEvent(new Event(EVENT_TYPE_DATAOBJECT_SEND_FAILURE, 
-									dObj, peerNode));
-				}
+				if (pEvent != PROT_EVENT_PENDING)
+					handleSendResult(dObj, pEvent);
 				break;
 			case PROT_EVENT_INCOMING_DATA:
+				// While data objects are in flight, this is usually 
+				// an ACK or REJECT, but it may be a data object
+				if (!inFlight.empty()) {
+					bool isCtrlMsg = false;
+
+					pEvent = peekControlMessage(&isCtrlMsg);
+
+					if (pEvent != PROT_EVENT_SUCCESS)
+						failInFlight();
+					else if (isCtrlMsg)
+						pEvent = waitForPipelineAcks(inFlight.size() - 1);
+
+					if (pEvent != PROT_EVENT_SUCCESS) {
+						q->close();
+						closeConnection();
+						setMode(PROT_MODE_DONE);
+						break;
+					}
+
+					if (isCtrlMsg)
+						break;
+				}
 				// Data object to receive:
 				HAGGLE_DBG("%s Incoming data object from [%s]\n", 
 					   getName(), peerDescription().c_str());
@@ -1256,6 +1728,8 @@ bool Protocol::run()
 
 	HAGGLE_DBG("%s DONE!\n", getName());
 
+	failInFlight();
+
 	if (isConnected())
 		closeConnection();
 
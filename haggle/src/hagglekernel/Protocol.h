@@ -26,6 +26,8 @@ typedef unsigned short ProtType_t;
 #include <libcpphaggle/Platform.h>
 #include <libcpphaggle/Timeval.h>
 #include <libcpphaggle/Watch.h>
+#include <libcpphaggle/List.h>
+#include <libcpphaggle/Pair.h>
 
 #include "ProtocolManager.h"
 #include "ManagerModule.h"
@@ -71,6 +73,7 @@ typedef enum {
         PROT_EVENT_TXQ_NEW_DATAOBJECT,
         PROT_EVENT_INCOMING_DATA,
         PROT_EVENT_WRITEABLE,
+	PROT_EVENT_PENDING, // A pipelined data object is waiting for its ACK
 } ProtocolEvent;
 
 typedef enum {
@@ -113,6 +116,12 @@ typedef enum {
 // many protocols running. A small buffer may be inefficient.
 #define PROTOCOL_BUFSIZE (4096) 
 
+// The maximum number of data objects that may wait for an ACK when the
+// peer accepts pipelined data objects
+#define PROT_PIPELINE_WINDOW 8
+// A receiver ACKs at least this often when data objects keep arriving
+#define PROT_PIPELINE_ACK_INTERVAL (PROT_PIPELINE_WINDOW / 2)
+
 /**
 	Protocol class
 
@@ -181,14 +190,69 @@ private:
                 CTRLMSG_TYPE_ACK = 5, // use something which is not zero
                 CTRLMSG_TYPE_ACCEPT,
                 CTRLMSG_TYPE_REJECT,
-		CTRLMSG_TYPE_TERMINATE /* Terminate the transmission of data objects.
+		CTRLMSG_TYPE_TERMINATE, /* Terminate the transmission of data objects.
 					Currently not implemented. */
+		CTRLMSG_TYPE_PIPELINE, /* The receiver accepts pipelined data objects */
+		CTRLMSG_TYPE_BINARY_METADATA /* The receiver accepts binary metadata headers */
         } ctrlmsg_type_t;
 
         typedef struct ctrlmsg {
                 u_int32_t type;
                 DataObjectId_t dobj_id;
         } ctrlmsg_t;
+
+	/*
+	  Pipelining lets a sender stream data objects without waiting
+	  for the ACK of one data object before sending the next one.
+
+	  A sender offers pipelining by putting the processing
+	  instruction PROT_PIPELINE_OFFER in the metadata header of
+	  the first data object it sends on a connection. XML parsers
+	  ignore it, so old receivers treat the data object as usual.
+	  A receiver that supports pipelining answers with a PIPELINE
+	  control message before the ACCEPT/REJECT of that data object,
+	  and all data objects that follow are pipelined.
+
+	  Pipelined data objects are numbered from one, and the
+	  sequence number is carried in the upper 16 bits of the type
+	  of the control messages that refer to them. The receiver
+	  skips the ACCEPT/REJECT for data objects without data, as the
+	  sender does not wait for it. An ACK acknowledges all data
+	  objects up to its sequence number, so the receiver may delay
+	  it while more data objects are arriving. A REJECT is the final
+	  answer for that data object only.
+
+	  Old peers send the type of control messages in host byte
+	  order. Once pipelining is agreed on, the receiver switches to
+	  version 1 of the control messages, which carry the type in
+	  network byte order. The PIPELINE message itself, and all
+	  messages before it, are in the old format. Either way, the type
+	  is kept in host byte order once received.
+
+	  While data objects are in flight, the peer may also send data
+	  objects on the same connection. Their headers never look like
+	  the type of a control message, so the two can be told apart
+	  before the data is parsed.
+	*/
+#define PROT_PIPELINE_OFFER "<?haggle-pipeline?>"
+#define PROT_PIPELINE_OFFER_LEN (sizeof(PROT_PIPELINE_OFFER) - 1)
+
+	/*
+	  A sender offers to send metadata headers in the binary format
+	  (see BinaryMetadata) the same way, with the processing
+	  instruction PROT_BINARY_METADATA_OFFER next to the pipelining
+	  offer. A receiver that can decode binary headers answers with
+	  a BINARY_METADATA control message before the ACCEPT/REJECT,
+	  and the sender uses the binary format for all data objects
+	  that follow. A receiver accepts both formats at any time.
+	*/
+#define PROT_BINARY_METADATA_OFFER "<?haggle-binary-metadata?>"
+#define PROT_BINARY_METADATA_OFFER_LEN (sizeof(PROT_BINARY_METADATA_OFFER) - 1)
+#define CTRLMSG_TYPE(m) ((m)->type & 0xffff)
+#define CTRLMSG_SEQNO(m) ((u_int16_t)((m)->type >> 16))
+#define CTRLMSG_SET_TYPE(m, t, seqno) ((m)->type = ((u_int32_t)(seqno) << 16) | (t))
+
+	typedef Pair<u_int16_t, DataObjectRef> InFlightDataObject;
 protected:
 	/**
 	   True if the Protocol is registered with the Protocol manager.
@@ -237,11 +301,73 @@ protected:
         // The amount of data read into the buffer
         size_t bufferDataLen;
 
+	// Pipelining state, see the description of the control messages
+	bool pipelineOffered; // We have offered the peer pipelining
+	bool txPipelined; // The peer accepts pipelined data objects from us
+	bool rxPipelined; // The peer sends us pipelined data objects
+	bool txBinaryMetadata; // The peer accepts binary metadata headers from us
+	u_int16_t txSeqno; // The sequence number of the last data object sent
+	u_int16_t rxSeqno; // The sequence number of the last data object received
+	unsigned int rxUnacked; // The number of received data objects not yet ACKed
+	u_int16_t rxAckSeqno; // The sequence number of the last data object not yet ACKed
+	// Data objects sent, but not yet ACKed, in the order they were sent
+	List<InFlightDataObject> inFlight;
+
+	/**
+	   Handle an ACK or REJECT for pipelined data objects, and report
+	   the result of the data objects it refers to.
+	   
+	   Returns: true if the control message referred to a data object
+	   in flight, or false otherwise.
+	*/
+	bool handlePipelineControlMessage(struct ctrlmsg *m);
+	/**
+	   Check if the next data from the peer is a control message, 
+	   reading the start of it into the buffer if needed.
+	*/
+	ProtocolEvent peekControlMessage(bool *isCtrlMsg);
+	/**
+	   Receive a control message about pipelined data objects, first
+	   receiving any data objects that the peer sends before it.
+	*/
+	ProtocolEvent receivePipelineControlMessage(struct ctrlmsg *m);
+	/**
+	   Receive control messages until at most 'max' data objects are in
+	   flight.
+	*/
+	ProtocolEvent waitForPipelineAcks(unsigned long max);
+	/**
+	   Report all data objects in flight as failed.
+	*/
+	void failInFlight();
+	/**
+	   Send an ACK for the data objects received but not yet ACKed.
+	*/
+	ProtocolEvent sendPipelineAck();
+
         /**
            Receive a data object from the connected peer.
          */
         virtual ProtocolEvent receiveDataObject();
 
+	/**
+	   Turn an error from sendData() or sendFileData() into the event
+	   that should end the send, or PROT_EVENT_SUCCESS to try again
+	   (after a pause) when the send would block.
+	*/
+	ProtocolEvent handleSendError(int *blockCount);
+	/**
+	   Send the data of a data object from its file with sendFileData(),
+	   once the header has been sent.
+	*/
+	ProtocolEvent sendDataFromFile(DataObjectDataRetrieverRef& retriever, size_t *bytesSent);
+
+	/**
+	   Report the result of sending a data object, and take the 
+	   action the result calls for.
+	*/
+	void handleSendResult(const DataObjectRef& dObj, ProtocolEvent pEvent);
+
 	// Generate a description of the peer node for this protocol.
 	// This function handles the fact that a node may be undefined
 	// before the node description is received. In that case, the
@@ -302,6 +428,23 @@ protected:
         {
                 return PROT_EVENT_ERROR;
         }
+        /**
+        	Returns true if the protocol can send bytes directly from a file
+        	with sendFileData().
+        */
+        virtual bool canSendFileData() const { return false; }
+        /**
+        	Wrapper to send up to len bytes from the file 'fd', starting at
+        	'offset', without copying them through the protocol buffer. 
+        	Should be implemented by derived classes that can do this.
+        	
+        	Returns: Protocol event indicating success, or error. On 
+        	success, zero bytes means that the file ended early.
+        */
+        virtual ProtocolEvent sendFileData(int fd, off_t offset, size_t len, size_t *bytes)
+        {
+                return PROT_EVENT_ERROR;
+        }
 
         virtual ProtocolError getProtocolError();
         virtual const char *getProtocolErrorStr();
@@ -616,7 +759,9 @@ public:
         	This function takes a data object to send and sends it immediately.
         	
         	Returns: PROT_EVENT_SUCCESS on successful transmission, another
-        	protocol event on failiure.
+        	protocol event on failiure. PROT_EVENT_PENDING is returned when the
+        	data object was pipelined, and the result is reported once the 
+        	peer acknowledges it.
         	
         	This function does not delete the data object. The data object remains
         	the property of the caller. (This is the way it's supposed to be, so
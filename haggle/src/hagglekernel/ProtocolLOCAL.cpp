@@ -19,191 +19,492 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
-#include <libcpphaggle/Exception.h>
 #include <haggleutils.h>
 
 #include "ProtocolLOCAL.h"
 
-ProtocolLOCAL::ProtocolLOCAL(SOCKET _sock, const InterfaceRef& _localIface, const InterfaceRef& _peerIface, 
-			 const char *_path, const short flags, ProtocolManager * m) :
-	ProtocolSocket(Protocol::TYPE_LOCAL, "ProtocolLOCAL", _localIface, _peerIface, flags, m, _sock), uaddr(_path)
-{
-}
+#include "../libhaggle/include/libhaggle/ipc.h"
 
-ProtocolLOCAL::ProtocolLOCAL(const InterfaceRef& _localIface, const InterfaceRef& _peerIface, 
-			 const char *_path, const short flags, ProtocolManager * m) : 
-	ProtocolSocket(Protocol::TYPE_LOCAL, "ProtocolLOCAL", _localIface, _peerIface, flags, m), uaddr(_path)
-{
-}
+#define PROTOCOL_LOCAL_BUFSIZE (50000)
 
-ProtocolLOCAL::~ProtocolLOCAL()
-{
-	unlink(uaddr.getStr());
-}
+/*
+	Unix domain datagram sockets queue only a few datagrams per receiver,
+	so sending blocks until an application has read some of its data
+	objects. This is how long we wait before a data object is dropped.
+*/
+#define PROTOCOL_LOCAL_SEND_TIMEOUT_MSECS 100
 
-bool ProtocolLOCAL::initbase()
+bool ProtocolLOCAL::init_derived()
 {
-	int optval = 1;
 	struct sockaddr_un local_addr;
-        socklen_t addrlen = 0;
-        
-	uaddr.fillInSockaddr(&local_addr);
+	struct timeval timeout = { 0, PROTOCOL_LOCAL_SEND_TIMEOUT_MSECS * 1000 };
+	struct stat st;
+	socklen_t addrlen;
+	UnixAddress *addr;
 
 	if (!localIface) {
-		HAGGLE_ERR("Local interface is NULL\n");
+		HAGGLE_ERR("Could not create LOCAL socket, no local interface\n");
                 return false;
-        }
-	
-	// Check if we are already connected, i.e., we are a client
-	// that was created from acceptClient()
-	if (isConnected()) {
-		// Nothing to initialize
-		return true;
 	}
-	
-	if (localIface->getType() != Interface::TYPE_APPLICATION_LOCAL) {
-		HAGGLE_ERR("Local interface type is not LOCAL\n");
+
+	addr = localIface->getAddress<UnixAddress>();
+
+	if (!addr) {
+		HAGGLE_ERR("Could not create LOCAL socket, no path\n");
+                return false;
+	}
+
+	addrlen = addr->fillInSockaddr(&local_addr);
+
+	if (addrlen == 0) {
+		HAGGLE_ERR("Bad LOCAL socket path %s\n", addr->getStr());
 		return false;
 	}
-		
-	if (!openSocket(local_addr.sun_family, SOCK_STREAM, 0, isServer())) {
-		HAGGLE_ERR("Could not create LOCAL socket\n");
+
+	// A socket left behind by a previous instance would make bind fail
+	if (stat(local_addr.sun_path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(local_addr.sun_path);
+
+	if (!openSocket(AF_UNIX, SOCK_DGRAM, 0, true, false)) {
+		HAGGLE_ERR("Could not open LOCAL socket\n");
                 return false;
 	}
-	
-	if (!setSocketOption(SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval))) {
+
+	if (!setSocketOption(SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout))) {
 		closeSocket();
-		HAGGLE_ERR("setsockopt SO_REUSEADDR failed\n");
+		HAGGLE_ERR("setsockopt SO_SNDTIMEO failed\n");
                 return false;
 	}
-	
-	if (!setSocketOption(SOL_SOCKET, SO_KEEPALIVE, &optval, sizeof(optval))) {
-		closeSocket();
-		HAGGLE_ERR("setsockopt SO_KEEPALIVE failed\n");
-                return false;
+
+	// For application IPC socket we need a large receive buffer.
+	if (!multiplyReceiveBufferSize(2)) {
+		HAGGLE_ERR("Could not increase receive buffer size.\n");
 	}
-	
+
 	if (!bind((struct sockaddr *)&local_addr, addrlen)) {
 		closeSocket();
-		HAGGLE_ERR("Could not bind LOCAL socket\n");
-                return false;
-        }
-	
-   
-	HAGGLE_DBG("%s Created LOCAL socket - %s\n", getName(), uaddr.getStr());
-   	
+		return false;
+	}
+
+	HAGGLE_DBG("Application socket bound to %s\n", local_addr.sun_path);
+
 	return true;
 }
 
-bool ProtocolLOCALClient::init_derived()
+ProtocolLOCAL::ProtocolLOCAL(const char *path, ProtocolManager * m) :
+	ProtocolSocket(Protocol::TYPE_LOCAL, "ProtocolLOCAL", NULL, NULL,
+		       PROT_FLAG_SERVER | PROT_FLAG_CLIENT, m, -1, PROTOCOL_LOCAL_BUFSIZE)
 {
-	if (!peerIface) {
-		HAGGLE_ERR("Client has no peer interface\n");
-		return false;
+	UnixAddress address(path);
+
+	localIface = new ApplicationLocalInterface(path, "Application", &address, IFFLAG_UP);
+}
+
+ProtocolLOCAL::~ProtocolLOCAL()
+{
+	UnixAddress *addr = localIface ? localIface->getAddress<UnixAddress>() : NULL;
+
+	if (addr && addr->getStr())
+		unlink(addr->getStr());
+
+	while (!rings.empty()) {
+		munmap(rings.begin()->second, HAGGLE_IPC_RING_FILE_SIZE);
+		rings.erase(rings.begin());
 	}
-	return initbase();
 }
 
-ProtocolEvent ProtocolLOCALClient::connectToPeer()
+/*
+	Applications create their rings, so we only map the ring of an
+	application once it sends us something. Applications send their
+	metadata in datagrams until we have replied through the ring, so
+	nothing is lost if we cannot map it. An application that exits 
+	leaves its ring mapped until another one is mapped.
+*/
+void ProtocolLOCAL::removeStaleRings()
 {
-	socklen_t addrlen;
-	struct sockaddr_un peer_addr;
-	InterfaceRef pIface; 
-	UnixAddress *addr;
-	
-	if (!peerIface || peerIface->getType() != Interface::TYPE_APPLICATION_LOCAL)
-		return PROT_EVENT_ERROR;
-	    
-	addr = peerIface->getAddress<UnixAddress>();
-		
-	if (!addr) {
-		HAGGLE_DBG("No LOCAL address to connect to\n");
-		return PROT_EVENT_ERROR;
+	RingMap::iterator it = rings.begin();
+
+	while (it != rings.end()) {
+		struct stat st;
+
+		if (stat((*it).first.c_str(), &st) != 0) {
+			munmap((*it).second, HAGGLE_IPC_RING_FILE_SIZE);
+			rings.erase(it++);
+		} else {
+			it++;
+		}
 	}
-	
-        addrlen = addr->fillInSockaddr(&peer_addr);
-	
-	ProtocolEvent ret = openConnection((struct sockaddr *)&peer_addr, addrlen);
-	
-	if (ret != PROT_EVENT_SUCCESS) {
-		HAGGLE_DBG("%s Connection failed to LOCAL [%s]\n", 
-			   getName(), addr->getStr());
-		return ret;
-	}
-	
-	HAGGLE_DBG("%s Connected to LOCAL [%s]\n", getName(), addr->getStr());
-	
-	return ret;
 }
 
-ProtocolLOCALServer::ProtocolLOCALServer(const InterfaceRef& _localIface, ProtocolManager *m, const char *_path, int _backlog) :
-	ProtocolLOCAL(_localIface, NULL, _path, PROT_FLAG_SERVER, m), backlog(_backlog) 
+/*
+	Maps the ring of an application that sent us a datagram, if it has
+	one, so that our replies tell it that the ring can be used.
+*/
+struct haggle_ipc_ring_file *ProtocolLOCAL::findRing(const char *path)
 {
+	struct haggle_ipc_ring_file header;
+	string ringpath = string(path) + HAGGLE_IPC_RING_SUFFIX;
+	ssize_t ret;
+	int fd;
+
+	fd = open(ringpath.c_str(), O_RDONLY);
+
+	// Older applications have no ring
+	if (fd < 0)
+		return NULL;
+
+	ret = read(fd, &header, sizeof(header));
+
+	close(fd);
+
+	if (ret != sizeof(header) || header.magic != HAGGLE_IPC_RING_MAGIC)
+		return NULL;
+
+	return getRing(path, header.id);
 }
 
-ProtocolLOCALServer::~ProtocolLOCALServer()
+struct haggle_ipc_ring_file *ProtocolLOCAL::getRing(const char *path, unsigned int id)
 {
+	Mutex::AutoLocker l(ringMutex);
+	struct haggle_ipc_ring_file *f;
+	RingMap::iterator it = rings.find(path);
+	string ringpath = string(path) + HAGGLE_IPC_RING_SUFFIX;
+	struct stat st;
+	int fd;
+
+	if (it != rings.end()) {
+		if ((*it).second->id == id)
+			return (*it).second;
+
+		// An application that went away had the same socket
+		munmap((*it).second, HAGGLE_IPC_RING_FILE_SIZE);
+		rings.erase(it);
+	}
+
+	removeStaleRings();
+
+	fd = open(ringpath.c_str(), O_RDWR);
+
+	if (fd < 0) {
+		HAGGLE_ERR("Could not open ring %s: %s\n", ringpath.c_str(), STRERROR(ERRNO));
+		return NULL;
+	}
+
+	if (fstat(fd, &st) != 0 || st.st_size < HAGGLE_IPC_RING_FILE_SIZE) {
+		HAGGLE_ERR("Ring %s is too small\n", ringpath.c_str());
+		close(fd);
+		return NULL;
+	}
+
+	f = (struct haggle_ipc_ring_file *)mmap(NULL, HAGGLE_IPC_RING_FILE_SIZE, 
+						PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	close(fd);
+
+	if (f == MAP_FAILED) {
+		HAGGLE_ERR("Could not map ring %s: %s\n", ringpath.c_str(), STRERROR(ERRNO));
+		return NULL;
+	}
+
+	if (f->magic != HAGGLE_IPC_RING_MAGIC || f->id != id) {
+		HAGGLE_ERR("Ring %s does not belong to %s\n", ringpath.c_str(), path);
+		munmap(f, HAGGLE_IPC_RING_FILE_SIZE);
+		return NULL;
+	}
+
+	rings.insert(make_pair(path, f));
+
+	HAGGLE_DBG("Mapped ring %s\n", ringpath.c_str());
+
+	return f;
 }
 
+bool ProtocolLOCAL::isSender()
+{
+	return true;
+}
 
-bool ProtocolLOCALServer::init_derived()
+bool ProtocolLOCAL::isReceiver()
 {
-	if (!initbase())
-		return false;
-	
-	if (!setListen(backlog))  {
-		HAGGLE_ERR("Could not set listen mode on socket\n");
-        }
 	return true;
 }
 
-ProtocolEvent ProtocolLOCALServer::acceptClient()
+bool ProtocolLOCAL::isForInterface(const InterfaceRef& iface)
+{
+	// Same reasoning as in ProtocolUDP: all local application
+	// interfaces are reached through this protocol.
+	if (iface->getType() == Interface::TYPE_APPLICATION_LOCAL &&
+	    localIface->getType() == Interface::TYPE_APPLICATION_LOCAL)
+		return true;
+	else if (peerIface && iface == peerIface)
+		return true;
+
+	return false;
+}
+
+bool ProtocolLOCAL::sendDataObject(const DataObjectRef& dObj, const NodeRef& peer, const InterfaceRef& _peerIface)
+{
+	int ret = PROT_EVENT_ERROR;
+
+	if (peerIface) {
+		HAGGLE_ERR("Peer interface %s is set when it shouldn't be\n", peerIface->getIdentifierStr());
+	} else {
+		// Reassign the peer interface to our target destination
+		peerIface = _peerIface;
+
+		ret = sendDataObjectNow(dObj);
+
+		// Note: failures are handled by the caller (ProtocolManager)
+		if (ret == PROT_EVENT_SUCCESS) {
+			getKernel()->addEvent(new Event(EVENT_TYPE_DATAOBJECT_SEND_SUCCESSFUL, dObj, peer));
+		}
+	}
+
+	peerIface = NULL;
+
+	return ret == PROT_EVENT_SUCCESS;
+}
+
+ProtocolEvent ProtocolLOCAL::receiveDataObject()
 {
+	size_t len = 0;
+	const unsigned char *data = buffer;
+	struct haggle_ipc_ring_file *ring = NULL;
+	struct haggle_ipc_ring_notice notice;
+	DataObjectRef dObj;
 	struct sockaddr_un peer_addr;
-	socklen_t len;
-	SOCKET clientsock;
-	ProtocolLOCALClient *p = NULL;
-	
-	HAGGLE_DBG("In LOCALServer receive\n");
-	
-	if (getMode() != PROT_MODE_LISTENING) {
-		HAGGLE_DBG("Error: LOCALServer not in LISTEN mode\n");
+	ProtocolEvent pEvent;
+
+	pEvent = receiveData(buffer, bufferSize, (struct sockaddr *)&peer_addr, MSG_DONTWAIT, &len);
+
+	if (pEvent != PROT_EVENT_SUCCESS)
+		return pEvent;
+
+	peer_addr.sun_path[sizeof(peer_addr.sun_path) - 1] = '\0';
+
+	// Applications must bind their end of the socket, or we
+	// cannot send anything back to them
+	if (peer_addr.sun_family != AF_UNIX || peer_addr.sun_path[0] == '\0') {
+		HAGGLE_ERR("Data from unnamed LOCAL socket, ignoring\n");
 		return PROT_EVENT_ERROR;
 	}
-	
-	len = sizeof(struct sockaddr_un);
-	
-	clientsock = accept((struct sockaddr *)&peer_addr, &len);
-	
-	if (clientsock == SOCKET_ERROR)
-		return PROT_EVENT_ERROR;
-	
-	if (!getManager()) {
-		HAGGLE_DBG("Error: No manager for protocol!\n");
-		CLOSE_SOCKET(clientsock);
+
+	if (peerIface) {
+		HAGGLE_ERR("LOCAL peer interface was not null\n");
 		return PROT_EVENT_ERROR;
 	}
-		
+
+	// The metadata may be in the ring of the application
+	if (len == sizeof(notice)) {
+		memcpy(&notice, buffer, sizeof(notice));
+
+		if (notice.magic == HAGGLE_IPC_RING_MAGIC) {
+			ring = getRing(peer_addr.sun_path, notice.id);
+
+			if (!ring)
+				return PROT_EVENT_ERROR;
+
+			// The application could have written anything here
+			if (notice.len == 0 || notice.offset >= HAGGLE_IPC_RING_SIZE ||
+			    notice.len > HAGGLE_IPC_RING_SIZE - notice.offset) {
+				HAGGLE_ERR("Bad ring notice from %s\n", peer_addr.sun_path);
+				return PROT_EVENT_ERROR;
+			}
+
+			data = HAGGLE_IPC_RING_DATA(ring, &ring->to_haggle) + notice.offset;
+			len = notice.len;
+		}
+	}
+
+	if (!ring)
+		findRing(peer_addr.sun_path);
+
 	UnixAddress addr(peer_addr);
 
-        p = new ProtocolLOCALReceiver(clientsock, localIface, resolvePeerInterface(addr), peer_addr.sun_path, getManager());
-	
-	if (!p || !p->init()) {
-		HAGGLE_DBG("Unable to create new LOCAL client on socket %d\n", clientsock);
-		CLOSE_SOCKET(clientsock);
-		
-		if (p)
-			delete p;
-		
+	peerIface = new ApplicationLocalInterface(peer_addr.sun_path, "Application", &addr, IFFLAG_UP);
+        peerNode = getKernel()->getNodeStore()->retrieve(peerIface);
+
+	if (!peerNode) {
+		peerNode = Node::create(Node::TYPE_APPLICATION, "Unknown application");
+
+		if (!peerNode) {
+			HAGGLE_ERR("Could not create application node\n");
+			peerIface = NULL;
+			return PROT_EVENT_ERROR;
+		}
+	}
+
+	dObj = DataObject::create(data, len, localIface, peerIface);
+
+	if (ring) {
+		// Done with the record, so the application may overwrite it
+		__sync_synchronize();
+		ring->to_haggle.tail = notice.end;
+	}
+
+        // Release the peer interface, the next datagram might be
+        // from another application
+        peerIface = NULL;
+
+	if (!dObj) {
+                HAGGLE_DBG("%s:%lu Could not create data object\n", getName(), getId());
 		return PROT_EVENT_ERROR;
 	}
-	
-	p->registerWithManager();
-	
-	HAGGLE_DBG("Accepted client with socket %d, starting client thread\n", clientsock);
-	
-	return p->startTxRx();
+
+	dObj->setReceiveTime(Timeval::now());
+
+	if (getKernel()->getThisNode()->getBloomfilter()->has(dObj)) {
+		HAGGLE_DBG("Data object [%s] from %s has already been received, ignoring.\n",
+			dObj->getIdStr(), peer_addr.sun_path);
+		return PROT_EVENT_SUCCESS;
+	}
+
+	getKernel()->addEvent(new Event(EVENT_TYPE_DATAOBJECT_INCOMING, dObj, peerNode));
+
+	HAGGLE_DBG("Received data object [%s] from %s\n",
+		dObj->getIdStr(), peer_addr.sun_path);
+
+	// Each datagram holds a complete data object
+	getKernel()->addEvent(new Event(EVENT_TYPE_DATAOBJECT_RECEIVED, dObj, peerNode));
+
+	return PROT_EVENT_SUCCESS;
+}
+
+/*
+	Copies a record into a ring, and fills in the notice that tells the
+	reader where it is. Returns false if the ring has no room for it.
+	Only the offset is taken from the ring, as the application can
+	change the rest.
+*/
+static bool ring_write(struct haggle_ipc_ring_file *f, struct haggle_ipc_ring *r, 
+		       const void *data, size_t len, struct haggle_ipc_ring_notice *n)
+{
+	unsigned int head = r->head;
+	unsigned int offset = head & (HAGGLE_IPC_RING_SIZE - 1);
+	unsigned int pad = 0;
+
+	if (len == 0 || len > HAGGLE_IPC_RING_SIZE)
+		return false;
+
+	if (offset + len > HAGGLE_IPC_RING_SIZE) {
+		pad = HAGGLE_IPC_RING_SIZE - offset;
+		offset = 0;
+	}
+
+	if ((head - r->tail) + pad + len > HAGGLE_IPC_RING_SIZE)
+		return false;
+
+	memcpy(HAGGLE_IPC_RING_DATA(f, r) + offset, data, len);
+
+	n->magic = HAGGLE_IPC_RING_MAGIC;
+	n->id = f->id;
+	n->offset = offset;
+	n->len = (unsigned int)len;
+	n->end = head + pad + (unsigned int)len;
+
+	r->head = n->end;
+
+	return true;
+}
+
+/*
+	Sends data through the ring of the application it is for. Returns
+	false, without sending anything, if the application has no ring
+	or it is full. Otherwise, ret is set like by sendTo().
+*/
+bool ProtocolLOCAL::sendToRing(const void *buf, size_t len, const int flags, 
+			       const struct sockaddr_un *sa, socklen_t addrlen, ssize_t *ret)
+{
+	Mutex::AutoLocker l(ringMutex);
+	struct haggle_ipc_ring_notice notice;
+	struct haggle_ipc_ring *r;
+	RingMap::iterator it = rings.find(sa->sun_path);
+	unsigned int head;
+
+	if (it == rings.end())
+		return false;
+
+	r = &(*it).second->from_haggle;
+	head = r->head;
+
+	if (!ring_write((*it).second, r, buf, len, &notice))
+		return false;
+
+	*ret = sendTo(&notice, sizeof(notice), flags, (struct sockaddr *)sa, addrlen);
+
+	if (*ret < 0) {
+		// The application will never read the record
+		r->head = head;
+	} else if (*ret > 0) {
+		*ret = len;
+	}
+
+	return true;
+}
+
+ProtocolEvent ProtocolLOCAL::sendData(const void *buffer, size_t len, const int flags, size_t *bytes)
+{
+	struct sockaddr_un sa;
+	socklen_t addrlen;
+	UnixAddress *addr;
+	ssize_t ret;
+
+	if (!buffer) {
+		HAGGLE_DBG("Send buffer is NULL\n");
+		return PROT_EVENT_ERROR;
+	}
+
+	if (!peerIface) {
+		HAGGLE_DBG("Send interface invalid\n");
+		*bytes = 0;
+		return PROT_EVENT_ERROR;
+	}
+
+	addr = peerIface->getAddress<UnixAddress>();
+
+	if (!addr || (addrlen = addr->fillInSockaddr(&sa)) == 0) {
+		HAGGLE_DBG("Send interface has no valid path\n");
+		*bytes = 0;
+		return PROT_EVENT_ERROR;
+	}
+
+	if (!sendToRing(buffer, len, flags, &sa, addrlen, &ret))
+		ret = sendTo(buffer, len, flags, (struct sockaddr *)&sa, addrlen);
+
+	if (ret < 0)
+		return PROT_EVENT_ERROR;
+	else if (ret == 0)
+		return PROT_EVENT_PEER_CLOSED;
+
+	*bytes = ret;
+
+	return PROT_EVENT_SUCCESS;
+}
+
+ProtocolEvent ProtocolLOCAL::receiveData(void *buf, size_t buflen, struct sockaddr *peer_addr, const int flags, size_t *bytes)
+{
+	socklen_t addrlen = sizeof(struct sockaddr_un);
+	ssize_t ret;
+
+	*bytes = 0;
+
+	memset(peer_addr, 0, addrlen);
+
+	ret = recvFrom(buf, buflen, flags, peer_addr, &addrlen);
+
+	if (ret < 0) {
+		return PROT_EVENT_ERROR;
+	} else if (ret == 0)
+		return PROT_EVENT_PEER_CLOSED;
+
+	*bytes = ret;
+
+	return PROT_EVENT_SUCCESS;
 }
 
-#endif
+#endif /* OS_WINDOWS */
@@ -15,87 +15,63 @@
 #ifndef _PROTOCOLLOCAL_H
 #define _PROTOCOLLOCAL_H
 
+/*
+	Forward declarations of all data types declared in this file. This is to
+	avoid circular dependencies. If/when a data type is added to this file,
+	remember to add it here.
+*/
 class ProtocolLOCAL;
-class ProtocolLOCALClient;
-class ProtocolLOCALServer;
-
 
 #include <libcpphaggle/Platform.h>
+#include <libcpphaggle/Map.h>
+#include <libcpphaggle/Mutex.h>
+#include <libcpphaggle/String.h>
 
 #include "ProtocolSocket.h"
 #include <sys/types.h>
 #include <sys/un.h>
 
-/* Configurable parameters */
-#define LOCAL_DEFAULT_BACKLOG 10
-#define LOCAL_DEFAULT_PATH "/tmp/haggle.sock"
-
-/** */
-class ProtocolLOCAL : public ProtocolSocket
-{
-        friend class ProtocolLOCALServer;
-        friend class ProtocolLOCALClient;
-	UnixAddress uaddr;
-	bool initbase();
-        ProtocolLOCAL(SOCKET sock, const InterfaceRef& _localIface, const InterfaceRef& _peerIface,
-		    const char *_path, const short flags = PROT_FLAG_CLIENT, ProtocolManager *m = NULL);
-public:
-        ProtocolLOCAL(const InterfaceRef& _localIface, const InterfaceRef& _peerIface,
-                    const char *_path = LOCAL_DEFAULT_PATH,
-                    const short flags = PROT_FLAG_CLIENT, ProtocolManager *m = NULL);
-        virtual ~ProtocolLOCAL() = 0;
-};
-
-/** */
-class ProtocolLOCALClient : public ProtocolLOCAL
-{
-        friend class ProtocolLOCALServer;
-	bool init_derived();
-public:
-        ProtocolLOCALClient(SOCKET sock, const InterfaceRef& _localIface, const InterfaceRef& _peerIface, const char *_path, ProtocolManager *m = NULL) : 
-	ProtocolLOCAL(sock, _localIface, _peerIface, _path, PROT_FLAG_CLIENT | PROT_FLAG_CONNECTED, m) {}
-        ProtocolLOCALClient(const InterfaceRef& _localIface, const InterfaceRef& _peerIface,
-                          const char *_path = LOCAL_DEFAULT_PATH, ProtocolManager *m = NULL) :
-	ProtocolLOCAL(_localIface, _peerIface, _path, PROT_FLAG_CLIENT, m) {}
-        ProtocolEvent connectToPeer();};
+/*
+	The name of the socket that applications on the same machine connect
+	to. It is created in the private Haggle directory, where libhaggle
+	looks for it next to the pid file.
+*/
+#define HAGGLE_LOCAL_SOCKET "haggle.sock"
 
+struct haggle_ipc_ring_file;
 
-/** */
-class ProtocolLOCALSender : public ProtocolLOCALClient
-{
-public:
-	ProtocolLOCALSender(const InterfaceRef& _localIface, 
-			  const InterfaceRef& _peerIface,
-			  const char *_path = LOCAL_DEFAULT_PATH, 
-			  ProtocolManager *m = NULL) :
-	ProtocolLOCALClient(_localIface, _peerIface, _path, m) {}
-	bool isSender() { return true; }
-};
-
-/** */
-class ProtocolLOCALReceiver : public ProtocolLOCALClient
-{
-public:
-	ProtocolLOCALReceiver(SOCKET sock, 
-			    const InterfaceRef& _localIface,
-			    const InterfaceRef& _peerIface,
-			    const char  *_path,
-			    ProtocolManager *m = NULL) : 
-	ProtocolLOCALClient(sock, _localIface, _peerIface, _path, m) {}
-	bool isReceiver() { return true; }
-};
-
-/** */
-class ProtocolLOCALServer : public ProtocolLOCAL
+/**
+	Application IPC over a Unix domain datagram socket. It works like the
+	UDP application protocol, but the data objects exchanged with local
+	applications do not pass through the IP stack, and the socket can only
+	be reached from this machine.
+*/
+class ProtocolLOCAL : public ProtocolSocket
 {
-        friend class ProtocolLOCAL;
-        int backlog;
+	/*
+		The shared memory rings of the applications that have
+		them, by the path of their socket. The mutex protects the
+		map and the rings, which are written to from other threads
+		than the one that reads them.
+	*/
+	typedef Map<string, struct haggle_ipc_ring_file *> RingMap;
+	RingMap rings;
+	Mutex ringMutex;
+	struct haggle_ipc_ring_file *findRing(const char *path);
+	struct haggle_ipc_ring_file *getRing(const char *path, unsigned int id);
+	void removeStaleRings();
+	bool sendToRing(const void *buf, size_t len, const int flags, const struct sockaddr_un *sa, socklen_t addrlen, ssize_t *ret);
+        ProtocolEvent sendData(const void *buf, size_t buflen, const int flags, size_t *bytes);
+	ProtocolEvent receiveData(void *buf, size_t buflen, struct sockaddr *peer_addr, const int flags, size_t *bytes);
+	ProtocolEvent receiveDataObject();
 	bool init_derived();
 public:
-        ProtocolLOCALServer(const InterfaceRef& _localIface = NULL, ProtocolManager *m = NULL,
-                          const char *_path = LOCAL_DEFAULT_PATH, int _backlog = LOCAL_DEFAULT_BACKLOG);
-        ~ProtocolLOCALServer();
-        ProtocolEvent acceptClient();
+	ProtocolLOCAL(const char *path, ProtocolManager *m = NULL);
+	~ProtocolLOCAL();
+	bool isForInterface(const InterfaceRef& iface);
+	bool isSender();
+	bool isReceiver();
+	bool sendDataObject(const DataObjectRef& dObj, const NodeRef& peer, const InterfaceRef& _peerIface);
 };
 
 #endif /* PROTOCOLLOCAL_H */
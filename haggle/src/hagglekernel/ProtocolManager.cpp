@@ -351,24 +351,6 @@ public:
 	}
 };
 
-class PeerParentCriteria : public InterfaceStore::Criteria
-{
-	InterfaceRef parent;
-	InterfaceRef peerIface;
-public:
-	PeerParentCriteria(const InterfaceRef& iface) : parent(NULL), peerIface(iface) {}
-	virtual bool operator() (const InterfaceRecord& ir)
-	{
-		if (parent && ir.iface && parent == ir.iface && ir.iface->isUp())
-			return true;
-
-		if (ir.iface == peerIface)
-			parent = ir.parent;
-
-		return false;
-	}
-};
-
 Protocol *ProtocolManager::getSenderProtocol(const ProtType_t type, const InterfaceRef& peerIface)
 {
 	Protocol *p = NULL;
@@ -392,22 +374,29 @@ Protocol *ProtocolManager::getSenderProtocol(const ProtType_t type, const Interf
 	
 	// Did we find a protocol?
 	if (p == NULL) {
-		// Nope. Find a suitable local interface to associate with the protocol
-		kernel->getInterfaceStore()->retrieve(PeerParentCriteria(peerIface), ifl);
+		// Nope. Find a suitable local interface to associate with the protocol,
+		// preferably the one that the peer interface was discovered on
+		localIface = kernel->getInterfaceStore()->retrieveParent(peerIface);
+
+		if (!localIface) {
+			kernel->getInterfaceStore()->retrieve(InterfaceStore::Criteria(), ifl);
+
+			if (ifl.size() != 0)
+				localIface = ifl.pop();
+		}
 		
 		// Parent interface found?
-		if (ifl.size() != 0) {
+		if (localIface) {
 			// Create a new one:
 			switch (type) {
 #if defined(ENABLE_BLUETOOTH)
 				case Protocol::TYPE_RFCOMM:
 					// We always grab the first local Bluetooth interface
-					p = new ProtocolRFCOMMSender(ifl.pop(), peerIface, RFCOMM_DEFAULT_CHANNEL, this);
+					p = new ProtocolRFCOMMSender(localIface, peerIface, RFCOMM_DEFAULT_CHANNEL, this);
 					break;
 #endif				
 				case Protocol::TYPE_TCP:
-					// TODO: should retrieve local interface by querying for the parent interface of the peer.
-					p = new ProtocolTCPSender(ifl.pop(), peerIface, TCP_DEFAULT_PORT, this);
+					p = new ProtocolTCPSender(localIface, peerIface, TCP_DEFAULT_PORT, this);
 					break;                           
 				case Protocol::TYPE_LOCAL:
 					// FIXME: shouldn't be able to get here!
@@ -641,7 +630,7 @@ void ProtocolManager::onLocalInterfaceDown(Event *e)
 		Never bring down our application IPC protocol when
 		application interfaces go down (i.e., applications deregister).
 		*/
-		if (p->getLocalInterface()->getType() == Interface::TYPE_APPLICATION_PORT) {
+		if (p->getLocalInterface()->isApplication()) {
 			continue;
 		}
 		// Is the associated with this protocol?
@@ -712,7 +701,7 @@ void ProtocolManager::onNeighborInterfaceDown(Event *e)
 		 Never bring down our application IPC protocol when
 		 application interfaces go down (i.e., applications deregister).
 		 */
-		if (p->getLocalInterface()->getType() == Interface::TYPE_APPLICATION_PORT) {
+		if (p->getLocalInterface()->isApplication()) {
 			continue;
 		}
 		// Is the associated with this protocol?
@@ -877,9 +866,12 @@ void ProtocolManager::onSendDataObjectActual(Event *e)
 					if (!iface->getAddress<IPv4Address>() 
 #if defined(ENABLE_IPv6)
 					    && !iface->getAddress<IPv6Address>()
+#endif
+#if defined(OS_UNIX)
+					    && !iface->getAddress<UnixAddress>()
 #endif
 						) {
-						HAGGLE_DBG("Interface %s:%s has no IPv4 or IPv6 addresses - IGNORING.\n",
+						HAGGLE_DBG("Interface %s:%s has no IPv4, IPv6 or local addresses - IGNORING.\n",
 							   iface->getTypeStr(), iface->getIdentifierStr());
 						break;
 					}
@@ -947,16 +939,17 @@ void ProtocolManager::onSendDataObjectActual(Event *e)
 #if defined(ENABLE_IPv6)
 			case Address::TYPE_IPV6:
 #endif
-				if (peerIface->isApplication()) {
-#ifdef USE_UNIX_APPLICATION_SOCKET
-					p = getSenderProtocol(Protocol::TYPE_LOCAL, peerIface);
-#else
+				if (peerIface->isApplication())
 					p = getSenderProtocol(Protocol::TYPE_UDP, peerIface);
-#endif
-				}
 				else
 					p = getSenderProtocol(Protocol::TYPE_TCP, peerIface);
 				break;
+#if defined(OS_UNIX)
+			case Address::TYPE_UNIX:
+				if (peerIface->isApplication())
+					p = getSenderProtocol(Protocol::TYPE_LOCAL, peerIface);
+				break;
+#endif
 #if defined(ENABLE_MEDIA)
 			case Address::TYPE_FILEPATH:
 				p = getSenderProtocol(Protocol::TYPE_MEDIA, peerIface);
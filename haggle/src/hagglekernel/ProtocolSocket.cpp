@@ -17,6 +17,10 @@
 
 #include "ProtocolSocket.h"
 
+#if defined(OS_LINUX)
+#include <sys/sendfile.h>
+#endif
+
 #define MAX(a,b) (a > b ? a : b)
 
 #if defined(ENABLE_IPv6)
@@ -485,6 +489,25 @@ ProtocolEvent ProtocolSocket::sendData(const void *buf, size_t len,
 
 	ret = send(sock, (const char *)buf, len, flags);
 
+	// Nothing is sent when the file ended, which the caller checks for
+	if (ret < 0)
+		return PROT_EVENT_ERROR;
+
+	*bytes = ret;
+	
+	return PROT_EVENT_SUCCESS;
+}
+
+ProtocolEvent ProtocolSocket::sendFileData(int fd, off_t offset, size_t len, size_t *bytes)
+{
+#if defined(OS_LINUX)
+	ssize_t ret;
+
+	*bytes = 0;
+
+	// The kernel copies the data from the page cache to the socket
+	ret = sendfile(sock, fd, &offset, len);
+
 	if (ret < 0) {
 		return PROT_EVENT_ERROR;
 	} else if (ret == 0)
@@ -493,6 +516,9 @@ ProtocolEvent ProtocolSocket::sendData(const void *buf, size_t len,
 	*bytes = ret;
 	
 	return PROT_EVENT_SUCCESS;
+#else
+	return Protocol::sendFileData(fd, offset, len, bytes);
+#endif
 }
 
 ProtocolEvent ProtocolSocket::waitForEvent(Timeval *timeout, 
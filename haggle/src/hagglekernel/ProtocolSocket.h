@@ -90,6 +90,7 @@ class ProtocolSocket : public Protocol
 	
 	ProtocolEvent receiveData(void *buf, size_t len, const int flags, size_t *bytes);
 	ProtocolEvent sendData(const void *buf, size_t len, const int flags, size_t *bytes);
+	ProtocolEvent sendFileData(int fd, off_t offset, size_t len, size_t *bytes);
 	ProtocolError getProtocolError();
 	const char *getProtocolErrorStr();
 	void hookShutdown();
@@ -29,13 +29,15 @@
 
 ProtocolTCP::ProtocolTCP(SOCKET _sock, const InterfaceRef& _localIface, const InterfaceRef& _peerIface, 
 			 const unsigned short _port, const short flags, ProtocolManager * m) :
-	ProtocolSocket(Protocol::TYPE_TCP, "ProtocolTCP", _localIface, _peerIface, flags, m, _sock), localport(_port)
+	ProtocolSocket(Protocol::TYPE_TCP, "ProtocolTCP", _localIface, _peerIface, flags, m, _sock, TCP_BUFSIZE), 
+	localport(_port)
 {
 }
 
 ProtocolTCP::ProtocolTCP(const InterfaceRef& _localIface, const InterfaceRef& _peerIface, 
 			 const unsigned short _port, const short flags, ProtocolManager * m) : 
-	ProtocolSocket(Protocol::TYPE_TCP, "ProtocolTCP", _localIface, _peerIface, flags, m), localport(_port)
+	ProtocolSocket(Protocol::TYPE_TCP, "ProtocolTCP", _localIface, _peerIface, flags, m, INVALID_SOCKET, TCP_BUFSIZE), 
+	localport(_port)
 {
 }
 
@@ -107,6 +109,24 @@ bool ProtocolTCP::initbase()
                 return false;
 	}
 
+	/*
+	  Data is always written a full buffer at a time, so Nagle's
+	  algorithm only delays the last bytes of a data object, and the
+	  headers that follow it on a pipelined connection. Sockets 
+	  accepted by a server inherit these options. Failing to set
+	  them only costs throughput.
+	*/
+	if (!setSocketOption(IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval))) {
+		HAGGLE_DBG("%s Could not set TCP_NODELAY\n", getName());
+	}
+
+	optval = TCP_SOCKET_BUFSIZE;
+
+	if (!setSocketOption(SOL_SOCKET, SO_SNDBUF, &optval, sizeof(optval)) ||
+	    !setSocketOption(SOL_SOCKET, SO_RCVBUF, &optval, sizeof(optval))) {
+		HAGGLE_DBG("%s Could not set socket buffers to %d bytes\n", getName(), optval);
+	}
+
 	if (!bind(local_addr, addrlen)) {
 		closeSocket();
 		HAGGLE_ERR("Could not bind TCP socket\n");
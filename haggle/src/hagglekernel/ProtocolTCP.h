@@ -34,6 +34,12 @@ class ProtocolTCPServer;
 /* Configurable parameters */
 #define TCP_BACKLOG_SIZE 30
 #define TCP_DEFAULT_PORT 9697
+// The protocol buffer, which is larger than PROTOCOL_BUFSIZE, since TCP
+// connections carry most of the data
+#define TCP_BUFSIZE (32 * 1024)
+// The socket send and receive buffers. Large buffers keep the
+// connection busy while the protocol thread waits to write more data
+#define TCP_SOCKET_BUFSIZE (256 * 1024)
 
 /** */
 class ProtocolTCP : public ProtocolSocket
@@ -49,6 +55,9 @@ public:
                     const unsigned short _port = TCP_DEFAULT_PORT,
                     const short flags = PROT_FLAG_CLIENT, ProtocolManager *m = NULL);
         virtual ~ProtocolTCP() = 0;
+#if defined(OS_LINUX)
+	bool canSendFileData() const { return true; }
+#endif
 };
 
 /** */
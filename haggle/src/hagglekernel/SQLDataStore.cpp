@@ -76,9 +76,9 @@ using namespace haggle;
 	|ROWID|dataobject_rowid|attr_rowid|timestamp
 	|ROWID|node_rowid|attr_rowid|timestamp
 
-	These views are dynamic in that they are recreated at query
-	time such that they are subsets of the views above in relation
-	to a specific node or data object.  
+	These views used to be recreated at query time such that they
+	were subsets of the views above in relation to a specific node
+	or data object. Now they always cover all rows.
 */
 #define VIEW_MAP_DATAOBJECTS_TO_ATTRIBUTES_VIA_ROWID_DYNAMIC	\
 	"view_map_dataobjects_to_attributes_via_rowid_dynamic"
@@ -539,6 +539,12 @@ enum {
 	Comment: wildcards for matching between Dataobjects and Nodes
 	is not supported anymore due to performance issues. This might
 	be investigated again for the future.
+
+	The data store does not query these views anymore. Instead,
+	the matching is done with an in-memory inverted index
+	(AttributeIndex) that gives the same ratios. The views are
+	kept so that the schema of existing database files stays the
+	same, and for inspecting a database by hand.
 	
 */
 
@@ -558,14 +564,6 @@ enum {
 	view_limited_dataobject_attributes_timestamp
 };
 
-#define SQL_DROP_VIEW_LIMITED_DATAOBJECT_ATTRIBUTES_CMD		\
-	"DROP VIEW "						\
-	VIEW_MAP_DATAOBJECTS_TO_ATTRIBUTES_VIA_ROWID_DYNAMIC	\
-	";"
-
-// Note: VIEW_MAP_DATAOBJECTS_TO_ATTRIBUTES_VIA_ROWID_DYNAMIC gets
-// dynamically replaced during matching
-
 // limit the node attributes link table 
 //------------------------------------------
 #define SQL_CREATE_VIEW_LIMITED_NODE_ATTRIBUTES_CMD    \
@@ -581,13 +579,6 @@ enum {
 	view_map_nodes_to_attributes_via_rowid_dynamic_weight,
 	view_map_nodes_to_attributes_via_rowid_dynamic_timestamp
 };
-#define SQL_DROP_VIEW_LIMITED_NODE_ATTRIBUTES_CMD \
-	"DROP VIEW " \
-	VIEW_MAP_NODES_TO_ATTRIBUTES_VIA_ROWID_DYNAMIC \
-	";"
-
-// Note: VIEW_MAP_NODES_TO_ATTRIBUTES_VIA_ROWID_DYNAMIC gets
-// dynamically replaced during matching
 
 // Matching Filter > Dataobjects 
 //------------------------------------------
@@ -972,79 +963,28 @@ static const char *tbl_cmds[] = {
 
 static char sqlcmd[SQL_MAX_CMD_SIZE];
 
-static inline char *sql_insert_dataobject_cmd_alloc(const char *metadata, 
-						    const sqlite_int64 ifaceRowId, 
-						    const DataObjectRef dObj, 
-						    const string node_id)
-{
-	size_t cmd_size = strlen(metadata) + node_id.length() + 1024;
-	char *cmd = (char *)malloc(cmd_size);
+#define SQL_INSERT_DATAOBJECT_CMD		\
+	"INSERT OR ABORT INTO "			\
+	TABLE_DATAOBJECTS			\
+	" ("					\
+	"id,"					\
+	"xmlhdr,"				\
+	"filepath,"				\
+	"filename,"				\
+	"datalen,"				\
+	"datastate,"				\
+	"datahash,"				\
+	"signaturestatus,"			\
+	"signee,"				\
+	"signature,"				\
+	"siglen,"				\
+	"createtime,"				\
+	"receivetime,"				\
+	"rxtime,"				\
+	"source_iface_rowid,"			\
+	"node_id"				\
+	") VALUES(?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?);"
 
-	if (!cmd) {
-		HAGGLE_ERR("could not allocate insert command\n");
-		return NULL;
-	}
-	memset(cmd, 0, cmd_size);
-	/*
-		WARNING:
-		
-		This code, by inserting the xml header verbatim into the actual SQL 
-		query suffers from a risk of SQL injection. See the haggle trac page,
-		ticket #139.
-	*/
-	int ret = snprintf(cmd, cmd_size, 
-			   "INSERT INTO "
-			   "%s ("
-			   "id,"
-			   "xmlhdr,"
-			   "filepath,"
-			   "filename,"
-			   "datalen,"
-			   "datastate,"
-			   "datahash,"
-			   "signaturestatus,"
-			   "signee,"
-			   "signature,"
-			   "siglen,"
-			   "createtime,"
-			   "receivetime,"
-			   "rxtime,"
-			   "source_iface_rowid,"
-			   "node_id"
-			   ") VALUES(?,\'%s\',\'%s\',\'%s\',"
-			   SIZE_T_FMT ",%d,?,%d,\'%s\',?,"
-			   SIZE_T_FMT "," 
-			   SQLITE_INT64_FMT "," 
-			   SQLITE_INT64_FMT ",%lu," 
-			   SQLITE_INT64_FMT ",'%s');", 
-			   TABLE_DATAOBJECTS, 
-			   metadata, 
-			   dObj->getFilePath().c_str(), 
-			   dObj->getFileName().c_str(), 
-			   dObj->getDataLen(),
-			   dObj->getDataState(),
-			   dObj->getSignatureStatus(), 
-			   dObj->getSignee().c_str(),
-			   dObj->getSignatureLength(),
-			   (unsigned long long)
-			   dObj->getCreateTime().getTimeAsMilliSeconds(),
-			   (unsigned long long)
-			   dObj->getReceiveTime().getTimeAsMilliSeconds(), 
-			   dObj->getRxTime(), 
-			   ifaceRowId, 
-			   node_id.c_str());
-	
-        if (ret < 0) {
-                HAGGLE_ERR("insert error: %s\n", STRERROR(ERRNO));
-		free(cmd);
-		cmd = NULL;
-        } else if ((unsigned int)ret == cmd_size) {
-                HAGGLE_ERR("insert command too large\n");
-		free(cmd);
-		cmd = NULL;
-        }
-	return cmd;
-}
 static inline char *SQL_DELETE_DATAOBJECT_CMD()
 {
 	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, "DELETE FROM %s WHERE id = ?;", 
@@ -1057,9 +997,7 @@ static inline char *SQL_AGE_DATAOBJECT_CMD(const Timeval& minimumAge)
 {
 	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, "SELECT * FROM " 
 		 TABLE_DATAOBJECTS 
-		 " WHERE rowid NOT IN (SELECT dataobject_rowid FROM " 
-		 VIEW_MATCH_FILTERS_AND_DATAOBJECTS_AS_RATIO 
-		 " ) AND timestamp < strftime('%s', 'now','-%ld seconds');", 
+		 " WHERE timestamp < strftime('%s', 'now','-%ld seconds');", 
 		 "%s", minimumAge.getSeconds());
 	
 	return sqlcmd;
@@ -1070,48 +1008,26 @@ static inline char *SQL_AGE_DATAOBJECT_CMD(const Timeval& minimumAge)
 	TABLE_DATAOBJECTS			\
 	" WHERE id=?;"
 
-static inline 
-char *SQL_INSERT_DATAOBJECT_ATTR_CMD(const sqlite_int64 dataobject_rowid, 
-				     const sqlite_int64 attr_rowid)
-{
-	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, "INSERT INTO " 
-		 TABLE_MAP_DATAOBJECTS_TO_ATTRIBUTES_VIA_ROWID 
-		 " (dataobject_rowid,attr_rowid) VALUES (" 
-		 SQLITE_INT64_FMT "," SQLITE_INT64_FMT ");", 
-		 dataobject_rowid, attr_rowid);
-
-	return sqlcmd;
-}
+#define SQL_INSERT_DATAOBJECT_ATTR_CMD				\
+	"INSERT OR ABORT INTO "						\
+	TABLE_MAP_DATAOBJECTS_TO_ATTRIBUTES_VIA_ROWID			\
+	" (dataobject_rowid,attr_rowid) VALUES (?,?);"
 
 // -- ATTRIBUTE
-static inline char *SQL_INSERT_ATTR_CMD(const Attribute * attr)
-{
-	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, "INSERT INTO " 
-		 TABLE_ATTRIBUTES " (name,value) VALUES(\'%s\',\'%s\');", 
-		 attr->getName().c_str(), attr->getValue().c_str());
-
-	return sqlcmd;
-}
-
-static inline char *SQL_FIND_ATTR_CMD(const Attribute * attr)
-{
-	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, "SELECT ROWID FROM " 
-		 TABLE_ATTRIBUTES " WHERE (name=\'%s\' AND value=\'%s\');", 
-		 attr->getName().c_str(), attr->getValue().c_str());
-
-	return sqlcmd;
-}
+#define SQL_INSERT_ATTR_CMD					\
+	"INSERT OR ABORT INTO "					\
+	TABLE_ATTRIBUTES					\
+	" (name,value) VALUES(?,?);"
 
-static inline 
-char *SQL_ATTRS_FROM_NODE_ROWID_CMD(const sqlite_int64 node_rowid)
-{
-	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, "SELECT * FROM " 
-		 TABLE_MAP_NODES_TO_ATTRIBUTES_VIA_ROWID 
-		 " WHERE node_rowid=" SQLITE_INT64_FMT ";", 
-		 node_rowid);
+#define SQL_FIND_ATTR_CMD					\
+	"SELECT ROWID FROM "					\
+	TABLE_ATTRIBUTES					\
+	" WHERE (name=? AND value=?);"
 
-	return sqlcmd;
-}
+#define SQL_ATTRS_FROM_NODE_ROWID_CMD				\
+	"SELECT * FROM "					\
+	TABLE_MAP_NODES_TO_ATTRIBUTES_VIA_ROWID			\
+	" WHERE node_rowid=?;"
 
 static inline 
 char *SQL_ATTRS_FROM_DATAOBJECT_ROWID_CMD(const sqlite_int64 dataobject_rowid)
@@ -1123,21 +1039,14 @@ char *SQL_ATTRS_FROM_DATAOBJECT_ROWID_CMD(const sqlite_int64 dataobject_rowid)
 
 	return sqlcmd;
 }
-static inline 
-char *SQL_ATTR_FROM_ROWID_CMD(const sqlite_int64 attr_rowid, 
-			      const sqlite_int64 node_rowid)
-{
-	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, 
-		 "SELECT a.rowid, a.name, a.value, w.weight FROM " 
-		 TABLE_ATTRIBUTES 
-		 " as a LEFT JOIN " 
-		 TABLE_MAP_NODES_TO_ATTRIBUTES_VIA_ROWID 
-		 " as w ON a.rowid=w.attr_rowid WHERE a.rowid=" 
-		 SQLITE_INT64_FMT " AND w.node_rowid=" SQLITE_INT64_FMT ";", 
-		 attr_rowid, node_rowid);
+#define SQL_ATTR_FROM_ROWID_CMD					\
+	"SELECT a.rowid, a.name, a.value, w.weight FROM "	\
+	TABLE_ATTRIBUTES					\
+	" as a LEFT JOIN "					\
+	TABLE_MAP_NODES_TO_ATTRIBUTES_VIA_ROWID			\
+	" as w ON a.rowid=w.attr_rowid WHERE a.rowid=?"		\
+	" AND w.node_rowid=?;"
 
-	return sqlcmd;
-}
 enum {
 	sql_attr_from_rowid_cmd_rowid	=	0,
 	sql_attr_from_rowid_cmd_name,
@@ -1145,66 +1054,38 @@ enum {
 	sql_attr_from_rowid_cmd_weight
 };
 
-static inline char *SQL_DATAOBJECT_FROM_ROWID_CMD(const sqlite_int64 do_rowid)
-{
-	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, 
-		 "SELECT * FROM %s WHERE rowid=" 
-		 SQLITE_INT64_FMT ";", 
-		 TABLE_DATAOBJECTS, do_rowid);
-
-	return sqlcmd;
-}
+#define SQL_DATAOBJECT_FROM_ROWID_CMD		\
+	"SELECT * FROM "			\
+	TABLE_DATAOBJECTS			\
+	" WHERE rowid=?;"
 
 // -- INTERFACE
-static inline char *SQL_INSERT_IFACE_CMD(const int type, 
-					 const char *mac_str, 
-					 const sqlite_int64 node_rowid)
-{
-	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, 
-		 "INSERT INTO %s (type,mac,mac_str,node_rowid) "
-		 "VALUES(%d,?,\'%s\',"
-		 SQLITE_INT64_FMT ");", 
-		 TABLE_INTERFACES,  
-		 type, 
-		 mac_str, 
-		 node_rowid);
-
-	return sqlcmd;
-}
-
-static inline 
-char *SQL_IFACES_FROM_NODE_ROWID_CMD(const sqlite_int64 node_rowid)
-{
-	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, 
-		 "SELECT * FROM %s WHERE "
-		 "node_rowid=" SQLITE_INT64_FMT ";", 
-		 TABLE_INTERFACES, node_rowid);
-
-	return sqlcmd;
-}
-
-static inline 
-char *SQL_IFACE_FROM_ROWID_CMD(const sqlite_int64 iface_rowid)
-{
-	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, 
-		 "SELECT * FROM %s WHERE rowid=" 
-		 SQLITE_INT64_FMT ";", 
-		 TABLE_INTERFACES, iface_rowid);
+#define SQL_INSERT_IFACE_CMD					\
+	"INSERT OR ABORT INTO "					\
+	TABLE_INTERFACES					\
+	" (type,mac,mac_str,node_rowid) VALUES(?,?,?,?);"
 
-	return sqlcmd;
-}
+#define SQL_IFACES_FROM_NODE_ROWID_CMD		\
+	"SELECT * FROM "			\
+	TABLE_INTERFACES			\
+	" WHERE node_rowid=?;"
 
 #define SQL_FIND_IFACE_CMD			\
 	"SELECT * FROM "			\
 	TABLE_INTERFACES			\
 	" WHERE (mac=?);"
 
+#define SQL_NODE_ROWID_FROM_IFACE_CMD		\
+	"SELECT node_rowid FROM "		\
+	TABLE_INTERFACES			\
+	" WHERE (type=? AND mac_str=?);"
+
 // -- NODE
 
 static inline char *SQL_INSERT_NODE_CMD(const NodeRef& node)
 {
 	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, 
-		 "INSERT INTO " 
+		 "INSERT OR ABORT INTO " 
 		 TABLE_NODES 
 		 " ("
 		 "type,"
@@ -1233,25 +1114,12 @@ static inline char *SQL_DELETE_NODE_CMD()
 	
 	return sqlcmd;
 }
-static inline char *SQL_INSERT_NODE_ATTR_CMD(const sqlite_int64 node_rowid, const sqlite_int64 attr_rowid, const sqlite_int64 weight)
-{
-	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, "INSERT INTO " 
-		 TABLE_MAP_NODES_TO_ATTRIBUTES_VIA_ROWID 
-		 " (node_rowid,attr_rowid,weight) VALUES (" 
-		 SQLITE_INT64_FMT "," SQLITE_INT64_FMT "," SQLITE_INT64_FMT ");", 
-		 node_rowid, attr_rowid, weight);
-
-	return sqlcmd;
-}
-static inline char *SQL_NODE_FROM_ROWID_CMD(const sqlite_int64 node_rowid)
-{
-	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, 
-		 "SELECT * from %s WHERE rowid=" 
-		 SQLITE_INT64_FMT ";", 
-		 TABLE_NODES, node_rowid);
+#define SQL_INSERT_NODE_ATTR_CMD				\
+	"INSERT OR ABORT INTO "					\
+	TABLE_MAP_NODES_TO_ATTRIBUTES_VIA_ROWID			\
+	" (node_rowid,attr_rowid,weight) VALUES (?,?,?);"
 
-	return sqlcmd;
-}
+#define SQL_NODE_FROM_ROWID_CMD "SELECT * FROM " TABLE_NODES " WHERE rowid=?;"
 
 static inline char *SQL_NODE_BY_TYPE_CMD(Node::Type_t type)
 {
@@ -1272,7 +1140,7 @@ enum {
 static inline char *SQL_INSERT_FILTER_CMD(const long eventType)
 {
 	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, 
-		 "INSERT INTO " TABLE_FILTERS " (event) VALUES (%ld);", 
+		 "INSERT OR ABORT INTO " TABLE_FILTERS " (event) VALUES (%ld);", 
 		 eventType);
 
 	return sqlcmd;
@@ -1285,54 +1153,16 @@ static inline char *SQL_DELETE_FILTER_CMD(const long eventType)
 
 	return sqlcmd;
 }
-static inline 
-char *SQL_INSERT_FILTER_ATTR_CMD(const sqlite_int64 filter_rowid, 
-				 const sqlite_int64 attr_rowid, 
-				 const sqlite_int64 attr_weight)
-{
-	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, 
-		 "INSERT INTO " 
-		 TABLE_MAP_FILTERS_TO_ATTRIBUTES_VIA_ROWID 
-		 " (filter_rowid,attr_rowid,weight) VALUES (" 
-		 SQLITE_INT64_FMT "," SQLITE_INT64_FMT "," SQLITE_INT64_FMT ");", 
-		 filter_rowid, attr_rowid, attr_weight);
-
-	return sqlcmd;
-}
+#define SQL_INSERT_FILTER_ATTR_CMD				\
+	"INSERT OR ABORT INTO "					\
+	TABLE_MAP_FILTERS_TO_ATTRIBUTES_VIA_ROWID		\
+	" (filter_rowid,attr_rowid,weight) VALUES (?,?,?);"
 
-#define SQL_FILTER_MATCH_DATAOBJECT_ALL_CMD				\
-	"SELECT * FROM "						\
-	VIEW_MATCH_FILTERS_AND_DATAOBJECTS_AS_RATIO			\
-	" WHERE ratio>0;"
 #define SQL_FILTER_MATCH_NODE_ALL_CMD					\
 	"SELECT * FROM "						\
 	VIEW_MATCH_FILTERS_AND_NODES_AS_RATIO				\
 	" WHERE filter_id=? and ratio>0;"
 
-static inline char *SQL_FILTER_MATCH_ALL_CMD(long filter_event)
-{
-	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, 
-		 "SELECT * FROM " 
-		 VIEW_MATCH_FILTERS_AND_DATAOBJECTS_AS_RATIO 
-		 " WHERE filter_event=%ld and ratio>0;", filter_event);
-
-	return sqlcmd;
-}
-
-static inline 
-char *SQL_FILTER_MATCH_DATAOBJECT_CMD(const sqlite_int64 filter_rowid)
-{
-	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, 
-		 "SELECT * FROM " 
-		 VIEW_MATCH_FILTERS_AND_DATAOBJECTS_AS_RATIO 
-		 " WHERE filter_rowid=" 
-		 SQLITE_INT64_FMT 
-		 " AND ratio>0 ORDER BY ratio, dataobject_rowid;", 
-		 filter_rowid);
-
-	return sqlcmd;
-}
-
 static inline 
 char *SQL_FILTER_MATCH_NODE_CMD(const sqlite_int64 filter_rowid)
 {
@@ -1356,9 +1186,43 @@ static inline char *SQL_DEL_FILTER_CMD(const sqlite_int64 filter_rowid)
 	return sqlcmd;
 }
 
+// Milliseconds a query worker waits for a locked database
+#define SQL_QUERY_WORKER_BUSY_TIMEOUT 1000
+
 #define SQL_BEGIN_TRANSACTION_CMD "BEGIN TRANSACTION;"
 #define SQL_END_TRANSACTION_CMD "END TRANSACTION;"
 
+/*
+	The commands of the pooled statements, in the same order as the
+	Statement_t enum in SQLDataStore.h.
+
+	The unique constraints of the tables roll back the current
+	transaction on a conflict. All inserts therefore use "OR ABORT",
+	which only undoes the failing statement, so that a duplicate does
+	not undo the other tasks in the same batch.
+*/
+static const char *stmt_cmds[] = {
+	SQL_BEGIN_TRANSACTION_CMD,
+	SQL_END_TRANSACTION_CMD,
+	SQL_INSERT_DATAOBJECT_CMD,
+	SQL_FIND_DATAOBJECT_CMD,
+	SQL_DATAOBJECT_FROM_ROWID_CMD,
+	SQL_INSERT_ATTR_CMD,
+	SQL_FIND_ATTR_CMD,
+	SQL_ATTR_FROM_ROWID_CMD,
+	SQL_INSERT_DATAOBJECT_ATTR_CMD,
+	SQL_INSERT_NODE_ATTR_CMD,
+	SQL_INSERT_FILTER_ATTR_CMD,
+	SQL_ATTRS_FROM_NODE_ROWID_CMD,
+	SQL_INSERT_IFACE_CMD,
+	SQL_FIND_IFACE_CMD,
+	SQL_IFACES_FROM_NODE_ROWID_CMD,
+	SQL_NODE_FROM_ID_CMD,
+	SQL_NODE_FROM_ROWID_CMD,
+	SQL_NODE_ROWID_FROM_IFACE_CMD,
+	NULL
+};
+
 
 
 /* ========================================================= */
@@ -1410,12 +1274,10 @@ DataObject *SQLDataStore::createDataObject(sqlite3_stmt * stmt)
 					(unsigned char *)sqlite3_column_blob(stmt, table_dataobjects_datahash));
 }
 
-NodeRef SQLDataStore::createNode(sqlite3_stmt * in_stmt)
+NodeRef SQLDataStore::createNode(Connection& c, sqlite3_stmt *in_stmt)
 {
 	int ret;
-	char *sql_cmd;
 	sqlite3_stmt *stmt;
-	const char *tail;
 	sqlite_int64 node_rowid;
 	NodeRef node = NULL;
 	int num_match = 0;
@@ -1456,26 +1318,25 @@ NodeRef SQLDataStore::createNode(sqlite3_stmt * in_stmt)
 
 	node_rowid = sqlite3_column_int64(in_stmt, table_nodes_rowid);
 
-	sql_cmd = SQL_ATTRS_FROM_NODE_ROWID_CMD(node_rowid);
+	stmt = c.getStatement(STMT_ATTRS_FROM_NODE_ROWID);
 
-	ret = sqlite3_prepare_v2(db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
-
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", sql_cmd);
+	if (!stmt)
 		return node;
-	}
+
+	sqlite3_bind_int64(stmt, 1, node_rowid);
 
 	num_match = 0;
 
 	while ((ret = sqlite3_step(stmt)) != SQLITE_DONE) {
 		if (ret == SQLITE_ROW) {
 			sqlite_int64 attr_rowid = sqlite3_column_int64(stmt, table_map_nodes_to_attributes_via_rowid_attr_rowid);
-			Attribute *attr = getAttrFromRowId(attr_rowid, node_rowid);
+			Attribute *attr = getAttrFromRowId(c, attr_rowid, node_rowid);
 
 			if (!attr) {
 				node = NULL;
 				HAGGLE_DBG("Get attr failed\n");
-				goto out;
+				c.releaseStatement(STMT_ATTRS_FROM_NODE_ROWID, stmt);
+				return node;
 			}
 			
 			node->addAttribute(*attr);
@@ -1483,21 +1344,21 @@ NodeRef SQLDataStore::createNode(sqlite3_stmt * in_stmt)
 		}
 
 		if (ret == SQLITE_ERROR) {
-			HAGGLE_DBG("Could not get Attribute Error:%s\n", sqlite3_errmsg(db));
+			HAGGLE_DBG("Could not get Attribute Error:%s\n", sqlite3_errmsg(c.db));
 			node = NULL;
-			goto out;
+			c.releaseStatement(STMT_ATTRS_FROM_NODE_ROWID, stmt);
+			return node;
 		}
 	}
 
-	sqlite3_finalize(stmt);
+	c.releaseStatement(STMT_ATTRS_FROM_NODE_ROWID, stmt);
 
-	ret = sqlite3_prepare_v2(db, SQL_IFACES_FROM_NODE_ROWID_CMD(node_rowid), (int)
-				 strlen(SQL_IFACES_FROM_NODE_ROWID_CMD(node_rowid)), &stmt, &tail);
+	stmt = c.getStatement(STMT_IFACES_FROM_NODE_ROWID);
 
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", SQL_IFACES_FROM_NODE_ROWID_CMD);
+	if (!stmt)
 		return node;
-	}
+
+	sqlite3_bind_int64(stmt, 1, node_rowid);
 
 	num_match = 0;
 
@@ -1523,35 +1384,32 @@ NodeRef SQLDataStore::createNode(sqlite3_stmt * in_stmt)
 		}
 
 		if (ret == SQLITE_ERROR) {
-			HAGGLE_DBG("Could not get Interface Error:%s\n", sqlite3_errmsg(db));
+			HAGGLE_DBG("Could not get Interface Error:%s\n", sqlite3_errmsg(c.db));
 			node = NULL;
 			goto out;
 		}
 	}
 
       out:
-	sqlite3_finalize(stmt);
+	c.releaseStatement(STMT_IFACES_FROM_NODE_ROWID, stmt);
 
 	return node;
 }
 
-Attribute *SQLDataStore::getAttrFromRowId(const sqlite_int64 attr_rowid, const sqlite_int64 node_rowid)
+Attribute *SQLDataStore::getAttrFromRowId(Connection& c, const sqlite_int64 attr_rowid, const sqlite_int64 node_rowid)
 {
 	int ret;
 	sqlite3_stmt *stmt;
-	const char *tail;
-	char *sql_cmd;
 	Attribute *attr = NULL;
 	int num_match = 0;
 
-	sql_cmd = SQL_ATTR_FROM_ROWID_CMD(attr_rowid, node_rowid);
-
-	ret = sqlite3_prepare(db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
+	stmt = c.getStatement(STMT_ATTR_FROM_ROWID);
 
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", sql_cmd);
+	if (!stmt)
 		return NULL;
-	}
+
+	sqlite3_bind_int64(stmt, 1, attr_rowid);
+	sqlite3_bind_int64(stmt, 2, node_rowid);
 
 	while ((ret = sqlite3_step(stmt)) != SQLITE_DONE) {
 		if (ret == SQLITE_ROW) {
@@ -1570,33 +1428,37 @@ Attribute *SQLDataStore::getAttrFromRowId(const sqlite_int64 attr_rowid, const s
 				goto out;
 			}
 		} else if (ret == SQLITE_ERROR) {
-			HAGGLE_DBG("Attribute get Error:%s\n", sqlite3_errmsg(db));
+			HAGGLE_DBG("Attribute get Error:%s\n", sqlite3_errmsg(c.db));
 			goto out;
 		}
 	}
       out:
-	sqlite3_finalize(stmt);
+	c.releaseStatement(STMT_ATTR_FROM_ROWID, stmt);
 
 	return attr;
 }
 
-DataObject *SQLDataStore::getDataObjectFromRowId(const sqlite_int64 dataObjectRowId)
+DataObjectRef SQLDataStore::getDataObjectFromRowId(Connection& c, const sqlite_int64 dataObjectRowId)
 {
 	int ret;
 	sqlite3_stmt *stmt;
-	const char *tail;
-	char *sql_cmd;
 	int num_match = 0;
-	DataObject *dObj = NULL;
+	DataObjectRef dObj;
+
+	// Avoid parsing the metadata again if the data object was created recently
+	synchronized(indexMutex) {
+		dObj = dataObjectCache.get(dataObjectRowId);
+	}
 
-	sql_cmd = SQL_DATAOBJECT_FROM_ROWID_CMD(dataObjectRowId);
+	if (dObj)
+		return dObj;
 
-	ret = sqlite3_prepare(db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
+	stmt = c.getStatement(STMT_DATAOBJECT_FROM_ROWID);
 
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", sql_cmd);
+	if (!stmt)
 		return NULL;
-	}
+
+	sqlite3_bind_int64(stmt, 1, dataObjectRowId);
 
 	while ((ret = sqlite3_step(stmt)) != SQLITE_DONE) {
 		if (ret == SQLITE_ROW) {
@@ -1609,265 +1471,234 @@ DataObject *SQLDataStore::getDataObjectFromRowId(const sqlite_int64 dataObjectRo
 				goto out;
 			}
 		} else if (ret == SQLITE_ERROR) {
-			HAGGLE_DBG("DataObject get Error:%s\n", sqlite3_errmsg(db));
+			HAGGLE_DBG("DataObject get Error:%s\n", sqlite3_errmsg(c.db));
 			goto out;
 		}
 	}
       out:
-	sqlite3_finalize(stmt);
+	c.releaseStatement(STMT_DATAOBJECT_FROM_ROWID, stmt);
+
+	if (!dObj)
+		return NULL;
+
+	/*
+		A query worker may have read the data object just before
+		the data store thread deleted it. Only cache the data object
+		if it is still in the attribute index, since the data store
+		thread removes it from the cache after removing it from the
+		index.
+	*/
+	indexMutex.lock();
+
+	const DataObjectId_t *id = attrIndex.getDataObjectId(dataObjectRowId);
+
+	if (id && memcmp(*id, dObj->getId(), DATAOBJECT_ID_LEN) == 0)
+		dataObjectCache.put(dataObjectRowId, dObj);
+
+	indexMutex.unlock();
 
 	return dObj;
 }
 
-NodeRef SQLDataStore::getNodeFromRowId(const sqlite_int64 nodeRowId)
+NodeRef SQLDataStore::getNodeFromRowId(Connection& c, const sqlite_int64 nodeRowId)
 {
 	int ret;
 	sqlite3_stmt *stmt;
-	const char *tail;
-	char *sql_cmd;
 	NodeRef node = NULL;
 	int num_match = 0;
 
-	sql_cmd = SQL_NODE_FROM_ROWID_CMD(nodeRowId);
-
-	ret = sqlite3_prepare(db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
+	stmt = c.getStatement(STMT_NODE_FROM_ROWID);
 
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", sql_cmd);
+	if (!stmt)
 		return NULL;
-	}
+
+	sqlite3_bind_int64(stmt, 1, nodeRowId);
 
 	while ((ret = sqlite3_step(stmt)) != SQLITE_DONE) {
 		if (ret == SQLITE_ROW) {
 			num_match++;
 
 			if (num_match == 1) {
-				node = createNode(stmt);
+				node = createNode(c, stmt);
 			} else {
 				HAGGLE_DBG("More than on Node with key=" SQLITE_INT64_FMT "\n", nodeRowId);
 				node = NULL;
 				goto out_err;
 			}
 		} else if (ret == SQLITE_ERROR) {
-			HAGGLE_DBG("Node get Error:%s\n", sqlite3_errmsg(db));
+			HAGGLE_DBG("Node get Error:%s\n", sqlite3_errmsg(c.db));
 			goto out_err;
 		}
 	}
 
       out_err:
-	sqlite3_finalize(stmt);
+	c.releaseStatement(STMT_NODE_FROM_ROWID, stmt);
 
 	return node;
 }
 
-#if 0 // not used at the moment, disabled to remove compiler warning
-Interface *SQLDataStore::getInterfaceFromRowId(const sqlite_int64 ifaceRowId)
+/* ========================================================= */
+/* attribute index                                           */
+/*                                                           */
+/* matching is done with the in-memory attribute index,      */
+/* which is loaded from the tables when the data store is    */
+/* opened                                                    */
+/* ========================================================= */
+
+#define SQL_LOAD_INDEX_DATAOBJECTS_CMD			\
+	"SELECT rowid,id FROM "				\
+	TABLE_DATAOBJECTS ";"
+#define SQL_LOAD_INDEX_DATAOBJECT_ATTRIBUTES_CMD		\
+	"SELECT da.dataobject_rowid,a.name,a.value FROM "	\
+	TABLE_MAP_DATAOBJECTS_TO_ATTRIBUTES_VIA_ROWID	\
+	" as da INNER JOIN "				\
+	TABLE_ATTRIBUTES				\
+	" as a ON da.attr_rowid=a.rowid;"
+#define SQL_LOAD_INDEX_NODES_CMD				\
+	"SELECT rowid,resolution_threshold FROM "	\
+	TABLE_NODES ";"
+#define SQL_LOAD_INDEX_NODE_ATTRIBUTES_CMD			\
+	"SELECT na.node_rowid,a.name,a.value,na.weight FROM "	\
+	TABLE_MAP_NODES_TO_ATTRIBUTES_VIA_ROWID		\
+	" as na INNER JOIN "				\
+	TABLE_ATTRIBUTES				\
+	" as a ON na.attr_rowid=a.rowid;"
+#define SQL_LOAD_INDEX_FILTERS_CMD				\
+	"SELECT rowid,event FROM "			\
+	TABLE_FILTERS ";"
+#define SQL_LOAD_INDEX_FILTER_ATTRIBUTES_CMD			\
+	"SELECT fa.filter_rowid,a.name,a.value FROM "	\
+	TABLE_MAP_FILTERS_TO_ATTRIBUTES_VIA_ROWID	\
+	" as fa INNER JOIN "				\
+	TABLE_ATTRIBUTES				\
+	" as a ON fa.attr_rowid=a.rowid;"
+
+enum {
+	index_dataobjects,
+	index_dataobject_attributes,
+	index_nodes,
+	index_node_attributes,
+	index_filters,
+	index_filter_attributes
+};
+
+/*
+	Loads the data objects, nodes and filters, and their attributes,
+	into the attribute index. There are no filters when the data store
+	is opened, but there may be when a transaction was rolled back.
+*/
+int SQLDataStore::buildAttributeIndex()
 {
+	static const char *cmds[] = {
+		SQL_LOAD_INDEX_DATAOBJECTS_CMD,
+		SQL_LOAD_INDEX_DATAOBJECT_ATTRIBUTES_CMD,
+		SQL_LOAD_INDEX_NODES_CMD,
+		SQL_LOAD_INDEX_NODE_ATTRIBUTES_CMD,
+		SQL_LOAD_INDEX_FILTERS_CMD,
+		SQL_LOAD_INDEX_FILTER_ATTRIBUTES_CMD
+	};
 	int ret;
 	sqlite3_stmt *stmt;
 	const char *tail;
-	char *sql_cmd;
-	Interface *iface = NULL;
-	int num_match = 0;
 
-	sql_cmd = SQL_IFACE_FROM_ROWID_CMD(ifaceRowId);
+	attrIndex.clear();
 
-	ret = sqlite3_prepare(db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
+	for (unsigned int i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
+		ret = sqlite3_prepare_v2(db, cmds[i], (int) strlen(cmds[i]), &stmt, &tail);
 
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", sql_cmd);
-		return NULL;
-	}
+		if (ret != SQLITE_OK) {
+			HAGGLE_ERR("SQLite command compilation failed! %s\n", cmds[i]);
+			return -1;
+		}
 
-	while ((ret = sqlite3_step(stmt)) != SQLITE_DONE) {
-		if (ret == SQLITE_ROW) {
-			num_match++;
+		while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+			sqlite_int64 rowid = sqlite3_column_int64(stmt, 0);
 
-			if (num_match == 1) {
-				const unsigned char *identifier = (const unsigned char *)sqlite3_column_blob(stmt, table_interfaces_mac);
-				Interface::Type_t type = (Interface::Type_t) sqlite3_column_int(stmt, table_interfaces_type);
+			switch (i) {
+			case index_dataobjects:
+				if (sqlite3_column_bytes(stmt, 1) == DATAOBJECT_ID_LEN)
+					attrIndex.addDataObject(rowid, (const unsigned char *)sqlite3_column_blob(stmt, 1));
+				break;
+			case index_dataobject_attributes:
+				attrIndex.addDataObjectAttribute(rowid, 
+								 (const char *)sqlite3_column_text(stmt, 1), 
+								 (const char *)sqlite3_column_text(stmt, 2));
+				break;
+			case index_nodes:
+				attrIndex.addNode(rowid, (unsigned long)sqlite3_column_int64(stmt, 1));
+				break;
+			case index_node_attributes:
+				attrIndex.addNodeAttribute(rowid, 
+							   (const char *)sqlite3_column_text(stmt, 1), 
+							   (const char *)sqlite3_column_text(stmt, 2), 
+							   (long)sqlite3_column_int64(stmt, 3));
+				break;
+			case index_filters:
+				attrIndex.addFilter(rowid, (long)sqlite3_column_int64(stmt, 1));
+				break;
+			case index_filter_attributes:
+				attrIndex.addFilterAttribute(rowid, 
+							     (const char *)sqlite3_column_text(stmt, 1), 
+							     (const char *)sqlite3_column_text(stmt, 2));
+				break;
+			}
+		}
 
-				iface = new Interface::create(type, identifier);
+		sqlite3_finalize(stmt);
 
-			} else {
-				HAGGLE_DBG("More than on Node with key=" SQLITE_INT64_FMT "\n", ifaceRowId);
-				delete iface;
-				iface = NULL;
-				goto out_err;
-			}
-		} else if (ret == SQLITE_ERROR) {
-			HAGGLE_DBG("Node get Error:%s\n", sqlite3_errmsg(db));
-			goto out_err;
+		if (ret != SQLITE_DONE) {
+			HAGGLE_ERR("Could not build attribute index: %s\n", sqlite3_errmsg(db));
+			return -1;
 		}
 	}
 
-      out_err:
-	sqlite3_finalize(stmt);
+	HAGGLE_DBG("Attribute index has %lu data objects and %lu nodes\n", 
+		   (unsigned long)attrIndex.getNumDataObjects(), 
+		   (unsigned long)attrIndex.getNumNodes());
 
-	return iface;
+	return 0;
 }
-#endif
-
-// FIXME: This function seems to be unused. Delete?
-int SQLDataStore::findAndAddDataObjectTargets(DataObjectRef& dObj, const sqlite_int64 dataObjectRowId, const long ratio)
-{
-/*
-	int ret;
-	sqlite3_stmt *stmt;
-	const char *tail;
-	char *sql_cmd = sqlcmd;
-	//Node *node = NULL;
-	int num_match = 0;
-
-	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, "SELECT * FROM %s WHERE ratio >= %ld AND dataobject_rowid == " SQLITE_INT64_FMT ";", VIEW_MATCH_DATAOBJECTS_AND_NODES_AS_RATIO, ratio, dataObjectRowId);
 
-	ret = sqlite3_prepare(db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
 
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", sql_cmd);
-		goto out_err;
-	}
+/* ========================================================= */
+/* SQLDataStore                                              */
+/* ========================================================= */
 
-	while ((ret = sqlite3_step(stmt)) != SQLITE_DONE) {
-		if (ret == SQLITE_ROW) {
-			sqlite_int64 node_rowid = sqlite3_column_int64(stmt, view_match_dataobjects_and_nodes_as_ratio_node_rowid);
+SQLDataStore::SQLDataStore(const bool _recreate, const string _filepath, const string name) : 
+	DataStore(name), db(NULL), isInMemory(false), isWAL(false), recreate(_recreate), 
+	filepath(_filepath), inTransaction(false)
+{
+}
 
-			HAGGLE_DBG("Node rowid=" SQLITE_INT64_FMT "\n", node_rowid);
+SQLDataStore::~SQLDataStore()
+{
+	_endTaskBatch();
 
-			NodeRef node = NodeRef(getNodeFromRowId(node_rowid), "NodeTargetFromDataStore");
+	// Left if the last transaction could not be committed
+	while (!transactionEvents.empty()) {
+		delete transactionEvents.front();
+		transactionEvents.pop_front();
+	}
 
-			if (node) {
-				num_match++;
-				dObj->addTarget(node);
-			} else {
-				HAGGLE_DBG("Could not get node from key\n");
-			}
-		} else if (ret == SQLITE_ERROR) {
-			HAGGLE_DBG("findTargets Error:%s\n", sqlite3_errmsg(db));
-			goto out_err;
+#if defined(HAVE_SQLITE_BACKUP_SUPPORT)
+	// backup in-memory database
+	if (isInMemory) {
+		string file = getFilepath();
+		if (file.empty()) {
+			file = DEFAULT_DATASTORE_FILENAME;
+			HAGGLE_DBG("Backup in-memory database to ./%s because of problems creating filepath\n", file.c_str());
 		}
-	}
+		
+		backupDatabase(db, file.c_str(), 1);
+	}	
+#endif
+	
+	HAGGLE_DBG("Data object cache: %lu hits, %lu misses, %lu evictions\n", 
+		   dataObjectCache.getHits(), dataObjectCache.getMisses(), 
+		   dataObjectCache.getEvictions());
 
-	sqlite3_finalize(stmt);
+	writer.finalizeStatements();
 
-	return num_match;
-      out_err:
-	sqlite3_finalize(stmt);
-*/
-	return -1;
-}
-
-/* ========================================================= */
-/* limit/reset views on dataobject and node attributes       */
-/*                                                           */
-/* the views are limited to speed up matching queries        */
-/* ========================================================= */
-
-int SQLDataStore::setViewLimitedDataobjectAttributes(sqlite_int64 dataobject_rowid) {
-	int ret;
-	sqlite3_stmt *stmt;
-	const char *tail;
-	char *sql_cmd = sqlcmd;
-	
-	// -- drop existing view
-	sql_cmd = (char *) SQL_DROP_VIEW_LIMITED_DATAOBJECT_ATTRIBUTES_CMD;
-	ret = sqlite3_prepare(db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", sql_cmd);
-		HAGGLE_DBG("%s\n", sqlite3_errmsg(db));
-		// view probably missing, so we do not quit
-	} else {
-		ret = sqlite3_step(stmt);
-	}
-	sqlite3_finalize(stmt);
-	
-	// -- replace with a) limted to specific dataobject, or b) all (default)
-	sql_cmd = sqlcmd;
-	if (dataobject_rowid) {
-		snprintf(sql_cmd, SQL_MAX_CMD_SIZE, SQL_CREATE_VIEW_LIMITED_DATAOBJECT_ATTRIBUTES_CMD " as da WHERE da.dataobject_rowid=" SQLITE_INT64_FMT ";", dataobject_rowid);
-		// remove ';' from SQL_CREATE_VIEW_LIMITED_DATAOBJECT_ATTRIBUTES_CMD
-		sql_cmd[strlen(SQL_CREATE_VIEW_LIMITED_DATAOBJECT_ATTRIBUTES_CMD)-1] = ' ';
-	} else {
-		sql_cmd = (char *) SQL_CREATE_VIEW_LIMITED_DATAOBJECT_ATTRIBUTES_CMD;
-	}
-	ret = sqlite3_prepare(db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", sql_cmd);
-		HAGGLE_DBG("%s\n", sqlite3_errmsg(db));
-		return -1;
-	}
-	ret = sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
-	
-	return 1;
-}
-
-
-int SQLDataStore::setViewLimitedNodeAttributes(sqlite_int64 node_rowid) {
-	int ret;
-	sqlite3_stmt *stmt;
-	const char *tail;
-	char *sql_cmd = sqlcmd;
-	// This is unused:
-	//char *tmp = NULL;
-	
-	// -- drop existing view
-	sql_cmd = (char *) SQL_DROP_VIEW_LIMITED_NODE_ATTRIBUTES_CMD;
-	ret = sqlite3_prepare(db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", sql_cmd);
-		HAGGLE_DBG("%s\n", sqlite3_errmsg(db));
-	} else {
-		ret = sqlite3_step(stmt);
-	}
-	sqlite3_finalize(stmt);
-	
-	// -- replace with a) limted to specific node, or b) all (default)
-	sql_cmd = sqlcmd;
-	if (node_rowid) {
-		snprintf(sql_cmd, SQL_MAX_CMD_SIZE, SQL_CREATE_VIEW_LIMITED_NODE_ATTRIBUTES_CMD " as na WHERE na.node_rowid=" SQLITE_INT64_FMT ";", node_rowid);
-		// remove ';' from SQL_CREATE_VIEW_LIMITED_NODE_ATTRIBUTES_CMD
-		sql_cmd[strlen(SQL_CREATE_VIEW_LIMITED_NODE_ATTRIBUTES_CMD)-1] = ' ';
-	} else {
-		sql_cmd = (char *) SQL_CREATE_VIEW_LIMITED_NODE_ATTRIBUTES_CMD;
-	}
-	ret = sqlite3_prepare(db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", sql_cmd);
-		HAGGLE_DBG("%s\n", sqlite3_errmsg(db));
-		return -1;
-	}
-	ret = sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
-	
-	return 1;
-}
-
-
-/* ========================================================= */
-/* SQLDataStore                                              */
-/* ========================================================= */
-
-SQLDataStore::SQLDataStore(const bool _recreate, const string _filepath, const string name) : 
-	DataStore(name), db(NULL), isInMemory(false), recreate(_recreate), filepath(_filepath)
-{
-}
-
-SQLDataStore::~SQLDataStore()
-{
-#if defined(HAVE_SQLITE_BACKUP_SUPPORT)
-	// backup in-memory database
-	if (isInMemory) {
-		string file = getFilepath();
-		if (file.empty()) {
-			file = DEFAULT_DATASTORE_FILENAME;
-			HAGGLE_DBG("Backup in-memory database to ./%s because of problems creating filepath\n", file.c_str());
-		}
-		
-		backupDatabase(db, file.c_str(), 1);
-	}	
-#endif
-	
 	if (db)
 		sqlite3_close(db);
 }
@@ -1898,10 +1729,26 @@ bool SQLDataStore::init()
 			}
 			free(wfilepath);
 		}
+		// A log left behind would otherwise be applied to the new database
+		wfilepath = strtowstr_alloc((file + "-wal").c_str());
+
+		if (wfilepath) {
+			DeleteFile(wfilepath);
+			free(wfilepath);
+		}
+		wfilepath = strtowstr_alloc((file + "-shm").c_str());
+
+		if (wfilepath) {
+			DeleteFile(wfilepath);
+			free(wfilepath);
+		}
 #else
 		if (unlink(file.c_str()) == 0) {
 			printf("Deleted existing database file: %s\n", file.c_str());
 		}
+		// A log left behind would otherwise be applied to the new database
+		unlink((file + "-wal").c_str());
+		unlink((file + "-shm").c_str());
 #endif
 	}
 		
@@ -1912,6 +1759,12 @@ bool SQLDataStore::init()
 		sqlite3_close(db);
                 return false;
 	}
+
+	writer.db = db;
+
+#if defined(HAVE_SQLITE_WAL_SUPPORT)
+	isWAL = setJournalModeWAL();
+#endif
 	
 	// First check if the tables already exist
 	ret = sqlite3_prepare(db, "SELECT name FROM sqlite_master where name='" TABLE_DATAOBJECTS "';\0", -1, &stmt, &tail);
@@ -1943,6 +1796,12 @@ bool SQLDataStore::init()
 		HAGGLE_DBG("Database and tables already exist...\n");
 		sqlite3_finalize(stmt);
 		cleanupDataStore();
+
+		if (buildAttributeIndex() < 0) {
+			HAGGLE_ERR("Could not build attribute index\n");
+			sqlite3_close(db);
+			return false;
+		}
 		return true;
 	}
 	sqlite3_finalize(stmt);
@@ -2019,30 +1878,314 @@ int SQLDataStore::sqlQuery(const char *sql_cmd)
 	return ret;
 }
 
+#if defined(HAVE_SQLITE_WAL_SUPPORT)
+/*
+	Switches the database file to write-ahead logging, which lets the
+	query workers read from the database while the data store thread
+	writes to it. Returns true if the database uses write-ahead
+	logging.
+*/
+bool SQLDataStore::setJournalModeWAL()
+{
+	int ret;
+	sqlite3_stmt *stmt;
+	const char *tail;
+	bool wal = false;
+
+	ret = sqlite3_prepare_v2(db, "PRAGMA journal_mode=WAL;", -1, &stmt, &tail);
+
+	if (ret != SQLITE_OK) {
+		HAGGLE_ERR("SQLite command compilation failed: %s\n", sqlite3_errmsg(db));
+		return false;
+	}
 
-sqlite_int64 SQLDataStore::getDataObjectRowId(const DataObjectId_t& id)
+	// The pragma returns the journal mode in use after the command
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		const char *mode = (const char *)sqlite3_column_text(stmt, 0);
+
+		if (mode && strcmp(mode, "wal") == 0)
+			wal = true;
+	}
+
+	sqlite3_finalize(stmt);
+
+	if (!wal) {
+		HAGGLE_DBG("Database does not support write-ahead logging, queries are executed by the data store thread\n");
+	}
+
+	return wal;
+}
+#endif
+
+SQLDataStore::Connection::Connection() : db(NULL)
+{
+	for (int i = 0; i < _STMT_MAX; i++) {
+		stmtPool[i] = NULL;
+		stmtInUse[i] = false;
+	}
+}
+
+/*
+	Returns a pooled statement of the given type, compiling it the
+	first time it is used. If the pooled statement is already in use
+	further up the call stack, a new statement is compiled instead.
+*/
+sqlite3_stmt *SQLDataStore::Connection::getStatement(Statement_t type)
 {
 	int ret;
 	sqlite3_stmt *stmt;
 	const char *tail;
+
+	if (!stmtInUse[type] && stmtPool[type]) {
+		stmtInUse[type] = true;
+		return stmtPool[type];
+	}
+
+	ret = sqlite3_prepare_v2(db, stmt_cmds[type], (int) strlen(stmt_cmds[type]), &stmt, &tail);
+
+	if (ret != SQLITE_OK) {
+		HAGGLE_ERR("SQLite command compilation failed! %s\n", stmt_cmds[type]);
+		return NULL;
+	}
+
+	if (!stmtInUse[type]) {
+		stmtPool[type] = stmt;
+		stmtInUse[type] = true;
+	}
+	
+	return stmt;
+}
+
+void SQLDataStore::Connection::releaseStatement(Statement_t type, sqlite3_stmt *stmt)
+{
+	if (!stmt)
+		return;
+
+	if (stmt != stmtPool[type]) {
+		sqlite3_finalize(stmt);
+		return;
+	}
+	
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+	stmtInUse[type] = false;
+}
+
+void SQLDataStore::Connection::finalizeStatements()
+{
+	for (int i = 0; i < _STMT_MAX; i++) {
+		if (stmtPool[i]) {
+			sqlite3_finalize(stmtPool[i]);
+			stmtPool[i] = NULL;
+		}
+		stmtInUse[i] = false;
+	}
+}
+
+void SQLDataStore::_beginTaskBatch()
+{
+	sqlite3_stmt *stmt;
+	int ret;
+
+	if (inTransaction)
+		return;
+	
+	stmt = getStatement(STMT_BEGIN_TRANSACTION);
+
+	if (!stmt)
+		return;
+
+	ret = sqlite3_step(stmt);
+	releaseStatement(STMT_BEGIN_TRANSACTION, stmt);
+
+	if (ret != SQLITE_DONE) {
+		HAGGLE_ERR("Could not begin transaction: %s\n", sqlite3_errmsg(db));
+		return;
+	}
+
+	inTransaction = true;
+}
+
+/*
+	Events of the tasks in a transaction are held back until it is
+	committed, so that nobody hears about changes that may be rolled 
+	back. Query workers do not run in the transaction.
+*/
+void SQLDataStore::addTaskEvent(Event *e)
+{
+	if (inTransaction)
+		transactionEvents.push_back(e);
+	else
+		kernel->addEvent(e);
+}
+
+void SQLDataStore::addTaskEvent(Connection& c, Event *e)
+{
+	if (&c == &writer)
+		addTaskEvent(e);
+	else
+		kernel->addEvent(e);
+}
+
+/*
+	The attribute index and the data object cache still have what the
+	rolled back tasks added, and lack what they removed, so they are
+	built again from the data store. The events of the tasks are
+	dropped, since their changes are gone.
+*/
+void SQLDataStore::rollbackTaskBatch()
+{
+	HAGGLE_ERR("Transaction was rolled back, dropping %lu events\n", 
+		   (unsigned long)transactionEvents.size());
+
+	while (!transactionEvents.empty()) {
+		delete transactionEvents.front();
+		transactionEvents.pop_front();
+	}
+
+	indexMutex.lock();
+	dataObjectCache.clear();
+
+	if (buildAttributeIndex() < 0) {
+		HAGGLE_ERR("Could not rebuild attribute index\n");
+	}
+	indexMutex.unlock();
+}
+
+void SQLDataStore::_endTaskBatch()
+{
+	sqlite3_stmt *stmt;
+	int ret;
+
+	if (!inTransaction)
+		return;
+
+	// SQLite rolls back the transaction itself on some errors
+	if (sqlite3_get_autocommit(db)) {
+		inTransaction = false;
+		rollbackTaskBatch();
+		return;
+	}
+
+	stmt = getStatement(STMT_END_TRANSACTION);
+
+	if (!stmt)
+		return;
+
+	ret = sqlite3_step(stmt);
+	releaseStatement(STMT_END_TRANSACTION, stmt);
+
+	if (ret != SQLITE_DONE) {
+		// Keep the transaction open and try to commit it with the next batch
+		HAGGLE_ERR("Could not commit transaction: %s\n", sqlite3_errmsg(db));
+		return;
+	}
+
+	inTransaction = false;
+
+	while (!transactionEvents.empty()) {
+		kernel->addEvent(transactionEvents.front());
+		transactionEvents.pop_front();
+	}
+}
+
+SQLDataStore::QueryWorker::QueryWorker(SQLDataStore *_sqlds) : 
+	DataStoreQueryWorker(_sqlds, "SQLDataStoreQueryWorker"), sqlds(_sqlds)
+{
+}
+
+SQLDataStore::QueryWorker::~QueryWorker()
+{
+	conn.finalizeStatements();
+
+	if (conn.db)
+		sqlite3_close(conn.db);
+}
+
+bool SQLDataStore::QueryWorker::init()
+{
+	string file = sqlds->getFilepath();
+	int ret;
+
+	if (file.empty())
+		return false;
+
+	ret = sqlite3_open_v2(file.c_str(), &conn.db, SQLITE_OPEN_READWRITE, NULL);
+
+	if (ret != SQLITE_OK) {
+		HAGGLE_ERR("Query worker could not open database file %s: %s\n", 
+			   file.c_str(), sqlite3_errmsg(conn.db));
+		sqlite3_close(conn.db);
+		conn.db = NULL;
+		return false;
+	}
+
+	// Wait rather than fail while the data store thread checkpoints the log
+	sqlite3_busy_timeout(conn.db, SQL_QUERY_WORKER_BUSY_TIMEOUT);
+
+	return true;
+}
+
+int SQLDataStore::QueryWorker::_doFilterQuery(DataStoreFilterQuery *q)
+{
+	return sqlds->_doFilterQuery(conn, q);
+}
+
+int SQLDataStore::QueryWorker::_doDataObjectQuery(DataStoreDataObjectQuery *q)
+{
+	return sqlds->_doDataObjectQuery(conn, q);
+}
+
+int SQLDataStore::QueryWorker::_doDataObjectForNodesQuery(DataStoreDataObjectForNodesQuery *q)
+{
+	return sqlds->_doDataObjectForNodesQuery(conn, q);
+}
+
+int SQLDataStore::QueryWorker::_doNodeQuery(DataStoreNodeQuery *q)
+{
+	return sqlds->_doNodeQuery(conn, q);
+}
+
+int SQLDataStore::QueryWorker::_readRepository(DataStoreRepositoryQuery *q)
+{
+	return sqlds->_readRepository(conn, q);
+}
+
+int SQLDataStore::QueryWorker::_buildBloomfilter(const EventCallback<EventHandler> *callback)
+{
+	return sqlds->_buildBloomfilter(conn, callback);
+}
+
+DataStoreQueryWorker *SQLDataStore::_createQueryWorker(unsigned int num)
+{
+	// An in-memory database cannot be shared between connections,
+	// and without write-ahead logging the workers would wait for 
+	// every transaction of the data store thread.
+	if (isInMemory || !isWAL)
+		return NULL;
+
+	return new QueryWorker(this);
+}
+
+sqlite_int64 SQLDataStore::getDataObjectRowId(Connection& c, const DataObjectId_t& id)
+{
+	int ret;
+	sqlite3_stmt *stmt;
 	sqlite_int64 rowid = -1;
 
 	if (id == NULL)
 		return -1;
 
-	ret = sqlite3_prepare_v2(db, SQL_FIND_DATAOBJECT_CMD, (int) strlen(SQL_FIND_DATAOBJECT_CMD), &stmt, &tail);
+	stmt = c.getStatement(STMT_FIND_DATAOBJECT);
 
-
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", SQL_FIND_DATAOBJECT_CMD);
+	if (!stmt)
 		return -1;
-	}
 
 	ret = sqlite3_bind_blob(stmt, 1, id, DATAOBJECT_ID_LEN, SQLITE_TRANSIENT);
 
 	if (ret != SQLITE_OK) {
 		HAGGLE_DBG("SQLite could not bind blob!\n");
-		sqlite3_finalize(stmt);
+		c.releaseStatement(STMT_FIND_DATAOBJECT, stmt);
 		return -1;
 	}
 
@@ -2053,12 +2196,12 @@ sqlite_int64 SQLDataStore::getDataObjectRowId(const DataObjectId_t& id)
 	}
 
 	if (ret == SQLITE_ERROR) {
-		HAGGLE_DBG("Could not insert DO Error: %s\n", sqlite3_errmsg(db));
-		sqlite3_finalize(stmt);
+		HAGGLE_DBG("Could not insert DO Error: %s\n", sqlite3_errmsg(c.db));
+		c.releaseStatement(STMT_FIND_DATAOBJECT, stmt);
 		return -1;
 	}
 
-	sqlite3_finalize(stmt);
+	c.releaseStatement(STMT_FIND_DATAOBJECT, stmt);
 
 	return rowid;
 }
@@ -2067,20 +2210,18 @@ sqlite_int64 SQLDataStore::getAttributeRowId(const Attribute *attr)
 {
 	int ret;
 	sqlite3_stmt *stmt;
-	const char *tail;
-	char *sql_cmd;
 	sqlite_int64 rowid = -1;
 
 	if (!attr)
 		return -1;
 
-	sql_cmd = SQL_FIND_ATTR_CMD(attr);
-	ret = sqlite3_prepare_v2(db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
+	stmt = getStatement(STMT_FIND_ATTR);
 
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", sql_cmd);
+	if (!stmt)
 		return -1;
-	}
+
+	sqlite3_bind_text(stmt, 1, attr->getName().c_str(), -1, SQLITE_TRANSIENT);
+	sqlite3_bind_text(stmt, 2, attr->getValue().c_str(), -1, SQLITE_TRANSIENT);
 
 	ret = sqlite3_step(stmt);
 
@@ -2090,38 +2231,68 @@ sqlite_int64 SQLDataStore::getAttributeRowId(const Attribute *attr)
 
 	if (ret == SQLITE_ERROR) {
 		HAGGLE_DBG("Could not find Attribute: %s\n", sqlite3_errmsg(db));
-		sqlite3_finalize(stmt);
+		releaseStatement(STMT_FIND_ATTR, stmt);
 		return -1;
 	}
 
-	sqlite3_finalize(stmt);
+	releaseStatement(STMT_FIND_ATTR, stmt);
 
 	return rowid;
 }
 
+/*
+	Inserts an attribute unless it is already in the data store.
+	Returns the rowid of the attribute, or -1 on error.
+*/
+sqlite_int64 SQLDataStore::insertAttribute(const Attribute *attr)
+{
+	int ret;
+	sqlite3_stmt *stmt;
+
+	if (!attr)
+		return -1;
+
+	stmt = getStatement(STMT_INSERT_ATTR);
+
+	if (!stmt)
+		return -1;
+
+	sqlite3_bind_text(stmt, 1, attr->getName().c_str(), -1, SQLITE_TRANSIENT);
+	sqlite3_bind_text(stmt, 2, attr->getValue().c_str(), -1, SQLITE_TRANSIENT);
+
+	ret = sqlite3_step(stmt);
+	releaseStatement(STMT_INSERT_ATTR, stmt);
+
+	if (ret == SQLITE_CONSTRAINT)
+		return getAttributeRowId(attr);
+	
+	if (ret != SQLITE_DONE) {
+		HAGGLE_DBG("Could not insert Attribute: %s\n", sqlite3_errmsg(db));
+		return -1;
+	}
+
+	return sqlite3_last_insert_rowid(db);
+}
 
 sqlite_int64 SQLDataStore::getInterfaceRowId(const InterfaceRef& iface)
 {
 	int ret;
 	sqlite3_stmt *stmt;
-	const char *tail;
 	sqlite_int64 ifaceRowId = -1;
 
 	if (!iface)
 		return -1;
 
-	ret = sqlite3_prepare_v2(db, SQL_FIND_IFACE_CMD, (int) strlen(SQL_FIND_IFACE_CMD), &stmt, &tail);
+	stmt = getStatement(STMT_FIND_IFACE);
 
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", SQL_FIND_IFACE_CMD);
+	if (!stmt)
 		return -1;
-	}
 
 	ret = sqlite3_bind_blob(stmt, 1, iface->getIdentifier(), iface->getIdentifierLen(), SQLITE_TRANSIENT);
 
 	if (ret != SQLITE_OK) {
 		HAGGLE_DBG("SQLite could not bind blob!\n");
-		sqlite3_finalize(stmt);
+		releaseStatement(STMT_FIND_IFACE, stmt);
 		return -1;
 	}
 
@@ -2133,34 +2304,30 @@ sqlite_int64 SQLDataStore::getInterfaceRowId(const InterfaceRef& iface)
 
 	if (ret == SQLITE_ERROR) {
 		HAGGLE_DBG("Could not insert DO Error: %s\n", sqlite3_errmsg(db));
-		sqlite3_finalize(stmt);
+		releaseStatement(STMT_FIND_IFACE, stmt);
 		return -1;
 	}
 
-	sqlite3_finalize(stmt);
+	releaseStatement(STMT_FIND_IFACE, stmt);
 
 	return ifaceRowId;
 }
 
 
-sqlite_int64 SQLDataStore::getNodeRowId(const InterfaceRef& iface)
+sqlite_int64 SQLDataStore::getNodeRowId(Connection& c, const InterfaceRef& iface)
 {
 	sqlite_int64 nodeRowId = -1;
 	sqlite3_stmt *stmt;
-	const char *tail;
 	int ret;
 	
 	// lookup by common interfaces
-	
-	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, "SELECT node_rowid FROM %s WHERE (type = %d AND mac_str='%s');", 
-		 TABLE_INTERFACES, iface->getType(), iface->getIdentifierStr());
-		
-	ret = sqlite3_prepare_v2(db, sqlcmd, (int) strlen(sqlcmd), &stmt, &tail);
-	
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", sqlcmd);
+	stmt = c.getStatement(STMT_NODE_ROWID_FROM_IFACE);
+
+	if (!stmt)
 		return -1;
-	}
+	
+	sqlite3_bind_int(stmt, 1, iface->getType());
+	sqlite3_bind_text(stmt, 2, iface->getIdentifierStr(), -1, SQLITE_TRANSIENT);
 	
 	ret = sqlite3_step(stmt);
 	
@@ -2169,94 +2336,67 @@ sqlite_int64 SQLDataStore::getNodeRowId(const InterfaceRef& iface)
 		nodeRowId = sqlite3_column_int64(stmt, 0);
 	}
 	
+	c.releaseStatement(STMT_NODE_ROWID_FROM_IFACE, stmt);
+	
 	if (ret == SQLITE_ERROR) {
-		HAGGLE_DBG("Could not retrieve node from database: %s\n", sqlite3_errmsg(db));
+		HAGGLE_DBG("Could not retrieve node from database: %s\n", sqlite3_errmsg(c.db));
 		return -1;
 	}
 	
-	sqlite3_finalize(stmt);	
-	
 	return nodeRowId;
 }
 
-sqlite_int64 SQLDataStore::getNodeRowId(const NodeRef& node)
+sqlite_int64 SQLDataStore::getNodeRowId(Connection& c, const Node::Id_t id)
 {
 	int ret;
 	sqlite3_stmt *stmt;
-	const char *tail;
 	sqlite_int64 nodeRowId = -1;
 
-	if (node->getType() != Node::TYPE_UNDEFINED) {
-		// lookup by id
-		ret = sqlite3_prepare_v2(db, SQL_NODE_FROM_ID_CMD, (int) strlen(SQL_NODE_FROM_ID_CMD), &stmt, &tail);
+	stmt = c.getStatement(STMT_NODE_FROM_ID);
 
-		if (ret != SQLITE_OK) {
-			HAGGLE_DBG("SQLite command compilation failed! %s\n", SQL_NODE_FROM_ID_CMD);
-			return -1;
-		}
+	if (!stmt)
+		return -1;
 
-		ret = sqlite3_bind_blob(stmt, 1, node->getId(), NODE_ID_LEN, SQLITE_TRANSIENT);
+	ret = sqlite3_bind_blob(stmt, 1, id, NODE_ID_LEN, SQLITE_TRANSIENT);
 
-		if (ret != SQLITE_OK) {
-			HAGGLE_DBG("SQLite could not bind blob!\n");
-			sqlite3_finalize(stmt);
-			return -1;
-		}
+	if (ret != SQLITE_OK) {
+		HAGGLE_DBG("SQLite could not bind blob!\n");
+		c.releaseStatement(STMT_NODE_FROM_ID, stmt);
+		return -1;
+	}
 
-		ret = sqlite3_step(stmt);
+	ret = sqlite3_step(stmt);
 
-		if (ret == SQLITE_ROW) {
-			nodeRowId = sqlite3_column_int64(stmt, table_nodes_rowid);
-		}
+	if (ret == SQLITE_ROW) {
+		nodeRowId = sqlite3_column_int64(stmt, table_nodes_rowid);
+	}
 
-		if (ret == SQLITE_ERROR) {
-			HAGGLE_DBG("Could not insert DO Error: %s\n", sqlite3_errmsg(db));
-			sqlite3_finalize(stmt);
-			return -1;
-		}
+	if (ret == SQLITE_ERROR) {
+		HAGGLE_DBG("Could not insert DO Error: %s\n", sqlite3_errmsg(c.db));
+		c.releaseStatement(STMT_NODE_FROM_ID, stmt);
+		return -1;
+	}
 
-		sqlite3_finalize(stmt);
+	c.releaseStatement(STMT_NODE_FROM_ID, stmt);
+
+	return nodeRowId;
+}
+
+sqlite_int64 SQLDataStore::getNodeRowId(Connection& c, const NodeRef& node)
+{
+	sqlite_int64 nodeRowId = -1;
+
+	if (node->getType() != Node::TYPE_UNDEFINED) {
+		// lookup by id
+		nodeRowId = getNodeRowId(c, node->getId());
 	} else {
 		// lookup by common interfaces
-		
-		snprintf(sqlcmd, SQL_MAX_CMD_SIZE, "SELECT node_rowid FROM %s", TABLE_INTERFACES);
-
 		const InterfaceRefList *ifaces = node->getInterfaces();
 		
-		int cnt = 0;
 		for (InterfaceRefList::const_iterator it = ifaces->begin(); 
-		     it != ifaces->end(); it++) {
-			InterfaceRef ifaceRef = (*it);
-			cnt++;
-			
-			if (cnt == 1) 
-				sprintf(&(sqlcmd[strlen(sqlcmd)]), " WHERE (type = %d AND mac_str='%s')", ifaceRef->getType(), ifaceRef->getIdentifierStr());
-			else
-				sprintf(&(sqlcmd[strlen(sqlcmd)]), " OR (type = %d AND mac_str='%s')", ifaceRef->getType(), ifaceRef->getIdentifierStr());
-		}
-		
-		strcat(sqlcmd, ";");
-
-		ret = sqlite3_prepare_v2(db, sqlcmd, (int) strlen(sqlcmd), &stmt, &tail);
-			
-		if (ret != SQLITE_OK) {
-			HAGGLE_DBG("SQLite command compilation failed! %s\n", sqlcmd);
-			return -1;
-		}
-			
-		ret = sqlite3_step(stmt);
-		
-		if (ret == SQLITE_ROW) {
-			// No name for this column: See select statement in this function:
-			nodeRowId = sqlite3_column_int64(stmt, 0);
+		     it != ifaces->end() && nodeRowId == -1; it++) {
+			nodeRowId = getNodeRowId(c, *it);
 		}
-			
-		if (ret == SQLITE_ERROR) {
-			HAGGLE_DBG("Could not retrieve node from database: %s\n", sqlite3_errmsg(db));
-			return -1;
-		}
-
-		sqlite3_finalize(stmt);
 	}
 
 	return nodeRowId;
@@ -2271,12 +2411,8 @@ sqlite_int64 SQLDataStore::getNodeRowId(const NodeRef& node)
 
 int SQLDataStore::evaluateFilters(const DataObjectRef& dObj, sqlite_int64 dataobject_rowid)
 {
-	int ret, n = 0;
-	sqlite3_stmt *stmt;
-	char *sql_cmd = sqlcmd;
-	const char *tail;
-	sqlite_int64 filter_rowid = -1;
-	int eventType = -1;
+	int n = 0;
+	AttributeIndex::Matches filters;
 	DataObjectRefList dObjs;
 
 	if (!dObj)
@@ -2285,47 +2421,29 @@ int SQLDataStore::evaluateFilters(const DataObjectRef& dObj, sqlite_int64 dataob
 	HAGGLE_DBG("Evaluating filters\n");
 
 	if (dataobject_rowid == 0) {
-		dataobject_rowid = getDataObjectRowId(dObj->getId());
+		dataobject_rowid = getDataObjectRowId(writer, dObj->getId());
 	}
 	
 	if (dataobject_rowid < 0)
 		return -1;
 	
-	/* limit VIEW_MAP_DATAOBJECTS_TO_ATTRIBUTES_VIA_ROWID_DYNAMIC to dataobject in question */
-	setViewLimitedDataobjectAttributes(dataobject_rowid);
-
 	/* matching filters */
-	sql_cmd = (char *) SQL_FILTER_MATCH_DATAOBJECT_ALL_CMD;
-	ret = sqlite3_prepare(db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
+	attrIndex.filtersForDataObject(dataobject_rowid, filters);
 
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", SQL_FILTER_MATCH_DATAOBJECT_ALL_CMD);
-		return -1;
-	}
-	
 	// Add the data object to the result list
 	dObjs.add(dObj);
 
 	/* Loop through the results, i.e., all the filters that match */
-	while ((ret = sqlite3_step(stmt)) != SQLITE_DONE) {
-		if (ret == SQLITE_ROW) {
-			
-			filter_rowid = sqlite3_column_int64(stmt, view_match_filters_and_dataobjects_as_ratio_filter_rowid);
-			eventType = sqlite3_column_int(stmt, view_match_filters_and_dataobjects_as_ratio_filter_event);
+	for (size_t i = 0; i < filters.size(); i++) {
+		sqlite_int64 filter_rowid = filters[i].rowid;
+		long eventType = attrIndex.getFilterEvent(filter_rowid);
 
-			HAGGLE_DBG("Filter " SQLITE_INT64_FMT " with event type %d matches!\n", filter_rowid, eventType);
-			n++;
+		HAGGLE_DBG("Filter " SQLITE_INT64_FMT " with event type %ld matches!\n", filter_rowid, eventType);
+		n++;
 
-                        kernel->addEvent(new Event(eventType, dObjs));
-		} else if (ret == SQLITE_ERROR) {
-			HAGGLE_DBG("Could not evaluate filter result, Error: %s\n", sqlite3_errmsg(db));
-			sqlite3_finalize(stmt);
-			return -1;
-		}
+		addTaskEvent(new Event(eventType, dObjs));
 	}
 
-	sqlite3_finalize(stmt);
-
 	return n;
 }
 
@@ -2334,62 +2452,44 @@ int SQLDataStore::evaluateFilters(const DataObjectRef& dObj, sqlite_int64 dataob
 
 int SQLDataStore::evaluateDataObjects(long eventType)
 {
-	int ret;
-	sqlite3_stmt *stmt;
-	const char *tail;
-	sqlite_int64 do_rowid = -1;
-	char *sql_cmd = sqlcmd;
+	AttributeIndex::Matches matches;
+	sqlite_int64 filter_rowid = attrIndex.getFilterRowId(eventType);
 	DataObjectRefList dObjs;
 
 	HAGGLE_DBG("Evaluating filter\n");
 
-	/* reset dynamic link table */
-	setViewLimitedDataobjectAttributes();	
-
-	sql_cmd = SQL_FILTER_MATCH_ALL_CMD(eventType);
-	
-	ret = sqlite3_prepare_v2(db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
-
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("Match filter command compilation failed\n");
-		return -1;
+	if (filter_rowid < 0) {
+		HAGGLE_DBG("No filter for event type %ld\n", eventType);
+		return 0;
 	}
 
-	while ((ret = sqlite3_step(stmt)) != SQLITE_DONE) {
-		if (ret == SQLITE_ROW) {
-			
-			do_rowid = sqlite3_column_int64(stmt, view_match_filters_and_dataobjects_as_ratio_dataobject_rowid);
+	attrIndex.dataObjectsForFilter(filter_rowid, matches);
 
-			HAGGLE_DBG("Data object with rowid " SQLITE_INT64_FMT " matches!\n", do_rowid);
-			
-			DataObjectRef dObj = getDataObjectFromRowId(do_rowid);
-			
-			if (dObj) {
-				dObjs.push_back(dObj);
-                        } else {
-				HAGGLE_ERR("Could not create data object from row id " SQLITE_INT64_FMT "\n", do_rowid);
-			}
-			// FIXME: Set a limit on how many data objects to match when registering
-			// a filter. If there are many data objects, the matching will take too long time
-			// and Haggle will become unresponsive.
-			// Therefore, we set a limit to 10 data objects here. In the future we should
-			// make sure the limit is a user configurable variable and that the data
-			// objects returned are the highest ranking ones in descending order.
-			
-			if (dObjs.size() == 10)
-				break;
+	for (size_t i = 0; i < matches.size(); i++) {
+		sqlite_int64 do_rowid = matches[i].rowid;
 
-		} else if (ret == SQLITE_ERROR) {
-			HAGGLE_DBG("Could not insert DO Error: %s\n", sqlite3_errmsg(db));
-			sqlite3_finalize(stmt);
-			return -1;
+		HAGGLE_DBG("Data object with rowid " SQLITE_INT64_FMT " matches!\n", do_rowid);
+		
+		DataObjectRef dObj = getDataObjectFromRowId(writer, do_rowid);
+		
+		if (dObj) {
+			dObjs.push_back(dObj);
+		} else {
+			HAGGLE_ERR("Could not create data object from row id " SQLITE_INT64_FMT "\n", do_rowid);
 		}
+		// FIXME: Set a limit on how many data objects to match when registering
+		// a filter. If there are many data objects, the matching will take too long time
+		// and Haggle will become unresponsive.
+		// Therefore, we set a limit to 10 data objects here. The matches are in
+		// descending order, so these are the highest ranking ones. In the future we
+		// should make sure the limit is a user configurable variable.
+		
+		if (dObjs.size() == 10)
+			break;
 	}
-
-	sqlite3_finalize(stmt);
 	
 	if (dObjs.size())
-		kernel->addEvent(new Event(eventType, dObjs));
+		addTaskEvent(new Event(eventType, dObjs));
 
 	return dObjs.size();
 }
@@ -2442,7 +2542,7 @@ int SQLDataStore::deleteDataObjectNodeDescriptions(DataObjectRef dObj,
 			sqlite_int64 dObjRowId = sqlite3_column_int64(stmt, table_dataobjects_rowid);
 			
 			// create dObj and push it into list
-			DataObjectRef dObj_tmp = getDataObjectFromRowId(dObjRowId);
+			DataObjectRef dObj_tmp = getDataObjectFromRowId(writer, dObjRowId);
 			
 			if (dObj_tmp) {
 				if (dObj_tmp->getCreateTime() < newest_dObj->getCreateTime()) {
@@ -2498,6 +2598,11 @@ int SQLDataStore::_deleteFilter(long eventtype)
 		HAGGLE_DBG("Could not delete filter : %s\n", sqlite3_errmsg(db));
 		return -1;
 	}
+
+	indexMutex.lock();
+	attrIndex.removeFilter(attrIndex.getFilterRowId(eventtype));
+	indexMutex.unlock();
+
 	return 0;
 }
 
@@ -2551,6 +2656,10 @@ int SQLDataStore::_insertFilter(Filter *f, bool matchFilter,
 
 	filter_rowid = sqlite3_last_insert_rowid(db);
 
+	indexMutex.lock();
+	attrIndex.addFilter(filter_rowid, f->getEventType());
+	indexMutex.unlock();
+
 	// Insert Attributes
 	attrs = f->getAttributes();
 
@@ -2558,31 +2667,39 @@ int SQLDataStore::_insertFilter(Filter *f, bool matchFilter,
 	     it != attrs->end(); it++) {
 		const Attribute& a = (*it).second;
 
-		ret = sqlQuery(SQL_INSERT_ATTR_CMD(&a));
+		attr_rowid = insertAttribute(&a);
 
-		if (ret == SQLITE_ERROR) {
+		if (attr_rowid < 0) {
 			HAGGLE_DBG("SQLite insert of attribute failed!\n");
 			return -1;
 		}
 
-		if (ret == SQLITE_CONSTRAINT) {
-			attr_rowid = getAttributeRowId(&a);
-		} else {
-			attr_rowid = sqlite3_last_insert_rowid(db);
-		}
+		stmt = getStatement(STMT_INSERT_FILTER_ATTR);
+
+		if (!stmt)
+			return -1;
+
+		sqlite3_bind_int64(stmt, 1, filter_rowid);
+		sqlite3_bind_int64(stmt, 2, attr_rowid);
+		sqlite3_bind_int64(stmt, 3, a.getWeight());
 
-		ret = sqlQuery(SQL_INSERT_FILTER_ATTR_CMD(filter_rowid, 
-							  attr_rowid, 
-							  a.getWeight()));
+		ret = sqlite3_step(stmt);
+		releaseStatement(STMT_INSERT_FILTER_ATTR, stmt);
 
 		if (ret == SQLITE_ERROR) {
 			HAGGLE_DBG("insert of filter-attribute link failed!\n");
 			return -1;
 		}
+
+		if (ret == SQLITE_DONE) {
+			indexMutex.lock();
+			attrIndex.addFilterAttribute(filter_rowid, a.getName(), a.getValue());
+			indexMutex.unlock();
+		}
 	}
 
 	if (callback)
-		kernel->addEvent(new Event(callback, f));
+		addTaskEvent(new Event(callback, f));
 	
 	// Find all data objects that match this filter, and report them back:
 	if (matchFilter)
@@ -2598,6 +2715,7 @@ int SQLDataStore::_deleteNode(NodeRef& node)
 	char *sql_cmd;
 	sqlite3_stmt *stmt;
 	const char *tail;
+	sqlite_int64 node_rowid = getNodeRowId(writer, node->getId());
 	
 	sql_cmd = SQL_DELETE_NODE_CMD();
 	
@@ -2627,6 +2745,13 @@ int SQLDataStore::_deleteNode(NodeRef& node)
 			   sqlite3_errmsg(db));
 		return -1;
 	}
+	
+	if (node_rowid >= 0) {
+		indexMutex.lock();
+		attrIndex.removeNode(node_rowid);
+		indexMutex.unlock();
+	}
+	
 	return 0;
 }
 
@@ -2704,10 +2829,10 @@ int SQLDataStore::_insertNode(NodeRef& node,
 			   node->getName().c_str());
 
 		if (mergeBloomfilter) {
-			sqlite_int64 node_rowid = getNodeRowId(node);
+			sqlite_int64 node_rowid = getNodeRowId(writer, node);
 
 			if (node_rowid >= 0) {
-				existing_node = getNodeFromRowId(node_rowid);
+				existing_node = getNodeFromRowId(writer, node_rowid);
 
 				if (existing_node) {
 					HAGGLE_DBG("Merging BF of node %s\n", 
@@ -2740,6 +2865,10 @@ int SQLDataStore::_insertNode(NodeRef& node,
 
 	HAGGLE_DBG("Node rowid=" SQLITE_INT64_FMT "\n", node_rowid);
 
+	indexMutex.lock();
+	attrIndex.addNode(node_rowid, node->getMatchingThreshold());
+	indexMutex.unlock();
+
 	// Insert Attributes
 	
 	// Must use the node pointer here since the nodeRef is now locked.
@@ -2751,30 +2880,36 @@ int SQLDataStore::_insertNode(NodeRef& node,
 		HAGGLE_DBG("Inserting attribute %s=%s\n", 
 			   a.getName().c_str(), a.getValue().c_str());
 
-		sql_cmd = SQL_INSERT_ATTR_CMD(&a);
+		attr_rowid = insertAttribute(&a);
 
-		ret = sqlQuery(sql_cmd);
-
-		if (ret == SQLITE_ERROR) {
+		if (attr_rowid < 0) {
 			HAGGLE_DBG("SQLite insert of attribute failed !\n");
 			goto out_insertNode_err;
 		}
 
-		if (ret == SQLITE_CONSTRAINT) {
-			attr_rowid = getAttributeRowId(&a);
-		} else {
-			attr_rowid = sqlite3_last_insert_rowid(db);
-		}
+		stmt = getStatement(STMT_INSERT_NODE_ATTR);
+
+		if (!stmt)
+			goto out_insertNode_err;
 
-		sql_cmd = SQL_INSERT_NODE_ATTR_CMD(node_rowid, 
-						   attr_rowid, a.getWeight());
+		sqlite3_bind_int64(stmt, 1, node_rowid);
+		sqlite3_bind_int64(stmt, 2, attr_rowid);
+		sqlite3_bind_int64(stmt, 3, a.getWeight());
 
-		ret = sqlQuery(sql_cmd);
+		ret = sqlite3_step(stmt);
+		releaseStatement(STMT_INSERT_NODE_ATTR, stmt);
 
 		if (ret == SQLITE_ERROR) {
 			HAGGLE_DBG("node-attribute link insert failed!\n");
 			goto out_insertNode_err;
 		}
+
+		if (ret == SQLITE_DONE) {
+			indexMutex.lock();
+			attrIndex.addNodeAttribute(node_rowid, a.getName(), 
+						   a.getValue(), (long)a.getWeight());
+			indexMutex.unlock();
+		}
 	}
 
 	// Insert node interfaces
@@ -2786,36 +2921,33 @@ int SQLDataStore::_insertNode(NodeRef& node,
 
 		iface.lock();
 		
-		sql_cmd = SQL_INSERT_IFACE_CMD((sqlite_int64) iface->getType(), 
-					       iface->getIdentifierStr(), 
-					       node_rowid);
-		
-		HAGGLE_DBG("Insert interface SQLcmd: %s\n", sql_cmd);
+		HAGGLE_DBG("Insert interface %s\n", iface->getIdentifierStr());
 
-		ret = sqlite3_prepare_v2(db, sql_cmd, 
-					 (int)strlen(sql_cmd), 
-					 &stmt, &tail);
+		stmt = getStatement(STMT_INSERT_IFACE);
 
-		if (ret != SQLITE_OK) {
-			HAGGLE_DBG("SQLite command compilation failed! %s\n", 
-				   sql_cmd);
+		if (!stmt) {
 			iface.unlock();
 			goto out_insertNode_err;
 		}
 
-		ret = sqlite3_bind_blob(stmt, 1, iface->getIdentifier(), 
+		sqlite3_bind_int(stmt, 1, iface->getType());
+
+		ret = sqlite3_bind_blob(stmt, 2, iface->getIdentifier(), 
 					iface->getIdentifierLen(), 
 					SQLITE_TRANSIENT);
 
 		if (ret != SQLITE_OK) {
 			HAGGLE_DBG("could not bind interface identifier blob\n");
-			sqlite3_finalize(stmt);
+			releaseStatement(STMT_INSERT_IFACE, stmt);
 			iface.unlock();
 			goto out_insertNode_err;
 		}
 
+		sqlite3_bind_text(stmt, 3, iface->getIdentifierStr(), -1, SQLITE_TRANSIENT);
+		sqlite3_bind_int64(stmt, 4, node_rowid);
+
 		ret = sqlite3_step(stmt);
-		sqlite3_finalize(stmt);
+		releaseStatement(STMT_INSERT_IFACE, stmt);
 
 		if (ret == SQLITE_CONSTRAINT) {
 			HAGGLE_DBG("Interface %s already in datastore\n", 
@@ -2835,7 +2967,7 @@ int SQLDataStore::_insertNode(NodeRef& node,
 	
 	if (callback) {
 		HAGGLE_DBG("Scheduling callback for inserted node\n");
-		kernel->addEvent(new Event(callback, node));
+		addTaskEvent(new Event(callback, node));
 	}
 	HAGGLE_DBG("Node %s inserted successfully\n", 
 		   node->getName().c_str());
@@ -2857,21 +2989,30 @@ int SQLDataStore::_deleteDataObject(const DataObjectId_t &id,
 	sqlite3_stmt *stmt;
 	const char *tail;
 	char idStr[MAX_DATAOBJECT_ID_STR_LEN];
-	int len = 0;
+	sqlite_int64 dataobject_rowid = getDataObjectRowId(writer, id);
 
 	// Generate a readable string of the Id
-	for (int i = 0; i < DATAOBJECT_ID_LEN; i++) {
-		len += sprintf(idStr + len, "%02x", id[i] & 0xff);
+	buf2str((const char *)id, idStr, DATAOBJECT_ID_LEN);
+	
+	/*
+	   Remove the data object from the cache first, so that the data
+	   object reported as removed is a new one, which is not shared
+	   with anyone else.
+	*/
+	if (dataobject_rowid >= 0) {
+		indexMutex.lock();
+		dataObjectCache.remove(dataobject_rowid);
+		indexMutex.unlock();
 	}
 	
 	if (shouldReportRemoval) {
-		DataObjectRef dObj = getDataObjectFromRowId(getDataObjectRowId(id));
+		DataObjectRef dObj = getDataObjectFromRowId(writer, dataobject_rowid);
 		// FIXME: shouldn't the data object be given back ownership of it's 
 		// file? (If it has one.) So that the file is removed from disk along 
 		// with the data object.
 		if (dObj) {
 			dObj->setStored(false);
-			kernel->addEvent(new Event(EVENT_TYPE_DATAOBJECT_DELETED, 
+			addTaskEvent(new Event(EVENT_TYPE_DATAOBJECT_DELETED, 
 						   dObj, keepInBloomfilter));
 		} else {
 			HAGGLE_ERR("Tried to report removal of a data object that "
@@ -2918,6 +3059,14 @@ int SQLDataStore::_deleteDataObject(const DataObjectId_t &id,
 				   idStr);
 		}
 	}
+	
+	if (dataobject_rowid >= 0) {
+		indexMutex.lock();
+		attrIndex.removeDataObject(dataobject_rowid);
+		dataObjectCache.remove(dataobject_rowid);
+		indexMutex.unlock();
+	}
+	
 	return 0;
 }
 
@@ -2929,7 +3078,7 @@ int SQLDataStore::_deleteDataObject(DataObjectRef& dObj,
 	// (If it has one.) So that the file is removed from disk along with the
 	// data object.
 	if (_deleteDataObject(dObj->getId(), false, keepInBloomfilter) == 0 && shouldReportRemoval)
-		kernel->addEvent(new Event(EVENT_TYPE_DATAOBJECT_DELETED, dObj, keepInBloomfilter));
+		addTaskEvent(new Event(EVENT_TYPE_DATAOBJECT_DELETED, dObj, keepInBloomfilter));
 	
 	return 0;
 }
@@ -2944,32 +3093,8 @@ int SQLDataStore::_ageDataObjects(const Timeval& minimumAge,
 	const char *tail;
 	DataObjectRefList dObjs;
 	
-	// -- drop dataobject view
-	sql_cmd = (char *) SQL_DROP_VIEW_LIMITED_DATAOBJECT_ATTRIBUTES_CMD;
-	ret = sqlite3_prepare(db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
-
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", sql_cmd);
-		HAGGLE_DBG("%s\n", sqlite3_errmsg(db));
-		// view probably missing, so we do not quit
-	} else {
-		ret = sqlite3_step(stmt);
-	}
-	sqlite3_finalize(stmt);
-	
-	// -- reset dataobject view
-	sql_cmd = (char *) SQL_CREATE_VIEW_LIMITED_DATAOBJECT_ATTRIBUTES_CMD;
-	ret = sqlite3_prepare(db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", sql_cmd);
-		HAGGLE_DBG("%s\n", sqlite3_errmsg(db));
-		// view probably missing, so we do not quit
-	} else {
-		ret = sqlite3_step(stmt);
-	}
-	sqlite3_finalize(stmt);
-	
 	// -- delete dataobjects not related to any filter (no interest) and being created more than minimumAge seconds ago. 
+	// The filter matching is done with the attribute index, for each data object old enough.
 	sql_cmd = SQL_AGE_DATAOBJECT_CMD(minimumAge);
 	
 	ret = sqlite3_prepare_v2(db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
@@ -2982,6 +3107,13 @@ int SQLDataStore::_ageDataObjects(const Timeval& minimumAge,
 	
 	while (dObjs.size() < DATASTORE_MAX_DATAOBJECTS_AGED_AT_ONCE && (ret = sqlite3_step(stmt)) != SQLITE_DONE) {
 		if (ret == SQLITE_ROW) {
+			AttributeIndex::Matches filters;
+
+			attrIndex.filtersForDataObject(sqlite3_column_int64(stmt, table_dataobjects_rowid), filters);
+
+			if (!filters.empty())
+				continue;
+
 			DataObjectRef dObj = createDataObject(stmt);
 			if (dObj) {
 				dObj->setStored(false);
@@ -3001,7 +3133,7 @@ int SQLDataStore::_ageDataObjects(const Timeval& minimumAge,
 		_deleteDataObject(*it, false);	// delete and report as event
 	}
 
-	kernel->addEvent(new Event(EVENT_TYPE_DATAOBJECT_DELETED, dObjs, keepInBloomfilter));
+	addTaskEvent(new Event(EVENT_TYPE_DATAOBJECT_DELETED, dObjs, keepInBloomfilter));
 	
 	if (ret == SQLITE_ERROR) {
 		HAGGLE_DBG("Could not age data objects : %s\n", sqlite3_errmsg(db));
@@ -3010,7 +3142,7 @@ int SQLDataStore::_ageDataObjects(const Timeval& minimumAge,
 		
 out:
 	if (callback)
-		kernel->addEvent(new Event(callback, dObjs));
+		addTaskEvent(new Event(callback, dObjs));
 
 	return ret;
 }
@@ -3021,9 +3153,7 @@ int SQLDataStore::_insertDataObject(DataObjectRef& dObj,
 	int ret;
 	size_t metadatalen;
 	char *metadata;
-	char *sql_cmd;
 	sqlite3_stmt *stmt;
-	const char *tail;
 	sqlite_int64 dataobject_rowid;
 	sqlite_int64 attr_rowid;
 	sqlite_int64 ifaceRowId = -1;
@@ -3071,56 +3201,70 @@ int SQLDataStore::_insertDataObject(DataObjectRef& dObj,
 	if (dObj->getRemoteInterface())
 		ifaceRowId = getInterfaceRowId(dObj->getRemoteInterface());
 	
-	sql_cmd = sql_insert_dataobject_cmd_alloc(metadata, ifaceRowId, 
-						      dObj, node_id);
+	stmt = getStatement(STMT_INSERT_DATAOBJECT);
 
-	if (!sql_cmd) {
+	if (!stmt) {
 		goto out_insertDataObject_err;
 	}
 
-	ret = sqlite3_prepare_v2(db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
+	ret = sqlite3_bind_blob(stmt, 1, dObj->getId(), 
+				DATAOBJECT_ID_LEN, SQLITE_TRANSIENT);
 
-	free(sql_cmd);
-	
 	if (ret != SQLITE_OK) {
-		HAGGLE_ERR("SQLite command compilation failed! %s\n", sql_cmd);
+		HAGGLE_ERR("could not bind data object identifier blob!\n");
+		releaseStatement(STMT_INSERT_DATAOBJECT, stmt);
 		goto out_insertDataObject_err;
 	}
 
-	ret = sqlite3_bind_blob(stmt, 1, dObj->getId(), 
-				DATAOBJECT_ID_LEN, SQLITE_TRANSIENT);
+	// The metadata is not freed until after the statement has been run
+	ret = sqlite3_bind_text(stmt, 2, metadata, -1, SQLITE_STATIC);
 
 	if (ret != SQLITE_OK) {
-		HAGGLE_ERR("could not bind data object identifier blob!\n");
-		sqlite3_finalize(stmt);
+		HAGGLE_ERR("could not bind data object metadata!\n");
+		releaseStatement(STMT_INSERT_DATAOBJECT, stmt);
 		goto out_insertDataObject_err;
 	}
 
+	sqlite3_bind_text(stmt, 3, dObj->getFilePath().c_str(), -1, SQLITE_TRANSIENT);
+	sqlite3_bind_text(stmt, 4, dObj->getFileName().c_str(), -1, SQLITE_TRANSIENT);
+	sqlite3_bind_int64(stmt, 5, dObj->getDataLen());
+	sqlite3_bind_int(stmt, 6, dObj->getDataState());
+
 	if (dObj->getDataState() > DataObject::DATA_STATE_NO_DATA) {
-		ret = sqlite3_bind_blob(stmt, 2, dObj->getDataHash(), 
+		ret = sqlite3_bind_blob(stmt, 7, dObj->getDataHash(), 
 					sizeof(DataHash_t), SQLITE_TRANSIENT);
 
 		if (ret != SQLITE_OK) {
 			HAGGLE_ERR("could not bind data object signature blob!\n");
-			sqlite3_finalize(stmt);
+			releaseStatement(STMT_INSERT_DATAOBJECT, stmt);
 			goto out_insertDataObject_err;
 		}
 	}
 
+	sqlite3_bind_int(stmt, 8, dObj->getSignatureStatus());
+	sqlite3_bind_text(stmt, 9, dObj->getSignee().c_str(), -1, SQLITE_TRANSIENT);
+
 	if (dObj->getSignatureLength() && 
 	    dObj->getSignatureStatus() != DataObject::SIGNATURE_MISSING) {
-		ret = sqlite3_bind_blob(stmt, 3, dObj->getSignature(), 
+		ret = sqlite3_bind_blob(stmt, 10, dObj->getSignature(), 
 					dObj->getSignatureLength(), SQLITE_TRANSIENT);
 
 		if (ret != SQLITE_OK) {
 			HAGGLE_ERR("could not bind data object signature blob!\n");
-			sqlite3_finalize(stmt);
+			releaseStatement(STMT_INSERT_DATAOBJECT, stmt);
 			goto out_insertDataObject_err;
 		}
 	}
 
+	sqlite3_bind_int64(stmt, 11, dObj->getSignatureLength());
+	sqlite3_bind_int64(stmt, 12, dObj->getCreateTime().getTimeAsMilliSeconds());
+	sqlite3_bind_int64(stmt, 13, dObj->getReceiveTime().getTimeAsMilliSeconds());
+	sqlite3_bind_int64(stmt, 14, dObj->getRxTime());
+	sqlite3_bind_int64(stmt, 15, ifaceRowId);
+	sqlite3_bind_text(stmt, 16, node_id.c_str(), -1, SQLITE_TRANSIENT);
+
 	ret = sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
+	releaseStatement(STMT_INSERT_DATAOBJECT, stmt);
 
 	if (ret == SQLITE_CONSTRAINT) {
 		if (!dObj->isPersistent()) {
@@ -3157,36 +3301,44 @@ int SQLDataStore::_insertDataObject(DataObjectRef& dObj,
 
 	dataobject_rowid = sqlite3_last_insert_rowid(db);
 
+	indexMutex.lock();
+	attrIndex.addDataObject(dataobject_rowid, dObj->getId());
+	indexMutex.unlock();
+
 	// Insert Attributes
 	attrs = dObj->getAttributes();
 
 	for (Attributes::const_iterator it = attrs->begin(); it != attrs->end(); it++) {
 		const Attribute& a = (*it).second;
 
-		sql_cmd = SQL_INSERT_ATTR_CMD(&a);
-
-		ret = sqlQuery(sql_cmd);
+		attr_rowid = insertAttribute(&a);
 
-		if (ret == SQLITE_ERROR) {
+		if (attr_rowid < 0) {
 			HAGGLE_ERR("SQLite insert of attribute failed!\n");
 			goto out_insertDataObject_err;
 		}
 
-		
-		if (ret == SQLITE_CONSTRAINT) {
-			attr_rowid = getAttributeRowId(&a);
-		} else {
-			attr_rowid = sqlite3_last_insert_rowid(db);
-		}
+		stmt = getStatement(STMT_INSERT_DATAOBJECT_ATTR);
+
+		if (!stmt)
+			goto out_insertDataObject_err;
 
-		sql_cmd = SQL_INSERT_DATAOBJECT_ATTR_CMD(dataobject_rowid, attr_rowid);
+		sqlite3_bind_int64(stmt, 1, dataobject_rowid);
+		sqlite3_bind_int64(stmt, 2, attr_rowid);
 
-		ret = sqlQuery(sql_cmd);
+		ret = sqlite3_step(stmt);
+		releaseStatement(STMT_INSERT_DATAOBJECT_ATTR, stmt);
 
 		if (ret == SQLITE_ERROR) {
 			HAGGLE_ERR("SQLite insert of dataobject-attribute link failed!\n");
 			goto out_insertDataObject_err;
 		}
+
+		if (ret == SQLITE_DONE) {
+			indexMutex.lock();
+			attrIndex.addDataObjectAttribute(dataobject_rowid, a.getName(), a.getValue());
+			indexMutex.unlock();
+		}
 	}
 
 	dObj.unlock();
@@ -3206,7 +3358,7 @@ int SQLDataStore::_insertDataObject(DataObjectRef& dObj,
 	}
 		
 	if (callback)
-		kernel->addEvent(new Event(callback, dObj));
+		addTaskEvent(new Event(callback, dObj));
 		
 	return 0;
 
@@ -3216,7 +3368,7 @@ out_insertDataObject_duplicate:
 
         // Notify the data manager of this duplicate data object
         if (callback)
-		kernel->addEvent(new Event(callback, dObj));
+		addTaskEvent(new Event(callback, dObj));
         
         return 0;
 out_insertDataObject_err:
@@ -3243,16 +3395,16 @@ int SQLDataStore::_retrieveNode(NodeRef& refNode, const EventCallback<EventHandl
 	
 	HAGGLE_DBG("Retrieve Node %s\n", refNode->getName().c_str());
 	
-	sqlite_int64 node_rowid = getNodeRowId(refNode);
+	sqlite_int64 node_rowid = getNodeRowId(writer, refNode);
 	
 	if (node_rowid != -1)
-		node = getNodeFromRowId(node_rowid);
+		node = getNodeFromRowId(writer, node_rowid);
 	
 	if (!node) {
 		HAGGLE_DBG("No node %s in data store\n", refNode->getName().c_str());
 		if (forceCallback) {
 			HAGGLE_DBG("Forcing callback\n");
-			kernel->addEvent(new Event(callback, refNode));
+			addTaskEvent(new Event(callback, refNode));
 			return 0;
 		} else {
 			return -1;
@@ -3280,7 +3432,7 @@ int SQLDataStore::_retrieveNode(NodeRef& refNode, const EventCallback<EventHandl
 	
 	HAGGLE_DBG("Node %s retrieved successfully\n", refNode->getName().c_str());
 
-	kernel->addEvent(new Event(callback, node));
+	addTaskEvent(new Event(callback, node));
 
 	return 1;
 }
@@ -3311,7 +3463,7 @@ int SQLDataStore::_retrieveNode(Node::Type_t type, const EventCallback<EventHand
 		ret = sqlite3_step(stmt);
 
 		if (ret == SQLITE_ROW) {
-			NodeRef node = getNodeFromRowId(sqlite3_column_int64(stmt, sql_node_by_type_cmd_rowid));
+			NodeRef node = getNodeFromRowId(writer, sqlite3_column_int64(stmt, sql_node_by_type_cmd_rowid));
 			if (node) {
 				if (nodes == NULL) {
 					nodes = new NodeRefList();
@@ -3323,7 +3475,7 @@ int SQLDataStore::_retrieveNode(Node::Type_t type, const EventCallback<EventHand
 	
 	sqlite3_finalize(stmt);
 	
-	kernel->addEvent(new Event(callback, nodes));
+	addTaskEvent(new Event(callback, nodes));
 
 	return 1;
 }
@@ -3340,16 +3492,16 @@ int SQLDataStore::_retrieveNode(const InterfaceRef& iface, const EventCallback<E
 	
 	HAGGLE_DBG("Retrieving node based on interface [%s]\n", iface->getIdentifierStr());
 	
-	sqlite_int64 node_rowid = getNodeRowId(iface);
+	sqlite_int64 node_rowid = getNodeRowId(writer, iface);
 	
 	if (node_rowid != -1)
-		node = getNodeFromRowId(node_rowid);
+		node = getNodeFromRowId(writer, node_rowid);
 	
 	if (!node) {
 		HAGGLE_DBG("No node with interface [%s] in data store\n", iface->getIdentifierStr());
 		if (forceCallback) {
 			HAGGLE_DBG("Forcing callback\n");
-			kernel->addEvent(new Event(callback, iface));
+			addTaskEvent(new Event(callback, iface));
 			return 0;
 		} else {
 			return -1;
@@ -3362,7 +3514,7 @@ int SQLDataStore::_retrieveNode(const InterfaceRef& iface, const EventCallback<E
 	
 	HAGGLE_DBG("Node %s retrieved successfully based on interface [%s]\n", node->getName().c_str(), iface->getIdentifierStr());
 	
-	kernel->addEvent(new Event(callback, node));
+	addTaskEvent(new Event(callback, node));
 	
 	return 1;
 }
@@ -3374,16 +3526,11 @@ int SQLDataStore::_retrieveNode(const InterfaceRef& iface, const EventCallback<E
 
 // ----- Filter > Dataobjects
 
-int SQLDataStore::_doFilterQuery(DataStoreFilterQuery *q)
+int SQLDataStore::_doFilterQuery(Connection& c, DataStoreFilterQuery *q)
 {
 	DataStoreQueryResult *qr;
 	unsigned int num_match = 0;
-	sqlite3_stmt *stmt;
-	const char *tail;
-	char *sql_cmd = sqlcmd;
-	int ret;
-	sqlite_int64 filter_rowid = 0;
-	sqlite_int64 dataobject_rowid = 0;
+	AttributeIndex::Matches matches;
 	
 	HAGGLE_DBG("Filter Query\n");
 	
@@ -3398,153 +3545,131 @@ int SQLDataStore::_doFilterQuery(DataStoreFilterQuery *q)
 		return -1;
 	}
 	
-	// insert filter into database (remove after query)
-	filter_rowid = _insertFilter((Filter*)q->getFilter());
-	
-	if (filter_rowid < 0)
-		return -1;
-	
-	/* reset view dataobject>attribute */
-	setViewLimitedDataobjectAttributes();
-
-	/* query */
-	sql_cmd = SQL_FILTER_MATCH_DATAOBJECT_CMD(filter_rowid);
-	
-	ret = sqlite3_prepare(db, sql_cmd, (int)strlen(sql_cmd), &stmt, &tail);
-	
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", sql_cmd);
-		ret = -1;
-		goto filterQuery_cleanup;
+	/* 
+	   query, matching the filter's attributes directly against
+	   the index, so that the query does not modify the data store
+	*/
+	synchronized(indexMutex) {
+		attrIndex.dataObjectsForAttributes(*q->getFilter()->getAttributes(), matches);
 	}
+
+	if (!matches.empty())
+		qr->setQuerySqlEndTime();
 	
-	/* loop through results and create dataobjects */
-	while ((ret = sqlite3_step(stmt)) != SQLITE_DONE) {
-		if (num_match == 0) {
-			qr->setQuerySqlEndTime();
-		}
-		
-		if (ret == SQLITE_ROW) {
+	/* 
+	   loop through results and create dataobjects, in order of
+	   ascending ratio, and oldest first for the same ratio
+	*/
+	for (size_t end = matches.size(); end > 0;) {
+		size_t start = end;
+
+		while (start > 0 && matches[start - 1].ratio == matches[end - 1].ratio)
+			start--;
+
+		for (size_t i = start; i < end; i++) {
+			sqlite_int64 dataobject_rowid = matches[i].rowid;
+
 			num_match++;
 			
-			dataobject_rowid = sqlite3_column_int(stmt, view_match_filters_and_dataobjects_as_ratio_dataobject_rowid);
-			
-			HAGGLE_DBG("Dataobject with rowid %d matches!\n", dataobject_rowid);
+			HAGGLE_DBG("Dataobject with rowid " SQLITE_INT64_FMT " matches!\n", dataobject_rowid);
 			
-			DataObjectRef dObj = getDataObjectFromRowId(dataobject_rowid);
+			DataObjectRef dObj = getDataObjectFromRowId(c, dataobject_rowid);
 			
 			if (dObj) {
 				qr->addDataObject(dObj);
 			} else {
 				HAGGLE_DBG("Could not get data object from rowid\n");
 			}
-		} else if (ret == SQLITE_ERROR) {
-			HAGGLE_DBG("Could not insert DO Error: %s\n", sqlite3_errmsg(db));
-			break;
 		}
+		end = start;
 	}
 	
-	sqlite3_finalize(stmt);
-
 	if (num_match) {
-		kernel->addEvent(new Event(q->getCallback(), qr));
+		addTaskEvent(c, new Event(q->getCallback(), qr));
 	} else {
 		delete qr;
 	}
 
-	ret = num_match;
-	
-filterQuery_cleanup:	
-	// remove filter from database
-	sprintf(sql_cmd, "DELETE FROM %s WHERE rowid = " SQLITE_INT64_FMT "", TABLE_FILTERS, filter_rowid);
-	sqlite3_prepare(db, sql_cmd, (int)strlen(sql_cmd), &stmt, &tail);
-	sqlite3_step(stmt);
-	sqlite3_finalize(stmt);
-	
-	return ret;
+	return num_match;
 }
 
 
 // ----- Node > Dataobjects
 
-int SQLDataStore::_doDataObjectQueryStep2(NodeRef &node, 
+int SQLDataStore::_doDataObjectQueryStep2(Connection& c,
+					  NodeRef &node, 
 					  NodeRef delegate_node, 
 					  DataStoreQueryResult *qr, 
 					  int max_matches, 
 					  unsigned int threshold, 
 					  unsigned int attrMatch)
 {
-	int ret;
-	sqlite3_stmt *stmt;
-	const char *tail;
-	char *sql_cmd = sqlcmd;
 	int num_match = 0;
+	AttributeIndex::Matches matches;
 	
-	sqlite_int64 node_rowid = getNodeRowId(node);
+	sqlite_int64 node_rowid = getNodeRowId(c, node);
 
 	if (node_rowid == -1 ){
 		HAGGLE_DBG("No rowid for node %s\n", node->getName().c_str());
 		return 0;
 	}
 
-	/* limit VIEW_MAP_NODES_TO_ATTRIBUTES_VIA_ROWID_DYNAMIC to node in question */
-	setViewLimitedNodeAttributes(node_rowid);
-	 
 	/* matching */
-	snprintf(sqlcmd, SQL_MAX_CMD_SIZE, "SELECT * FROM " VIEW_MATCH_NODES_AND_DATAOBJECTS_AS_RATIO " WHERE ratio >= %u AND mcount >= %u;", threshold, attrMatch);
-
-	ret = sqlite3_prepare(db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
-
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", sql_cmd);
-		return 0;
+	synchronized(indexMutex) {
+		attrIndex.dataObjectsForNode(node_rowid, threshold, attrMatch, matches);
 	}
 
 	/* looping through the results and allocating dataobjects */
-	while ((ret = sqlite3_step(stmt)) != SQLITE_DONE) {
-		if (ret == SQLITE_ROW) {
-			sqlite_int64 dObjRowId = sqlite3_column_int64(stmt, view_match_nodes_and_dataobjects_rated_dataobject_rowid);
+	for (size_t i = 0; i < matches.size(); i++) {
+		sqlite_int64 dObjRowId = matches[i].rowid;
+		DataObjectId_t id;
+		bool has_id = false;
+
+		// Copy the id, since the data object may be removed from the 
+		// index as soon as the lock is released
+		indexMutex.lock();
+		const DataObjectId_t *idp = attrIndex.getDataObjectId(dObjRowId);
+
+		if (idp) {
+			memcpy(id, *idp, sizeof(DataObjectId_t));
+			has_id = true;
+		}
+		indexMutex.unlock();
 
-			DataObjectRef dObj = getDataObjectFromRowId(dObjRowId);
+		// Ignore this data object if the target or the potential delegate 
+		// already has it. Checking the id first avoids loading the data 
+		// objects that would be ignored anyway.
+		if (has_id && (node->getBloomfilter()->has(id) || 
+			   (delegate_node && delegate_node->getBloomfilter()->has(id))))
+			continue;
 
-			if (dObj) {
-				bool delegate_has_dataobject = delegate_node ? delegate_node->getBloomfilter()->has(dObj) : false;
-				// Ignore this data object if the target or the potential delegate 
-				// already has it
-				if (node->getBloomfilter()->has(dObj) || delegate_has_dataobject)
+		DataObjectRef dObj = getDataObjectFromRowId(c, dObjRowId);
+
+		if (dObj) {
+			//HAGGLE_DBG("Data object rowid=" SQLITE_INT64_FMT "\n", dObjRowId);
+			if (dObj->isNodeDescription()) {
+				NodeRef desc_node = Node::create(Node::TYPE_PEER, dObj);
+				// Ignore this data object if it is the node description of the target
+				// or a potential delegate
+				if (desc_node == node || (delegate_node && delegate_node == desc_node)) {
 					continue;
-					
-				//HAGGLE_DBG("Data object rowid=" SQLITE_INT64_FMT "\n", dObjRowId);
-				if (dObj->isNodeDescription()) {
-					NodeRef desc_node = Node::create(Node::TYPE_PEER, dObj);
-					// Ignore this data object if it is the node description of the target
-					// or a potential delegate
-					if (desc_node == node || (delegate_node && delegate_node == desc_node)) {
-						continue;
-					}
 				}
-				qr->addDataObject(dObj);
-				num_match++;
-				
-				if (max_matches != 0 && (num_match >= max_matches)) {
-					break;
-				}
-			} else {
-				HAGGLE_DBG("Could not get data object from rowid\n");
 			}
-		} else if (ret == SQLITE_ERROR) {
-			HAGGLE_DBG("data object query Error:%s\n", sqlite3_errmsg(db));
-			sqlite3_finalize(stmt);
-			return num_match;
+			qr->addDataObject(dObj);
+			num_match++;
+			
+			if (max_matches != 0 && (num_match >= max_matches)) {
+				break;
+			}
+		} else {
+			HAGGLE_DBG("Could not get data object from rowid\n");
 		}
 	}
 
-	sqlite3_finalize(stmt);
-	
 	return num_match;
 }
 
-int SQLDataStore::_doDataObjectQuery(DataStoreDataObjectQuery *q)
+int SQLDataStore::_doDataObjectQuery(Connection& c, DataStoreDataObjectQuery *q)
 {
 	unsigned int num_match = 0;
 	DataStoreQueryResult *qr;
@@ -3563,7 +3688,7 @@ int SQLDataStore::_doDataObjectQuery(DataStoreDataObjectQuery *q)
 	qr->setQuerySqlStartTime();
 	qr->setQueryInitTime(q->getQueryInitTime());
 
-	num_match = _doDataObjectQueryStep2(node, NULL, 
+	num_match = _doDataObjectQueryStep2(c, node, NULL, 
 					    qr, node->getMaxDataObjectsInMatch(), 
 					    node->getMatchingThreshold(), 
 					    q->getAttrMatch());
@@ -3574,10 +3699,10 @@ int SQLDataStore::_doDataObjectQuery(DataStoreDataObjectQuery *q)
 	qr->setQueryResultTime();
 
 #if defined(BENCHMARK)
-	kernel->addEvent(new Event(q->getCallback(), qr));
+	addTaskEvent(c, new Event(q->getCallback(), qr));
 #else
 	if (num_match) {
-		kernel->addEvent(new Event(q->getCallback(), qr));
+		addTaskEvent(c, new Event(q->getCallback(), qr));
 	} else {
 		delete qr;
 	}
@@ -3592,7 +3717,7 @@ int SQLDataStore::_doDataObjectQuery(DataStoreDataObjectQuery *q)
 	This function is basically the same as _doDataObjectQuery, except that it
 	also goes through a list of secondary nodes.
 */
-int SQLDataStore::_doDataObjectForNodesQuery(DataStoreDataObjectForNodesQuery *q)
+int SQLDataStore::_doDataObjectForNodesQuery(Connection& c, DataStoreDataObjectForNodesQuery *q)
 {
 	unsigned int num_match = 0;
 #if defined(DEBUG)
@@ -3629,7 +3754,7 @@ int SQLDataStore::_doDataObjectForNodesQuery(DataStoreDataObjectForNodesQuery *q
 	
 	while (node && !(has_maximum && (num_left <= 0))) {
 
-		num_match = _doDataObjectQueryStep2(node, delegateNode, qr, num_left, threshold, q->getAttrMatch());
+		num_match = _doDataObjectQueryStep2(c, node, delegateNode, qr, num_left, threshold, q->getAttrMatch());
                 
 		if (has_maximum) {
 			num_left -= num_match;
@@ -3644,10 +3769,10 @@ int SQLDataStore::_doDataObjectForNodesQuery(DataStoreDataObjectForNodesQuery *q
 	qr->setQueryResultTime();
 
 #if defined(BENCHMARK)
-	kernel->addEvent(new Event(q->getCallback(), qr));
+	addTaskEvent(c, new Event(q->getCallback(), qr));
 #else
 	if (num_match) {
-		kernel->addEvent(new Event(q->getCallback(), qr));
+		addTaskEvent(c, new Event(q->getCallback(), qr));
 	} else {
 		delete qr;
 	}
@@ -3660,14 +3785,11 @@ int SQLDataStore::_doDataObjectForNodesQuery(DataStoreDataObjectForNodesQuery *q
 
 // ----- Dataobject > Nodes
 
-int SQLDataStore::_doNodeQuery(DataStoreNodeQuery *q)
+int SQLDataStore::_doNodeQuery(Connection& c, DataStoreNodeQuery *q)
 {
-	int ret;
-	sqlite3_stmt *stmt;
-	const char *tail;
-	char *sql_cmd = sqlcmd;
 	unsigned int num_match = 0;
 	DataStoreQueryResult *qr;
+	AttributeIndex::Matches matches;
 	DataObjectRef dObj = q->getDataObject();
 	
 	if (!dObj) {
@@ -3688,56 +3810,38 @@ int SQLDataStore::_doNodeQuery(DataStoreNodeQuery *q)
 	qr->setQuerySqlStartTime();
 	qr->setQueryInitTime(q->getQueryInitTime());
 	
-	sqlite_int64 dataobject_rowid = getDataObjectRowId(dObj->getId());
-	
-	/* limit the dataobject attribute links */
-	setViewLimitedDataobjectAttributes(dataobject_rowid);
+	sqlite_int64 dataobject_rowid = getDataObjectRowId(c, dObj->getId());
 	
 	/* the actual query */
-	if (q->getMaxResp() > 0) {
-		snprintf(sqlcmd, SQL_MAX_CMD_SIZE, "SELECT * FROM %s WHERE ratio >= threshold AND mcount >= %u AND dataobject_not_match=0 limit %u;", VIEW_MATCH_DATAOBJECTS_AND_NODES_AS_RATIO, q->getAttrMatch(), q->getMaxResp());
-	} else {
-		snprintf(sqlcmd, SQL_MAX_CMD_SIZE, "SELECT * FROM %s WHERE ratio >= threshold AND mcount >= %u AND dataobject_not_match=0;", VIEW_MATCH_DATAOBJECTS_AND_NODES_AS_RATIO, q->getAttrMatch());
-	}
-	
-	ret = sqlite3_prepare(db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
-	
-	if (ret != SQLITE_OK) {
-		HAGGLE_DBG("SQLite command compilation failed! %s\n", sql_cmd);
-		goto out_err;
+	synchronized(indexMutex) {
+		attrIndex.nodesForDataObject(dataobject_rowid, q->getAttrMatch(), matches);
 	}
 
+	if (!matches.empty())
+		qr->setQuerySqlEndTime();
+
 	/* looping through the results and allocating nodes */
-	while ((ret = sqlite3_step(stmt)) != SQLITE_DONE) {
-		if (num_match == 0) {
-			qr->setQuerySqlEndTime();
-		}
+	for (size_t i = 0; i < matches.size(); i++) {
+		if (q->getMaxResp() > 0 && i == q->getMaxResp())
+			break;
+
+		sqlite_int64 nodeRowId = matches[i].rowid;
 		
-		if (ret == SQLITE_ROW) {
-			sqlite_int64 nodeRowId = sqlite3_column_int64(stmt, view_match_dataobjects_and_nodes_as_ratio_node_rowid);
-			
-			//HAGGLE_DBG("node rowid=%ld\n", nodeRowId);
-			
-			NodeRef node = getNodeFromRowId(nodeRowId);
-			
-			/*
-			 Only consider peers and gateways as targets.
-			 Application nodes receive data objects via their
-			 filters....
-			*/
-			if (node && (node->getType() == Node::TYPE_PEER || node->getType() == Node::TYPE_GATEWAY)) {
-				qr->addNode(node);
-				num_match++;
-			}
-		} else if (ret == SQLITE_ERROR) {
-			HAGGLE_DBG("node query Error:%s\n", sqlite3_errmsg(db));
-			sqlite3_finalize(stmt);
-			goto out_err;
+		//HAGGLE_DBG("node rowid=%ld\n", nodeRowId);
+		
+		NodeRef node = getNodeFromRowId(c, nodeRowId);
+		
+		/*
+		 Only consider peers and gateways as targets.
+		 Application nodes receive data objects via their
+		 filters....
+		*/
+		if (node && (node->getType() == Node::TYPE_PEER || node->getType() == Node::TYPE_GATEWAY)) {
+			qr->addNode(node);
+			num_match++;
 		}
 	}
 	
-	sqlite3_finalize(stmt);
-	
 	if (num_match == 0) {
 		qr->setQuerySqlEndTime();
 	}
@@ -3745,25 +3849,17 @@ int SQLDataStore::_doNodeQuery(DataStoreNodeQuery *q)
 	
 #if !defined(BENCHMARK)
 	if (num_match) {
-		kernel->addEvent(new Event(q->getCallback(), qr));
+		addTaskEvent(c, new Event(q->getCallback(), qr));
 	} else {
 		delete qr;
 	}
 #else
-	kernel->addEvent(new Event(q->getCallback(), qr));
+	addTaskEvent(c, new Event(q->getCallback(), qr));
 #endif
 	
 	HAGGLE_DBG("%u nodes matched data object [%s]\n", num_match, dObj->getIdStr());
 	
 	return num_match;
-out_err:
-	
-	HAGGLE_DBG("Data object query error, abort!\n");
-	
-	if (qr)
-		delete qr;
-	
-	return -1;
 }
 
 
@@ -3886,59 +3982,64 @@ int SQLDataStore::_insertRepository(DataStoreRepositoryQuery *q)
 	return 1;
 }
 
-int SQLDataStore::_readRepository(DataStoreRepositoryQuery *q, const EventCallback<EventHandler> *callback)
+/*
+	The repository is read with a statement of its own with bound
+	parameters, since the query may run in a query worker, which must
+	not use the shared command buffer.
+*/
+int SQLDataStore::_readRepository(Connection& c, DataStoreRepositoryQuery *q)
 {
 	int ret;
 	sqlite3_stmt *stmt;
 	const char *tail;
-	char *sql_cmd = sqlcmd;
+	const char *sql_cmd;
+	int param = 1;
 	
 	const RepositoryEntryRef query = q->getQuery();
-	DataStoreQueryResult *qr = new DataStoreQueryResult();
 	
 	HAGGLE_DBG("Reading repository \'%s\' : \'%s\'\n", query->getAuthority(), query->getKey() ? query->getKey() : "-");
 	
-	
-	if (!qr) {
-		HAGGLE_ERR("Could not allocate query result object\n");
-		return -1;
-	}
-	
 	if (!query->getAuthority()) {
 		HAGGLE_ERR("Error: No authority in repository entry\n");
 		return -1;
 	}
 	
 	if (query->getKey() && query->getId() > 0) {
-		snprintf(sql_cmd, SQL_MAX_CMD_SIZE, "SELECT * FROM " TABLE_REPOSITORY " WHERE authority='%s' AND key LIKE '%s' AND id=%u;", 
-			 query->getAuthority(), 
-			 query->getKey(),
-			 query->getId());	
+		sql_cmd = "SELECT * FROM " TABLE_REPOSITORY " WHERE authority=? AND key LIKE ? AND rowid=?;";
 	} else if (query->getKey()) {
-		snprintf(sql_cmd, SQL_MAX_CMD_SIZE, "SELECT * FROM " TABLE_REPOSITORY " WHERE authority='%s' AND key LIKE '%s';",
-			 query->getAuthority(), 
-			 query->getKey());	
+		sql_cmd = "SELECT * FROM " TABLE_REPOSITORY " WHERE authority=? AND key LIKE ?;";
 	} else if (query->getId() > 0) {
-		snprintf(sql_cmd, SQL_MAX_CMD_SIZE, "SELECT * FROM " TABLE_REPOSITORY " WHERE authority='%s' AND id='%u';", 
-			 query->getAuthority(), 
-			 query->getId());	
+		sql_cmd = "SELECT * FROM " TABLE_REPOSITORY " WHERE authority=? AND rowid=?;";
 	} else {
-		snprintf(sql_cmd, SQL_MAX_CMD_SIZE, "SELECT * FROM " TABLE_REPOSITORY " WHERE authority='%s';",
-			 query->getAuthority());	
+		sql_cmd = "SELECT * FROM " TABLE_REPOSITORY " WHERE authority=?;";
 	}
 	
-	ret = sqlite3_prepare_v2(db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
+	ret = sqlite3_prepare_v2(c.db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
 	
 	if (ret != SQLITE_OK) {
 		HAGGLE_DBG("SQLite command compilation failed! %s\n", sql_cmd);
 		return -1;
 	}
 	
+	sqlite3_bind_text(stmt, param++, query->getAuthority(), -1, SQLITE_TRANSIENT);
+	
+	if (query->getKey())
+		sqlite3_bind_text(stmt, param++, query->getKey(), -1, SQLITE_TRANSIENT);
 	
-	RepositoryEntryRef re;
+	if (query->getId() > 0)
+		sqlite3_bind_int64(stmt, param++, query->getId());
+	
+	DataStoreQueryResult *qr = new DataStoreQueryResult();
+	
+	if (!qr) {
+		HAGGLE_ERR("Could not allocate query result object\n");
+		sqlite3_finalize(stmt);
+		return -1;
+	}
 	
 	while ((ret = sqlite3_step(stmt)) != SQLITE_DONE) {
 		if (ret == SQLITE_ROW) {
+			RepositoryEntryRef re;
 			unsigned int id = (unsigned int)sqlite3_column_int64(stmt, table_repository_rowid);
 			RepositoryEntry::ValueType type = (RepositoryEntry::ValueType)sqlite3_column_int64(stmt, table_repository_type);
 			const char* authority = (const char*)sqlite3_column_text(stmt, table_repository_authority);
@@ -3956,15 +4057,16 @@ int SQLDataStore::_readRepository(DataStoreRepositoryQuery *q, const EventCallba
 			if (re) {
 				qr->addRepositoryEntry(re);
 			}
-		} else if (ret == SQLITE_ERROR) {
-			HAGGLE_DBG("query Error:%s\n", sqlite3_errmsg(db));
+		} else {
+			HAGGLE_DBG("query Error:%s\n", sqlite3_errmsg(c.db));
 			sqlite3_finalize(stmt);
+			delete qr;
 			return -1;
 		}
 	}
 	sqlite3_finalize(stmt);
 		
-	kernel->addEvent(new Event(q->getCallback(), qr));
+	addTaskEvent(c, new Event(q->getCallback(), qr));
 	
 	return 1;
 }
@@ -4197,7 +4299,6 @@ xmlDocPtr SQLDataStore::dumpToXML()
 		goto xml_alloc_fail;
 	}
 	
-//	setViewLimitedDataobjectAttributes();
 //	dumpTable(root_node, db, VIEW_MATCH_DATAOBJECTS_AND_NODES_AS_RATIO);
 //	dumpTable(root_node, db, VIEW_MATCH_FILTERS_AND_DATAOBJECTS_AS_RATIO);
 
@@ -4211,6 +4312,77 @@ xml_alloc_fail:
 	return NULL;
 }
 
+int SQLDataStore::_buildBloomfilter(Connection& c, const EventCallback<EventHandler> *callback)
+{
+	int ret;
+	sqlite3_stmt *stmt;
+	const char *tail;
+	const char *sql_cmd;
+	unsigned int capacity = 0;
+	unsigned long num = 0;
+	Bloomfilter *bf;
+
+	if (!callback) {
+		HAGGLE_ERR("Invalid callback\n");
+		return -1;
+	}
+
+	sql_cmd = "SELECT COUNT(*) FROM " TABLE_DATAOBJECTS ";";
+
+	ret = sqlite3_prepare_v2(c.db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
+
+	if (ret != SQLITE_OK) {
+		HAGGLE_DBG("SQLite command compilation failed! %s\n", sql_cmd);
+		return -1;
+	}
+
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		capacity = (unsigned int)sqlite3_column_int64(stmt, 0) * BLOOMFILTER_SCALE_GROWTH;
+
+	sqlite3_finalize(stmt);
+
+	if (capacity < Bloomfilter::getDefaultCapacity())
+		capacity = Bloomfilter::getDefaultCapacity();
+
+	bf = Bloomfilter::create(Bloomfilter::TYPE_COUNTING, Bloomfilter::getDefaultErrorRate(), capacity);
+
+	if (!bf) {
+		HAGGLE_ERR("Could not create bloomfilter\n");
+		return -1;
+	}
+
+	sql_cmd = "SELECT id FROM " TABLE_DATAOBJECTS ";";
+
+	ret = sqlite3_prepare_v2(c.db, sql_cmd, (int) strlen(sql_cmd), &stmt, &tail);
+
+	if (ret != SQLITE_OK) {
+		HAGGLE_DBG("SQLite command compilation failed! %s\n", sql_cmd);
+		delete bf;
+		return -1;
+	}
+
+	while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+		if (sqlite3_column_bytes(stmt, 0) == DATAOBJECT_ID_LEN) {
+			bf->add((const unsigned char *)sqlite3_column_blob(stmt, 0), DATAOBJECT_ID_LEN);
+			num++;
+		}
+	}
+
+	sqlite3_finalize(stmt);
+
+	if (ret != SQLITE_DONE) {
+		HAGGLE_ERR("Could not read data object ids: %s\n", sqlite3_errmsg(c.db));
+		delete bf;
+		return -1;
+	}
+
+	HAGGLE_DBG("Built bloomfilter with %lu data objects and capacity %u\n", num, capacity);
+
+	addTaskEvent(c, new Event(callback, bf));
+
+	return (int)num;
+}
+
 int SQLDataStore::_dump(const EventCallback<EventHandler> *callback)
 {
         xmlDocPtr doc;
@@ -4646,10 +4818,15 @@ int SQLDataStore::_onConfig()
 		HAGGLE_DBG("Cannot switch to in-memory database since there is no backup support in SQLite\n");
 #endif
 		if (ret == SQLITE_OK) {
+			// The pooled statements belong to the file database
+			writer.finalizeStatements();
+
 			if (db)
 				sqlite3_close(db);
 			db = db_memory;
+			writer.db = db;
 			isInMemory = true;
+			isWAL = false;
 		} else {
 			HAGGLE_ERR("did not switch to in-memory database\n");
 			return -1;
@@ -40,9 +40,12 @@ class SQLDataStore;
 #include <sqlite3.h>
 #include "DataObject.h"
 #include "Metadata.h"
+#include "AttributeIndex.h"
+#include "DataObjectCache.h"
 
 #if (SQLITE_VERSION_NUMBER >= 3007000)
 #define HAVE_SQLITE_BACKUP_SUPPORT 1
+#define HAVE_SQLITE_WAL_SUPPORT 1
 #endif
 #ifdef DEBUG_DATASTORE
 #define DEBUG_SQLDATASTORE
@@ -52,35 +55,124 @@ class SQLDataStore;
 class SQLDataStore : public DataStore
 {
 private:
+	/*
+		Statements that are executed for most tasks. They are
+		compiled once and kept in a pool, so that they only need to
+		be reset and bound to new parameters before they are run.
+	*/
+	typedef enum {
+		STMT_BEGIN_TRANSACTION = 0,
+		STMT_END_TRANSACTION,
+		STMT_INSERT_DATAOBJECT,
+		STMT_FIND_DATAOBJECT,
+		STMT_DATAOBJECT_FROM_ROWID,
+		STMT_INSERT_ATTR,
+		STMT_FIND_ATTR,
+		STMT_ATTR_FROM_ROWID,
+		STMT_INSERT_DATAOBJECT_ATTR,
+		STMT_INSERT_NODE_ATTR,
+		STMT_INSERT_FILTER_ATTR,
+		STMT_ATTRS_FROM_NODE_ROWID,
+		STMT_INSERT_IFACE,
+		STMT_FIND_IFACE,
+		STMT_IFACES_FROM_NODE_ROWID,
+		STMT_NODE_FROM_ID,
+		STMT_NODE_FROM_ROWID,
+		STMT_NODE_ROWID_FROM_IFACE,
+		_STMT_MAX
+	} Statement_t;
+
+	/*
+		A database connection with a pool of the statements above.
+		Statements cannot be shared between connections, so the
+		data store thread and every query worker have a connection
+		of their own.
+	*/
+	class Connection {
+		sqlite3_stmt *stmtPool[_STMT_MAX];
+		bool stmtInUse[_STMT_MAX];
+	public:
+		sqlite3 *db;
+		/*
+			Returns a compiled statement, which must be given back
+			with releaseStatement().
+		*/
+		sqlite3_stmt *getStatement(Statement_t type);
+		void releaseStatement(Statement_t type, sqlite3_stmt *stmt);
+		void finalizeStatements();
+		Connection();
+	};
+
+	/*
+		Executes queries against a connection of its own, next to
+		the data store thread.
+	*/
+	class QueryWorker : public DataStoreQueryWorker {
+		SQLDataStore *sqlds;
+		Connection conn;
+		int _doFilterQuery(DataStoreFilterQuery *q);
+		int _doDataObjectQuery(DataStoreDataObjectQuery *q);
+		int _doDataObjectForNodesQuery(DataStoreDataObjectForNodesQuery *q);
+		int _doNodeQuery(DataStoreNodeQuery *q);
+		int _readRepository(DataStoreRepositoryQuery *q);
+		int _buildBloomfilter(const EventCallback<EventHandler> *callback);
+	public:
+		QueryWorker(SQLDataStore *_sqlds);
+		~QueryWorker();
+		bool init();
+	};
+	friend class QueryWorker;
+
 	sqlite3 *db; 
 	bool isInMemory;
+	bool isWAL;
 	bool recreate;
 	string filepath;
+	// The data store thread's connection. Its db is always the same as db.
+	Connection writer;
+	bool inTransaction;
+	// Events held back until the transaction is committed
+	List<Event *> transactionEvents;
+	// Matches data objects, nodes and filters without going through SQLite
+	AttributeIndex attrIndex;
+	// Data objects recently created from the data store
+	DataObjectCache dataObjectCache;
+	/*
+		Protects the attribute index and the data object cache
+		against the query workers. Only the data store thread
+		changes the attribute index, so it does not lock the mutex
+		when it only reads from it.
+	*/
+	Mutex indexMutex;
 
 	int cleanupDataStore();
 	int createTables();
 	int sqlQuery(const char *sql_cmd);
+#if defined(HAVE_SQLITE_WAL_SUPPORT)
+	bool setJournalModeWAL();
+#endif
 
-	int setViewLimitedDataobjectAttributes(sqlite_int64 dataobject_rowid = 0);
-	int setViewLimitedNodeAttributes(sqlite_int64 dataobject_rowid = 0);
+	sqlite3_stmt *getStatement(Statement_t type) { return writer.getStatement(type); }
+	void releaseStatement(Statement_t type, sqlite3_stmt *stmt) { writer.releaseStatement(type, stmt); }
+
+	int buildAttributeIndex();
 	int evaluateDataObjects(long eventType);
 	int evaluateFilters(const DataObjectRef& dObj, sqlite_int64 dataobject_rowid = 0);
 
-	sqlite_int64 getDataObjectRowId(const DataObjectId_t& id);
+	sqlite_int64 getDataObjectRowId(Connection& c, const DataObjectId_t& id);
 	sqlite_int64 getAttributeRowId(const Attribute* attr);
-	sqlite_int64 getNodeRowId(const NodeRef& node);
-	sqlite_int64 getNodeRowId(const InterfaceRef& iface);
+	sqlite_int64 insertAttribute(const Attribute* attr);
+	sqlite_int64 getNodeRowId(Connection& c, const NodeRef& node);
+	sqlite_int64 getNodeRowId(Connection& c, const Node::Id_t id);
+	sqlite_int64 getNodeRowId(Connection& c, const InterfaceRef& iface);
 	sqlite_int64 getInterfaceRowId(const InterfaceRef& iface);
 
 	DataObject *createDataObject(sqlite3_stmt *stmt);
-	NodeRef createNode(sqlite3_stmt *in_stmt);
+	NodeRef createNode(Connection& c, sqlite3_stmt *in_stmt);
 
-	Attribute *getAttrFromRowId(const sqlite_int64 attr_rowid, const sqlite_int64 node_rowid);
-	DataObject *getDataObjectFromRowId(const sqlite_int64 dataObjectRowId);
-	NodeRef getNodeFromRowId(const sqlite_int64 nodeRowId);
-	Interface *getInterfaceFromRowId(const sqlite_int64 ifaceRowId);
-	
-	int findAndAddDataObjectTargets(DataObjectRef& dObj, const sqlite_int64 dataObjectRowId, const long ratio);
+	Attribute *getAttrFromRowId(Connection& c, const sqlite_int64 attr_rowid, const sqlite_int64 node_rowid);
+	DataObjectRef getDataObjectFromRowId(Connection& c, const sqlite_int64 dataObjectRowId);
+	NodeRef getNodeFromRowId(Connection& c, const sqlite_int64 nodeRowId);
 	int deleteDataObjectNodeDescriptions(DataObjectRef ref_dObj, string& node_id);
 #if defined(HAVE_SQLITE_BACKUP_SUPPORT)
 	int backupDatabase(sqlite3 *pInMemory, const char *zFilename, int toFile = 1);
@@ -109,25 +201,45 @@ protected:
 	int _ageDataObjects(const Timeval& minimumAge, const EventCallback<EventHandler> *callback = NULL, bool keepInBloomfilter = false);
 	int _insertFilter(Filter *f, bool matchFilter = false, const EventCallback<EventHandler> *callback = NULL);
 	int _deleteFilter(long eventtype);
+	/*
+		The queries only read the data store, and can be executed
+		against the connection of a query worker, as well as by the
+		data store thread.
+	*/
 	// matching Filters
-	int _doFilterQuery(DataStoreFilterQuery *q);
+	int _doFilterQuery(Connection& c, DataStoreFilterQuery *q);
+	int _doFilterQuery(DataStoreFilterQuery *q) { return _doFilterQuery(writer, q); }
 	// matching Dataobject > Nodes
 	/**
 		Returns: The number of data objects filled in.
 	*/
-	int _doDataObjectQueryStep2(NodeRef &node, NodeRef alsoThisBF, DataStoreQueryResult *qr, int max_matches, unsigned int ratio, unsigned int attrMatch);
-	int _doDataObjectQuery(DataStoreDataObjectQuery *q);
-	int _doDataObjectForNodesQuery(DataStoreDataObjectForNodesQuery *q);
+	int _doDataObjectQueryStep2(Connection& c, NodeRef &node, NodeRef alsoThisBF, DataStoreQueryResult *qr, int max_matches, unsigned int ratio, unsigned int attrMatch);
+	int _doDataObjectQuery(Connection& c, DataStoreDataObjectQuery *q);
+	int _doDataObjectQuery(DataStoreDataObjectQuery *q) { return _doDataObjectQuery(writer, q); }
+	int _doDataObjectForNodesQuery(Connection& c, DataStoreDataObjectForNodesQuery *q);
+	int _doDataObjectForNodesQuery(DataStoreDataObjectForNodesQuery *q) { return _doDataObjectForNodesQuery(writer, q); }
 	// matching Node > Dataobjects
-	int _doNodeQuery(DataStoreNodeQuery *q);
+	int _doNodeQuery(Connection& c, DataStoreNodeQuery *q);
+	int _doNodeQuery(DataStoreNodeQuery *q) { return _doNodeQuery(writer, q); }
 	int _insertRepository(DataStoreRepositoryQuery *q);
-	int _readRepository(DataStoreRepositoryQuery *q, const EventCallback<EventHandler> *callback = NULL);
+	int _readRepository(Connection& c, DataStoreRepositoryQuery *q);
+	int _readRepository(DataStoreRepositoryQuery *q, const EventCallback<EventHandler> *callback = NULL) { return _readRepository(writer, q); }
 	int _deleteRepository(DataStoreRepositoryQuery *q);
+	int _buildBloomfilter(Connection& c, const EventCallback<EventHandler> *callback);
+	int _buildBloomfilter(const EventCallback<EventHandler> *callback) { return _buildBloomfilter(writer, callback); }
 	
 	int _dump(const EventCallback<EventHandler> *callback = NULL);
 	int _dumpToFile(const char *filename);
 	int _onConfig();
 
+	void addTaskEvent(Event *e);
+	void addTaskEvent(Connection& c, Event *e);
+	void rollbackTaskBatch();
+	void _beginTaskBatch();
+	void _endTaskBatch();
+
+	DataStoreQueryWorker *_createQueryWorker(unsigned int num);
+
 public:
 	SQLDataStore(const bool recreate = false, const string = DEFAULT_DATASTORE_FILEPATH, const string name = "SQLDataStore");
 	~SQLDataStore();
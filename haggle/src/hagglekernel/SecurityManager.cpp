@@ -23,6 +23,7 @@
 #include <openssl/pem.h>
 #include <openssl/rsa.h>
 #include <openssl/err.h>
+#include <openssl/sha.h>
 
 // The reason for this function being a macro, is so that HAGGLE_DBG can 
 // specify which function called writeErrors().
@@ -42,6 +43,60 @@
 #define writeErrors(prefix)
 #endif
 
+/*
+  The security helpers use the keys from several threads. OpenSSL
+  versions before 1.1.0 are only thread safe if we give them locks and
+  a way to tell the threads apart.
+*/
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#if !defined(OS_WINDOWS)
+#include <pthread.h>
+#endif
+
+static Mutex *openssl_locks = NULL;
+
+static void openssl_locking_callback(int mode, int n, const char *file, int line)
+{
+	if (mode & CRYPTO_LOCK)
+		openssl_locks[n].lock();
+	else
+		openssl_locks[n].unlock();
+}
+
+static unsigned long openssl_id_callback(void)
+{
+#if defined(OS_WINDOWS)
+	return (unsigned long)GetCurrentThreadId();
+#else
+	return (unsigned long)pthread_self();
+#endif
+}
+
+static void openssl_locks_init(void)
+{
+	if (openssl_locks)
+		return;
+
+	openssl_locks = new Mutex[CRYPTO_num_locks()];
+	CRYPTO_set_id_callback(openssl_id_callback);
+	CRYPTO_set_locking_callback(openssl_locking_callback);
+}
+
+static void openssl_locks_cleanup(void)
+{
+	if (!openssl_locks)
+		return;
+
+	CRYPTO_set_locking_callback(NULL);
+	CRYPTO_set_id_callback(NULL);
+	delete [] openssl_locks;
+	openssl_locks = NULL;
+}
+#else
+#define openssl_locks_init()
+#define openssl_locks_cleanup()
+#endif
+
 /* 
  Private and public key of certificate authority in PEM format.
  
@@ -152,7 +207,7 @@ SecurityTask::SecurityTask(const SecurityTaskType_t _type,
 			   DataObjectRef _dObj, 
 			   CertificateRef _cert) : 
 	type(_type), completed(false), dObj(_dObj), 
-	privKey(NULL), cert(_cert) 
+	privKey(NULL), cert(_cert), timestamp(Timeval::now())
 {
 }
 
@@ -212,9 +267,10 @@ bool SecurityHelper::signDataObject(DataObjectRef& dObj, RSA *key)
 	return true;
 }
 
-bool SecurityHelper::verifyDataObject(DataObjectRef& dObj, CertificateRef& cert) const
+bool SecurityHelper::verifyDataObject(DataObjectRef& dObj, CertificateRef& cert)
 {
 	RSA *key;
+	Timeval start;
 	
 	// Cannot verify without signature
 	if (!dObj->getSignature()) {
@@ -225,6 +281,8 @@ bool SecurityHelper::verifyDataObject(DataObjectRef& dObj, CertificateRef& cert)
 	
 	key = cert->getPubKey();
 
+	start = Timeval::now();
+
 	if (RSA_verify(NID_sha1, dObj->getId(), sizeof(DataObjectId_t), 
 		       const_cast<unsigned char *>(dObj->getSignature()), dObj->getSignatureLength(), key) != 1) {
 		char *raw;
@@ -242,6 +300,7 @@ bool SecurityHelper::verifyDataObject(DataObjectRef& dObj, CertificateRef& cert)
 	
 	HAGGLE_DBG("Signature is valid\n");
 	dObj->setSignatureStatus(DataObject::SIGNATURE_VALID);
+	getManager()->addVerifiedSignature(dObj, Timeval::now() - start);
 
 	return true;
 }
@@ -366,9 +425,13 @@ void SecurityHelper::cleanup()
 const char *security_level_names[] = { "LOW", "MEDIUM", "HIGH" };
 
 SecurityManager::SecurityManager(HaggleKernel *_haggle, 
-				 const SecurityLevel_t slevel) :
+				 const SecurityLevel_t slevel,
+				 unsigned int _numHelpers) :
 	Manager("SecurityManager", _haggle), securityLevel(slevel), 
-	etype(EVENT_TYPE_INVALID), helper(NULL), 
+	etype(EVENT_TYPE_INVALID), helpers(NULL), 
+	numHelpers(_numHelpers > 0 ? _numHelpers : 1),
+	verifiedSignaturesHits(0), verifiedSignaturesMisses(0),
+	numVerifications(0), verificationTime(0), verificationLatency(0),
 	myCert(NULL), ca_issuer(CA_ISSUER_NAME), 
 	caPrivKey(NULL), caPubKey(NULL), privKey(NULL)
 {
@@ -377,8 +440,13 @@ SecurityManager::SecurityManager(HaggleKernel *_haggle,
 
 SecurityManager::~SecurityManager()
 {
-	if (helper)
-		delete helper;
+	if (helpers) {
+		for (unsigned int i = 0; i < numHelpers; i++) {
+			if (helpers[i])
+				delete helpers[i];
+		}
+		delete [] helpers;
+	}
 
 	Event::unregisterType(etype);
 
@@ -397,6 +465,8 @@ SecurityManager::~SecurityManager()
         // Unload OpenSSL algorithms
         EVP_cleanup();
 
+	openssl_locks_cleanup();
+
 #if defined(DEBUG)
 	// Release ssl error strings.
 	ERR_free_strings();
@@ -440,6 +510,8 @@ bool SecurityManager::init_derived()
 	
 	onRepositoryDataCallback = newEventCallback(onRepositoryData);
 
+	openssl_locks_init();
+
         /* This function must be called to load crypto algorithms used
          * for signing and verification of certificates. */
         OpenSSL_add_all_algorithms();
@@ -469,13 +541,26 @@ bool SecurityManager::init_derived()
 
 	HAGGLE_DBG("Security level is set to %s\n", security_level_names[securityLevel]);
 	
-	helper = new SecurityHelper(this, etype);
+	helpers = new SecurityHelper *[numHelpers];
 
-	if (!helper || !helper->start()) {
-		HAGGLE_ERR("Could not create or start security helper\n");
+	if (!helpers) {
+		HAGGLE_ERR("Could not allocate security helpers\n");
 		return false;
 	}
 
+	memset(helpers, 0, sizeof(SecurityHelper *) * numHelpers);
+
+	for (unsigned int i = 0; i < numHelpers; i++) {
+		helpers[i] = new SecurityHelper(this, etype);
+
+		if (!helpers[i] || !helpers[i]->start()) {
+			HAGGLE_ERR("Could not create or start security helper %u\n", i);
+			return false;
+		}
+	}
+
+	HAGGLE_DBG("Started %u security helpers\n", numHelpers);
+
 	HAGGLE_DBG("Initialized security manager\n");
 
 	return true;
@@ -508,10 +593,17 @@ void SecurityManager::onPrepareShutdown()
 
 void SecurityManager::onShutdown()
 {
-	if (helper) {
-		HAGGLE_DBG("Stopping security helper...\n");
-		helper->stop();
+	if (helpers) {
+		HAGGLE_DBG("Stopping security helpers...\n");
+
+		for (unsigned int i = 0; i < numHelpers; i++) {
+			if (helpers[i])
+				helpers[i]->stop();
+		}
 	}
+#ifdef DEBUG
+	printVerificationStatistics();
+#endif
 	unregisterWithKernel();
 }
 
@@ -530,7 +622,7 @@ void SecurityManager::onRepositoryData(Event *e)
 	
 	if (qr->countRepositoryEntries() == 0) {
 		HAGGLE_DBG("No repository entries, generating new certificate and keypair\n");
-		helper->addTask(new SecurityTask(SECURITY_TASK_GENERATE_CERTIFICATE));
+		getHelper(NULL)->addTask(new SecurityTask(SECURITY_TASK_GENERATE_CERTIFICATE));
 		
 		// Delay signalling that we are ready for startup until we get the 
 		// task result indicating our certificate is ready.
@@ -605,6 +697,101 @@ CertificateRef SecurityManager::retrieveCertificate(const string subject)
 	return (*it).second;
 }
 
+SecurityHelper *SecurityManager::getHelper(const DataObjectRef& dObj)
+{
+	unsigned long hash = 0;
+
+	if (dObj) {
+		const char *str = dObj->getSignee().length() > 0 ? 
+			dObj->getSignee().c_str() : dObj->getIdStr();
+
+		while (*str)
+			hash = hash * 31 + (unsigned char)*str++;
+	}
+
+	return helpers[hash % numHelpers];
+}
+
+/*
+	The id and signee of a data object, and a digest of its signature,
+	as they are remembered for verified signatures.
+*/
+static bool verified_signature_key(const DataObjectRef& dObj, string& key, char *digest)
+{
+	unsigned char md[SHA_DIGEST_LENGTH];
+
+	if (!dObj->getSignature() || dObj->getSignee().length() == 0)
+		return false;
+
+	key = dObj->getIdStr();
+	key += ":";
+	key += dObj->getSignee();
+
+	SHA1(dObj->getSignature(), dObj->getSignatureLength(), md);
+	buf2str((const char *)md, digest, SHA_DIGEST_LENGTH);
+
+	return true;
+}
+
+bool SecurityManager::hasVerifiedSignature(const DataObjectRef& dObj)
+{
+	char digest[2 * SHA_DIGEST_LENGTH + 1];
+	string key;
+
+	if (!verified_signature_key(dObj, key, digest))
+		return false;
+
+	Mutex::AutoLocker l(verifiedSignaturesMutex);
+
+	VerifiedSignatures_t::iterator it = verifiedSignatures.find(key);
+
+	if (it == verifiedSignatures.end() || (*it).second != digest) {
+		verifiedSignaturesMisses++;
+		return false;
+	}
+
+	verifiedSignaturesHits++;
+
+	return true;
+}
+
+/*
+	Called by the security helpers when a signature has been verified 
+	in time 't'.
+*/
+void SecurityManager::addVerifiedSignature(const DataObjectRef& dObj, const Timeval& t)
+{
+	char digest[2 * SHA_DIGEST_LENGTH + 1];
+	string key;
+
+	Mutex::AutoLocker l(verifiedSignaturesMutex);
+
+	numVerifications++;
+	verificationTime += t;
+
+	if (!verified_signature_key(dObj, key, digest))
+		return;
+
+	VerifiedSignatures_t::iterator it = verifiedSignatures.find(key);
+
+	if (it != verifiedSignatures.end()) {
+		(*it).second = digest;
+		return;
+	}
+
+	if (verifiedSignaturesOrder.size() >= MAX_VERIFIED_SIGNATURES) {
+		it = verifiedSignatures.find(verifiedSignaturesOrder.front());
+
+		if (it != verifiedSignatures.end())
+			verifiedSignatures.erase(it);
+
+		verifiedSignaturesOrder.pop_front();
+	}
+
+	verifiedSignatures.insert(make_pair(key, string(digest)));
+	verifiedSignaturesOrder.push_back(key);
+}
+
 #ifdef DEBUG
 
 void SecurityManager::onDebugCmdEvent(Event *e)
@@ -613,6 +800,23 @@ void SecurityManager::onDebugCmdEvent(Event *e)
 		return;
 	
 	printCertificates();
+	printVerificationStatistics();
+}
+
+void SecurityManager::printVerificationStatistics()
+{
+	Mutex::AutoLocker l(verifiedSignaturesMutex);
+	unsigned long lookups = verifiedSignaturesHits + verifiedSignaturesMisses;
+	
+	printf("[Signature verification]: %u helpers\n", numHelpers);
+	printf("verified signatures: %lu/%u, hits=%lu misses=%lu (%.1f%% hit rate)\n",
+	       (unsigned long)verifiedSignatures.size(), MAX_VERIFIED_SIGNATURES,
+	       verifiedSignaturesHits, verifiedSignaturesMisses, 
+	       lookups ? 100.0 * verifiedSignaturesHits / lookups : 0.0);
+	printf("verifications: %lu, average time=%.3f ms, average latency=%.3f ms\n",
+	       numVerifications, 
+	       numVerifications ? verificationTime.getTimeAsMilliSecondsDouble() / numVerifications : 0.0,
+	       numVerifications ? verificationLatency.getTimeAsMilliSecondsDouble() / numVerifications : 0.0);
 }
 
 void SecurityManager::printCertificates()
@@ -678,6 +882,9 @@ void SecurityManager::onSecurityTaskComplete(Event *e)
 			  signature (if available) into a node's bloomfilter?
 			*/
 			if (task->dObj->hasValidSignature()) {
+				synchronized(verifiedSignaturesMutex) {
+					verificationLatency += Timeval::now() - task->timestamp;
+				}
 				HAGGLE_DBG("DataObject %s has a valid signature!\n", 
 					   task->dObj->getIdStr());
 				kernel->addEvent(new Event(EVENT_TYPE_DATAOBJECT_VERIFIED, 
@@ -712,7 +919,13 @@ void SecurityManager::onReceivedDataObject(Event *e)
 	if (dObj->signatureIsUnverified() && 
 	    ((dObj->isNodeDescription() && securityLevel > SECURITY_LEVEL_LOW) || 
 	     (securityLevel > SECURITY_LEVEL_MEDIUM))) {
-		helper->addTask(new SecurityTask(SECURITY_TASK_VERIFY_DATAOBJECT, dObj));
+		if (hasVerifiedSignature(dObj)) {
+			HAGGLE_DBG("Signature of data object [%s] was verified before\n", dObj->getIdStr());
+			dObj->setSignatureStatus(DataObject::SIGNATURE_VALID);
+			kernel->addEvent(new Event(EVENT_TYPE_DATAOBJECT_VERIFIED, dObj));
+		} else {
+			getHelper(dObj)->addTask(new SecurityTask(SECURITY_TASK_VERIFY_DATAOBJECT, dObj));
+		}
 	} else {
 		kernel->addEvent(new Event(EVENT_TYPE_DATAOBJECT_VERIFIED, dObj));	
 	}
@@ -741,7 +954,7 @@ void SecurityManager::onIncomingDataObject(Event *e)
 	// Check if there is a certificate embedded that we do not already have stored
 	if (m && m->getMetadata("Certificate")) {
 		HAGGLE_DBG("Data object has embedded certificate, trying to verify it!\n");
-		helper->addTask(new SecurityTask(SECURITY_TASK_VERIFY_CERTIFICATE, dObj));
+		getHelper(dObj)->addTask(new SecurityTask(SECURITY_TASK_VERIFY_CERTIFICATE, dObj));
 	}
 			
 	InterfaceRef iface = dObj->getRemoteInterface();
@@ -750,14 +963,14 @@ void SecurityManager::onIncomingDataObject(Event *e)
 	// In the future, the signing should potentially be handled by the application
 	// itself. But this requires some major rethinking of how to manage certificates 
 	// and keys, etc.
-	if (iface && iface->getType() == Interface::TYPE_APPLICATION_PORT && dObj->shouldSign()) {
+	if (iface && iface->isApplication() && dObj->shouldSign()) {
 		HAGGLE_DBG("Data object should be signed\n");
 
 		// FIXME: data objects should really be signed in the SecurityHelper thread since
 		// it is a potentially CPU intensive operation. But it is currently not possible
 		// to ensure that the signing operation has finished in the helper thread before
 		// the data object is added to the data store.
-		if (helper->signDataObject(dObj, privKey)) {
+		if (getHelper(dObj)->signDataObject(dObj, privKey)) {
 			HAGGLE_DBG("Successfully signed data object %s, which was added by an application.\n", 
 				   dObj->getIdStr());
 		} else {
@@ -804,7 +1017,7 @@ void SecurityManager::onSendDataObject(Event *e)
 	// description).
 	InterfaceRef iface = dObj->getRemoteInterface();
 	
-	if (dObj->shouldSign() && !(iface && iface->getType() == Interface::TYPE_APPLICATION_PORT)) {
+	if (dObj->shouldSign() && !(iface && iface->isApplication())) {
 		// FIXME: data objects should really be signed in the SecurityHelper thread since
 		// it is a potentially CPU intensive operation. But it is currently not possible
 		// to ensure that the signing operation has finished in the helper thread before
@@ -813,7 +1026,7 @@ void SecurityManager::onSendDataObject(Event *e)
 		// security related operations, after which the security manager generates the
 		// real send event.
 		
-		if (helper->signDataObject(dObj, privKey)) {
+		if (getHelper(dObj)->signDataObject(dObj, privKey)) {
 			HAGGLE_DBG("Successfully signed data object %s\n", dObj->getIdStr());
 		} else {
 			HAGGLE_DBG("Signing of data object %s failed!\n", dObj->getIdStr());
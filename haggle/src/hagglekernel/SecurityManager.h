@@ -43,6 +43,11 @@ class SecurityManager;
 
 #define CA_ISSUER_NAME "Haggle CA"
 
+// The number of security helper threads that sign and verify data objects
+#define DEFAULT_SECURITY_HELPERS 2
+// The number of verified signatures remembered by the security manager
+#define MAX_VERIFIED_SIGNATURES 1000
+
 typedef enum {
 	SECURITY_LEVEL_LOW = 0, // No security enabled.
 	SECURITY_LEVEL_MEDIUM = 1, // Only require valid signatures for node descriptions, but not for other data objects.
@@ -63,6 +68,7 @@ public:
 	DataObjectRef dObj;
         RSA *privKey;
         CertificateRef cert;
+	Timeval timestamp;
 	SecurityTask(const SecurityTaskType_t _type, DataObjectRef _dObj = NULL, CertificateRef _cert = NULL);
         ~SecurityTask();
 };
@@ -72,7 +78,7 @@ class SecurityHelper : public ManagerModule<SecurityManager> {
 	GenericQueue<SecurityTask *> taskQ;
 	const EventType etype;
 	bool signDataObject(DataObjectRef& dObj, RSA *key);
-	bool verifyDataObject(DataObjectRef& dObj, CertificateRef& cert) const;
+	bool verifyDataObject(DataObjectRef& dObj, CertificateRef& cert);
 	void doTask(SecurityTask *task);
 	bool run();
         void cleanup();
@@ -88,7 +94,32 @@ class SecurityManager : public Manager {
 private:
 	SecurityLevel_t securityLevel;
 	EventType etype;
-	SecurityHelper *helper;
+	/*
+		Tasks are spread over the helpers by signee, so that the
+		tasks for one node's data objects are done in order, e.g.,
+		the certificate in a node description is verified before
+		the signature of the node description.
+	*/
+	SecurityHelper **helpers;
+	unsigned int numHelpers;
+	SecurityHelper *getHelper(const DataObjectRef& dObj);
+	/*
+		Signatures that have already been verified, so that data
+		objects that are received again need not be verified
+		again. The key is the data object id and signee, and the
+		value is a digest of the signature. The oldest signatures
+		are forgotten first.
+	*/
+	typedef HashMap<string,string> VerifiedSignatures_t;
+	VerifiedSignatures_t verifiedSignatures;
+	List<string> verifiedSignaturesOrder;
+	// Protects the verified signatures and the statistics below
+	Mutex verifiedSignaturesMutex;
+	unsigned long verifiedSignaturesHits, verifiedSignaturesMisses;
+	unsigned long numVerifications;
+	Timeval verificationTime, verificationLatency;
+	bool hasVerifiedSignature(const DataObjectRef& dObj);
+	void addVerifiedSignature(const DataObjectRef& dObj, const Timeval& t);
 	EventCallback<EventHandler> *onRepositoryDataCallback;
 	typedef HashMap<string,CertificateRef> CertificateStore_t;
 	CertificateStore_t certStore;
@@ -114,11 +145,14 @@ private:
 public:
 #ifdef DEBUG
 	void printCertificates();
+	void printVerificationStatistics();
 	void onDebugCmdEvent(Event *e);
 #endif
 	void setSecurityLevel(const SecurityLevel_t slevel) { securityLevel = slevel; }
 	SecurityLevel_t getSecurityLevel() const { return securityLevel; }
-	SecurityManager(HaggleKernel *_haggle = haggleKernel, SecurityLevel_t slevel = SECURITY_LEVEL_MEDIUM);
+	unsigned int getNumHelpers() const { return numHelpers; }
+	SecurityManager(HaggleKernel *_haggle = haggleKernel, SecurityLevel_t slevel = SECURITY_LEVEL_MEDIUM, 
+			unsigned int _numHelpers = DEFAULT_SECURITY_HELPERS);
 	~SecurityManager();
 };
 
@@ -51,7 +51,6 @@ HINSTANCE g_hInstance;
 #endif
 
 #if defined(OS_LINUX) || defined(OS_MACOSX) || defined(OS_WINDOWS_DESKTOP)
-#define HAGGLE_LOCAL_SOCKET "haggle.sock"
 #include <signal.h>
 #endif
 
@@ -65,6 +64,10 @@ static bool setCreateTimeOnBloomfilterUpdate = false;
 static bool recreateDataStore = false;
 static bool runAsInteractive = true;
 static SecurityLevel_t securityLevel = SECURITY_LEVEL_MEDIUM;
+static unsigned long eventBatchSize = DEFAULT_EVENT_BATCH_SIZE;
+static unsigned long taskBatchSize = DEFAULT_DATASTORE_TASK_BATCH_SIZE;
+static unsigned int queryWorkers = DEFAULT_DATASTORE_QUERY_WORKERS;
+static unsigned int securityHelpers = DEFAULT_SECURITY_HELPERS;
 /* Command line options variables. */
 // Benchmark specific variables
 #ifdef BENCHMARK
@@ -191,10 +194,14 @@ static void daemonize()
 #endif
 
 /*
-	NOTE: if this path changes for any reason whatsoever, the path used in
-	libhaggle to find the pid file also needs to change. Remember to change it!
+	NOTE: if these paths change for any reason whatsoever, the paths used in
+	libhaggle to find the pid file and the application socket also need to
+	change. Remember to change them!
 */
 #define PID_FILE string(DEFAULT_DATASTORE_PATH).append("/haggle.pid")
+#if defined(OS_UNIX)
+#define LOCAL_SOCKET_FILE string(DEFAULT_DATASTORE_PATH).append("/" HAGGLE_LOCAL_SOCKET)
+#endif
 
 enum {
         HAGGLE_PROCESS_BAD_PID = -3,
@@ -446,6 +453,10 @@ int run_haggle()
 		return -1;
 	}
 	
+	kernel->setEventBatchSize(eventBatchSize);
+	kernel->getDataStore()->setTaskBatchSize(taskBatchSize);
+	kernel->getDataStore()->setNumQueryWorkers(queryWorkers);
+	
 	// Build a Haggle configuration
 	am = new ApplicationManager(kernel);
 
@@ -482,15 +493,17 @@ int run_haggle()
 		goto finish;
 	}
 
-	sm = new SecurityManager(kernel, securityLevel);
+	sm = new SecurityManager(kernel, securityLevel, securityHelpers);
 
 	if (!sm || !sm->init()) {
 		HAGGLE_ERR("Could not initialize security manager\n");
 		goto finish;
 	}
 
-#ifdef USE_UNIX_APPLICATION_SOCKET
-	p = new ProtocolLOCAL(kernel->getStoragePath() + "/" + HAGGLE_LOCAL_SOCKET, pm);
+#if defined(OS_UNIX)
+	/* Applications on this machine prefer the Unix domain
+	 * socket, but may still use UDP. */
+	p = new ProtocolLOCAL(LOCAL_SOCKET_FILE.c_str(), pm);
 	
 	if (!p || !p->init()) {
 		HAGGLE_ERR("Could not initialize LOCAL protocol\n");
@@ -613,14 +626,18 @@ static struct {
 	{ "-d", "--daemonize", "run in the background as a daemon." },
 	{ "-f", "--filelog", "write debug output to a file (haggle.log)." },
 	{ "-c", "--create-time-bloomfilter", "set create time in node description on bloomfilter update." },
-	{ "-s", "--security-level", "set security level 0-2 (low, medium, high)" }
+	{ "-s", "--security-level", "set security level 0-2 (low, medium, high)" },
+	{ "-e", "--event-batch", "max number of events handled between socket checks." },
+	{ "-t", "--task-batch", "max number of data store tasks executed in one transaction." },
+	{ "-q", "--query-workers", "number of threads that execute data store queries (0 to disable)." },
+	{ "-w", "--security-helpers", "number of threads that verify signatures." }
 };
 
 static void print_help()
 {	
 	unsigned int i;
 	
-	printf("Usage: ./haggle -[hbdfIcs{dd}]\n");
+	printf("Usage: ./haggle -[hbdfIcsetqw{dd}]\n");
 	
 	for (i = 0; i < sizeof(cmd) / (3*sizeof(char *)); i++) {
 		printf("\t%-4s %-20s %s\n", cmd[i].cmd_short, cmd[i].cmd_long, cmd[i].cmd_desc);
@@ -733,6 +750,38 @@ int main(void)
                         securityLevel = static_cast<SecurityLevel_t>(atoi(argv[1]));
 			argv++;
 			argc--;
+		} else if (check_cmd(argv[0], 8)) {
+			if (!argv[1] || atoi(argv[1]) <= 0) {
+				fprintf(stderr, "Bad event batch size, must be larger than 0\n");
+				return -1;
+			}
+                        eventBatchSize = atoi(argv[1]);
+			argv++;
+			argc--;
+		} else if (check_cmd(argv[0], 9)) {
+			if (!argv[1] || atoi(argv[1]) <= 0) {
+				fprintf(stderr, "Bad task batch size, must be larger than 0\n");
+				return -1;
+			}
+                        taskBatchSize = atoi(argv[1]);
+			argv++;
+			argc--;
+		} else if (check_cmd(argv[0], 10)) {
+			if (!argv[1] || atoi(argv[1]) < 0) {
+				fprintf(stderr, "Bad number of query workers, must be 0 or larger\n");
+				return -1;
+			}
+                        queryWorkers = atoi(argv[1]);
+			argv++;
+			argc--;
+		} else if (check_cmd(argv[0], 11)) {
+			if (!argv[1] || atoi(argv[1]) <= 0) {
+				fprintf(stderr, "Bad number of security helpers, must be larger than 0\n");
+				return -1;
+			}
+                        securityHelpers = atoi(argv[1]);
+			argv++;
+			argc--;
 		} else {
 			fprintf(stderr, "Unknown command line option: %s\n", argv[0]);
 			print_help();
@@ -9,6 +9,7 @@ LOCAL_SRC_FILES := \
 	Heap.cpp \
 	Thread.cpp \
 	Timeval.cpp \
+	TimerWheel.cpp \
 	Watch.cpp \
 	Mutex.cpp \
 	Condition.cpp \
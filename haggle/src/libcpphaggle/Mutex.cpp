@@ -85,5 +85,48 @@ Mutex::~Mutex()
 	pthread_mutex_destroy(&mutex);
 #endif
 }
+
+bool RWMutex::readLock()
+{
+#if defined(OS_WINDOWS) || defined(OS_ANDROID)
+	return mutex.lock();
+#else
+	return pthread_rwlock_rdlock(&rwlock) == 0;
+#endif
+}
+
+bool RWMutex::writeLock()
+{
+#if defined(OS_WINDOWS) || defined(OS_ANDROID)
+	return mutex.lock();
+#else
+	return pthread_rwlock_wrlock(&rwlock) == 0;
+#endif
+}
+
+bool RWMutex::unlock()
+{
+#if defined(OS_WINDOWS) || defined(OS_ANDROID)
+	mutex.unlock();
+#else
+	pthread_rwlock_unlock(&rwlock);
+#endif
+	return true;
+}
+
+RWMutex::RWMutex()
+{
+#if !defined(OS_WINDOWS) && !defined(OS_ANDROID)
+	if (pthread_rwlock_init(&rwlock, NULL) != 0)
+		throw Exception(0, "Unable to create reader/writer mutex\n");
+#endif
+}
+
+RWMutex::~RWMutex()
+{
+#if !defined(OS_WINDOWS) && !defined(OS_ANDROID)
+	pthread_rwlock_destroy(&rwlock);
+#endif
+}
 	
 }; // namespace haggle
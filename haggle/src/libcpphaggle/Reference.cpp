@@ -18,19 +18,18 @@ namespace haggle {
 
 HashMap<void *, RefCounter *> RefCounter::objects;
 Mutex RefCounter::objectsMutex;
-unsigned long RefCounter::totNum = 0;
+atomic_t RefCounter::totNum = 0;
 
-RefCounter::RefCounter(void *_obj) : 
-	countMutex(),
+RefCounter::RefCounter(void *_obj, Refcountable *_owner) : 
 	refcount(1),
+	owner(_owner),
 	objectMutex(),
 	obj(_obj), 
-	identifier(totNum++)
+	identifier(atomic_inc(&totNum) - 1)
 {
-	objects.insert(RefcountPair(obj, this));
 }
 
-RefCounter *RefCounter::create(void *_obj)
+RefCounter *RefCounter::create(void *key, void *_obj)
 {
 	Mutex::AutoLocker l(objectsMutex);
 	RefCounter *refCount;
@@ -46,8 +45,38 @@ RefCounter *RefCounter::create(void *_obj)
 			return NULL;
 		return refCount;
 	}
-	return new RefCounter(_obj);
+	refCount = new RefCounter(_obj);
+	objects.insert(RefcountPair(_obj, refCount));
+	
+	return refCount;
+}
+
+/*
+  The lock keeps the counter from being deleted by dec_count() between
+  reading it from the object and increasing it.
+ */
+RefCounter *RefCounter::create(Refcountable *key, void *_obj)
+{
+	Mutex::AutoLocker l(objectsMutex);
+	RefCounter *refCount;
+	
+	if (!key || !_obj)
+		return NULL;
+	
+	refCount = key->refCounter;
+	
+	if (refCount) {
+		if (refCount->inc_count() == 0)
+			return NULL;
+		return refCount;
+	}
+	
+	refCount = new RefCounter(_obj, key);
+	key->refCounter = refCount;
+
+	return refCount;
 }
+
 /**
     Destructor.
 */
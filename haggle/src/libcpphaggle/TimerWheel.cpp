@@ -0,0 +1,277 @@
+/* Copyright 2008-2009 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <string.h>
+
+#include <libcpphaggle/TimerWheel.h>
+
+namespace haggle {
+
+/* The index of the current slot of a higher level n, i.e., 1..3 */
+#define LVLN_SHIFT(n) (TIMERWHEEL_LVL0_BITS + ((n) - 1) * TIMERWHEEL_LVLN_BITS)
+#define LVLN_INDEX(t, n) ((unsigned int)((t) >> LVLN_SHIFT(n)) & TIMERWHEEL_LVLN_MASK)
+
+TimerWheelItem::TimerWheelItem() : prev(NULL), next(NULL), slot(NULL), level(0), expires(0)
+{
+}
+
+TimerWheelItem::~TimerWheelItem()
+{
+}
+
+TimerWheel::TimerWheel(int64_t now) : base(now), _size(0)
+{
+	memset(count, 0, sizeof(count));
+	memset(lvl0, 0, sizeof(lvl0));
+	memset(lvln, 0, sizeof(lvln));
+}
+
+TimerWheel::~TimerWheel()
+{
+	List<TimerWheelItem *> items;
+
+	// The items are not owned by the wheel, so just unlink them
+	removeAll(items);
+}
+
+void TimerWheel::link(TimerWheelItem *item)
+{
+	int64_t delta = item->expires - base;
+	int64_t expires = item->expires;
+
+	if (delta < 0) {
+		// Already expired, so put it in the next slot to process
+		item->level = 0;
+		item->slot = &lvl0[base & TIMERWHEEL_LVL0_MASK];
+	} else if (delta < TIMERWHEEL_LVL0_SIZE) {
+		item->level = 0;
+		item->slot = &lvl0[expires & TIMERWHEEL_LVL0_MASK];
+	} else {
+		unsigned int n;
+
+		if (delta > TIMERWHEEL_MAX_TICKS)
+			expires = base + TIMERWHEEL_MAX_TICKS;
+
+		for (n = 1; n < TIMERWHEEL_NUM_LEVELS - 1; n++) {
+			if (delta < (((int64_t)1) << (LVLN_SHIFT(n) + TIMERWHEEL_LVLN_BITS)))
+				break;
+		}
+		item->level = n;
+		item->slot = &lvln[n - 1][LVLN_INDEX(expires, n)];
+	}
+
+	item->prev = NULL;
+	item->next = *item->slot;
+
+	if (item->next)
+		item->next->prev = item;
+
+	*item->slot = item;
+	count[item->level]++;
+}
+
+void TimerWheel::unlink(TimerWheelItem *item)
+{
+	if (item->prev)
+		item->prev->next = item->next;
+	else
+		*item->slot = item->next;
+
+	if (item->next)
+		item->next->prev = item->prev;
+
+	count[item->level]--;
+	item->prev = item->next = NULL;
+	item->slot = NULL;
+}
+
+void TimerWheel::insert(TimerWheelItem *item, int64_t expires)
+{
+	if (!item)
+		return;
+
+	if (item->slot)
+		unlink(item);
+	else
+		_size++;
+
+	item->expires = expires;
+	link(item);
+}
+
+bool TimerWheel::remove(TimerWheelItem *item)
+{
+	if (!item || !item->slot)
+		return false;
+
+	unlink(item);
+	_size--;
+
+	return true;
+}
+
+/*
+	Move the items in a slot of a higher level down the wheel, and
+	return the index of the slot.
+ */
+unsigned long TimerWheel::cascade(unsigned int level, unsigned int index)
+{
+	TimerWheelItem *item = lvln[level - 1][index];
+
+	lvln[level - 1][index] = NULL;
+
+	while (item) {
+		TimerWheelItem *next = item->next;
+
+		count[level]--;
+		link(item);
+		item = next;
+	}
+	return index;
+}
+
+unsigned long TimerWheel::advance(int64_t now, List<TimerWheelItem *>& expired)
+{
+	unsigned long n = 0;
+
+	while (base <= now) {
+		unsigned int index = (unsigned int)(base & TIMERWHEEL_LVL0_MASK);
+
+		if (_size == 0) {
+			base = now + 1;
+			break;
+		}
+
+		/*
+		   The first level wrapped around, so cascade the higher
+		   levels. A level is only cascaded if the level below it
+		   also wrapped around.
+		 */
+		if (index == 0) {
+			for (unsigned int l = 1; l < TIMERWHEEL_NUM_LEVELS; l++) {
+				if (cascade(l, LVLN_INDEX(base, l)) != 0)
+					break;
+			}
+		}
+
+		if (count[0] == 0) {
+			// Nothing can expire before the first level wraps around again
+			int64_t next = (base | TIMERWHEEL_LVL0_MASK) + 1;
+
+			if (next > now) {
+				base = now + 1;
+				break;
+			}
+			base = next;
+			continue;
+		}
+
+		TimerWheelItem *item = lvl0[index];
+
+		lvl0[index] = NULL;
+
+		while (item) {
+			TimerWheelItem *next = item->next;
+
+			count[0]--;
+			_size--;
+			item->prev = item->next = NULL;
+			item->slot = NULL;
+			expired.push_back(item);
+			n++;
+			item = next;
+		}
+		base++;
+	}
+
+	return n;
+}
+
+unsigned long TimerWheel::removeAll(List<TimerWheelItem *>& items)
+{
+	unsigned long n = 0;
+	unsigned int i, l;
+
+	for (i = 0; i < TIMERWHEEL_LVL0_SIZE && count[0]; i++) {
+		while (lvl0[i]) {
+			TimerWheelItem *item = lvl0[i];
+			unlink(item);
+			items.push_back(item);
+			n++;
+		}
+	}
+
+	for (l = 1; l < TIMERWHEEL_NUM_LEVELS; l++) {
+		for (i = 0; i < TIMERWHEEL_LVLN_SIZE && count[l]; i++) {
+			while (lvln[l - 1][i]) {
+				TimerWheelItem *item = lvln[l - 1][i];
+				unlink(item);
+				items.push_back(item);
+				n++;
+			}
+		}
+	}
+
+	_size -= n;
+
+	return n;
+}
+
+bool TimerWheel::getNextExpiry(int64_t& tick) const
+{
+	bool found = false;
+	unsigned int i, l;
+
+	if (_size == 0)
+		return false;
+
+	if (count[0]) {
+		for (i = 0; i < TIMERWHEEL_LVL0_SIZE; i++) {
+			if (lvl0[(base + i) & TIMERWHEEL_LVL0_MASK]) {
+				tick = base + i;
+				found = true;
+				break;
+			}
+		}
+	}
+
+	/*
+	   An item in a higher level expires no earlier than the time
+	   its slot is cascaded. The current slot of a level has already
+	   been cascaded, so items there are a full turn away. A slot
+	   may be cascaded before the first occupied level 0 slot is
+	   due, so all levels must be checked.
+	 */
+	for (l = 1; l < TIMERWHEEL_NUM_LEVELS; l++) {
+		int64_t cur = base >> LVLN_SHIFT(l);
+
+		if (count[l] == 0)
+			continue;
+
+		for (i = 1; i <= TIMERWHEEL_LVLN_SIZE; i++) {
+			if (lvln[l - 1][(cur + i) & TIMERWHEEL_LVLN_MASK]) {
+				int64_t t = (cur + i) << LVLN_SHIFT(l);
+
+				if (!found || t < tick)
+					tick = t;
+				found = true;
+				break;
+			}
+		}
+	}
+
+	return found;
+}
+
+}; // namespace haggle
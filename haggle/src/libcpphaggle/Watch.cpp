@@ -16,6 +16,10 @@
 #include <libcpphaggle/Watch.h>
 #include <libcpphaggle/Thread.h>
 #include <string.h>
+#if defined(HAVE_EPOLL)
+#include <unistd.h>
+#include <errno.h>
+#endif
 
 // For TRACE macro
 #include <haggleutils.h>
@@ -659,4 +663,238 @@ bool Watch::getRemainingTime(Timeval *remaining)
 	return true;
 }
 
+WatchSet::WatchSet() : numSet(0), s(Thread::selfGetExitSignal())
+{
+#if defined(HAVE_EPOLL)
+	epfd = epoll_create(WATCHSET_MAX_SET_OBJECTS);
+
+	if (epfd == -1) {
+		TRACE_ERR("Could not create epoll instance: %s\n", strerror(errno));
+	} else if (s) {
+		struct epoll_event ev;
+		
+		// The exit signal is identified by a NULL entry pointer
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, Watchable(*s).getSocket(), &ev) == -1) {
+			TRACE_ERR("Could not add exit signal to epoll set: %s\n", strerror(errno));
+		}
+	}
+#endif
+}
+
+WatchSet::~WatchSet()
+{
+	while (!entries.empty()) {
+		delete (*entries.begin()).second;
+		entries.erase(entries.begin());
+	}
+#if defined(HAVE_EPOLL)
+	if (epfd != -1)
+		close(epfd);
+#endif
+}
+
+int WatchSet::add(const Watchable& wbl, u_int8_t state, void *data)
+{
+	if (!wbl.isValid() || !(state & WATCH_STATE_ALL))
+		return -1;
+
+	// Signals are only readable
+	if (wbl.getType() == WATCHABLE_TYPE_SIGNAL)
+		state = WATCH_STATE_READ;
+
+	Entry *e = new Entry(wbl, state, data);
+
+	if (!entries.insert(make_pair(wbl, e)).second) {
+		delete e;
+		return -1;
+	}
+#if defined(HAVE_EPOLL)
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.data.ptr = e;
+
+	if (state & WATCH_STATE_READ)
+		ev.events |= EPOLLIN;
+	if (state & WATCH_STATE_WRITE)
+		ev.events |= EPOLLOUT;
+	if (state & WATCH_STATE_EXCEPTION)
+		ev.events |= EPOLLPRI;
+
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, wbl.getSocket(), &ev) == -1) {
+		TRACE_ERR("Could not add %s to epoll set: %s\n", wbl.getStr(), strerror(errno));
+		entries.erase(wbl);
+		delete e;
+		return -1;
+	}
+#endif
+	return entries.size();
+}
+
+bool WatchSet::remove(const Watchable& wbl)
+{
+	entry_map_t::iterator it = entries.find(wbl);
+
+	if (it == entries.end())
+		return false;
+
+	Entry *e = (*it).second;
+
+	entries.erase(it);
+
+#if defined(HAVE_EPOLL)
+	/*
+		If the descriptor was closed before it was removed, the
+		operating system has already removed it from the epoll set.
+	 */
+	if (epoll_ctl(epfd, EPOLL_CTL_DEL, wbl.getSocket(), NULL) == -1 && 
+	    errno != EBADF && errno != ENOENT) {
+		TRACE_ERR("Could not remove %s from epoll set: %s\n", wbl.getStr(), strerror(errno));
+	}
+#endif
+	// Invalidate the object in case it is pending in the set list
+	for (unsigned int i = 0; i < numSet; i++) {
+		if (setObjects[i] == e)
+			setObjects[i] = NULL;
+	}
+
+	delete e;
+
+	return true;
+}
+
+const Watchable *WatchSet::getSetObject(unsigned int i) const
+{
+	if (i >= numSet || !setObjects[i])
+		return NULL;
+
+	return &setObjects[i]->wbl;
+}
+
+u_int8_t WatchSet::getSetState(unsigned int i) const
+{
+	if (i >= numSet || !setObjects[i])
+		return WATCH_STATE_NONE;
+
+	return setStates[i];
+}
+
+void *WatchSet::getSetData(unsigned int i) const
+{
+	if (i >= numSet || !setObjects[i])
+		return NULL;
+
+	return setObjects[i]->data;
+}
+
+int WatchSet::wait(const Timeval *timeout)
+{
+	int ret = Watch::SET;
+
+	numSet = 0;
+
+	if (timeout && *timeout < 0)
+		return Watch::TIMEOUT;
+
+#if defined(HAVE_EPOLL)
+	int i, n, millisec = -1;
+
+	if (epfd == -1)
+		return Watch::FAILED;
+
+	if (timeout) {
+		// Round up, so that we do not return before the timeout
+		// has actually expired.
+		int64_t usec = (int64_t)timeout->getSeconds() * 1000000 + timeout->getMicroSeconds();
+		millisec = (int)((usec + 999) / 1000);
+	}
+
+	n = epoll_wait(epfd, events, WATCHSET_MAX_SET_OBJECTS, millisec);
+
+	if (n < 0) {
+		if (errno == EINTR)
+			return Watch::TIMEOUT;
+		TRACE_ERR("Wait on objects failed: %s\n", strerror(errno));
+		return Watch::FAILED;
+	} else if (n == 0) {
+		return Watch::TIMEOUT;
+	}
+
+	for (i = 0; i < n; i++) {
+		Entry *e = static_cast<Entry *>(events[i].data.ptr);
+		u_int8_t state = WATCH_STATE_NONE;
+		
+		if (!e) {
+			ret = Watch::ABANDONED;
+			continue;
+		}
+		
+		if (events[i].events & EPOLLIN)
+			state |= WATCH_STATE_READ;
+		if (events[i].events & EPOLLOUT)
+			state |= WATCH_STATE_WRITE;
+		if (events[i].events & EPOLLPRI)
+			state |= WATCH_STATE_EXCEPTION;
+		/*
+			Hangups and errors make select() report a
+			descriptor as readable, so we do the same here.
+		 */
+		if (events[i].events & (EPOLLERR | EPOLLHUP))
+			state |= (e->state & WATCH_STATE_READ) ? WATCH_STATE_READ : WATCH_STATE_EXCEPTION;
+
+		setObjects[numSet] = e;
+		setStates[numSet] = state;
+		numSet++;
+	}
+#else
+	Watch w;
+	Entry *watched[WATCH_MAX_NUM_OBJECTS];
+	int index[WATCH_MAX_NUM_OBJECTS];
+	int i, n = 0, res;
+
+	for (entry_map_t::iterator it = entries.begin(); it != entries.end(); it++) {
+		if (n == WATCH_MAX_NUM_OBJECTS) {
+			TRACE_ERR("Too many objects in watch set, only watching %d\n", n);
+			break;
+		}
+		index[n] = w.add((*it).second->wbl, (*it).second->state);
+
+		if (index[n] < 0) {
+			TRACE_ERR("Could not add %s to watch\n", (*it).second->wbl.getStr());
+			break;
+		}
+		watched[n++] = (*it).second;
+	}
+
+	/*
+		A Watch returns immediately, without checking its objects,
+		when given a zero timeout. Therefore, poll with the
+		shortest possible timeout instead.
+	 */
+	Timeval minTimeout(0, 1);
+
+	res = w.wait((timeout && *timeout == 0) ? &minTimeout : timeout);
+
+	if (res != Watch::SET && res != Watch::ABANDONED)
+		return res;
+
+	ret = res;
+
+	for (i = 0; i < n && numSet < WATCHSET_MAX_SET_OBJECTS; i++) {
+		if (w.isSet(index[i])) {
+			setObjects[numSet] = watched[i];
+			setStates[numSet] = (w.isSet(index[i], WATCH_STATE_READ) ? WATCH_STATE_READ : 0) |
+				(w.isSet(index[i], WATCH_STATE_WRITE) ? WATCH_STATE_WRITE : 0) |
+				(w.isSet(index[i], WATCH_STATE_EXCEPTION) ? WATCH_STATE_EXCEPTION : 0);
+			numSet++;
+		}
+	}
+#endif
+	return ret;
+}
+
 }; // namespace haggle
@@ -0,0 +1,118 @@
+/* Copyright 2008-2009 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _ATOMIC_H
+#define _ATOMIC_H
+
+#include "Platform.h"
+
+/*
+	Atomic operations for the few places where a mutex is too
+	expensive. All operations imply a full memory barrier.
+
+	On Windows we use the Interlocked functions, and elsewhere the
+	GCC __sync builtins (available in GCC >= 4.1, and in the Android
+	and iPhone toolchains).
+*/
+namespace haggle {
+
+typedef volatile long atomic_t;
+
+/**
+	Atomically compare the pointer at 'ptr' with 'oldval', and if
+	they are equal, replace it with 'newval'.
+
+	@returns true if the pointer was replaced, or false otherwise.
+*/
+template<typename T>
+inline bool atomic_cas_ptr(T * volatile *ptr, T *oldval, T *newval)
+{
+#if defined(OS_WINDOWS)
+	return InterlockedCompareExchangePointer((PVOID volatile *)ptr, newval, oldval) == oldval;
+#else
+	return __sync_bool_compare_and_swap(ptr, oldval, newval);
+#endif
+}
+
+/**
+	Atomically set the pointer at 'ptr' to 'newval'.
+
+	@returns the previous value of the pointer.
+*/
+template<typename T>
+inline T *atomic_swap_ptr(T * volatile *ptr, T *newval)
+{
+#if defined(OS_WINDOWS)
+	return (T *)InterlockedExchangePointer((PVOID volatile *)ptr, newval);
+#else
+	T *oldval;
+
+	/*
+	  __sync_lock_test_and_set() is only an acquire barrier, so we use
+	  a compare-and-swap loop to get a full barrier.
+	 */
+	do {
+		oldval = *ptr;
+	} while (!__sync_bool_compare_and_swap(ptr, oldval, newval));
+
+	return oldval;
+#endif
+}
+
+/**
+	Atomically compare the value at 'v' with 'oldval', and if they
+	are equal, replace it with 'newval'.
+
+	@returns true if the value was replaced, or false otherwise.
+*/
+inline bool atomic_cas(atomic_t *v, long oldval, long newval)
+{
+#if defined(OS_WINDOWS)
+	return InterlockedCompareExchange(v, newval, oldval) == oldval;
+#else
+	return __sync_bool_compare_and_swap(v, oldval, newval);
+#endif
+}
+
+/**
+	Atomically increment the value at 'v'.
+
+	@returns the new value.
+*/
+inline long atomic_inc(atomic_t *v)
+{
+#if defined(OS_WINDOWS)
+	return InterlockedIncrement(v);
+#else
+	return __sync_add_and_fetch(v, 1);
+#endif
+}
+
+/**
+	Atomically decrement the value at 'v'.
+
+	@returns the new value.
+*/
+inline long atomic_dec(atomic_t *v)
+{
+#if defined(OS_WINDOWS)
+	return InterlockedDecrement(v);
+#else
+	return __sync_sub_and_fetch(v, 1);
+#endif
+}
+
+}; // namespace haggle
+
+#endif /* _ATOMIC_H */
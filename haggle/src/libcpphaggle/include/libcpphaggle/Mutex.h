@@ -101,6 +101,67 @@ public:
 	~RecursiveMutex() {}
 };
 
+/**
+	A reader/writer mutex can be held by any number of readers at the
+	same time, or by a single writer. It is not recursive.
+
+	Where there are no reader/writer locks (Windows and older Android
+	versions), readers exclude each other as with a normal mutex.
+*/
+class RWMutex
+{
+private:
+#if defined(OS_WINDOWS) || defined(OS_ANDROID)
+	Mutex mutex;
+#else
+	pthread_rwlock_t rwlock;
+#endif
+public:
+	/**
+	   Locks the mutex for reading.
+
+	   Returns true iff the lock was aquired.
+	*/
+	bool readLock();
+	/**
+	   Locks the mutex for writing.
+
+	   Returns true iff the lock was aquired.
+	*/
+	bool writeLock();
+	/**
+	   Unlocks a read or write lock. Returns true.
+	*/
+	bool unlock();
+	/**
+	   Constructor
+	*/
+	RWMutex();
+	/**
+	   Destructor
+	*/
+	~RWMutex();
+
+	/**
+	   The ReadLocker and WriteLocker classes lock the mutex within
+	   the context of a function, like Mutex::AutoLocker.
+	*/
+	class ReadLocker {
+	private:
+		RWMutex *m;
+	public:
+		inline ReadLocker(RWMutex& _m) : m(&_m) { m->readLock(); }
+		inline ~ReadLocker() { m->unlock(); }
+	};
+	class WriteLocker {
+	private:
+		RWMutex *m;
+	public:
+		inline WriteLocker(RWMutex& _m) : m(&_m) { m->writeLock(); }
+		inline ~WriteLocker() { m->unlock(); }
+	};
+};
+
 #define synchronized(mutex) \
         bool done = false; \
         for (Mutex::AutoLocker l(mutex); !done; done = true)
@@ -16,6 +16,7 @@
 #define __REFERENCE_H_
 
 #include "Platform.h"
+#include "Atomic.h"
 #include "Pair.h"
 #include "List.h"
 #include "Mutex.h"
@@ -34,18 +35,39 @@
 #endif
 
 namespace haggle {
-	
+
+class RefCounter;
+
+/**
+ Classes that are referenced a lot should inherit from this class. A
+ refcountable object keeps a pointer to its own reference counter, so
+ that creating a reference to it does not have to look up the counter
+ in the global store of refcounted objects. The pointer is protected 
+ by the mutex of the store. The counter is not copied when the object
+ is copied.
+ */
+class Refcountable {
+	friend class RefCounter;
+	RefCounter * volatile refCounter;
+public:
+	Refcountable() : refCounter(NULL) {}
+	Refcountable(const Refcountable&) : refCounter(NULL) {}
+	Refcountable& operator=(const Refcountable&) { return *this; }
+};
+
 /**
  This class is for keeping a reference count to the object being 
  referenced. It is allocated on the heap, so that there is only one 
- reference count and one mutex to protect that reference count.
+ reference count and one mutex to protect the object.
  */
 class RefCounter {
 	typedef Pair<void *, RefCounter *> RefcountPair;
 	typedef HashMap<void *, RefCounter *> RefcountMap;
 	/**
 	 This is a store of objects that have already been refcounted. It is 
-	 used to ensure that objects have only one reference counter.
+	 used to ensure that objects have only one reference counter. 
+	 Refcountable objects are not kept here, as they point to their
+	 counter themselves.
 	 */
 	static RefcountMap objects;
 	
@@ -58,21 +80,22 @@ class RefCounter {
 	 The total number of such object having been refcounted.
 	 Used for debugging purposes.
 	*/
-	static unsigned long totNum;
+	static atomic_t totNum;
 	/**
-	 The mutex protecting the reference count
+	 The reference count. This will start at 1, and when it reaches 0, 
+	 the object will be deleted. It is only modified atomically.
 	 */
-	Mutex countMutex;
+	atomic_t refcount;
 	/**
-	 The reference count. This will start at 1, and when it reaches 0, 
-	 the object will be deleted.
+	 The object if it is refcountable, or NULL if the counter is in
+	 the store of refcounted objects.
 	 */
-	unsigned long refcount;
+	Refcountable *owner;
 	
 	/**
 	 Constructor.
 	 */
-	RefCounter(void *_obj);
+	RefCounter(void *_obj, Refcountable *_owner = NULL);
 public:
 	
 	/**
@@ -91,7 +114,14 @@ public:
 	 */
 	const unsigned long identifier;
 	
-	static RefCounter *create(void *_obj);
+	/**
+	 Get the reference counter of an object, or create it if the
+	 object is not yet refcounted. The first argument selects the
+	 version to use, which is the one without the global store if
+	 the object is refcountable.
+	 */
+	static RefCounter *create(void *key, void *_obj);
+	static RefCounter *create(Refcountable *key, void *_obj);
 	/**
 	 Destructor.
 	 */
@@ -100,14 +130,22 @@ public:
 	template<typename T>
 	T *object() { return static_cast<T *>(obj); }
 	/**
-	 This function increases the reference count atomically.
+	 This function increases the reference count atomically. A count
+	 that has reached zero is never increased again, as the object is
+	 being deleted.
 	 */
 	unsigned long inc_count()
 	{
-		Mutex::AutoLocker l(countMutex);
-		if (refcount == 0)
-			return 0;
-		return ++refcount;
+		long c;
+		
+		do {
+			c = refcount;
+			
+			if (c == 0)
+				return 0;
+		} while (!atomic_cas(&refcount, c, c + 1));
+		
+		return c + 1;
 	}
 	
 	/**
@@ -116,27 +154,30 @@ public:
 	template<typename T>
 	unsigned long dec_count()
 	{
-		unsigned long ret;
-		countMutex.lock();
-
-		if (refcount == 0) {
-			countMutex.unlock();
-			return 0;
-		}
-
-		ret = --refcount;
+		long c;
+		
+		do {
+			c = refcount;
+			
+			if (c == 0)
+				return 0;
+		} while (!atomic_cas(&refcount, c, c - 1));
+		
+		if (c == 1) {
+			T *tmp_obj = static_cast<T *>(obj);
+			
+			objectsMutex.lock();
 
-		countMutex.unlock();
+			if (owner)
+				owner->refCounter = NULL;
+			else
+				objects.erase(obj);
 
-		if (ret == 0) {	
-			objectsMutex.lock();
-			objects.erase(obj);
-			T * tmp_obj = static_cast<T *>(obj);
-			objectsMutex.unlock();			
+			objectsMutex.unlock();
 			delete this;
 			delete tmp_obj;
 		} 
-		return ret;
+		return c - 1;
 	}
 	
 	/**
@@ -265,8 +306,16 @@ private:
 	/**
            Constructor
 	*/
-	Reference(const T *obj = NULL) : refCount(RefCounter::create(const_cast<T *>(obj)))
+	Reference(const T *obj = NULL) : refCount(RefCounter::create(const_cast<T *>(obj), const_cast<T *>(obj)))
 	{
+		/*
+		  The type must be complete here, or the counter could be
+		  looked up differently for the same object in different
+		  places.
+		 */
+		typedef char type_must_be_complete[sizeof(T) ? 1 : -1];
+		(void)sizeof(type_must_be_complete);
+		
 		if (!refCount) {
 			// ERROR!
 		}
@@ -402,7 +451,7 @@ private:
 			return false;
 		if (eo1.refCount == NULL || eo2 == NULL)
 			return false;
-		return eo1.getObj() < *eo2;
+		return *eo1.getObj() < *eo2;
 	}
 
 	template<typename TT>
@@ -440,7 +489,7 @@ private:
 			return true;
 		if (eo1.refCount == NULL || eo2 == NULL)
 			return false;
-		return eo1.getObj() == *eo2;
+		return *eo1.getObj() == *eo2;
 	}
 	template<typename TT>
 	friend bool operator==(const Reference<T>& eo1, const TT &eo2)
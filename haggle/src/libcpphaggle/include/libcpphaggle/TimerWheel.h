@@ -0,0 +1,136 @@
+/* Copyright 2008-2009 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef _TIMERWHEEL_H
+#define _TIMERWHEEL_H
+
+#include <haggleutils.h>
+#include "Platform.h"
+#include "List.h"
+
+namespace haggle {
+
+class TimerWheelItem;
+class TimerWheel;
+
+/*
+	The wheel has one level of 256 slots with a resolution of one tick,
+	and three levels of 64 slots, each covering 64 times the range of
+	the level below. This covers 2^26 ticks, which is about 18 hours
+	with one millisecond ticks. Items that expire further into the
+	future are kept in the last slot of the top level until they come
+	within range.
+*/
+#define TIMERWHEEL_LVL0_BITS 8
+#define TIMERWHEEL_LVLN_BITS 6
+#define TIMERWHEEL_LVL0_SIZE (1 << TIMERWHEEL_LVL0_BITS)
+#define TIMERWHEEL_LVLN_SIZE (1 << TIMERWHEEL_LVLN_BITS)
+#define TIMERWHEEL_LVL0_MASK (TIMERWHEEL_LVL0_SIZE - 1)
+#define TIMERWHEEL_LVLN_MASK (TIMERWHEEL_LVLN_SIZE - 1)
+#define TIMERWHEEL_NUM_LEVELS 4
+#define TIMERWHEEL_MAX_TICKS ((((int64_t)1) << (TIMERWHEEL_LVL0_BITS + (TIMERWHEEL_NUM_LEVELS - 1) * TIMERWHEEL_LVLN_BITS)) - 1)
+
+/**
+ The TimerWheelItem class should be inherited by any data item that
+ should be placed in a timer wheel. The item is linked into the wheel
+ directly, so inserting and removing items never allocate memory.
+ */
+class TimerWheelItem
+{
+        friend class TimerWheel;
+	TimerWheelItem *prev, *next;
+	TimerWheelItem **slot;
+	unsigned char level;
+	int64_t expires;
+public:
+        TimerWheelItem();
+	virtual ~TimerWheelItem();
+	/**
+	   @returns true if the item is currently in a timer wheel.
+	 */
+	bool isInTimerWheel() const { return slot != NULL; }
+	/**
+	   @returns the tick at which the item expires.
+	 */
+	int64_t getExpiryTick() const { return expires; }
+};
+
+/**
+ The TimerWheel class implements a hierarchical timing wheel, which
+ holds items that expire at a given tick. Inserting and removing an
+ item is O(1). Items in the lower levels expire when the wheel is
+ advanced past their tick, while items in the higher levels are moved
+ down ("cascaded") a level each time the level below wraps around.
+
+ The wheel does not do any locking.
+ */
+class TimerWheel
+{
+public:
+	/**
+	   Create a timer wheel whose current time is the given tick.
+	 */
+        TimerWheel(int64_t now = 0);
+        ~TimerWheel();
+        bool empty() const { return _size == 0; }
+	unsigned long size() const { return _size; }
+	/**
+	   Insert an item that expires at the given tick. An item that
+	   is already in the wheel is moved. Items that expire in the
+	   past expire the next time the wheel is advanced.
+	 */
+        void insert(TimerWheelItem *item, int64_t expires);
+	/**
+	   Remove an item from the wheel.
+
+	   @returns true if the item was in the wheel, or false otherwise.
+	 */
+        bool remove(TimerWheelItem *item);
+	/**
+	   Advance the wheel to the given tick, and move the items that
+	   have expired to a list. The expired items are not sorted.
+
+	   @returns the number of expired items.
+	 */
+	unsigned long advance(int64_t now, List<TimerWheelItem *>& expired);
+	/**
+	   Move all items in the wheel to a list, whether they have
+	   expired or not.
+
+	   @returns the number of items moved.
+	 */
+	unsigned long removeAll(List<TimerWheelItem *>& items);
+	/**
+	   Get a lower bound on the tick at which the next item expires.
+	   The bound is exact for items in the first level, while it is
+	   the time of the next cascade for items in the higher levels.
+
+	   @returns true if the wheel has items and the tick was set, or
+	   false if the wheel is empty.
+	 */
+	bool getNextExpiry(int64_t& tick) const;
+private:
+	void link(TimerWheelItem *item);
+	void unlink(TimerWheelItem *item);
+	unsigned long cascade(unsigned int level, unsigned int index);
+	int64_t base; // The next tick to process
+	unsigned long _size;
+	unsigned long count[TIMERWHEEL_NUM_LEVELS];
+	TimerWheelItem *lvl0[TIMERWHEEL_LVL0_SIZE];
+	TimerWheelItem *lvln[TIMERWHEEL_NUM_LEVELS - 1][TIMERWHEEL_LVLN_SIZE];
+};
+
+}; // namespace haggle
+
+#endif /* _TIMERWHEEL_H */
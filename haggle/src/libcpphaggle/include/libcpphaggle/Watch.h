@@ -20,6 +20,16 @@
 #include "Platform.h"
 #include "Timeval.h"
 #include "Signal.h"
+#include "Map.h"
+
+/*
+	Linux (and Android) provide epoll, which allows a persistent watch set
+	that does not have to be rebuilt, and scanned, on every wait.
+*/
+#if defined(OS_LINUX)
+#define HAVE_EPOLL 1
+#include <sys/epoll.h>
+#endif
 
 namespace haggle {
 /*
@@ -190,6 +200,101 @@ public:
 	~Watch(void);
 };
 
+// The maximum number of set objects that WatchSet::wait() reports at once.
+// With epoll, objects that are still set are reported in the next wait.
+#define WATCHSET_MAX_SET_OBJECTS 64
+
+/**
+	A WatchSet is a persistent version of the Watch. Objects are added
+	and removed incrementally, and remain in the set across waits. This
+	makes it suitable for long-lived run-loops, like the one in the
+	kernel, that otherwise would have to rebuild a Watch for every wait.
+
+	On platforms with epoll, the set is kept in the operating
+	system's kernel and wait() only returns the objects that are
+	set, so that the cost of a wait does not depend on the number of
+	watched objects. On other platforms, a Watch is populated from the
+	set on each wait, and the limit of WATCH_MAX_NUM_OBJECTS applies.
+
+	After a wait, the set objects are retrieved by position, using
+	getSetObject(), getSetState() and getSetData(). It is safe to
+	remove objects from the set while iterating the set objects;
+	removed objects will be reported as NULL.
+*/
+class WatchSet
+{
+private:
+	class Entry {
+	public:
+		Watchable wbl;
+		u_int8_t state;
+		void *data;
+		Entry(const Watchable& _wbl, u_int8_t _state, void *_data) : 
+			wbl(_wbl), state(_state), data(_data) {}
+	};
+	typedef Map<Watchable, Entry *> entry_map_t;
+	entry_map_t entries;
+	Entry *setObjects[WATCHSET_MAX_SET_OBJECTS];
+	u_int8_t setStates[WATCHSET_MAX_SET_OBJECTS];
+	unsigned int numSet;
+	Signal *s;
+#if defined(HAVE_EPOLL)
+	int epfd;
+	struct epoll_event events[WATCHSET_MAX_SET_OBJECTS];
+#endif
+public:
+	/**
+		Add an object to the set. The data pointer is an opaque
+		value that is handed back by getSetData() when the object
+		is set.
+
+		@returns the number of objects in the set, or -1 on
+		error (e.g., the object is already in the set).
+	*/
+	int add(const Watchable& wbl, u_int8_t state = WATCH_STATE_DEFAULT, void *data = NULL);
+	/**
+		Remove an object from the set.
+
+		@returns true if the object was removed, or false if it
+		was not in the set.
+	*/
+	bool remove(const Watchable& wbl);
+	/**
+		@returns the number of objects in the set.
+	*/
+	unsigned long size() const { return entries.size(); }
+	/**
+		Wait on the objects in the set. If timeout is NULL, the
+		wait is infinite. Unlike a Watch, a zero timeout polls
+		the objects without blocking.
+
+		@returns see Watch::wait().
+	*/
+	int wait(const Timeval *timeout = NULL);
+	/**
+		@returns the number of set objects found in the last wait.
+	*/
+	unsigned int getNumSet() const { return numSet; }
+	/**
+		@returns the set object at position i, or NULL if the
+		object was removed after the wait returned.
+	*/
+	const Watchable *getSetObject(unsigned int i) const;
+	/**
+		@returns the states that were set for the object at
+		position i.
+	*/
+	u_int8_t getSetState(unsigned int i) const;
+	/**
+		@returns the data pointer given when the object at
+		position i was added.
+	*/
+	void *getSetData(unsigned int i) const;
+
+	WatchSet(void);
+	~WatchSet(void);
+};
+
 }; // namespace haggle
 
 #endif /* _WATCH */
@@ -139,6 +139,57 @@ typedef enum control_type {
 #define IO_REPLY_BLOCK             -1
 #define IO_REPLY_NON_BLOCK          0
 
+/*
+	Shared memory rings for the metadata exchanged over the Unix domain
+	socket. An application that has a socket of its own also creates a
+	file next to it, named after the socket with HAGGLE_IPC_RING_SUFFIX
+	appended, which holds one ring in each direction. Instead of the
+	metadata, the socket then carries a short notice that tells where in
+	the ring the metadata is. When a ring is full, or missing, the
+	metadata is sent in a datagram as before. An application only sends
+	notices once the daemon has sent it one, which shows that the daemon
+	has mapped the ring.
+
+	A record is never split, so when it does not fit before the end of
+	the ring, it starts over at the beginning. The reader sets the tail
+	to the end of a record once it is done with it.
+
+	Known limitation: payload files are not passed as file descriptors.
+	The metadata still names them by path, so the daemon and the
+	application must be able to open each other's files.
+*/
+#define HAGGLE_IPC_RING_MAGIC 0x48524e47 /* "HRNG" */
+#define HAGGLE_IPC_RING_SUFFIX ".ring"
+#define HAGGLE_IPC_RING_SIZE (128 * 1024) /* Must be a power of two */
+#define HAGGLE_IPC_RING_HEADER_SIZE (4096)
+#define HAGGLE_IPC_RING_FILE_SIZE (HAGGLE_IPC_RING_HEADER_SIZE + 2 * HAGGLE_IPC_RING_SIZE)
+
+struct haggle_ipc_ring {
+	unsigned int size;
+	volatile unsigned int head; /* Only changed by the writer */
+	volatile unsigned int tail; /* Only changed by the reader */
+};
+
+struct haggle_ipc_ring_file {
+	unsigned int magic;
+	unsigned int id; /* Tells files with the same name apart */
+	struct haggle_ipc_ring to_haggle;
+	struct haggle_ipc_ring from_haggle;
+};
+
+/* The data of a ring, which follows the header of the file */
+#define HAGGLE_IPC_RING_DATA(f, r) \
+	((unsigned char *)(f) + HAGGLE_IPC_RING_HEADER_SIZE + \
+	 ((r) == &(f)->to_haggle ? 0 : HAGGLE_IPC_RING_SIZE))
+
+struct haggle_ipc_ring_notice {
+	unsigned int magic;
+	unsigned int id;
+	unsigned int offset; /* Where the record starts in the ring */
+	unsigned int len;
+	unsigned int end; /* The tail of the ring once the record is read */
+};
+
 /* IPC API functions */
 
 /**
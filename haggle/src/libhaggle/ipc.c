@@ -31,6 +31,9 @@ typedef DWORD thread_handle_id_t;
 #include <sys/un.h>
 #include <sys/select.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <pthread.h>
 #include <signal.h>
@@ -64,11 +67,17 @@ typedef pthread_attr_t thread_handle_attr_t;
 #define HAGGLE_PROCESS_NAME "haggle"
 #endif
 
-#ifdef USE_UNIX_APPLICATION_SOCKET
-#define HAGGLE_UNIX_SOCK_PATH "/tmp/haggle.sock"
-#else
 #define HAGGLE_SERVICE_DEFAULT_PORT 8787
-#endif /* USE_UNIX_APPLICATION_SOCKET */
+
+#if defined(OS_UNIX)
+/*
+	The Unix domain socket of the daemon, which is preferred over
+	UDP when it exists. Each handle binds its own socket in the same
+	directory, so that the daemon can send replies and events back.
+*/
+#define HAGGLE_LOCAL_SOCKET libhaggle_platform_get_path(PLATFORM_PATH_HAGGLE_PRIVATE, "/haggle.sock")
+#define HAGGLE_LOCAL_SOCKET_APP_FMT "%.*s/app-%ld-%d.sock"
+#endif
 
 #include "sha1.h"
 #include "base64.h"
@@ -89,6 +98,20 @@ struct handler_data {
 struct haggle_handle {
 	list_t l;
 	SOCKET sock;
+	union {
+		struct sockaddr sa;
+		struct sockaddr_in in;
+#if defined(OS_UNIX)
+		struct sockaddr_un un;
+#endif
+	} haggle_addr; /* Where to send data objects */
+	int haggle_addrlen;
+#if defined(OS_UNIX)
+	struct sockaddr_un local_addr; /* Our end of a Unix domain socket */
+	struct haggle_ipc_ring_file *ring; /* Shared with the daemon, if any */
+	pthread_mutex_t ring_mutex; /* Serializes writes to the ring */
+	volatile int ring_confirmed; /* The daemon has sent through the ring */
+#endif
 #if defined(OS_UNIX)
         int signal[2];
 #elif defined(OS_WINDOWS)
@@ -760,6 +783,273 @@ out_error:
 	
 }
 
+#if defined(OS_UNIX)
+static void get_local_ring_path(struct haggle_handle *hh, char *path, size_t len)
+{
+	snprintf(path, len, "%s%s", hh->local_addr.sun_path, HAGGLE_IPC_RING_SUFFIX);
+}
+
+/*
+	Creates the shared memory rings that go with the socket of the
+	handle. The socket works without them, so failing is not an error.
+*/
+static void open_local_ring(struct haggle_handle *hh)
+{
+	char path[sizeof(hh->local_addr.sun_path) + sizeof(HAGGLE_IPC_RING_SUFFIX)];
+	struct haggle_ipc_ring_file *f;
+	struct timeval now;
+	int fd;
+
+	get_local_ring_path(hh, path, sizeof(path));
+
+	// Left behind together with the socket
+	unlink(path);
+
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+
+	if (fd < 0) {
+		LIBHAGGLE_DBG("Could not create %s: %s\n", path, strerror(errno));
+		return;
+	}
+
+	if (ftruncate(fd, HAGGLE_IPC_RING_FILE_SIZE) != 0) {
+		LIBHAGGLE_DBG("Could not resize %s: %s\n", path, strerror(errno));
+		close(fd);
+		unlink(path);
+		return;
+	}
+
+	f = (struct haggle_ipc_ring_file *)mmap(NULL, HAGGLE_IPC_RING_FILE_SIZE, 
+						PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	close(fd);
+
+	if (f == MAP_FAILED) {
+		LIBHAGGLE_DBG("Could not map %s: %s\n", path, strerror(errno));
+		unlink(path);
+		return;
+	}
+
+	gettimeofday(&now, NULL);
+
+	f->id = ((unsigned int)getpid() << 16) ^ (unsigned int)now.tv_sec ^ (unsigned int)now.tv_usec;
+	f->to_haggle.size = HAGGLE_IPC_RING_SIZE;
+	f->from_haggle.size = HAGGLE_IPC_RING_SIZE;
+	f->magic = HAGGLE_IPC_RING_MAGIC;
+
+	pthread_mutex_init(&hh->ring_mutex, NULL);
+	hh->ring = f;
+
+	LIBHAGGLE_DBG("Using shared memory ring %s\n", path);
+}
+
+static void close_local_ring(struct haggle_handle *hh)
+{
+	char path[sizeof(hh->local_addr.sun_path) + sizeof(HAGGLE_IPC_RING_SUFFIX)];
+
+	if (!hh->ring)
+		return;
+
+	munmap(hh->ring, HAGGLE_IPC_RING_FILE_SIZE);
+	pthread_mutex_destroy(&hh->ring_mutex);
+	hh->ring = NULL;
+	hh->ring_confirmed = 0;
+
+	get_local_ring_path(hh, path, sizeof(path));
+	unlink(path);
+}
+
+/*
+	Copies a record into a ring, and fills in the notice that tells the
+	reader where it is. Returns -1 if the ring has no room for it.
+*/
+static int ring_write(struct haggle_ipc_ring_file *f, struct haggle_ipc_ring *r, 
+		      const unsigned char *data, size_t len, 
+		      struct haggle_ipc_ring_notice *n)
+{
+	unsigned int head = r->head;
+	unsigned int offset = head & (HAGGLE_IPC_RING_SIZE - 1);
+	unsigned int pad = 0;
+
+	if (len == 0 || len > HAGGLE_IPC_RING_SIZE)
+		return -1;
+
+	if (offset + len > HAGGLE_IPC_RING_SIZE) {
+		pad = HAGGLE_IPC_RING_SIZE - offset;
+		offset = 0;
+	}
+
+	if ((head - r->tail) + pad + len > HAGGLE_IPC_RING_SIZE)
+		return -1;
+
+	memcpy(HAGGLE_IPC_RING_DATA(f, r) + offset, data, len);
+
+	n->magic = HAGGLE_IPC_RING_MAGIC;
+	n->id = f->id;
+	n->offset = offset;
+	n->len = (unsigned int)len;
+	n->end = head + pad + (unsigned int)len;
+
+	r->head = n->end;
+
+	return 0;
+}
+
+/*
+	Sends metadata to the daemon through the ring of the handle, or in
+	a datagram if the ring is full.
+*/
+static int send_local(struct haggle_handle *hh, const unsigned char *data, size_t len)
+{
+	struct haggle_ipc_ring *r = &hh->ring->to_haggle;
+	struct haggle_ipc_ring_notice n;
+	unsigned int head;
+	int ret;
+
+	pthread_mutex_lock(&hh->ring_mutex);
+
+	head = r->head;
+
+	if (ring_write(hh->ring, r, data, len, &n) == 0) {
+		ret = sendto(hh->sock, (const char *)&n, sizeof(n), 0, 
+			     &hh->haggle_addr.sa, hh->haggle_addrlen);
+
+		// The daemon will never read the record
+		if (ret < 0)
+			r->head = head;
+	} else {
+		ret = sendto(hh->sock, data, len, 0, 
+			     &hh->haggle_addr.sa, hh->haggle_addrlen);
+	}
+
+	pthread_mutex_unlock(&hh->ring_mutex);
+
+	return ret;
+}
+#endif
+
+/*
+	Creates a data object from what was read from the socket, which is
+	either its metadata, or a notice that tells where in the ring of the
+	handle the metadata is.
+*/
+static struct dataobject *dataobject_new_from_ipc(struct haggle_handle *hh, 
+						  const unsigned char *buf, size_t len)
+{
+#if defined(OS_UNIX)
+	struct haggle_ipc_ring_notice n;
+	struct dataobject *dobj;
+
+	if (hh->ring && len == sizeof(n)) {
+		memcpy(&n, buf, sizeof(n));
+
+		if (n.magic == HAGGLE_IPC_RING_MAGIC) {
+			struct haggle_ipc_ring *r = &hh->ring->from_haggle;
+
+			if (n.id != hh->ring->id || n.len == 0 || n.offset >= HAGGLE_IPC_RING_SIZE ||
+			    n.len > HAGGLE_IPC_RING_SIZE - n.offset) {
+				LIBHAGGLE_ERR("Bad ring notice\n");
+				return NULL;
+			}
+
+			dobj = haggle_dataobject_new_from_raw(HAGGLE_IPC_RING_DATA(hh->ring, r) + n.offset, n.len);
+
+			// The daemon has mapped the ring, so it can read from it too
+			hh->ring_confirmed = 1;
+
+			// Done with the record, so the daemon may overwrite it
+			__sync_synchronize();
+			r->tail = n.end;
+
+			return dobj;
+		}
+	}
+#endif
+	return haggle_dataobject_new_from_raw(buf, len);
+}
+
+#if defined(OS_UNIX)
+/*
+	Opens a socket to the daemon's Unix domain socket, and binds it to a
+	path of its own. Returns INVALID_SOCKET if the daemon has no such
+	socket or it cannot be used, in which case the caller uses UDP.
+*/
+static SOCKET open_local_socket(struct haggle_handle *hh)
+{
+	static int num_local_sockets = 0;
+	const char *path = HAGGLE_LOCAL_SOCKET;
+	struct sockaddr_un *sa = &hh->haggle_addr.un;
+	struct stat st;
+	const char *dirend;
+	SOCKET sock;
+	int len;
+
+	if (!path || strlen(path) >= sizeof(sa->sun_path))
+		return INVALID_SOCKET;
+
+	if (stat(path, &st) != 0 || !S_ISSOCK(st.st_mode))
+		return INVALID_SOCKET;
+
+	dirend = strrchr(path, '/');
+
+	if (!dirend)
+		return INVALID_SOCKET;
+
+	memset(sa, 0, sizeof(*sa));
+	sa->sun_family = AF_UNIX;
+	strcpy(sa->sun_path, path);
+
+	memset(&hh->local_addr, 0, sizeof(hh->local_addr));
+	hh->local_addr.sun_family = AF_UNIX;
+
+	len = snprintf(hh->local_addr.sun_path, sizeof(hh->local_addr.sun_path), 
+		       HAGGLE_LOCAL_SOCKET_APP_FMT, (int)(dirend - path), path, 
+		       (long)getpid(), num_local_sockets++);
+	
+	if (len < 0 || len >= (int)sizeof(hh->local_addr.sun_path)) {
+		hh->local_addr.sun_path[0] = '\0';
+		return INVALID_SOCKET;
+	}
+
+	sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+
+	if (sock == INVALID_SOCKET) {
+		hh->local_addr.sun_path[0] = '\0';
+		return INVALID_SOCKET;
+	}
+
+	// Left behind by an earlier process with the same pid
+	unlink(hh->local_addr.sun_path);
+
+	if (bind(sock, (struct sockaddr *)&hh->local_addr, sizeof(hh->local_addr)) == SOCKET_ERROR) {
+		LIBHAGGLE_DBG("Could not bind %s: %s\n", 
+			      hh->local_addr.sun_path, strerror(errno));
+		CLOSE_SOCKET(sock);
+		hh->local_addr.sun_path[0] = '\0';
+		return INVALID_SOCKET;
+	}
+
+	hh->haggle_addrlen = sizeof(struct sockaddr_un);
+
+	LIBHAGGLE_DBG("Using local socket %s\n", hh->local_addr.sun_path);
+
+	open_local_ring(hh);
+
+	return sock;
+}
+#endif
+
+static void close_handle_socket(struct haggle_handle *hh)
+{
+	CLOSE_SOCKET(hh->sock);
+#if defined(OS_UNIX)
+	close_local_ring(hh);
+
+	if (hh->local_addr.sun_path[0] != '\0')
+		unlink(hh->local_addr.sun_path);
+#endif
+}
+
 int haggle_handle_get_internal(const char *name, haggle_handle_t *handle, 
 			       int ignore_busy_signal)
 {
@@ -770,16 +1060,6 @@ int haggle_handle_get_internal(const char *name, haggle_handle_t *handle,
 	control_type_t ctrl_type;
 	SHA1_CTX ctxt;
 
-#ifdef USE_UNIX_APPLICATION_SOCKET
-#define AF_ADDRESS_FAMILY AF_UNIX
-	struct sockaddr_un haggle_addr;
-	socklen_t addrlen = sizeof(struct sockaddr_un);
-#else
-#define AF_ADDRESS_FAMILY AF_INET
-	/* struct sockaddr_in local_addr; */
-	/* unsigned long addrlen = sizeof(struct sockaddr_in); */
-#endif
-
 #if !defined(OS_MACOSX_IPHONE)
         if (haggle_daemon_pid(NULL) != HAGGLE_DAEMON_RUNNING)
                 return HAGGLE_DAEMON_ERROR;
@@ -797,7 +1077,21 @@ int haggle_handle_get_internal(const char *name, haggle_handle_t *handle,
 
 	INIT_LIST(&hh->l);
 
-	hh->sock = socket(AF_ADDRESS_FAMILY, SOCK_DGRAM, 0);
+	hh->sock = INVALID_SOCKET;
+
+#if defined(OS_UNIX)
+	hh->sock = open_local_socket(hh);
+#endif
+
+#if !defined(USE_UNIX_APPLICATION_SOCKET)
+	if (hh->sock == INVALID_SOCKET) {
+		hh->sock = socket(AF_INET, SOCK_DGRAM, 0);
+		hh->haggle_addr.in.sin_family = AF_INET;
+		hh->haggle_addr.in.sin_addr.s_addr = inet_addr("127.0.0.1");
+		hh->haggle_addr.in.sin_port = htons(HAGGLE_SERVICE_DEFAULT_PORT);
+		hh->haggle_addrlen = sizeof(struct sockaddr_in);
+	}
+#endif
 
 	if (hh->sock == INVALID_SOCKET) {
 		free(hh);
@@ -816,6 +1110,7 @@ int haggle_handle_get_internal(const char *name, haggle_handle_t *handle,
         ret = pipe(hh->signal);
         
         if (ret != 0) {
+		close_handle_socket(hh);
 		free(hh);
 		return HAGGLE_ERROR;
         }
@@ -834,21 +1129,13 @@ int haggle_handle_get_internal(const char *name, haggle_handle_t *handle,
 	hh->name = (char *)malloc(strlen(name) + 1);
 
 	if (!hh->name) {
+		close_handle_socket(hh);
 		free(hh);
 		return HAGGLE_ALLOC_ERROR;
 	}
 
 	strcpy(hh->name, name);
 
-#ifdef USE_UNIX_APPLICATION_SOCKET
-	haggle_addr.sun_family = AF_UNIX;
-	strcpy(haggle_addr.sun_path, HAGGLE_UNIX_SOCK_PATH);
-#else
-	haggle_addr.sin_family = AF_INET;
-	haggle_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
-	haggle_addr.sin_port = htons(HAGGLE_SERVICE_DEFAULT_PORT);
-#endif
-
 	dobj = create_control_dataobject(hh, CTRL_TYPE_REGISTRATION_REQUEST, 
 					 NULL);
 
@@ -985,7 +1272,7 @@ int haggle_handle_get_internal(const char *name, haggle_handle_t *handle,
 	return HAGGLE_NO_ERROR;
 
 out_error:
-	CLOSE_SOCKET(hh->sock);
+	close_handle_socket(hh);
 
 	if (hh->name)
 		free(hh->name);
@@ -1002,7 +1289,7 @@ void haggle_handle_free_final(haggle_handle_t hh)
 {
 	num_handles--;
 	list_detach(&hh->l);
-	CLOSE_SOCKET(hh->sock);
+	close_handle_socket(hh);
 #if defined(OS_WINDOWS)
         CloseHandle(hh->signal);
 #elif defined(OS_UNIX)
@@ -1287,8 +1574,13 @@ int haggle_ipc_send_dataobject(struct haggle_handle *hh, haggle_dobj_t *dobj,
 		return HAGGLE_ALLOC_ERROR;
 	}
         
+#if defined(OS_UNIX)
+	if (hh->ring && hh->ring_confirmed)
+		ret = send_local(hh, data, datalen);
+	else
+#endif
 	ret = sendto(hh->sock, data, datalen, 0, 
-		     (struct sockaddr *)&haggle_addr, sizeof(haggle_addr));
+		     &hh->haggle_addr.sa, hh->haggle_addrlen);
 
 	free(data);
 
@@ -1352,7 +1644,7 @@ int haggle_ipc_send_dataobject(struct haggle_handle *hh, haggle_dobj_t *dobj,
 		printf("Received raw data on socket: %s\n", 
 			      (char *)databuffer);
 		*/
-                dobj_recv = haggle_dataobject_new_from_raw(databuffer, ret);
+                dobj_recv = dataobject_new_from_ipc(hh, databuffer, ret);
                 
                 if (dobj_recv == NULL) {
                         dobj_reply = NULL;
@@ -1634,14 +1926,17 @@ start_ret_t haggle_event_loop(void *arg)
                                 continue;
                         }
                         
-                        dobj = haggle_dataobject_new_from_raw(eventbuffer, ret);
+                        dobj = dataobject_new_from_ipc(hh, eventbuffer, ret);
                         
                         if (!dobj) {
                                 LIBHAGGLE_ERR("Haggle event loop ERROR: could not create data object\n");
                                 continue;
                         }
                        
-			LIBHAGGLE_DBG("Received data object\n%s\n", (char *)eventbuffer);
+			LIBHAGGLE_DBG("Received data object\n");
+#if defined(DEBUG)
+			haggle_dataobject_print(stdout, dobj);
+#endif
 			
 			app_m = haggle_dataobject_get_metadata(dobj, DATAOBJECT_METADATA_APPLICATION);
 			
@@ -0,0 +1,242 @@
+/* Copyright 2008 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+	This program measures the latency and throughput of local publish and
+	subscribe through a running Haggle daemon. One handle publishes data
+	objects that another handle has registered interest in, and the time
+	from publishing each data object until it is received is recorded.
+
+	With a window of one, each data object is published when the previous
+	one has been received, which gives the round trip latency. Larger
+	windows keep more data objects in flight, which gives the throughput.
+*/
+#include <libhaggle/haggle.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#define DEFAULT_COUNT 1000
+#define DEFAULT_WINDOW 1
+#define RECEIVE_TIMEOUT 5 /* Seconds to wait for a data object */
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static struct timeval *sent;
+static struct timeval last_received;
+static double min_latency = -1, max_latency = 0, sum_latency = 0;
+static long count = DEFAULT_COUNT;
+static long num_received = 0;
+static char run_id[20];
+
+static double timeval_diff_ms(const struct timeval *start, const struct timeval *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_usec - start->tv_usec) / 1000.0;
+}
+
+static int on_dataobject(haggle_event_t *e, void *arg)
+{
+	struct attribute *a = haggle_dataobject_get_attribute_by_name(e->dobj, "seq");
+	struct timeval now;
+	double latency;
+	long seq;
+
+	gettimeofday(&now, NULL);
+
+	/*
+		Haggle remembers the interests of applications by name, so we
+		may also get the data objects of earlier runs.
+	*/
+	if (!a || !haggle_dataobject_get_attribute_by_name_value(e->dobj, "ipcbench", run_id))
+		return 0;
+
+	seq = strtol(haggle_attribute_get_value(a), NULL, 10);
+
+	if (seq < 0 || seq >= count)
+		return 0;
+
+	latency = timeval_diff_ms(&sent[seq], &now);
+
+	pthread_mutex_lock(&mutex);
+
+	if (min_latency < 0 || latency < min_latency)
+		min_latency = latency;
+	if (latency > max_latency)
+		max_latency = latency;
+
+	sum_latency += latency;
+	num_received++;
+	last_received = now;
+
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&mutex);
+
+	return 0;
+}
+
+/* Waits until at most 'outstanding' data objects are still in flight */
+static int wait_for_received(long num_sent, long outstanding)
+{
+	struct timespec ts;
+	struct timeval now;
+	int ret = 0;
+
+	pthread_mutex_lock(&mutex);
+
+	while (num_sent - num_received > outstanding && ret == 0) {
+		gettimeofday(&now, NULL);
+		ts.tv_sec = now.tv_sec + RECEIVE_TIMEOUT;
+		ts.tv_nsec = now.tv_usec * 1000;
+		ret = pthread_cond_timedwait(&cond, &mutex, &ts);
+	}
+
+	pthread_mutex_unlock(&mutex);
+
+	return ret == 0;
+}
+
+static int publish(haggle_handle_t hh, long seq)
+{
+	struct dataobject *dobj = haggle_dataobject_new();
+	char seq_str[20];
+	int ret;
+
+	if (!dobj)
+		return HAGGLE_ALLOC_ERROR;
+
+	snprintf(seq_str, sizeof(seq_str), "%ld", seq);
+
+	haggle_dataobject_set_createtime(dobj, NULL);
+	haggle_dataobject_add_attribute(dobj, "ipcbench", run_id);
+	haggle_dataobject_add_attribute(dobj, "seq", seq_str);
+
+	gettimeofday(&sent[seq], NULL);
+
+	ret = haggle_ipc_publish_dataobject(hh, dobj);
+
+	haggle_dataobject_free(dobj);
+
+	return ret;
+}
+
+static void print_usage(const char *progname)
+{
+	printf("Usage: %s [-n count] [-w window]\n", progname);
+	printf("\t-n\tNumber of data objects to publish (default %d)\n", DEFAULT_COUNT);
+	printf("\t-w\tNumber of data objects in flight (default %d)\n", DEFAULT_WINDOW);
+}
+
+int main(int argc, char *argv[])
+{
+	haggle_handle_t pub, sub;
+	struct timeval start;
+	long window = DEFAULT_WINDOW, i;
+	double elapsed;
+	int ch, ret = 1;
+
+	while ((ch = getopt(argc, argv, "n:w:h")) != -1) {
+		switch (ch) {
+		case 'n':
+			count = strtol(optarg, NULL, 10);
+			break;
+		case 'w':
+			window = strtol(optarg, NULL, 10);
+			break;
+		case 'h':
+		default:
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (count <= 0 || window <= 0) {
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	sent = (struct timeval *)malloc(count * sizeof(struct timeval));
+
+	if (!sent)
+		return 1;
+
+	snprintf(run_id, sizeof(run_id), "%ld", (long)getpid());
+
+	if (haggle_handle_get("ipcbench subscriber", &sub) != HAGGLE_NO_ERROR) {
+		fprintf(stderr, "Could not get subscriber handle\n");
+		goto out_sent;
+	}
+
+	if (haggle_handle_get("ipcbench publisher", &pub) != HAGGLE_NO_ERROR) {
+		fprintf(stderr, "Could not get publisher handle\n");
+		goto out_sub;
+	}
+
+	haggle_ipc_register_event_interest(sub, LIBHAGGLE_EVENT_NEW_DATAOBJECT, on_dataobject);
+
+	if (haggle_event_loop_run_async(sub) != HAGGLE_NO_ERROR) {
+		fprintf(stderr, "Could not start event loop\n");
+		goto out_pub;
+	}
+
+	haggle_ipc_add_application_interest(sub, "ipcbench", run_id);
+
+	// Give the daemon time to register the interest
+	sleep(1);
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < count; i++) {
+		if (!wait_for_received(i, window - 1)) {
+			fprintf(stderr, "Timeout after %ld data objects\n", i);
+			break;
+		}
+		if (publish(pub, i) < 0) {
+			fprintf(stderr, "Could not publish data object %ld\n", i);
+			break;
+		}
+	}
+
+	if (!wait_for_received(i, 0))
+		fprintf(stderr, "Timeout waiting for the last data objects\n");
+
+	pthread_mutex_lock(&mutex);
+
+	elapsed = timeval_diff_ms(&start, &last_received);
+
+	printf("Published:  %ld data objects, window %ld\n", i, window);
+	printf("Received:   %ld data objects\n", num_received);
+
+	if (num_received > 0) {
+		printf("Latency:    min %.3lf ms, avg %.3lf ms, max %.3lf ms\n",
+		       min_latency, sum_latency / num_received, max_latency);
+		printf("Throughput: %.1lf data objects/s\n", num_received * 1000.0 / elapsed);
+		ret = (num_received == count) ? 0 : 1;
+	}
+
+	pthread_mutex_unlock(&mutex);
+
+	haggle_event_loop_stop(sub);
+out_pub:
+	haggle_handle_free(pub);
+out_sub:
+	haggle_handle_free(sub);
+out_sent:
+	free(sent);
+
+	return ret;
+}
@@ -23,14 +23,18 @@
 #include <openssl/sha.h>
 
 struct bloomfilter *bloomfilter_new(double error_rate, unsigned int capacity)
+{
+	return bloomfilter_new_version(error_rate, capacity, BLOOMFILTER_VERSION_DEFAULT);
+}
+
+struct bloomfilter *bloomfilter_new_version(double error_rate, unsigned int capacity, unsigned int version)
 {
 	struct bloomfilter *bf;
-	unsigned int m, k, i;
+	unsigned int m, k;
 	unsigned long bflen;
-	salt_t *salts;
-	struct timeval tv;
 
-	bloomfilter_calculate_length(capacity, error_rate, &m, &k);
+	if (bloomfilter_calculate_version_length(capacity, error_rate, version, &m, &k) < 0)
+		return NULL;
 
 	bflen = sizeof(struct bloomfilter) + (k * SALT_SIZE + m / VALUES_PER_BIN * BIN_SIZE);
 
@@ -45,7 +49,24 @@ struct bloomfilter *bloomfilter_new(double error_rate, unsigned int capacity)
 	bf->k = k;
 	bf->n = 0;
 	
-	salts = BLOOMFILTER_GET_SALTS(bf);
+	bloomfilter_init_salts(BLOOMFILTER_GET_SALTS(bf), k, version);
+
+	return bf;
+}
+
+void bloomfilter_init_salts(salt_t *salts, unsigned int k, unsigned int version)
+{
+	unsigned int i;
+	struct timeval tv;
+
+	if (version != BLOOMFILTER_VERSION_SALTED_SHA1) {
+		/* Only the first salt is used, to hold the version */
+		for (i = 0; i < k; i++)
+			salts[i] = 0;
+		
+		salts[0] = BLOOMFILTER_VERSION_FLAG | version;
+		return;
+	}
 
 	// Seed the rand() function's state. rand() should probably be replaced
 	// by prng_uint8() or prnguint32(), but I don't know if there would be any
@@ -57,7 +78,6 @@ struct bloomfilter *bloomfilter_new(double error_rate, unsigned int capacity)
 	for (i = 0; i < k; i++) {
 		salts[i] = (salt_t)rand();
 	}	
-	return bf;
 }
 
 struct bloomfilter *bloomfilter_copy(const struct bloomfilter *bf)
@@ -215,62 +235,146 @@ struct bloomfilter *base64_to_bloomfilter(const char *b64str, const size_t b64le
 	return bf_net;
 }
 
-int bloomfilter_operation(struct bloomfilter *bf, const char *key, 
-			  const unsigned int len, unsigned int op)
+static inline u_int32_t rotl32(u_int32_t x, unsigned int r)
 {
-	unsigned char *buf;
+	return (x << r) | (x >> (32 - r));
+}
+
+/* The MurmurHash3 finalizer, which makes every bit of h affect every bit of the result */
+static inline u_int32_t fmix32(u_int32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+/* Maps a 32-bit hash value evenly onto [0, n) without a division */
+static inline u_int32_t reduce32(u_int32_t hash, u_int32_t n)
+{
+	return (u_int32_t)(((unsigned long long)hash * n) >> 32);
+}
+
+/*
+	Returns -1 if the filter's version is unknown or its length does not
+	fit the version, and 0 otherwise.
+*/
+int bloomfilter_key_init(struct bloomfilter_key *bk, const salt_t *salts, unsigned int k, u_int32_t m,
+			 const char *key, const unsigned int len)
+{
+	const unsigned char *p = (const unsigned char *)key;
+	u_int32_t h = len;
 	unsigned int i;
-	int res = 1;
-	salt_t *salts;
 
-	if (!bf || !key)
+	bk->key = key;
+	bk->len = len;
+	bk->salts = salts;
+	bk->m = m;
+	bk->version = bloomfilter_salts_version(salts, k);
+	bk->h1 = bk->h2 = 0;
+
+	if (m == 0 || bk->version > BLOOMFILTER_VERSION_MAX)
 		return -1;
 
-	if (op >= BF_OP_MAX) {
+	if (bk->version == BLOOMFILTER_VERSION_BLOCKED && m % BLOOMFILTER_BLOCK_BITS != 0)
 		return -1;
+
+	if (bk->version == BLOOMFILTER_VERSION_SALTED_SHA1)
+		return 0;
+
+	/*
+		The keys are mostly data object ids, which are SHA-1 digests
+		already, so a simple and fast hash is enough. The key is read
+		as little endian words, so that all nodes compute the same
+		bins regardless of their byte order.
+	*/
+	for (i = 0; i + 4 <= len; i += 4) {
+		u_int32_t w = p[i] | (p[i + 1] << 8) | (p[i + 2] << 16) | ((u_int32_t)p[i + 3] << 24);
+
+		w *= 0xcc9e2d51;
+		w = rotl32(w, 15);
+		w *= 0x1b873593;
+		h ^= w;
+		h = rotl32(h, 13);
+		h = h * 5 + 0xe6546b64;
 	}
 
-	buf = malloc(len + SALTS_LEN(bf));
-	
-	if (!buf)
-		return -1;
-	
-	memcpy(buf, key, len);
-	
-	salts = BLOOMFILTER_GET_SALTS(bf);
+	for (; i < len; i++) {
+		h ^= p[i];
+		h *= 0x01000193;
+	}
 
-	for (i = 0; i < bf->k; i++) {
+	bk->h1 = fmix32(h);
+	bk->h2 = fmix32(bk->h1 ^ 0x9e3779b9);
+
+	return 0;
+}
+
+u_int32_t bloomfilter_key_index(const struct bloomfilter_key *bk, unsigned int i)
+{
+	switch (bk->version) {
+	case BLOOMFILTER_VERSION_SALTED_SHA1:
+	{
 		SHA_CTX ctxt;
-		unsigned int md[SHA_DIGEST_LENGTH];
-		unsigned int hash = 0;
-		int j, index;
+		u_int32_t md[SHA_DIGEST_LENGTH / sizeof(u_int32_t)];
+		u_int32_t hash = 0;
+		unsigned int j;
 		
 		/* Salt the input */
-		memcpy(buf + len, salts + i, SALT_SIZE);
-
 		SHA1_Init(&ctxt);
-		SHA1_Update(&ctxt, buf, len + SALT_SIZE);
+		SHA1_Update(&ctxt, bk->key, bk->len);
+		SHA1_Update(&ctxt, bk->salts + i, SALT_SIZE);
 		SHA1_Final((unsigned char *)md, &ctxt);
 				
-		for (j = 0; j < 5; j++) {
+		for (j = 0; j < SHA_DIGEST_LENGTH / sizeof(u_int32_t); j++) {
 			hash = hash ^ md[j];			
 		}
-		
-		/* Maybe there is a more efficient way to set the
-		   correct bits? */
-		index = hash % bf->m;
+		return hash % bk->m;
+	}
+	case BLOOMFILTER_VERSION_DOUBLE_HASH:
+		return reduce32(bk->h1 + i * bk->h2, bk->m);
+	case BLOOMFILTER_VERSION_BLOCKED:
+	default:
+		/* The block is picked by the first hash, the bins within it by the second */
+		return reduce32(bk->h1, bk->m / BLOOMFILTER_BLOCK_BITS) * BLOOMFILTER_BLOCK_BITS + 
+			reduce32(bk->h2 + i * rotl32(bk->h2, 16), BLOOMFILTER_BLOCK_BITS);
+	}
+}
+
+int bloomfilter_operation(struct bloomfilter *bf, const char *key, 
+			  const unsigned int len, unsigned int op)
+{
+	struct bloomfilter_key bk;
+	bin_t *bins;
+	unsigned int i;
+
+	if (!bf || !key)
+		return -1;
+
+	if (op >= BF_OP_MAX) {
+		return -1;
+	}
+
+	if (bloomfilter_key_init(&bk, BLOOMFILTER_GET_SALTS(bf), bf->k, bf->m, key, len) < 0)
+		return -1;
+
+	bins = BLOOMFILTER_GET_FILTER(bf);
+
+	for (i = 0; i < bf->k; i++) {
+		u_int32_t index = bloomfilter_key_index(&bk, i);
 
 		//printf("index%d=%u\n", i, index);
 
 		switch (op) {
 		case BF_OP_CHECK:
-			if (!(BLOOMFILTER_GET_FILTER(bf)[index/VALUES_PER_BIN] & (1 << (index % VALUES_PER_BIN)))) {
-				res = 0;
-				goto out;
-			}
+			if (!(bins[index/VALUES_PER_BIN] & (1 << (index % VALUES_PER_BIN))))
+				return 0;
 			break;
 		case BF_OP_ADD:
-			BLOOMFILTER_GET_FILTER(bf)[index/VALUES_PER_BIN] |= (1 << (index % VALUES_PER_BIN));
+			bins[index/VALUES_PER_BIN] |= (1 << (index % VALUES_PER_BIN));
 			break;
 		default:
 			fprintf(stderr, "Unknown Bloomfilter operation\n");
@@ -280,11 +384,8 @@ int bloomfilter_operation(struct bloomfilter *bf, const char *key,
 	/* Increment or decrement the number of objects in the filter depending on operation */
 	if (op == BF_OP_ADD)
 		bf->n++;
-	
-out:
-	free(buf);
 
-	return res;
+	return 1;
 }
 
 int bloomfilter_merge(struct bloomfilter *bf, const struct bloomfilter *bf_merge)
@@ -352,6 +453,29 @@ int bloomfilter_calculate_length(unsigned int num_keys, double error_rate,
 	return 0;
 }
 
+int bloomfilter_calculate_version_length(unsigned int num_keys, double error_rate, unsigned int version,
+					 unsigned int *lowest_m, unsigned int *best_k)
+{
+	if (version > BLOOMFILTER_VERSION_MAX)
+		return -1;
+
+	bloomfilter_calculate_length(num_keys, error_rate, lowest_m, best_k);
+
+	/* 
+	   Blocked filters consist of whole blocks. Keys fill the blocks
+	   unevenly, so they need a few more bins than other filters for the
+	   same error rate. Half a bin per key is enough for error rates
+	   around one percent.
+	*/
+	if (version == BLOOMFILTER_VERSION_BLOCKED) {
+		*lowest_m += num_keys / 2;
+
+		if (*lowest_m % BLOOMFILTER_BLOCK_BITS != 0)
+			*lowest_m += BLOOMFILTER_BLOCK_BITS - (*lowest_m % BLOOMFILTER_BLOCK_BITS);
+	}
+	return 0;
+}
+
 #ifdef BLOOMFILTER_MAIN
 
 int main(int argc, char **argv)
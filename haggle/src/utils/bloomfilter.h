@@ -63,6 +63,48 @@ typedef unsigned char bin_t;
 #define BLOOMFILTER_GET_SALTS(bf) ((salt_t *)((unsigned char *)(bf) + sizeof(struct bloomfilter)))
 #define BLOOMFILTER_GET_FILTER(bf) ((bin_t *)((unsigned char *)(bf) + sizeof(struct bloomfilter) + SALTS_LEN(bf)))
 
+/*
+	Bloomfilter versions, i.e., how keys are mapped to bins.
+
+	Version 0 filters hash the key once per hash function, salted with
+	one of the k salts, using SHA-1. Later versions hash the key once
+	and derive all k bins from two 32-bit hash values (double hashing).
+	Blocked filters put all k bins of a key in the same block of
+	BLOOMFILTER_BLOCK_BITS bins. The blocks follow the header and salts,
+	so they are not aligned to cache lines, and a key may span two.
+
+	The version is stored in the first salt, with the top bit set. The
+	salts of version 0 filters come from rand(), which never sets the top
+	bit, so filters created before versions existed are still read as
+	version 0. The layout of the filter is the same for all versions.
+
+	Nodes that predate versions read every filter as version 0, so new
+	filters are version 0 unless another version is asked for.
+*/
+#define BLOOMFILTER_VERSION_SALTED_SHA1 0
+#define BLOOMFILTER_VERSION_DOUBLE_HASH 1
+#define BLOOMFILTER_VERSION_BLOCKED 2
+#define BLOOMFILTER_VERSION_MAX BLOOMFILTER_VERSION_BLOCKED
+#define BLOOMFILTER_VERSION_DEFAULT BLOOMFILTER_VERSION_SALTED_SHA1
+
+#define BLOOMFILTER_VERSION_FLAG 0x80000000
+#define BLOOMFILTER_BLOCK_BITS 512
+
+#define BLOOMFILTER_GET_VERSION(bf) bloomfilter_salts_version(BLOOMFILTER_GET_SALTS(bf), (bf)->k)
+
+/*
+	The hash state of a key, which is computed once per operation and then
+	gives the index of each of the k bins.
+*/
+struct bloomfilter_key {
+	const char *key;
+	unsigned int len;
+	const salt_t *salts;
+	u_int32_t m;
+	u_int32_t version;
+	u_int32_t h1, h2;
+};
+
 enum bf_op {
 	bf_op_check,
 #define BF_OP_CHECK   bf_op_check
@@ -79,8 +121,23 @@ enum bf_op {
 
 int bloomfilter_calculate_length(unsigned int num_keys, double error_rate, 
 				 unsigned int *lowest_m, unsigned int *best_k);
+int bloomfilter_calculate_version_length(unsigned int num_keys, double error_rate, unsigned int version,
+					 unsigned int *lowest_m, unsigned int *best_k);
+void bloomfilter_init_salts(salt_t *salts, unsigned int k, unsigned int version);
+int bloomfilter_key_init(struct bloomfilter_key *bk, const salt_t *salts, unsigned int k, u_int32_t m,
+			 const char *key, const unsigned int len);
+u_int32_t bloomfilter_key_index(const struct bloomfilter_key *bk, unsigned int i);
+
+static inline unsigned int bloomfilter_salts_version(const salt_t *salts, unsigned int k)
+{
+	if (k == 0 || !(salts[0] & BLOOMFILTER_VERSION_FLAG))
+		return BLOOMFILTER_VERSION_SALTED_SHA1;
+
+	return salts[0] & ~BLOOMFILTER_VERSION_FLAG;
+}
 
 struct bloomfilter *bloomfilter_new(double error_rate, unsigned int capacity);
+struct bloomfilter *bloomfilter_new_version(double error_rate, unsigned int capacity, unsigned int version);
 int bloomfilter_operation(struct bloomfilter *bf, const char *key, const unsigned int len, unsigned int op);
 void bloomfilter_free(struct bloomfilter *bf);
 struct bloomfilter *bloomfilter_copy(const struct bloomfilter *bf);
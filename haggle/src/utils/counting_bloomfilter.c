@@ -20,18 +20,21 @@
 #include "utils.h"
 #include "base64.h"
 #include "counting_bloomfilter.h"
-#include <openssl/sha.h>
 #include "bloomfilter.h"
 
 struct counting_bloomfilter *counting_bloomfilter_new(double error_rate, unsigned int capacity)
+{
+	return counting_bloomfilter_new_version(error_rate, capacity, BLOOMFILTER_VERSION_DEFAULT);
+}
+
+struct counting_bloomfilter *counting_bloomfilter_new_version(double error_rate, unsigned int capacity, unsigned int version)
 {
 	struct counting_bloomfilter *bf;
-	unsigned int m, k, i;
+	unsigned int m, k;
 	unsigned long bflen;
-	counting_salt_t *salts;
-	struct timeval tv;
 
-	bloomfilter_calculate_length(capacity, error_rate, &m, &k);
+	if (bloomfilter_calculate_version_length(capacity, error_rate, version, &m, &k) < 0)
+		return NULL;
 
 	bflen = sizeof(struct counting_bloomfilter) + (k * COUNTING_SALT_SIZE + m / COUNTING_VALUES_PER_BIN * COUNTING_BIN_SIZE);
 
@@ -46,18 +49,9 @@ struct counting_bloomfilter *counting_bloomfilter_new(double error_rate, unsigne
 	bf->k = k;
 	bf->n = 0;
 	
-	salts = COUNTING_BLOOMFILTER_GET_SALTS(bf);
+	/* The salts are the same for counting and non-counting filters */
+	bloomfilter_init_salts(COUNTING_BLOOMFILTER_GET_SALTS(bf), k, version);
 
-	// Seed the rand() function's state. rand() should probably be replaced
-	// by prng_uint8() or prnguint32(), but I don't know if there would be any
-	// bad effects of doing that.
-	gettimeofday(&tv, NULL);
-	srand(tv.tv_usec);
-	
-	/* Create salts for hash functions */
-	for (i = 0; i < k; i++) {
-		salts[i] = (counting_salt_t)rand();
-	}	
 	return bf;
 }
 
@@ -300,11 +294,10 @@ struct counting_bloomfilter *base64_to_counting_bloomfilter(const char *b64str,
 int counting_bloomfilter_operation(struct counting_bloomfilter *bf, const char *key, 
 			  const unsigned int len, unsigned int op)
 {
-	unsigned char *buf;
+	struct bloomfilter_key bk;
+	counting_bin_t *bins;
 	unsigned int i;
 	unsigned short removed = 0;
-	int res = 1;
-	counting_salt_t *salts;
 
 	if (!bf || !key)
 		return -1;
@@ -313,55 +306,27 @@ int counting_bloomfilter_operation(struct counting_bloomfilter *bf, const char *
 		return -1;
 	}
 
-	buf = malloc(len + CB_SALTS_LEN(bf));
-	
-	if (!buf)
+	if (bloomfilter_key_init(&bk, COUNTING_BLOOMFILTER_GET_SALTS(bf), bf->k, bf->m, key, len) < 0)
 		return -1;
-	
-	memcpy(buf, key, len);
-	
-	salts = COUNTING_BLOOMFILTER_GET_SALTS(bf);
 
-	/* Increment number of objects in filter */
-	if (op == COUNTING_BF_OP_ADD)
-		bf->n++;
+	bins = COUNTING_BLOOMFILTER_GET_FILTER(bf);
 
 	for (i = 0; i < bf->k; i++) {
-		SHA_CTX ctxt;
-		unsigned int md[SHA_DIGEST_LENGTH];
-		unsigned int hash = 0;
-		int j, index;
-		
-		/* Salt the input */
-		memcpy(buf + len, salts + i, COUNTING_SALT_SIZE);
-
-		SHA1_Init(&ctxt);
-		SHA1_Update(&ctxt, buf, len + COUNTING_SALT_SIZE);
-		SHA1_Final((unsigned char *)md, &ctxt);
-				
-		for (j = 0; j < 5; j++) {
-			hash = hash ^ md[j];			
-		}
-		
-		/* Maybe there is a more efficient way to set the
-		   correct bits? */
-		index = hash % bf->m;
+		u_int32_t index = bloomfilter_key_index(&bk, i);
 
 		//printf("index%d=%u\n", i, index);
 
 		switch(op) {
 		case COUNTING_BF_OP_CHECK:
-			if (COUNTING_BLOOMFILTER_GET_FILTER(bf)[index] == 0) {
-				res = 0;
-				goto out;
-			}
+			if (bins[index] == 0)
+				return 0;
 			break;
 		case COUNTING_BF_OP_ADD:
-			COUNTING_BLOOMFILTER_GET_FILTER(bf)[index]++;
+			bins[index]++;
 			break;
 		case COUNTING_BF_OP_REMOVE:
-			if (COUNTING_BLOOMFILTER_GET_FILTER(bf)[index] > 0) {
-				COUNTING_BLOOMFILTER_GET_FILTER(bf)[index]--;
+			if (bins[index] > 0) {
+				bins[index]--;
 				removed++;
 			}
 			
@@ -381,10 +346,7 @@ int counting_bloomfilter_operation(struct counting_bloomfilter *bf, const char *
 	else if (op == COUNTING_BF_OP_REMOVE && removed > 0)
 		bf->n--;
 	
-out:
-	free(buf);
-
-	return res;
+	return 1;
 }
 
 void counting_bloomfilter_free(struct counting_bloomfilter *bf)
@@ -372,14 +372,17 @@ void swap_6bytes(void* to, const void *from)
 		d[i] = s[5-i];
 }
 
-/* Hmm, this function does not check the size of str, which is a
- * potential buffer overflow when sprintf null-terminates... -Erik */
+/* The string must have room for 2*len+1 characters. Identifiers are
+ * converted often, so use a table instead of sprintf(). */
 void buf2str(const char* buf, char* str, int len)
 {
-	int i, n = 0;
+	static const char hex[] = "0123456789abcdef";
+	int i;
 	
-	for (i=0; i<len; i++)
-		n += sprintf(str+n, "%02x", buf[i] & 0xff);
+	for (i=0; i<len; i++) {
+		str[2*i] = hex[(buf[i] >> 4) & 0x0f];
+		str[2*i+1] = hex[buf[i] & 0x0f];
+	}
 	str[len*2] = '\0';
 }
 
@@ -82,6 +82,7 @@ double absolute_time_double(double _offset);
 char *ip_to_str(struct in_addr addr);
 char *eth_to_str(unsigned char *addr);
 void swap_6bytes(void* to, const void *from);
+/* Converts len bytes to lowercase hex, str must hold 2*len+1 characters */
 void buf2str(const char* buf, char* str, int len);
 void str2buf(const char* str, char* buf, int len);
 unsigned short in_cksum(const unsigned short *addr, register int len, unsigned short csum);
@@ -0,0 +1,179 @@
+/* Copyright 2008 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "testhlp.h"
+#include "Bloomfilter.h"
+#include "Metadata.h"
+
+using namespace haggle;
+
+/*
+	This program tests that the bloomfilter changes sent to neighbors
+	turn the filter they already have into the filter we have now.
+*/
+
+#define BASE_ID "daadcadb0a73b3e23280628ab476d441e9bcc345"
+
+static void add_keys(Bloomfilter *bf, unsigned int from, unsigned int to)
+{
+	for (unsigned int i = from; i < to; i++)
+		bf->add((const unsigned char *)&i, sizeof(i));
+}
+
+static bool has_keys(const Bloomfilter *bf, unsigned int from, unsigned int to)
+{
+	for (unsigned int i = from; i < to; i++)
+		if (!bf->has((const unsigned char *)&i, sizeof(i)))
+			return false;
+	return true;
+}
+
+static bool same_filter(const Bloomfilter *a, const Bloomfilter *b)
+{
+	Metadata *ma = a->toMetadata();
+	Metadata *mb = b->toMetadata();
+	bool same = ma && mb && ma->getContent() == mb->getContent();
+
+	delete ma;
+	delete mb;
+
+	return same;
+}
+
+static bool test_roundtrip()
+{
+	Bloomfilter *base = Bloomfilter::create(Bloomfilter::TYPE_NORMAL);
+	Bloomfilter *current = Bloomfilter::create(Bloomfilter::TYPE_NORMAL);
+	Bloomfilter *received = NULL;
+	Metadata *delta = NULL, *full = NULL;
+	bool success = false;
+
+	// Some data objects are removed and some are added
+	add_keys(base, 0, 100);
+	add_keys(current, 10, 120);
+
+	delta = current->toDeltaMetadata(*base, BASE_ID);
+	full = current->toMetadata();
+
+	if (!delta || !full || !Bloomfilter::isDeltaMetadata(*delta) || Bloomfilter::isDeltaMetadata(*full))
+		goto out;
+
+	if (delta->getContent().length() >= full->getContent().length())
+		goto out;
+
+	received = Bloomfilter::create(*base);
+
+	if (!received->applyDeltaMetadata(*delta))
+		goto out;
+
+	success = same_filter(received, current) && received->numObjects() == current->numObjects();
+out:
+	delete received;
+	delete delta;
+	delete full;
+	delete base;
+	delete current;
+
+	return success;
+}
+
+static bool test_set_only()
+{
+	Bloomfilter *base = Bloomfilter::create(Bloomfilter::TYPE_NORMAL);
+	Bloomfilter *current = Bloomfilter::create(Bloomfilter::TYPE_NORMAL);
+	Bloomfilter *other = Bloomfilter::create(Bloomfilter::TYPE_NORMAL);
+	Metadata *delta;
+	bool success = false;
+
+	add_keys(base, 0, 100);
+	add_keys(current, 10, 120);
+	add_keys(other, 0, 100);
+	add_keys(other, 200, 250);
+
+	delta = current->toDeltaMetadata(*base, BASE_ID);
+
+	// Applied to a filter it was not made for, nothing may be cleared
+	if (delta && other->applyDeltaMetadata(*delta, true))
+		success = has_keys(other, 200, 250) && has_keys(other, 0, 120);
+
+	delete delta;
+	delete base;
+	delete current;
+	delete other;
+
+	return success;
+}
+
+static bool test_mismatch()
+{
+	Bloomfilter *base = Bloomfilter::create(Bloomfilter::TYPE_NORMAL, 0.01, 1000);
+	Bloomfilter *current = Bloomfilter::create(Bloomfilter::TYPE_NORMAL, 0.01, 2000);
+	Bloomfilter *counting = Bloomfilter::create(Bloomfilter::TYPE_COUNTING, 0.01, 1000);
+	Metadata *full;
+	bool success = true;
+
+	// No delta between filters of different sizes or types
+	success &= (current->toDeltaMetadata(*base, BASE_ID) == NULL);
+	success &= (counting->toDeltaMetadata(*base, BASE_ID) == NULL);
+
+	// A full filter is not a delta
+	full = base->toMetadata();
+	success &= (full && !base->applyDeltaMetadata(*full));
+
+	delete full;
+	delete base;
+	delete current;
+	delete counting;
+
+	return success;
+}
+
+#if defined(OS_WINDOWS)
+int haggle_test_bloomfilterDelta(void)
+#else
+int main(int argc, char *argv[])
+#endif
+{
+	bool success = true, tmp_succ;
+
+	// Disable tracing
+	trace_disable(true);
+
+	print_over_test_str_nl(0, "Bloomfilter delta test: ");
+
+	try {
+		print_over_test_str(1, "Delta applied to its base: ");
+		tmp_succ = test_roundtrip();
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Delta applied to another filter: ");
+		tmp_succ = test_set_only();
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Filters without delta: ");
+		tmp_succ = test_mismatch();
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Total: ");
+
+		return (success ? 0 : 1);
+	} catch(Exception &) {
+		printf("**CRASH** ");
+		return 1;
+	}
+}
@@ -0,0 +1,241 @@
+/* Copyright 2008 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "testhlp.h"
+#include "Bloomfilter.h"
+#include "Metadata.h"
+
+using namespace haggle;
+
+/*
+	This program tests that bloomfilters grow sub-filters when they are
+	full, so that the false positive rate stays low, and that the
+	sub-filters survive copies, conversions and serialization.
+*/
+
+#define ERROR_RATE 0.01
+#define CAPACITY 500
+#define NUM_KEYS (CAPACITY * 10)
+#define NUM_CHECKS 20000
+
+static void add_keys(Bloomfilter *bf, unsigned int from, unsigned int to)
+{
+	for (unsigned int i = from; i < to; i++)
+		bf->add((const unsigned char *)&i, sizeof(i));
+}
+
+static bool has_keys(const Bloomfilter *bf, unsigned int from, unsigned int to)
+{
+	for (unsigned int i = from; i < to; i++)
+		if (!bf->has((const unsigned char *)&i, sizeof(i)))
+			return false;
+	return true;
+}
+
+static unsigned int count_keys(const Bloomfilter *bf, unsigned int from, unsigned int to)
+{
+	unsigned int num = 0;
+
+	for (unsigned int i = from; i < to; i++)
+		if (bf->has((const unsigned char *)&i, sizeof(i)))
+			num++;
+	return num;
+}
+
+static bool test_growth()
+{
+	Bloomfilter *bf = Bloomfilter::create(Bloomfilter::TYPE_NORMAL, ERROR_RATE, CAPACITY);
+	bool success = true;
+	unsigned int fp;
+
+	add_keys(bf, 0, NUM_KEYS);
+
+	// 500 + 1000 + 2000 + 4000 > 10 * 500
+	success &= (bf->numFilters() == 4);
+	success &= (bf->numObjects() == NUM_KEYS);
+	success &= has_keys(bf, 0, NUM_KEYS);
+
+	// Keys that were never added
+	fp = count_keys(bf, NUM_KEYS, NUM_KEYS + NUM_CHECKS);
+	success &= (fp < NUM_CHECKS * ERROR_RATE / (1 - BLOOMFILTER_SCALE_TIGHTENING));
+
+	delete bf;
+
+	return success;
+}
+
+static bool test_max_filters()
+{
+	Bloomfilter *bf;
+	bool success = true;
+
+	Bloomfilter::setMaxFilters(1);
+	bf = Bloomfilter::create(Bloomfilter::TYPE_NORMAL, ERROR_RATE, CAPACITY);
+	add_keys(bf, 0, NUM_KEYS);
+	success &= (bf->numFilters() == 1);
+	success &= has_keys(bf, 0, NUM_KEYS);
+	delete bf;
+
+	Bloomfilter::setMaxFilters(DEFAULT_BLOOMFILTER_MAX_FILTERS);
+
+	return success;
+}
+
+static bool test_counting()
+{
+	Bloomfilter *cbf = Bloomfilter::create(Bloomfilter::TYPE_COUNTING, ERROR_RATE, CAPACITY);
+	Bloomfilter *bf;
+	bool success = true;
+
+	add_keys(cbf, 0, NUM_KEYS);
+	success &= (cbf->numFilters() == 4);
+
+	// Remove the keys from the first and the last sub-filter
+	for (unsigned int i = 0; i < CAPACITY; i++)
+		cbf->remove((const unsigned char *)&i, sizeof(i));
+	for (unsigned int i = NUM_KEYS - CAPACITY; i < NUM_KEYS; i++)
+		cbf->remove((const unsigned char *)&i, sizeof(i));
+
+	// Keys that are also in another sub-filter by chance stay in the filter
+	success &= (cbf->numObjects() >= NUM_KEYS - 2 * CAPACITY);
+	success &= has_keys(cbf, CAPACITY, NUM_KEYS - CAPACITY);
+	success &= (count_keys(cbf, 0, CAPACITY) < CAPACITY * ERROR_RATE * 2);
+	success &= (count_keys(cbf, NUM_KEYS - CAPACITY, NUM_KEYS) < CAPACITY * ERROR_RATE * 2);
+
+	bf = cbf->to_noncounting();
+	success &= (bf && bf->numFilters() == cbf->numFilters());
+	success &= (bf && has_keys(bf, CAPACITY, NUM_KEYS - CAPACITY));
+
+	delete bf;
+	delete cbf;
+
+	return success;
+}
+
+static bool test_raw()
+{
+	Bloomfilter *cbf = Bloomfilter::create(Bloomfilter::TYPE_COUNTING, ERROR_RATE, CAPACITY);
+	Bloomfilter *bf = Bloomfilter::create(Bloomfilter::TYPE_NORMAL, ERROR_RATE, CAPACITY);
+	Bloomfilter *copy;
+	bool success = true;
+
+	add_keys(cbf, 0, NUM_KEYS);
+	add_keys(bf, 0, NUM_KEYS);
+
+	// As stored in the data store's repository
+	copy = Bloomfilter::create(cbf->getRaw(), cbf->getRawLen());
+	success &= (copy && copy->getType() == Bloomfilter::TYPE_COUNTING);
+	success &= (copy && copy->numFilters() == cbf->numFilters() && copy->numObjects() == NUM_KEYS);
+	success &= (copy && has_keys(copy, 0, NUM_KEYS));
+	delete copy;
+
+	// As stored with the nodes in the data store
+	copy = Bloomfilter::create(Bloomfilter::TYPE_NORMAL);
+	success &= copy->setRaw(bf->getRaw(), bf->getRawLen());
+	success &= (copy->numFilters() == bf->numFilters() && copy->numObjects() == NUM_KEYS);
+	success &= has_keys(copy, 0, NUM_KEYS);
+	success &= !copy->setRaw(cbf->getRaw(), cbf->getRawLen());
+	delete copy;
+
+	delete bf;
+	delete cbf;
+
+	return success;
+}
+
+static bool test_metadata()
+{
+	Bloomfilter *bf = Bloomfilter::create(Bloomfilter::TYPE_NORMAL, ERROR_RATE, CAPACITY);
+	Bloomfilter *copy = NULL;
+	bool success = true;
+
+	add_keys(bf, 0, NUM_KEYS);
+
+	// As in node descriptions, with one metadata per sub-filter
+	for (const Bloomfilter *sub = bf; sub; sub = sub->getNext()) {
+		Metadata *m = sub->toMetadata();
+
+		if (!m) {
+			success = false;
+			break;
+		}
+
+		if (copy)
+			success &= copy->append(Bloomfilter::fromMetadata(*m));
+		else
+			copy = Bloomfilter::fromMetadata(*m);
+
+		delete m;
+	}
+
+	success &= (copy && copy->numFilters() == bf->numFilters() && copy->numObjects() == NUM_KEYS);
+	success &= (copy && has_keys(copy, 0, NUM_KEYS));
+
+	// A bloomfilter with sub-filters has no delta
+	success &= (copy && bf->toDeltaMetadata(*copy, "base") == NULL);
+
+	delete copy;
+	delete bf;
+
+	return success;
+}
+
+#if defined(OS_WINDOWS)
+int haggle_test_bloomfilterScaling(void)
+#else
+int main(int argc, char *argv[])
+#endif
+{
+	bool success = true, tmp_succ;
+
+	// Disable tracing
+	trace_disable(true);
+
+	print_over_test_str_nl(0, "Bloomfilter scaling test: ");
+
+	try {
+		print_over_test_str(1, "Growing sub-filters: ");
+		tmp_succ = test_growth();
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Fixed capacity: ");
+		tmp_succ = test_max_filters();
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Counting sub-filters: ");
+		tmp_succ = test_counting();
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Raw sub-filters: ");
+		tmp_succ = test_raw();
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Sub-filter metadata: ");
+		tmp_succ = test_metadata();
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Total: ");
+
+		return (success ? 0 : 1);
+	} catch(Exception &) {
+		printf("**CRASH** ");
+		return 1;
+	}
+}
@@ -0,0 +1,120 @@
+/* Copyright 2008 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "testhlp.h"
+#include "DataObject.h"
+#include "utils.h"
+#include <haggleutils.h>
+
+using namespace haggle;
+
+/*
+	This program tests that data object identifiers follow changes to
+	the attributes and create time of data objects, and that they are
+	the same as those calculated by other nodes.
+*/
+
+#define CREATE_TIME "1234567890.123456"
+#define HEADER "<Haggle persistent=\"no\" create_time=\"" CREATE_TIME "\">" \
+	"<Attr name=\"a\">b</Attr><Attr name=\"c\" weight=\"3\">d</Attr></Haggle>"
+/*
+	The SHA1 hash of each attribute name, value and weight (as a 32-bit
+	integer in network byte order), in the order of the attribute
+	container (here "c" before "a"), followed by the create time.
+*/
+#define HEADER_ID "d4048bfd90adfbf2f73e725ac66c5dc1ac939d15"
+
+static bool test_known_id()
+{
+	DataObjectRef dObj = DataObject::create((const unsigned char *)HEADER, strlen(HEADER));
+	char idStr[MAX_DATAOBJECT_ID_STR_LEN];
+
+	if (!dObj)
+		return false;
+
+	buf2str((const char *)dObj->getId(), idStr, DATAOBJECT_ID_LEN);
+
+	return strcmp(dObj->getIdStr(), HEADER_ID) == 0 && strcmp(idStr, HEADER_ID) == 0;
+}
+
+static bool test_changes()
+{
+	DataObjectRef dObj = DataObject::create();
+	bool success = true;
+
+	if (!dObj)
+		return false;
+
+	// Attributes added in any order give the same id
+	dObj->addAttribute("c", "d", 3);
+	dObj->addAttribute("x", "y");
+	dObj->setCreateTime(Timeval(CREATE_TIME));
+	success &= (strcmp(dObj->getIdStr(), HEADER_ID) != 0);
+
+	dObj->addAttribute("a", "b");
+	dObj->removeAttribute("x", "y");
+	success &= (strcmp(dObj->getIdStr(), HEADER_ID) == 0);
+
+	// The id is read before and after a change
+	dObj->removeAttribute("a", "b");
+	success &= (strcmp(dObj->getIdStr(), HEADER_ID) != 0);
+	dObj->addAttribute("a", "b");
+	success &= (strcmp(dObj->getIdStr(), HEADER_ID) == 0);
+
+	// Copies get the id of the original, also when it is outdated
+	dObj->addAttribute("e", "f");
+
+	DataObjectRef dObjCopy = dObj->copy();
+
+	success &= (dObjCopy == dObj);
+	dObjCopy->removeAttribute("e", "f");
+	success &= (strcmp(dObjCopy->getIdStr(), HEADER_ID) == 0);
+	success &= !(dObjCopy == dObj);
+
+	return success;
+}
+
+#if defined(OS_WINDOWS)
+int haggle_test_dataObjectId(void)
+#else
+int main(int argc, char *argv[])
+#endif
+{
+	bool success = true, tmp_succ;
+
+	// Disable tracing
+	trace_disable(true);
+
+	print_over_test_str_nl(0, "Data object id test: ");
+
+	try {
+		print_over_test_str(1, "Id from metadata: ");
+		tmp_succ = test_known_id();
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Id after changes: ");
+		tmp_succ = test_changes();
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Total: ");
+
+		return (success ? 0 : 1);
+	} catch(Exception &) {
+		printf("**CRASH** ");
+		return 1;
+	}
+}
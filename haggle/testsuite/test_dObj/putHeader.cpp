@@ -0,0 +1,138 @@
+/* Copyright 2008 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "testhlp.h"
+#include "DataObject.h"
+#include "utils.h"
+#include <haggleutils.h>
+
+using namespace haggle;
+
+/*
+	This program tests that putData() finds the end of the metadata header
+	no matter how the header is split over calls, and that it does not
+	consume any bytes after the header.
+*/
+
+/*
+	Puts the buffer into a new data object in chunks of 'chunk' bytes,
+	and checks that the data object is complete exactly after 'hdrlen'
+	bytes.
+*/
+static bool put_header(const char *buf, size_t hdrlen, size_t chunk)
+{
+	DataObject *dObj = DataObject::create_for_putting();
+	size_t len = strlen(buf);
+	size_t i = 0, remaining = DATAOBJECT_METADATA_PENDING;
+	bool success = true;
+
+	if (!dObj)
+		return false;
+
+	while (i < len && remaining != 0) {
+		size_t n = (len - i < chunk) ? len - i : chunk;
+		ssize_t ret = dObj->putData((void *)(buf + i), n, &remaining);
+
+		if (ret < 0) {
+			success = false;
+			break;
+		}
+		i += ret;
+	}
+
+	success &= (remaining == 0 && i == hdrlen);
+
+	delete dObj;
+
+	return success;
+}
+
+static bool put_header_fails(const char *buf)
+{
+	DataObject *dObj = DataObject::create_for_putting();
+	size_t remaining;
+	bool success;
+
+	if (!dObj)
+		return false;
+
+	success = (dObj->putData((void *)buf, strlen(buf), &remaining) < 0);
+
+	delete dObj;
+
+	return success;
+}
+
+static bool put_header_all_chunks(const char *buf, size_t hdrlen)
+{
+	bool success = true;
+
+	for (size_t chunk = 1; chunk <= strlen(buf); chunk++)
+		success &= put_header(buf, hdrlen, chunk);
+
+	return success;
+}
+
+#define HEADER_1 "<Haggle></Haggle>"
+#define HEADER_2 "<Haggle persistent=\"no\"><Attr name=\"a\">b</Attr><Attr name=\"c\">d</Attr></Haggle>"
+#define HEADER_3 "<?xml version=\"1.0\"?>\n<!-- empty -->\n<Haggle persistent=\"no\"/>"
+#define HEADER_4 "<Haggle persistent=\"no\" />"
+
+#if defined(OS_WINDOWS)
+int haggle_test_putHeader(void)
+#else
+int main(int argc, char *argv[])
+#endif
+{
+	bool success = true, tmp_succ;
+
+	// Disable tracing
+	trace_disable(true);
+
+	print_over_test_str_nl(0, "putData header test: ");
+
+	try {
+		print_over_test_str(1, "End tag: ");
+		tmp_succ = put_header_all_chunks(HEADER_1, strlen(HEADER_1));
+		tmp_succ &= put_header_all_chunks(HEADER_2, strlen(HEADER_2));
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Self-closing root: ");
+		tmp_succ = put_header_all_chunks(HEADER_3, strlen(HEADER_3));
+		tmp_succ &= put_header_all_chunks(HEADER_4, strlen(HEADER_4));
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Bytes after header: ");
+		tmp_succ = put_header_all_chunks(HEADER_2 HEADER_1, strlen(HEADER_2));
+		tmp_succ &= put_header_all_chunks(HEADER_4 HEADER_2, strlen(HEADER_4));
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Unknown root: ");
+		tmp_succ = put_header_fails("<foo/>");
+		tmp_succ &= put_header_fails("<foo></foo></Haggle>");
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Total: ");
+
+		return (success ? 0 : 1);
+	} catch(Exception &) {
+		printf("**CRASH** ");
+		return 1;
+	}
+}
@@ -0,0 +1,145 @@
+/* Copyright 2008 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "testhlp.h"
+#include "DataObject.h"
+#include "utils.h"
+#include <haggleutils.h>
+#include <base64.h>
+
+using namespace haggle;
+
+/*
+	This program tests that the data of a data object is verified against
+	its data hash while it is put, and that the data is written correctly.
+*/
+
+#define PAYLOAD "abcdefghijklmnopqrstuvwxyz0123456789"
+
+/*
+	Puts a data object with the payload and the hash of 'hashed' into
+	a new data object, in chunks of 'chunk' bytes.
+*/
+static DataObject *put_data_object(const char *payload, const char *hashed, size_t chunk)
+{
+	DataObject *dObj = DataObject::create_for_putting(NULL, NULL, ".");
+	char buf[1024];
+	unsigned char digest[SHA_DIGEST_LENGTH];
+	char hash[BASE64_LENGTH(SHA_DIGEST_LENGTH) + 1];
+	size_t len, i = 0, remaining = DATAOBJECT_METADATA_PENDING;
+
+	if (!dObj)
+		return NULL;
+
+	SHA1((const unsigned char *)hashed, strlen(hashed), digest);
+	base64_encode((const char *)digest, SHA_DIGEST_LENGTH, hash, sizeof(hash));
+
+	len = sprintf(buf, "<Haggle persistent=\"no\"><Data data_len=\"%lu\">"
+		      "<FileName>putVerify.txt</FileName><FileHash>%s</FileHash>"
+		      "</Data></Haggle>%s", (unsigned long)strlen(payload), hash, payload);
+
+	while (i < len && remaining != 0) {
+		size_t n = (len - i < chunk) ? len - i : chunk;
+		ssize_t ret = dObj->putData(buf + i, n, &remaining);
+
+		if (ret < 0) {
+			delete dObj;
+			return NULL;
+		}
+		i += ret;
+	}
+
+	if (remaining != 0 || i != len) {
+		delete dObj;
+		return NULL;
+	}
+	return dObj;
+}
+
+static bool file_has_payload(DataObject *dObj, const char *payload)
+{
+	char buf[1024];
+	size_t len;
+	FILE *fp = fopen(dObj->getFilePath().c_str(), "rb");
+
+	if (!fp)
+		return false;
+
+	len = fread(buf, 1, sizeof(buf), fp);
+	fclose(fp);
+
+	return (len == strlen(payload) && memcmp(buf, payload, len) == 0);
+}
+
+#if defined(OS_WINDOWS)
+int haggle_test_putVerify(void)
+#else
+int main(int argc, char *argv[])
+#endif
+{
+	bool success = true, tmp_succ;
+	DataObject *dObj;
+
+	// Disable tracing
+	trace_disable(true);
+
+	print_over_test_str_nl(0, "putData verification test: ");
+
+	try {
+		print_over_test_str(1, "Good data hash: ");
+		tmp_succ = true;
+
+		for (size_t chunk = 1; chunk <= 64; chunk *= 2) {
+			dObj = put_data_object(PAYLOAD, PAYLOAD, chunk);
+
+			if (!dObj) {
+				tmp_succ = false;
+				break;
+			}
+			tmp_succ &= (dObj->getDataState() == DataObject::DATA_STATE_VERIFIED_OK);
+			tmp_succ &= (dObj->verifyData() == DataObject::DATA_STATE_VERIFIED_OK);
+			tmp_succ &= file_has_payload(dObj, PAYLOAD);
+			dObj->deleteData();
+			delete dObj;
+		}
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Bad data hash: ");
+		tmp_succ = true;
+
+		for (size_t chunk = 1; chunk <= 64; chunk *= 2) {
+			dObj = put_data_object(PAYLOAD, "something else", chunk);
+
+			if (!dObj) {
+				tmp_succ = false;
+				break;
+			}
+			tmp_succ &= (dObj->getDataState() == DataObject::DATA_STATE_VERIFIED_BAD);
+			tmp_succ &= (dObj->verifyData() == DataObject::DATA_STATE_VERIFIED_BAD);
+			dObj->deleteData();
+			delete dObj;
+		}
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Total: ");
+
+		return (success ? 0 : 1);
+	} catch(Exception &) {
+		printf("**CRASH** ");
+		return 1;
+	}
+}
@@ -0,0 +1,227 @@
+/* Copyright 2008 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "testhlp.h"
+#include "DataObject.h"
+#include "BinaryMetadata.h"
+#include "utils.h"
+#include <haggleutils.h>
+
+using namespace haggle;
+
+/*
+	This program tests that the serialized metadata of a data object is
+	reused while the data object is unchanged, and that it follows all
+	changes to the data object, including changes made directly to the
+	metadata.
+*/
+
+static bool get_raw(const DataObjectRef& dObj, string& raw)
+{
+	unsigned char *buf;
+	size_t len;
+
+	if (!dObj->getRawMetadataAlloc(&buf, &len))
+		return false;
+
+	raw = "";
+	raw.append((const char *)buf, len);
+	free(buf);
+
+	return true;
+}
+
+/*
+	Returns true if the binary metadata of the data object is the same as
+	in 'raw', which is replaced with the current binary metadata.
+*/
+static bool same_binary(const DataObjectRef& dObj, unsigned char **raw, size_t *len)
+{
+	unsigned char *buf;
+	size_t buflen;
+	bool same;
+
+	if (!dObj->getRawMetadataAlloc(&buf, &buflen, METADATA_FORMAT_BINARY))
+		return false;
+
+	same = (*raw && *len == buflen && memcmp(*raw, buf, buflen) == 0);
+
+	if (*raw)
+		free(*raw);
+
+	*raw = buf;
+	*len = buflen;
+
+	return same;
+}
+
+static bool raw_contains(const DataObjectRef& dObj, const char *str)
+{
+	string raw;
+
+	return get_raw(dObj, raw) && strstr(raw.c_str(), str) != NULL;
+}
+
+static bool test_unchanged()
+{
+	DataObjectRef dObj = DataObject::create();
+	string raw1, raw2;
+	unsigned char *bin = NULL;
+	size_t binlen = 0;
+	unsigned long version;
+	bool success = true;
+
+	if (!dObj)
+		return false;
+
+	dObj->addAttribute("foo", "bar");
+
+	success &= get_raw(dObj, raw1);
+	version = dObj->getMetadata()->getVersion();
+
+	// Neither serializing nor reading the metadata modifies it
+	success &= get_raw(dObj, raw2);
+	success &= (raw1 == raw2);
+	success &= (dObj->getMetadata()->getVersion() == version);
+
+	same_binary(dObj, &bin, &binlen);
+	success &= same_binary(dObj, &bin, &binlen);
+	success &= BinaryMetadata::isBinary(bin, binlen);
+	success &= (dObj->getMetadata()->getVersion() == version);
+
+	if (bin)
+		free(bin);
+
+	return success;
+}
+
+static bool test_changed()
+{
+	DataObjectRef dObj = DataObject::create();
+	unsigned char *bin = NULL;
+	size_t binlen = 0;
+	bool success = true;
+
+	if (!dObj)
+		return false;
+
+	success &= !raw_contains(dObj, "bar");
+	same_binary(dObj, &bin, &binlen);
+
+	dObj->addAttribute("foo", "bar");
+	success &= raw_contains(dObj, "bar");
+	success &= !same_binary(dObj, &bin, &binlen);
+
+	if (bin)
+		free(bin);
+
+	dObj->removeAttribute("foo", "bar");
+	success &= !raw_contains(dObj, "bar");
+
+	dObj->setPersistent(false);
+	success &= raw_contains(dObj, "persistent=\"no\"");
+	dObj->setPersistent(true);
+	success &= raw_contains(dObj, "persistent=\"yes\"");
+
+	unsigned char *sig = (unsigned char *)malloc(4);
+
+	if (!sig)
+		return false;
+
+	memcpy(sig, "abcd", 4);
+	dObj->setSignature("signee-id", sig, 4);
+	success &= raw_contains(dObj, "signee-id");
+
+	return success;
+}
+
+static bool test_metadata_changed()
+{
+	DataObjectRef dObj = DataObject::create();
+	Metadata *m;
+	bool success = true;
+
+	if (!dObj)
+		return false;
+
+	// Others add their own metadata to data objects
+	m = dObj->getMetadata()->addMetadata("Node");
+
+	if (!m)
+		return false;
+
+	success &= raw_contains(dObj, "<Node");
+
+	// Changes made later through a kept pointer are also noticed
+	m->setParameter("name", "node-name");
+	success &= raw_contains(dObj, "node-name");
+
+	m = m->addMetadata("Interface");
+
+	if (!m)
+		return false;
+
+	success &= raw_contains(dObj, "<Interface");
+
+	m->setContent("iface-content");
+	success &= raw_contains(dObj, "iface-content");
+
+	// A copy is serialized separately from the original
+	DataObjectRef dObjCopy = dObj->copy();
+
+	dObjCopy->getMetadata()->getMetadata("Node")->setParameter("name", "copy-name");
+	success &= raw_contains(dObjCopy, "copy-name");
+	success &= raw_contains(dObj, "node-name");
+
+	return success;
+}
+
+#if defined(OS_WINDOWS)
+int haggle_test_rawMetadata(void)
+#else
+int main(int argc, char *argv[])
+#endif
+{
+	bool success = true, tmp_succ;
+
+	// Disable tracing
+	trace_disable(true);
+
+	print_over_test_str_nl(0, "Raw metadata test: ");
+
+	try {
+		print_over_test_str(1, "Unchanged data object: ");
+		tmp_succ = test_unchanged();
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Changed data object: ");
+		tmp_succ = test_changed();
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Changed metadata: ");
+		tmp_succ = test_metadata_changed();
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Total: ");
+
+		return (success ? 0 : 1);
+	} catch(Exception &) {
+		printf("**CRASH** ");
+		return 1;
+	}
+}
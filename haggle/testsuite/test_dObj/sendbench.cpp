@@ -0,0 +1,273 @@
+/* Copyright 2008 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "testhlp.h"
+#include "DataObject.h"
+#include "ProtocolTCP.h"
+#include "utils.h"
+#include <libcpphaggle/Thread.h>
+#include <libcpphaggle/Timeval.h>
+#include <haggleutils.h>
+
+#if defined(OS_LINUX)
+#include <sys/sendfile.h>
+#endif
+
+using namespace haggle;
+/*
+  This program measures how fast a data object can be sent over a TCP
+  connection on the loopback interface, the way a TCP protocol sends it:
+
+  - read+send: the data is retrieved into a buffer of PROTOCOL_BUFSIZE
+    bytes, which is sent with send(), using the default socket buffers.
+    This is how all data was sent before.
+  - read+send (TCP): the same, but with a buffer of TCP_BUFSIZE bytes,
+    socket buffers of TCP_SOCKET_BUFSIZE bytes and TCP_NODELAY, as
+    ProtocolTCP sets them.
+  - sendfile: the header is sent from memory and the data with
+    sendfile() directly from the file, as ProtocolTCP does on Linux.
+
+  A thread on the other end of the connection reads and discards the
+  bytes.
+*/
+
+#define BENCH_FILE "sendbench.dat"
+
+class DrainRunnable : public Runnable {
+	SOCKET sock;
+	size_t total;
+public:
+	size_t received;
+	DrainRunnable(SOCKET _sock, size_t _total) : sock(_sock), total(_total), received(0) {}
+	bool run()
+	{
+		char buf[65536];
+
+		while (received < total) {
+			ssize_t ret = recv(sock, buf, sizeof(buf), 0);
+
+			if (ret <= 0)
+				break;
+
+			received += ret;
+		}
+		return false;
+	}
+	void cleanup() {}
+};
+
+static bool connect_loopback(SOCKET *s, SOCKET *r, bool tcp_options)
+{
+	int sockbuf = TCP_SOCKET_BUFSIZE, nodelay = 1;
+	struct sockaddr_in sa;
+	socklen_t len = sizeof(sa);
+	SOCKET l = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (l == INVALID_SOCKET)
+		return false;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (::bind(l, (struct sockaddr *)&sa, sizeof(sa)) == SOCKET_ERROR ||
+	    listen(l, 1) == SOCKET_ERROR ||
+	    getsockname(l, (struct sockaddr *)&sa, &len) == SOCKET_ERROR) {
+		CLOSE_SOCKET(l);
+		return false;
+	}
+
+	*s = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (tcp_options) {
+		setsockopt(*s, SOL_SOCKET, SO_SNDBUF, (char *)&sockbuf, sizeof(sockbuf));
+		setsockopt(*s, IPPROTO_TCP, TCP_NODELAY, (char *)&nodelay, sizeof(nodelay));
+		setsockopt(l, SOL_SOCKET, SO_RCVBUF, (char *)&sockbuf, sizeof(sockbuf));
+	}
+
+	if (connect(*s, (struct sockaddr *)&sa, sizeof(sa)) == SOCKET_ERROR) {
+		CLOSE_SOCKET(*s);
+		CLOSE_SOCKET(l);
+		return false;
+	}
+	*r = accept(l, NULL, NULL);
+
+	CLOSE_SOCKET(l);
+
+	return *r != INVALID_SOCKET;
+}
+
+static bool send_all(SOCKET sock, const unsigned char *buf, size_t len, unsigned long *calls)
+{
+	size_t sent = 0;
+
+	while (sent < len) {
+		ssize_t ret = send(sock, (const char *)buf + sent, len - sent, 0);
+
+		if (ret <= 0)
+			return false;
+
+		sent += ret;
+		(*calls)++;
+	}
+	return true;
+}
+
+/*
+	Sends the data object like Protocol::sendDataObjectNow(), with or
+	without sendfile(), and returns the time it took in milliseconds,
+	or a negative value on error.
+*/
+static double bench_send(const DataObjectRef& dObj, size_t bufsize, bool tcp_options,
+			 bool use_sendfile, unsigned long *calls)
+{
+	DataObjectDataRetrieverRef retriever = dObj->getDataObjectDataRetriever();
+	unsigned char *buf = new unsigned char[bufsize];
+	size_t total = 0;
+	ssize_t len;
+	SOCKET s, r;
+	bool success = true;
+	Timeval start;
+
+	*calls = 0;
+
+	if (!retriever || !connect_loopback(&s, &r, tcp_options)) {
+		delete [] buf;
+		return -1;
+	}
+
+	// Count the bytes the receiver should get
+	while ((len = retriever->retrieve(buf, bufsize, false)) > 0)
+		total += len;
+
+	retriever = dObj->getDataObjectDataRetriever();
+
+	DrainRunnable *drain = new DrainRunnable(r, total);
+	drain->start();
+
+	start = Timeval::now();
+
+	// The header is sent from memory in both cases
+	while (success && (len = retriever->retrieve(buf, bufsize, true)) > 0)
+		success = send_all(s, buf, len, calls);
+
+#if defined(OS_LINUX)
+	if (use_sendfile) {
+		off_t offset;
+		size_t left;
+		int fd = retriever->getDataFile(&offset, &left);
+
+		while (success && fd != -1 && left > 0) {
+			ssize_t ret = sendfile(s, fd, &offset, left);
+
+			if (ret <= 0) {
+				success = false;
+				break;
+			}
+			left -= ret;
+			(*calls)++;
+			success = retriever->skipData(ret);
+		}
+	}
+#endif
+	while (success && (len = retriever->retrieve(buf, bufsize, false)) > 0)
+		success = send_all(s, buf, len, calls);
+
+	drain->join();
+
+	double ms = (Timeval::now() - start).getTimeAsMilliSecondsDouble();
+
+	success &= (drain->received == total);
+
+	delete drain;
+	delete [] buf;
+	CLOSE_SOCKET(s);
+	CLOSE_SOCKET(r);
+
+	return success ? ms : -1;
+}
+
+static void print_result(const char *name, size_t bytes, double ms, unsigned long calls)
+{
+	if (ms < 0) {
+		printf("  %-18s failed\n", name);
+		return;
+	}
+	printf("  %-18s %8.1lf MB/s  %8lu send calls\n", name,
+	       (double)bytes / (1024 * 1024) / (ms / 1000), calls);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t sizes[] = { 1024 * 1024, 16 * 1024 * 1024, 128 * 1024 * 1024 };
+	char block[65536];
+
+	// Disable tracing
+	trace_disable(true);
+
+	for (size_t i = 0; i < sizeof(block); i++)
+		block[i] = (char)RANDOM_INT(256);
+
+	for (unsigned int j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+		size_t size = sizes[j];
+		unsigned long calls;
+		double ms;
+		FILE *fp = fopen(BENCH_FILE, "wb");
+
+		if (!fp) {
+			fprintf(stderr, "Could not create %s\n", BENCH_FILE);
+			return 1;
+		}
+
+		for (size_t n = 0; n < size; n += sizeof(block))
+			fwrite(block, 1, sizeof(block), fp);
+
+		fclose(fp);
+
+		DataObjectRef dObj = DataObject::create(BENCH_FILE);
+
+		if (!dObj) {
+			fprintf(stderr, "Could not create data object\n");
+			unlink(BENCH_FILE);
+			return 1;
+		}
+
+		printf("%lu MB data object (best of 3):\n", (unsigned long)(size / (1024 * 1024)));
+
+		for (int method = 0; method < 3; method++) {
+			double best = -1;
+			static const char *names[] = { "read+send", "read+send (TCP)", "sendfile" };
+
+			for (int k = 0; k < 3; k++) {
+				switch (method) {
+				case 0:
+					ms = bench_send(dObj, PROTOCOL_BUFSIZE, false, false, &calls);
+					break;
+				case 1:
+					ms = bench_send(dObj, TCP_BUFSIZE, true, false, &calls);
+					break;
+				default:
+					ms = bench_send(dObj, TCP_BUFSIZE, true, true, &calls);
+					break;
+				}
+				if (ms >= 0 && (best < 0 || ms < best))
+					best = ms;
+			}
+			print_result(names[method], size, best, calls);
+		}
+		unlink(BENCH_FILE);
+	}
+	return 0;
+}
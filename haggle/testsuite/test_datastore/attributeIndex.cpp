@@ -0,0 +1,245 @@
+/* Copyright 2008 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "testhlp.h"
+#include "AttributeIndex.h"
+#include <haggleutils.h>
+
+using namespace haggle;
+
+/*
+	This program tests that the attribute index matches data objects
+	against filters and nodes the same way as the matching views of
+	the data store.
+*/
+
+static void make_id(DataObjectId_t id, int n)
+{
+	memset(id, 0, DATAOBJECT_ID_LEN);
+	id[0] = (unsigned char)n;
+}
+
+static bool add_dataobject(AttributeIndex& index, sqlite_int64 rowid, const char *attrs[][2], int num)
+{
+	DataObjectId_t id;
+	bool success;
+
+	make_id(id, (int)rowid);
+	success = index.addDataObject(rowid, id);
+
+	for (int i = 0; i < num; i++)
+		success &= index.addDataObjectAttribute(rowid, attrs[i][0], attrs[i][1]);
+
+	return success;
+}
+
+static bool has_match(const AttributeIndex::Matches& m, size_t i, sqlite_int64 rowid, long ratio)
+{
+	return i < m.size() && m[i].rowid == rowid && m[i].ratio == ratio;
+}
+
+static bool test_filters()
+{
+	AttributeIndex index;
+	const char *do1[][2] = { { "A", "1" }, { "B", "2" } };
+	const char *do2[][2] = { { "A", "1" } };
+	const char *do3[][2] = { { "C", "3" } };
+	const char *do4[][2] = { { "A", "1" }, { "B", ATTR_WILDCARD } };
+	bool success = true;
+
+	success &= add_dataobject(index, 1, do1, 2);
+	success &= add_dataobject(index, 2, do2, 1);
+	success &= add_dataobject(index, 3, do3, 1);
+	success &= add_dataobject(index, 4, do4, 2);
+
+	// Duplicates are rejected
+	success &= !add_dataobject(index, 1, do1, 0);
+
+	success &= index.addFilter(10, 42);
+	success &= index.addFilterAttribute(10, "A", "1");
+	success &= index.addFilterAttribute(10, "B", ATTR_WILDCARD);
+
+	success &= (index.getFilterRowId(42) == 10);
+	success &= (index.getFilterEvent(10) == 42);
+
+	AttributeIndex::Matches dobjs;
+
+	index.dataObjectsForFilter(10, dobjs);
+
+	// A wildcard matches any value, but only once
+	success &= (dobjs.size() == 3);
+	success &= has_match(dobjs, 0, 1, 100);
+	success &= has_match(dobjs, 1, 4, 100);
+	success &= has_match(dobjs, 2, 2, 50);
+
+	// Matching the attributes directly gives the same result as 
+	// matching the filter that has them
+	Attributes attrs;
+	AttributeIndex::Matches direct;
+
+	attrs.add(Attribute("A", "1"));
+	attrs.add(Attribute("B", ATTR_WILDCARD));
+	index.dataObjectsForAttributes(attrs, direct);
+
+	success &= (direct.size() == dobjs.size());
+
+	for (size_t i = 0; i < direct.size() && i < dobjs.size(); i++)
+		success &= has_match(direct, i, dobjs[i].rowid, dobjs[i].ratio);
+
+	// Attributes that are not in the index still count
+	AttributeIndex::Matches unknown;
+
+	attrs.add(Attribute("D", "4"));
+	index.dataObjectsForAttributes(attrs, unknown);
+	success &= (unknown.size() == 3 && has_match(unknown, 2, 2, 33));
+
+	AttributeIndex::Matches filters;
+
+	index.filtersForDataObject(4, filters);
+	success &= (filters.size() == 1 && has_match(filters, 0, 10, 100));
+
+	AttributeIndex::Matches none;
+
+	index.filtersForDataObject(3, none);
+	success &= none.empty();
+
+	index.removeFilter(10);
+	success &= (index.getFilterRowId(42) == -1);
+	success &= (index.getNumFilters() == 0);
+
+	AttributeIndex::Matches removed;
+
+	index.filtersForDataObject(1, removed);
+	success &= removed.empty();
+
+	return success;
+}
+
+static bool test_nodes()
+{
+	AttributeIndex index;
+	const char *do1[][2] = { { "A", "1" }, { "B", "2" } };
+	const char *do2[][2] = { { "A", "1" } };
+	const char *do3[][2] = { { "B", "2" } };
+	const char *do4[][2] = { { "A", "1" }, { "C", "3" } };
+	bool success = true;
+
+	success &= add_dataobject(index, 1, do1, 2);
+	success &= add_dataobject(index, 2, do2, 1);
+	success &= add_dataobject(index, 3, do3, 1);
+	success &= add_dataobject(index, 4, do4, 2);
+
+	// Node 20 wants A and B, and B much more than A
+	success &= index.addNode(20, 50);
+	success &= index.addNodeAttribute(20, "A", "1", 1);
+	success &= index.addNodeAttribute(20, "B", "2", 3);
+
+	// Node 21 wants A or D, but nothing that has C
+	success &= index.addNode(21, 0);
+	success &= index.addNodeAttribute(21, "A", "1", 1);
+	success &= index.addNodeAttribute(21, "D", "4", 1);
+	success &= index.addNodeAttribute(21, "C", "3", ATTR_WEIGHT_NO_MATCH);
+
+	AttributeIndex::Matches dobjs;
+
+	index.dataObjectsForNode(20, 0, 0, dobjs);
+
+	success &= (dobjs.size() == 4);
+	success &= has_match(dobjs, 0, 1, 100);
+	success &= has_match(dobjs, 1, 3, 75);
+	success &= has_match(dobjs, 2, 4, 25);
+	success &= has_match(dobjs, 3, 2, 25);
+
+	AttributeIndex::Matches threshold;
+
+	index.dataObjectsForNode(20, 50, 0, threshold);
+	success &= (threshold.size() == 2);
+
+	AttributeIndex::Matches mcount;
+
+	index.dataObjectsForNode(20, 0, 2, mcount);
+	success &= (mcount.size() == 1 && has_match(mcount, 0, 1, 100));
+
+	// Equal matches are ordered newest first
+	AttributeIndex::Matches newest;
+
+	index.dataObjectsForNode(21, 0, 0, newest);
+	success &= (newest.size() == 2);
+	success &= has_match(newest, 0, 2, 100);
+	success &= has_match(newest, 1, 1, 100);
+
+	// Nodes must match with at least their own threshold
+	AttributeIndex::Matches nodes;
+
+	index.nodesForDataObject(2, 0, nodes);
+	success &= (nodes.size() == 1 && has_match(nodes, 0, 21, 100));
+
+	AttributeIndex::Matches excluded;
+
+	index.nodesForDataObject(4, 0, excluded);
+	success &= excluded.empty();
+
+	index.removeNode(21);
+	index.removeDataObject(1);
+
+	success &= (index.getNumNodes() == 1);
+	success &= (index.getNumDataObjects() == 3);
+	success &= (index.getDataObjectId(1) == NULL);
+	success &= (index.getDataObjectId(2) != NULL && (*index.getDataObjectId(2))[0] == 2);
+
+	AttributeIndex::Matches after;
+
+	index.dataObjectsForNode(20, 0, 0, after);
+	success &= (after.size() == 3);
+	success &= has_match(after, 0, 3, 75);
+
+	index.clear();
+	success &= (index.getNumNodes() == 0 && index.getNumDataObjects() == 0);
+
+	return success;
+}
+
+#if defined(OS_WINDOWS)
+int haggle_test_attributeIndex(void)
+#else
+int main(int argc, char *argv[])
+#endif
+{
+	bool success = true, tmp_succ;
+
+	// Disable tracing
+	trace_disable(true);
+
+	print_over_test_str_nl(0, "Attribute index test: ");
+
+	try {
+		print_over_test_str(1, "Filter matching: ");
+		tmp_succ = test_filters();
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Node matching: ");
+		tmp_succ = test_nodes();
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Total: ");
+
+		return (success ? 0 : 1);
+	} catch(Exception &) {
+		printf("**CRASH** ");
+		return 1;
+	}
+}
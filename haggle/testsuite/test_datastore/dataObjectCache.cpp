@@ -0,0 +1,142 @@
+/* Copyright 2008 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "testhlp.h"
+#include "DataObjectCache.h"
+#include <haggleutils.h>
+
+using namespace haggle;
+
+/*
+	This program tests that the data object cache returns the data
+	objects put into it, and that it evicts the least recently used
+	data objects that are not referenced elsewhere first.
+*/
+
+static DataObjectRef create_dataobject(int n)
+{
+	char buf[128];
+
+	sprintf(buf, "<Haggle persistent=\"no\"><Attr name=\"n\">%d</Attr></Haggle>", n);
+
+	return DataObject::create((unsigned char *)buf, strlen(buf));
+}
+
+static bool in_cache(DataObjectCache& cache, sqlite_int64 rowid)
+{
+	DataObjectRef dObj = cache.get(rowid);
+
+	if (dObj)
+		return true;
+
+	return false;
+}
+
+static bool test_get_put()
+{
+	DataObjectCache cache(4);
+	DataObjectRef dObj = create_dataobject(1);
+	bool success = true;
+
+	if (!dObj)
+		return false;
+
+	success &= !in_cache(cache, 1);
+	cache.put(1, dObj);
+	success &= (cache.get(1) == dObj);
+	success &= (cache.size() == 1);
+	success &= (cache.getHits() == 1 && cache.getMisses() == 1);
+
+	cache.remove(1);
+	success &= !in_cache(cache, 1);
+	success &= (cache.size() == 0);
+
+	return success;
+}
+
+static bool test_eviction()
+{
+	DataObjectCache cache(8);
+	DataObjectRef kept;
+	bool success = true;
+
+	for (int i = 1; i <= 8; i++) {
+		DataObjectRef dObj = create_dataobject(i);
+
+		if (!dObj)
+			return false;
+
+		cache.put(i, dObj);
+
+		// Keep a reference to the oldest data object
+		if (i == 1)
+			kept = dObj;
+	}
+
+	// Use the second oldest data object, so that it is not evicted
+	success &= in_cache(cache, 2);
+
+	cache.put(9, create_dataobject(9));
+
+	// A quarter of the cache was evicted
+	success &= (cache.size() == 6);
+	success &= (cache.getEvictions() == 3);
+
+	// The referenced and recently used data objects are still there
+	success &= (cache.get(1) == kept);
+	success &= in_cache(cache, 2);
+	success &= in_cache(cache, 9);
+
+	// The least recently used unreferenced data objects were evicted
+	success &= !in_cache(cache, 3);
+	success &= !in_cache(cache, 4);
+	success &= !in_cache(cache, 5);
+	success &= in_cache(cache, 6);
+
+	return success;
+}
+
+#if defined(OS_WINDOWS)
+int haggle_test_dataObjectCache(void)
+#else
+int main(int argc, char *argv[])
+#endif
+{
+	bool success = true, tmp_succ;
+
+	// Disable tracing
+	trace_disable(true);
+
+	print_over_test_str_nl(0, "Data object cache test: ");
+
+	try {
+		print_over_test_str(1, "Get and put: ");
+		tmp_succ = test_get_put();
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Eviction: ");
+		tmp_succ = test_eviction();
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Total: ");
+
+		return (success ? 0 : 1);
+	} catch(Exception &) {
+		printf("**CRASH** ");
+		return 1;
+	}
+}
@@ -0,0 +1,169 @@
+/* Copyright 2008 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "testhlp.h"
+#include <libcpphaggle/Thread.h>
+#include <haggleutils.h>
+#include "EventQueue.h"
+
+using namespace haggle;
+/*
+  This program tests that events added concurrently to the event
+  queue by many threads are all returned by the queue.
+*/
+
+#define NUM_PRODUCERS 8
+#define NUM_EVENTS_PER_PRODUCER 5000
+
+class producerRunnable : public Runnable {
+	EventQueue *eq;
+	bool delayed;
+public:
+	producerRunnable(EventQueue *_eq, bool _delayed) : eq(_eq), delayed(_delayed) {}
+	~producerRunnable() {}
+
+	bool run()
+	{
+		for (int i = 0; i < NUM_EVENTS_PER_PRODUCER; i++) {
+			// Every tenth event of a delayed producer goes into the heap directly
+			eq->addEvent(new Event(EVENT_TYPE_NODE_UPDATED, NULL,
+					       (delayed && i % 10 == 0) ? 0.001 : 0.0));
+		}
+		return false;
+	}
+	void cleanup() {}
+};
+
+static unsigned long drain(EventQueue *eq)
+{
+	List<Event *> events;
+	unsigned long n = 0;
+
+	if (eq->getNextEvents(events) == 0)
+		return 0;
+
+	while (!events.empty()) {
+		Event *e = events.front();
+		events.pop_front();
+
+		if (e->isScheduled() && e->getType() == EVENT_TYPE_NODE_UPDATED)
+			n++;
+		delete e;
+	}
+	return n;
+}
+
+#if defined(OS_WINDOWS)
+int haggle_test_eventqueue(void)
+#else
+int main(int argc, char *argv[])
+#endif
+{
+	// Disable tracing
+	trace_disable(true);
+
+	print_over_test_str_nl(0, "Event queue test: ");
+
+	try {
+		bool success = true;
+		bool tmp_succ;
+		EventQueue eq;
+		producerRunnable *producers[NUM_PRODUCERS];
+		unsigned long n = 0;
+		Timeval timeout;
+		int i;
+
+		print_over_test_str(1, "Single immediate event: ");
+		eq.addEvent(new Event(EVENT_TYPE_NODE_UPDATED, NULL));
+		tmp_succ = (eq.getNextEventTime(&timeout) == EQ_EVENT &&
+			    drain(&eq) == 1 &&
+			    eq.hasNextEvent() == EQ_EMPTY);
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Delayed event and cancel: ");
+		Event *delayed = new Event(EVENT_TYPE_NODE_UPDATED, NULL, 10.0);
+		delayed->setAutoDelete(false);
+		eq.addEvent(delayed);
+		tmp_succ = (delayed->isScheduled() &&
+			    eq.getNextEventTime(&timeout) == EQ_EVENT &&
+			    timeout > Timeval::now() &&
+			    timeout <= delayed->getTimeout() &&
+			    eq.cancelEvent(delayed) &&
+			    !delayed->isScheduled() &&
+			    !eq.cancelEvent(delayed) &&
+			    eq.hasNextEvent() == EQ_EMPTY);
+		delete delayed;
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Delayed event becomes due: ");
+		eq.addEvent(new Event(EVENT_TYPE_NODE_UPDATED, NULL, 0.05));
+		{
+			List<Event *> events;
+			Timeval now = Timeval::now();
+
+			tmp_succ = (eq.getNextEvents(events, &now) == 0);
+			milli_sleep(60);
+			now = Timeval::now();
+			tmp_succ &= (eq.getNextEventTime(&timeout) == EQ_EVENT &&
+				     timeout <= now &&
+				     eq.getNextEvents(events, &now) == 1);
+
+			while (!events.empty()) {
+				delete events.front();
+				events.pop_front();
+			}
+		}
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Concurrent producers: ");
+
+		for (i = 0; i < NUM_PRODUCERS; i++) {
+			producers[i] = new producerRunnable(&eq, i % 2 == 0);
+			producers[i]->start();
+		}
+
+		// Consume while the producers are running, but give up eventually
+		Timeval deadline = Timeval::now() + Timeval(10, 0);
+
+		while (n < NUM_PRODUCERS * NUM_EVENTS_PER_PRODUCER && Timeval::now() < deadline) {
+			unsigned long m = drain(&eq);
+
+			if (m == 0)
+				milli_sleep(1);
+
+			n += m;
+		}
+
+		for (i = 0; i < NUM_PRODUCERS; i++) {
+			producers[i]->join();
+			delete producers[i];
+		}
+
+		tmp_succ = (n == NUM_PRODUCERS * NUM_EVENTS_PER_PRODUCER &&
+			    eq.hasNextEvent() == EQ_EMPTY);
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Total: ");
+
+		return success ? 0 : 1;
+	} catch(Exception &) {
+		printf("**CRASH** ");
+		return 1;
+	}
+}
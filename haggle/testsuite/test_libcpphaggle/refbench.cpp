@@ -0,0 +1,137 @@
+/* Copyright 2008 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "testhlp.h"
+#include <libcpphaggle/Thread.h>
+#include <libcpphaggle/Reference.h>
+#include <libcpphaggle/Timeval.h>
+#include <haggleutils.h>
+
+using namespace haggle;
+/*
+  This program measures the cost of reference counting when many
+  threads use references at the same time, which is what happens when
+  protocol threads pass data objects and nodes to the kernel.
+
+  Each test runs with an increasing number of threads:
+
+  - copy: all threads copy and release references to one shared object,
+    like a data object passed in many events.
+  - create: each thread creates references from raw pointers to its own
+    objects, like "DataObjectRef(new DataObject(...))".
+
+  Plain objects have their reference counter in the global store of
+  refcounted objects, while refcountable objects keep it themselves.
+*/
+
+#define NUM_OPS 200000
+
+class PlainObject {
+public:
+	int value;
+	PlainObject() : value(0) {}
+};
+
+class RefcountableObject : public Refcountable {
+public:
+	int value;
+	RefcountableObject() : value(0) {}
+};
+
+template<typename T>
+class CopyRunnable : public Runnable {
+	Reference<T> ref;
+public:
+	CopyRunnable(const Reference<T>& _ref) : ref(_ref) {}
+	bool run()
+	{
+		for (int i = 0; i < NUM_OPS; i++) {
+			Reference<T> copy = ref;
+			Reference<T> copy2 = copy;
+		}
+		return false;
+	}
+	void cleanup() {}
+};
+
+template<typename T>
+class CreateRunnable : public Runnable {
+public:
+	bool run()
+	{
+		for (int i = 0; i < NUM_OPS / 10; i++) {
+			T *obj = new T();
+			Reference<T> ref = obj;
+			Reference<T> ref2 = obj;
+		}
+		return false;
+	}
+	void cleanup() {}
+};
+
+static double run_threads(Runnable **r, int num)
+{
+	Timeval start = Timeval::now();
+	int i;
+
+	for (i = 0; i < num; i++)
+		r[i]->start();
+
+	for (i = 0; i < num; i++) {
+		r[i]->join();
+		delete r[i];
+	}
+	return (Timeval::now() - start).getTimeAsMilliSecondsDouble();
+}
+
+template<typename T>
+static void bench(const char *name)
+{
+	int nthreads[] = { 1, 2, 4, 8 };
+	Runnable *r[8];
+
+	for (unsigned int j = 0; j < sizeof(nthreads) / sizeof(nthreads[0]); j++) {
+		int num = nthreads[j];
+		Reference<T> shared = new T();
+		double copy, create;
+		int i;
+
+		for (i = 0; i < num; i++)
+			r[i] = new CopyRunnable<T>(shared);
+
+		copy = run_threads(r, num);
+
+		for (i = 0; i < num; i++)
+			r[i] = new CreateRunnable<T>();
+
+		create = run_threads(r, num);
+
+		printf("  %-12s %d threads: copy %7.1lf ns/op  create %7.1lf ns/op\n", name, num,
+		       copy * 1000000 / ((double)NUM_OPS * 2 * num),
+		       create * 1000000 / ((double)NUM_OPS / 10 * num));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	// Disable tracing
+	trace_disable(true);
+
+	printf("Reference counting with concurrent threads (wall clock time per operation):\n");
+	bench<PlainObject>("Plain");
+	bench<RefcountableObject>("Refcountable");
+
+	return 0;
+}
@@ -29,6 +29,12 @@ static long pass_cppreference(const InterfaceRef &iface)
 	return iface.refcount();
 }
 
+class RefcountableObject : public Refcountable {
+public:
+	int value;
+	RefcountableObject(int _value = 0) : value(_value) {}
+};
+
 #if defined(OS_WINDOWS)
 int haggle_test_refcount(void)
 #else
@@ -161,6 +167,25 @@ int haggle_test_refcount(void)
 			success &= tmp_succ;
  			print_pass(tmp_succ);
 			
+			print_over_test_str(1, "Refcountable object copy has its own refcount: ");
+			{
+				Reference<RefcountableObject> ref1 = new RefcountableObject(1);
+				Reference<RefcountableObject> ref2 = ref1;
+				Reference<RefcountableObject> ref3 = new RefcountableObject(*ref1.getObj());
+				
+				tmp_succ = (ref1.refcount() == 2 &&
+					    ref3.refcount() == 1 &&
+					    ref3.getObj() != ref1.getObj() &&
+					    ref3->value == 1);
+				
+				// A reference from a raw pointer finds the existing counter
+				Reference<RefcountableObject> ref4 = ref2.getObj();
+				
+				tmp_succ &= (ref1.refcount() == 3 && ref4.getId() == ref1.getId());
+			}
+			success &= tmp_succ;
+			print_pass(tmp_succ);
+			
 			print_over_test_str(1, "Total: ");
 					
 		} catch(Exception &) {
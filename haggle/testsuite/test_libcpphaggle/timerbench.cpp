@@ -0,0 +1,156 @@
+/* Copyright 2008 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "testhlp.h"
+#include <libcpphaggle/Heap.h>
+#include <libcpphaggle/TimerWheel.h>
+#include <libcpphaggle/Timeval.h>
+#include <haggleutils.h>
+
+using namespace haggle;
+/*
+  This program compares the timer wheel with the heap that the event
+  queue used to keep delayed events in. It mimics per-neighbor timers:
+  every timer is started, half of them are rescheduled before they
+  expire (e.g., because the neighbor was seen again), and then time
+  is advanced in 10 ms steps until all timers have expired.
+
+  The heap cannot remove an item, so a rescheduled timer is left in
+  the heap and skipped when it reaches the front, which is how the
+  event queue had to handle cancelled events.
+*/
+
+#define MAX_DELAY 60000 // 60 seconds in milliseconds
+#define STEP 10
+
+class BenchTimer : public HeapItem, public TimerWheelItem {
+public:
+	int64_t expiresAt;
+	bool cancelled;
+	BenchTimer() : expiresAt(0), cancelled(false) {}
+	bool compare_less(const HeapItem& i) const {
+		return expiresAt < static_cast<const BenchTimer&>(i).expiresAt;
+	}
+	bool compare_greater(const HeapItem& i) const {
+		return expiresAt > static_cast<const BenchTimer&>(i).expiresAt;
+	}
+};
+
+static double usecs_since(const Timeval& start)
+{
+	Timeval t = Timeval::now() - start;
+	return (double)t.getSeconds() * 1000000 + t.getMicroSeconds();
+}
+
+static void bench_heap(unsigned long num, int64_t *delays)
+{
+	BenchTimer *timers = new BenchTimer[num * 2];
+	Heap heap;
+	unsigned long i, expired = 0, maxsize;
+	double insert, reschedule, expire;
+	int64_t now = 0;
+	Timeval start = Timeval::now();
+
+	for (i = 0; i < num; i++) {
+		timers[i].expiresAt = delays[i];
+		heap.insert(&timers[i]);
+	}
+	insert = usecs_since(start);
+
+	start = Timeval::now();
+	for (i = 0; i < num; i += 2) {
+		timers[i].cancelled = true;
+		timers[num + i].expiresAt = delays[num + i];
+		heap.insert(&timers[num + i]);
+	}
+	reschedule = usecs_since(start);
+	maxsize = heap.size();
+
+	start = Timeval::now();
+	while (!heap.empty()) {
+		now += STEP;
+		while (!heap.empty() && static_cast<BenchTimer *>(heap.front())->expiresAt <= now) {
+			BenchTimer *t = static_cast<BenchTimer *>(heap.extractFirst());
+			if (!t->cancelled)
+				expired++;
+		}
+	}
+	expire = usecs_since(start);
+
+	printf("  Heap:       insert %7.1lf ns  reschedule %7.1lf ns  expire %7.1lf ns  (%lu expired, max size %lu)\n",
+	       insert * 1000 / num, reschedule * 2000 / num, expire * 1000 / num, expired, maxsize);
+
+	delete [] timers;
+}
+
+static void bench_wheel(unsigned long num, int64_t *delays)
+{
+	BenchTimer *timers = new BenchTimer[num];
+	TimerWheel wheel(0);
+	unsigned long i, expired = 0, maxsize;
+	double insert, reschedule, expire;
+	int64_t now = 0;
+	Timeval start = Timeval::now();
+
+	for (i = 0; i < num; i++) {
+		timers[i].expiresAt = delays[i];
+		wheel.insert(&timers[i], delays[i]);
+	}
+	insert = usecs_since(start);
+
+	start = Timeval::now();
+	for (i = 0; i < num; i += 2) {
+		timers[i].expiresAt = delays[num + i];
+		wheel.insert(&timers[i], delays[num + i]);
+	}
+	reschedule = usecs_since(start);
+	maxsize = wheel.size();
+
+	start = Timeval::now();
+	while (!wheel.empty()) {
+		List<TimerWheelItem *> l;
+		now += STEP;
+		expired += wheel.advance(now, l);
+	}
+	expire = usecs_since(start);
+
+	printf("  TimerWheel: insert %7.1lf ns  reschedule %7.1lf ns  expire %7.1lf ns  (%lu expired, max size %lu)\n",
+	       insert * 1000 / num, reschedule * 2000 / num, expire * 1000 / num, expired, maxsize);
+
+	delete [] timers;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long sizes[] = { 1000, 10000, 100000 };
+
+	// Disable tracing
+	trace_disable(true);
+
+	for (unsigned int j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+		unsigned long num = sizes[j];
+		int64_t *delays = new int64_t[num * 2];
+
+		for (unsigned long i = 0; i < num * 2; i++)
+			delays[i] = 1 + RANDOM_INT(MAX_DELAY);
+
+		printf("%lu timers, delays up to %d ms (time per timer):\n", num, MAX_DELAY);
+		bench_heap(num, delays);
+		bench_wheel(num, delays);
+
+		delete [] delays;
+	}
+	return 0;
+}
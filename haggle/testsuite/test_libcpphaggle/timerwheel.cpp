@@ -0,0 +1,196 @@
+/* Copyright 2008 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "testhlp.h"
+#include <libcpphaggle/TimerWheel.h>
+#include <haggleutils.h>
+#include <libcpphaggle/Exception.h>
+
+using namespace haggle;
+/*
+  This program tests the timer wheel implementation
+*/
+
+#define NUM_TIMERS 2000
+
+class TestTimer : public TimerWheelItem {
+public:
+	int64_t expiresAt;
+	int64_t expiredAt;
+	bool cancelled;
+	TestTimer() : expiresAt(0), expiredAt(-1), cancelled(false) {}
+};
+
+/*
+  Advance the wheel in steps of random length, and check that every
+  timer expires in the step that passes its expiry time, and that
+  the next expiry is never later than the first timer.
+*/
+static bool run_wheel(TimerWheel& wheel, TestTimer *timers, int num, int64_t start, int64_t end, int64_t maxstep)
+{
+	int64_t now = start;
+	bool success = true;
+	int i;
+
+	while (now < end && success) {
+		List<TimerWheelItem *> expired;
+		int64_t next, first = -1;
+		int64_t prev = now;
+
+		for (i = 0; i < num; i++) {
+			if (timers[i].isInTimerWheel() && (first == -1 || timers[i].expiresAt < first))
+				first = timers[i].expiresAt;
+		}
+
+		if (first != -1 && (!wheel.getNextExpiry(next) || next > first))
+			success = false;
+
+		now += 1 + RANDOM_INT(maxstep);
+		wheel.advance(now, expired);
+
+		for (List<TimerWheelItem *>::iterator it = expired.begin(); it != expired.end(); it++) {
+			TestTimer *t = static_cast<TestTimer *>(*it);
+
+			if (t->expiredAt != -1 || t->cancelled || t->expiresAt > now ||
+			    (t->expiresAt <= prev && t->expiresAt >= start))
+				success = false;
+			t->expiredAt = now;
+		}
+	}
+	return success;
+}
+
+#if defined(OS_WINDOWS)
+int haggle_test_timerwheel(void)
+#else
+int main(int argc, char *argv[])
+#endif
+{
+	// Disable tracing
+	trace_disable(true);
+
+	print_over_test_str_nl(0, "Timer wheel test: ");
+
+	try {
+		bool success = true;
+		bool tmp_succ;
+		TestTimer *timers = new TestTimer[NUM_TIMERS];
+		int64_t start = 1000000;
+		int i;
+
+		{
+			TimerWheel wheel(start);
+
+			print_over_test_str(1, "Insert and size: ");
+			for (i = 0; i < NUM_TIMERS; i++) {
+				// Spread the timers over all levels of the wheel
+				timers[i].expiresAt = start + 1 + ((int64_t)RANDOM_INT((1 << 16)) << RANDOM_INT(12));
+				wheel.insert(&timers[i], timers[i].expiresAt);
+			}
+			tmp_succ = (wheel.size() == NUM_TIMERS);
+			success &= tmp_succ;
+			print_pass(tmp_succ);
+
+			print_over_test_str(1, "Cancel: ");
+			tmp_succ = true;
+			for (i = 0; i < NUM_TIMERS; i += 3) {
+				timers[i].cancelled = true;
+				tmp_succ &= wheel.remove(&timers[i]);
+				tmp_succ &= !wheel.remove(&timers[i]);
+			}
+			tmp_succ &= (wheel.size() == NUM_TIMERS - (NUM_TIMERS + 2) / 3);
+			success &= tmp_succ;
+			print_pass(tmp_succ);
+
+			print_over_test_str(1, "Reschedule: ");
+			for (i = 1; i < NUM_TIMERS; i += 3) {
+				timers[i].expiresAt = start + 1 + RANDOM_INT(1000);
+				wheel.insert(&timers[i], timers[i].expiresAt);
+			}
+			tmp_succ = (wheel.size() == NUM_TIMERS - (NUM_TIMERS + 2) / 3);
+			success &= tmp_succ;
+			print_pass(tmp_succ);
+
+			print_over_test_str(1, "Expire in order: ");
+			tmp_succ = run_wheel(wheel, timers, NUM_TIMERS, start, start + ((int64_t)1 << 29), 50000);
+			tmp_succ &= wheel.empty();
+
+			for (i = 0; i < NUM_TIMERS; i++)
+				tmp_succ &= (timers[i].cancelled || timers[i].expiredAt != -1);
+
+			success &= tmp_succ;
+			print_pass(tmp_succ);
+		}
+		{
+			// Start at the beginning of a turn of the first level
+			int64_t turn = (int64_t)1 << 20;
+			TimerWheel wheel(turn);
+			List<TimerWheelItem *> expired;
+			int64_t next;
+
+			print_over_test_str(1, "Next expiry across levels: ");
+
+			// Goes into the second level, since it is more than a turn away
+			timers[0].expiresAt = turn + TIMERWHEEL_LVL0_SIZE + 5;
+			timers[0].expiredAt = -1;
+			wheel.insert(&timers[0], timers[0].expiresAt);
+
+			wheel.advance(turn + 200, expired);
+			tmp_succ = expired.empty();
+
+			// Goes into the first level, but is due after the first timer
+			timers[1].expiresAt = turn + 432;
+			timers[1].expiredAt = -1;
+			wheel.insert(&timers[1], timers[1].expiresAt);
+
+			tmp_succ &= (wheel.getNextExpiry(next) && next <= timers[0].expiresAt);
+
+			wheel.advance(timers[0].expiresAt, expired);
+			tmp_succ &= (expired.size() == 1 && expired.front() == &timers[0]);
+
+			wheel.advance(timers[1].expiresAt, expired);
+			tmp_succ &= (expired.size() == 2 && !timers[1].isInTimerWheel() && wheel.empty());
+
+			success &= tmp_succ;
+			print_pass(tmp_succ);
+		}
+		{
+			TimerWheel wheel(start);
+			List<TimerWheelItem *> items;
+
+			print_over_test_str(1, "Remove all: ");
+
+			for (i = 0; i < NUM_TIMERS; i++) {
+				wheel.insert(&timers[i], start + RANDOM_INT((1 << 30)));
+			}
+			tmp_succ = (wheel.removeAll(items) == NUM_TIMERS &&
+				    items.size() == NUM_TIMERS && wheel.empty());
+
+			for (i = 0; i < NUM_TIMERS; i++)
+				tmp_succ &= !timers[i].isInTimerWheel();
+
+			success &= tmp_succ;
+			print_pass(tmp_succ);
+		}
+		delete [] timers;
+
+		print_over_test_str(1, "Total: ");
+
+		return success ? 0 : 1;
+	} catch(Exception &) {
+		printf("**CRASH** ");
+		return 1;
+	}
+}
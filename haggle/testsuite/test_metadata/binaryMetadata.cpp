@@ -0,0 +1,274 @@
+/* Copyright 2008 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "testhlp.h"
+#include "BinaryMetadata.h"
+#include "XMLMetadata.h"
+#include "DataObject.h"
+#include <haggleutils.h>
+
+using namespace haggle;
+
+/*
+	This program tests that metadata survives encoding and decoding in
+	the binary format, that data objects can be put with binary
+	headers, and that corrupt binary metadata is rejected.
+*/
+
+static Metadata *create_metadata()
+{
+	Metadata *m = new XMLMetadata("Haggle");
+	Metadata *c;
+
+	m->setParameter("persistent", "no");
+	m->setParameter("create_time", "1234567890.123456");
+
+	c = m->addMetadata("Attr", "value with <markup> & \"quotes\"");
+	c->setParameter("name", "a");
+
+	c = m->addMetadata("Attr", "");
+	c->setParameter("name", "empty");
+
+	c = m->addMetadata("Node");
+	c->setParameter("type", "peer");
+	c = c->addMetadata("Interface");
+	c->setParameter("type", "ethernet");
+	c->addMetadata("Address", "eth://00:11:22:33:44:55");
+
+	// A long string needs a multi-byte length
+	string s;
+
+	for (int i = 0; i < 300; i++)
+		s.append("x");
+
+	m->addMetadata("Long", s);
+
+	return m;
+}
+
+static bool same_raw(const unsigned char *a, size_t alen, const unsigned char *b, size_t blen)
+{
+	return alen == blen && memcmp(a, b, alen) == 0;
+}
+
+static bool test_roundtrip()
+{
+	Metadata *m = create_metadata();
+	BinaryMetadata bm;
+	XMLMetadata xm;
+	unsigned char *raw = NULL, *raw2 = NULL, *raw3 = NULL;
+	unsigned char buf[4096];
+	size_t len, len2, len3;
+	bool success = true;
+
+	success &= BinaryMetadata::encode(m, &raw, &len);
+	success &= BinaryMetadata::isBinary(raw, len);
+	success &= (BinaryMetadata::getLength(raw, len) == (ssize_t)len);
+
+	// Decode into both backends, and encode again
+	success &= bm.initFromRaw(raw, len);
+	success &= BinaryMetadata::decode(&xm, raw, len);
+	success &= bm.getRawAlloc(&raw2, &len2);
+	success &= BinaryMetadata::encode(&xm, &raw3, &len3);
+
+	success &= same_raw(raw, len, raw2, len2);
+	success &= same_raw(raw, len, raw3, len3);
+
+	// Into a buffer, which must be large enough
+	success &= (bm.getRaw(buf, sizeof(buf)) == (ssize_t)len && memcmp(buf, raw, len) == 0);
+	success &= (bm.getRaw(buf, len - 1) < 0);
+
+	success &= (bm.getName() == "Haggle");
+	success &= (bm.getParameter("persistent") && strcmp(bm.getParameter("persistent"), "no") == 0);
+	success &= (bm.getMetadata("Attr") && bm.getMetadata("Attr", 1) && !bm.getMetadata("Attr", 2));
+
+	const Metadata *addr = xm.getMetadata("Node");
+
+	if (addr)
+		addr = addr->getMetadata("Interface");
+	if (addr)
+		addr = addr->getMetadata("Address");
+
+	success &= (addr && addr->getContent() == "eth://00:11:22:33:44:55");
+
+	free(raw);
+	free(raw2);
+	free(raw3);
+	delete m;
+
+	return success;
+}
+
+static DataObjectRef create_dataobject()
+{
+	const char *xml = "<Haggle persistent=\"no\"><Attr name=\"a\">b</Attr><Attr name=\"c\" weight=\"3\">d</Attr></Haggle>";
+
+	return DataObject::create((unsigned char *)xml, strlen(xml));
+}
+
+/*
+	Puts the binary header of a data object into a new data object in
+	chunks of 'chunk' bytes, followed by an XML header that must not
+	be consumed.
+*/
+static bool put_binary_header(const DataObjectRef& dObj, const unsigned char *raw, size_t len, size_t chunk)
+{
+	DataObject *dObjPut = DataObject::create_for_putting();
+	unsigned char buf[1024];
+	const char *next = "<Haggle></Haggle>";
+	size_t total = len + strlen(next), i = 0, remaining = DATAOBJECT_METADATA_PENDING;
+	bool success = true;
+
+	if (!dObjPut || total > sizeof(buf))
+		return false;
+
+	memcpy(buf, raw, len);
+	memcpy(buf + len, next, strlen(next));
+
+	while (i < total && remaining != 0) {
+		size_t n = (total - i < chunk) ? total - i : chunk;
+		ssize_t ret = dObjPut->putData(buf + i, n, &remaining);
+
+		if (ret < 0) {
+			success = false;
+			break;
+		}
+		i += ret;
+	}
+
+	success &= (remaining == 0 && i == len);
+	success &= (memcmp(dObjPut->getId(), dObj->getId(), DATAOBJECT_ID_LEN) == 0);
+	success &= (dObjPut->getAttribute("c", "d") != NULL);
+
+	delete dObjPut;
+
+	return success;
+}
+
+static bool test_dataobject()
+{
+	DataObjectRef dObj = create_dataobject();
+	unsigned char *raw = NULL, *xml = NULL;
+	size_t len, xmlLen;
+	bool success = true;
+
+	if (!dObj)
+		return false;
+
+	success &= dObj->getRawMetadataAlloc(&raw, &len, METADATA_FORMAT_BINARY);
+	success &= dObj->getRawMetadataAlloc(&xml, &xmlLen);
+
+	// The binary header is smaller, and XML is still the default
+	success &= (len < xmlLen && !BinaryMetadata::isBinary(xml, xmlLen));
+
+	for (size_t chunk = 1; success && chunk <= len + 1; chunk++)
+		success &= put_binary_header(dObj, raw, len, chunk);
+
+	// The data store creates data objects from raw metadata as well
+	DataObjectRef dObjCreated = DataObject::create(raw, len);
+
+	success &= (dObjCreated && dObjCreated == dObj);
+
+	free(raw);
+	free(xml);
+
+	return success;
+}
+
+static bool test_corrupt()
+{
+	Metadata *m = create_metadata();
+	unsigned char *raw = NULL;
+	size_t len;
+	bool success = true;
+
+	if (!BinaryMetadata::encode(m, &raw, &len)) {
+		delete m;
+		return false;
+	}
+
+	// Truncated metadata
+	for (size_t i = 0; i < len; i++) {
+		XMLMetadata xm;
+		success &= !BinaryMetadata::decode(&xm, raw, i);
+	}
+
+	// A length that does not match the content
+	for (size_t i = BINARY_METADATA_PREAMBLE_LEN + 1; i < len; i += 7) {
+		XMLMetadata xm;
+		unsigned char saved[4];
+
+		memcpy(saved, raw + BINARY_METADATA_MAGIC_LEN, 4);
+		raw[BINARY_METADATA_MAGIC_LEN] = (unsigned char)(i >> 24);
+		raw[BINARY_METADATA_MAGIC_LEN + 1] = (unsigned char)(i >> 16);
+		raw[BINARY_METADATA_MAGIC_LEN + 2] = (unsigned char)(i >> 8);
+		raw[BINARY_METADATA_MAGIC_LEN + 3] = (unsigned char)i;
+		success &= !BinaryMetadata::decode(&xm, raw, len);
+		memcpy(raw + BINARY_METADATA_MAGIC_LEN, saved, 4);
+	}
+
+	// Another version of the format
+	raw[BINARY_METADATA_MAGIC_LEN - 1]++;
+	success &= (BinaryMetadata::getLength(raw, len) < 0);
+
+	DataObject *dObj = DataObject::create_for_putting();
+	size_t remaining;
+
+	success &= (dObj && dObj->putData(raw, len, &remaining) < 0);
+
+	delete dObj;
+	free(raw);
+	delete m;
+
+	return success;
+}
+
+#if defined(OS_WINDOWS)
+int haggle_test_binaryMetadata(void)
+#else
+int main(int argc, char *argv[])
+#endif
+{
+	bool success = true, tmp_succ;
+
+	// Disable tracing
+	trace_disable(true);
+
+	print_over_test_str_nl(0, "Binary metadata test: ");
+
+	try {
+		print_over_test_str(1, "Encode and decode: ");
+		tmp_succ = test_roundtrip();
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Put binary header: ");
+		tmp_succ = test_dataobject();
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Corrupt metadata: ");
+		tmp_succ = test_corrupt();
+		success &= tmp_succ;
+		print_pass(tmp_succ);
+
+		print_over_test_str(1, "Total: ");
+
+		return (success ? 0 : 1);
+	} catch(Exception &) {
+		printf("**CRASH** ");
+		return 1;
+	}
+}
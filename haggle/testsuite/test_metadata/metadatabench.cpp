@@ -0,0 +1,185 @@
+/* Copyright 2008 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "testhlp.h"
+#include "BinaryMetadata.h"
+#include "XMLMetadata.h"
+#include "DataObject.h"
+#include <libcpphaggle/Timeval.h>
+#include <haggleutils.h>
+
+using namespace haggle;
+
+/*
+  This program compares the XML and the binary metadata formats on
+  metadata shaped like a node description, with a number of
+  interfaces and attributes:
+
+  - encode: the metadata is serialized into a newly allocated buffer,
+    as when a changed data object is sent.
+  - cached: the metadata of an unchanged data object is retrieved
+    again, as when it is sent to another neighbor.
+  - decode: a data object is put from the serialized header, as when
+    a data object is received.
+
+  The size of the serialized metadata is also shown.
+*/
+
+#define BENCH_ROUNDS 2000
+
+static DataObjectRef create_node_description(unsigned int num_attrs)
+{
+	DataObjectRef dObj = DataObject::create();
+	Metadata *m, *node, *iface;
+	char name[32], value[64];
+
+	if (!dObj)
+		return NULL;
+
+	for (unsigned int i = 0; i < num_attrs; i++) {
+		snprintf(name, sizeof(name), "Interest%u", i % 8);
+		snprintf(value, sizeof(value), "value-%u", i);
+		dObj->addAttribute(name, value, i % 4 + 1);
+	}
+
+	m = dObj->getMetadata();
+	node = m->addMetadata("Node");
+	node->setParameter("type", "peer");
+	node->setParameter("id", "4d7f3b2c1a0e9f8d7c6b5a493827160504030201");
+	node->setParameter("name", "benchmark node");
+
+	for (unsigned int i = 0; i < 3; i++) {
+		iface = node->addMetadata("Interface");
+		iface->setParameter("type", "ethernet");
+		snprintf(value, sizeof(value), "00:11:22:33:44:%02x", i);
+		iface->setParameter("identifier", value);
+		snprintf(value, sizeof(value), "eth://00:11:22:33:44:%02x", i);
+		iface->addMetadata("Address", value);
+		snprintf(value, sizeof(value), "ipv4://10.0.0.%u", i + 1);
+		iface->addMetadata("Address", value);
+	}
+
+	node->addMetadata("Bloomfilter", "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA");
+
+	return dObj;
+}
+
+static double bench_encode(const DataObjectRef& dObj, MetadataFormat_t format, size_t *len)
+{
+	// Data objects cache their serialized metadata, so use the codecs directly
+	Metadata *m = dObj->getMetadata();
+	Timeval start = Timeval::now();
+
+	for (int i = 0; i < BENCH_ROUNDS; i++) {
+		unsigned char *raw;
+		bool ret;
+
+		if (format == METADATA_FORMAT_BINARY)
+			ret = BinaryMetadata::encode(m, &raw, len);
+		else
+			ret = m->getRawAlloc(&raw, len);
+
+		if (!ret)
+			return -1;
+
+		free(raw);
+	}
+	return (Timeval::now() - start).getTimeAsMilliSecondsDouble();
+}
+
+static double bench_cached(const DataObjectRef& dObj, MetadataFormat_t format)
+{
+	Timeval start = Timeval::now();
+
+	for (int i = 0; i < BENCH_ROUNDS; i++) {
+		unsigned char *raw;
+		size_t len;
+
+		if (!dObj->getRawMetadataAlloc(&raw, &len, format))
+			return -1;
+
+		free(raw);
+	}
+	return (Timeval::now() - start).getTimeAsMilliSecondsDouble();
+}
+
+static double bench_decode(const DataObjectRef& dObj, MetadataFormat_t format)
+{
+	unsigned char *raw;
+	size_t len;
+	Timeval start;
+
+	if (!dObj->getRawMetadataAlloc(&raw, &len, format))
+		return -1;
+
+	start = Timeval::now();
+
+	for (int i = 0; i < BENCH_ROUNDS; i++) {
+		DataObject *dObjPut = DataObject::create_for_putting();
+		size_t remaining;
+
+		// A trailing newline after an XML header is not put
+		if (!dObjPut || dObjPut->putData(raw, len, &remaining) < 0 || remaining != 0) {
+			delete dObjPut;
+			free(raw);
+			return -1;
+		}
+		delete dObjPut;
+	}
+	free(raw);
+
+	return (Timeval::now() - start).getTimeAsMilliSecondsDouble();
+}
+
+static void print_result(const char *name, double ms)
+{
+	if (ms < 0) {
+		printf("  %-8s %-8s failed\n", "", name);
+		return;
+	}
+	printf("  %-8s %-8s %8.2lf us/op\n", "", name, ms * 1000 / BENCH_ROUNDS);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int num_attrs[] = { 4, 32, 256 };
+
+	// Disable tracing
+	trace_disable(true);
+
+	for (unsigned int j = 0; j < sizeof(num_attrs) / sizeof(num_attrs[0]); j++) {
+		DataObjectRef dObj = create_node_description(num_attrs[j]);
+		static const char *names[] = { "XML", "binary" };
+		MetadataFormat_t formats[] = { METADATA_FORMAT_XML, METADATA_FORMAT_BINARY };
+
+		if (!dObj) {
+			fprintf(stderr, "Could not create data object\n");
+			return 1;
+		}
+
+		printf("Node description with %u attributes (%d rounds):\n", num_attrs[j], BENCH_ROUNDS);
+
+		for (int f = 0; f < 2; f++) {
+			size_t len = 0;
+			double ms = bench_encode(dObj, formats[f], &len);
+
+			printf("  %-8s %lu bytes\n", names[f], (unsigned long)len);
+			print_result("encode", ms);
+			print_result("cached", bench_cached(dObj, formats[f]));
+			print_result("decode", bench_decode(dObj, formats[f]));
+		}
+	}
+	return 0;
+}
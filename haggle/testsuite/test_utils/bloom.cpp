@@ -221,6 +221,45 @@ int main(int argc, char *argv[])
 	success &= tmp_succ;
 	print_pass(tmp_succ);
 
+	bloomfilter_free(bf_copy);
+
+	print_over_test_str(1, "Double hashing filter contains data objects: ");
+	bf_copy = bloomfilter_new_version((float)0.01, 1000, BLOOMFILTER_VERSION_DOUBLE_HASH);
+
+	if (bf_copy == NULL)
+		return 1;
+
+	for (i = 0; i < NUMBER_OF_DATA_OBJECTS_1; i++)
+		bloomfilter_add(bf_copy, data_object[i], data_object_len[i]);
+
+	tmp_succ = (BLOOMFILTER_GET_VERSION(bf_copy) == BLOOMFILTER_VERSION_DOUBLE_HASH) && 
+		check_for_data_objects_1(bf_copy);
+	success &= tmp_succ;
+	print_pass(tmp_succ);
+
+	bloomfilter_free(bf_copy);
+
+	print_over_test_str(1, "Blocked filter contains data objects: ");
+	bf_copy = bloomfilter_new_version((float)0.01, 1000, BLOOMFILTER_VERSION_BLOCKED);
+
+	if (bf_copy == NULL)
+		return 1;
+
+	for (i = 0; i < NUMBER_OF_DATA_OBJECTS_1; i++)
+		bloomfilter_add(bf_copy, data_object[i], data_object_len[i]);
+
+	tmp_succ = (BLOOMFILTER_GET_VERSION(bf_copy) == BLOOMFILTER_VERSION_BLOCKED) && 
+		(bf_copy->m % BLOOMFILTER_BLOCK_BITS == 0) &&
+		check_for_data_objects_1(bf_copy);
+	success &= tmp_succ;
+	print_pass(tmp_succ);
+
+	print_over_test_str(1, "Unknown version is not used: ");
+	BLOOMFILTER_GET_SALTS(bf_copy)[0] = BLOOMFILTER_VERSION_FLAG | (BLOOMFILTER_VERSION_MAX + 1);
+	tmp_succ = (bloomfilter_check(bf_copy, data_object[0], data_object_len[0]) == -1);
+	success &= tmp_succ;
+	print_pass(tmp_succ);
+
 	print_over_test_str(1, "Release: ");
 	bloomfilter_free(bf_copy);
 	
@@ -237,6 +237,29 @@ int main(int argc, char *argv[])
 	success &= tmp_succ;
 	print_pass(tmp_succ);
 	
+	print_over_test_str(1, "Blocked filter contains the same:");
+	counting_bloomfilter_free(cbf_copy);
+	bloomfilter_free(bf_from_cbf);
+	cbf_copy = counting_bloomfilter_new_version((float)0.01, BLOOMFILTER_SIZE, BLOOMFILTER_VERSION_BLOCKED);
+
+	if (cbf_copy == NULL)
+		return 1;
+
+	for (i = 0; i < NUMBER_OF_DATA_OBJECTS_INSERTED; i++)
+		counting_bloomfilter_add(cbf_copy, data_object_count[i], data_object_count_len[i]);
+
+	for (i = NUMBER_OF_DATA_OBJECTS_INSERTED - NUMBER_OF_DATA_OBJECTS_REMOVED; i < NUMBER_OF_DATA_OBJECTS_INSERTED; i++)
+		counting_bloomfilter_remove(cbf_copy, data_object_count[i], data_object_count_len[i]);
+
+	bf_from_cbf = counting_bloomfilter_to_noncounting(cbf_copy);
+	tmp_succ = (counting_bloomfilter_get_n(cbf_copy) == NUMBER_OF_DATA_OBJECTS_INSERTED - NUMBER_OF_DATA_OBJECTS_REMOVED) &&
+		check_for_data_objects(cbf_copy) &&
+		bf_from_cbf != NULL && 
+		BLOOMFILTER_GET_VERSION(bf_from_cbf) == BLOOMFILTER_VERSION_BLOCKED &&
+		check_for_data_objects_noncounting(bf_from_cbf);
+	success &= tmp_succ;
+	print_pass(tmp_succ);
+
 	print_over_test_str(1, "Release: ");
 
         if (cbf)
@@ -0,0 +1,162 @@
+/* Copyright 2008 Uppsala University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); 
+ * you may not use this file except in compliance with the License. 
+ * You may obtain a copy of the License at 
+ *     
+ *     http://www.apache.org/licenses/LICENSE-2.0 
+ *
+ * Unless required by applicable law or agreed to in writing, software 
+ * distributed under the License is distributed on an "AS IS" BASIS, 
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+ * See the License for the specific language governing permissions and 
+ * limitations under the License.
+ */ 
+
+#include "testhlp.h"
+
+#include <utils.h>
+#include <bloomfilter.h>
+#include <counting_bloomfilter.h>
+#include <libcpphaggle/Timeval.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace haggle;
+
+/*
+  This program compares the Bloomfilter versions on keys shaped like
+  data object ids, in filters of the size that nodes use:
+
+  - add: a key is added, as when a data object is received.
+  - check: a key that is in the filter is checked, as when a data
+    object is about to be sent to a neighbor that already has it.
+  - miss: a key that is not in the filter is checked, which is the
+    common case when deciding what to send. The share of these keys
+    that the filter claims to have is the false positive rate.
+*/
+
+#define BENCH_CAPACITY 2000
+#define BENCH_ERROR_RATE 0.01
+#define BENCH_ROUNDS 50
+#define KEY_LEN 20
+
+static unsigned char keys[2 * BENCH_CAPACITY][KEY_LEN];
+
+static const char *key(unsigned int i)
+{
+	return (const char *)keys[i];
+}
+
+// New keys for each round, since the filters of later versions are all the same
+static void create_keys(void)
+{
+	for (unsigned int i = 0; i < 2 * BENCH_CAPACITY; i++)
+		for (unsigned int j = 0; j < KEY_LEN; j++)
+			keys[i][j] = prng_uint8();
+}
+
+static void print_result(const char *name, double ms, unsigned long ops)
+{
+	printf("  %-8s %8.1lf ns/op\n", name, ms * 1000000 / ops);
+}
+
+static int bench_counting(unsigned int version)
+{
+	unsigned long hits = 0;
+	double ms_add = 0, ms_check = 0, ms_miss = 0;
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		struct counting_bloomfilter *cbf = counting_bloomfilter_new_version(BENCH_ERROR_RATE, BENCH_CAPACITY, version);
+		Timeval start;
+
+		create_keys();
+
+		if (!cbf)
+			return -1;
+
+		start = Timeval::now();
+		for (unsigned int i = 0; i < BENCH_CAPACITY; i++)
+			counting_bloomfilter_add(cbf, key(i), KEY_LEN);
+		ms_add += (Timeval::now() - start).getTimeAsMilliSecondsDouble();
+
+		start = Timeval::now();
+		for (unsigned int i = 0; i < BENCH_CAPACITY; i++)
+			counting_bloomfilter_check(cbf, key(i), KEY_LEN);
+		ms_check += (Timeval::now() - start).getTimeAsMilliSecondsDouble();
+
+		start = Timeval::now();
+		for (unsigned int i = BENCH_CAPACITY; i < 2 * BENCH_CAPACITY; i++)
+			hits += counting_bloomfilter_check(cbf, key(i), KEY_LEN);
+		ms_miss += (Timeval::now() - start).getTimeAsMilliSecondsDouble();
+
+		counting_bloomfilter_free(cbf);
+	}
+	printf("Counting filter, version %u:\n", version);
+	print_result("add", ms_add, BENCH_ROUNDS * BENCH_CAPACITY);
+	print_result("check", ms_check, BENCH_ROUNDS * BENCH_CAPACITY);
+	print_result("miss", ms_miss, BENCH_ROUNDS * BENCH_CAPACITY);
+	printf("  %-8s %8.2lf %%\n", "fp rate", hits * 100.0 / (BENCH_ROUNDS * BENCH_CAPACITY));
+
+	return 0;
+}
+
+static int bench_noncounting(unsigned int version)
+{
+	unsigned long hits = 0;
+	unsigned int m = 0;
+	double ms_add = 0, ms_check = 0, ms_miss = 0;
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		struct bloomfilter *bf = bloomfilter_new_version(BENCH_ERROR_RATE, BENCH_CAPACITY, version);
+		Timeval start;
+
+		create_keys();
+
+		if (!bf)
+			return -1;
+
+		m = bf->m;
+
+		start = Timeval::now();
+		for (unsigned int i = 0; i < BENCH_CAPACITY; i++)
+			bloomfilter_add(bf, key(i), KEY_LEN);
+		ms_add += (Timeval::now() - start).getTimeAsMilliSecondsDouble();
+
+		start = Timeval::now();
+		for (unsigned int i = 0; i < BENCH_CAPACITY; i++)
+			bloomfilter_check(bf, key(i), KEY_LEN);
+		ms_check += (Timeval::now() - start).getTimeAsMilliSecondsDouble();
+
+		start = Timeval::now();
+		for (unsigned int i = BENCH_CAPACITY; i < 2 * BENCH_CAPACITY; i++)
+			hits += bloomfilter_check(bf, key(i), KEY_LEN);
+		ms_miss += (Timeval::now() - start).getTimeAsMilliSecondsDouble();
+
+		bloomfilter_free(bf);
+	}
+	printf("Filter, version %u (%u bins):\n", version, m);
+	print_result("add", ms_add, BENCH_ROUNDS * BENCH_CAPACITY);
+	print_result("check", ms_check, BENCH_ROUNDS * BENCH_CAPACITY);
+	print_result("miss", ms_miss, BENCH_ROUNDS * BENCH_CAPACITY);
+	printf("  %-8s %8.2lf %%\n", "fp rate", hits * 100.0 / (BENCH_ROUNDS * BENCH_CAPACITY));
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	prng_init();
+
+	printf("%d keys of %d bytes, error rate %.2lf (%d rounds):\n", 
+	       BENCH_CAPACITY, KEY_LEN, BENCH_ERROR_RATE, BENCH_ROUNDS);
+
+	for (unsigned int v = 0; v <= BLOOMFILTER_VERSION_MAX; v++) {
+		if (bench_counting(v) < 0 || bench_noncounting(v) < 0) {
+			fprintf(stderr, "Could not create filter version %u\n", v);
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -121,12 +121,15 @@ int main(void)
 
 	ADD_SEPA("------ Metadata test suite ----------------\n");
 	ADD_TEST(haggle_test_metadata);
+	ADD_TEST(haggle_test_binaryMetadata);
 	
 	ADD_SEPA("------ Libcpphaggle -----------------------\n");
 	ADD_TEST(haggle_test_timeval);
 	//ADD_TEST(haggle_test_refcount);
 	ADD_TEST(haggle_test_map);
 	ADD_TEST(haggle_test_list);
+	ADD_TEST(haggle_test_eventqueue);
+	ADD_TEST(haggle_test_timerwheel);
 
 	ADD_SEPA("------ HaggleQueue test suite -------------\n");
 	ADD_TEST(haggle_test_createtest);
@@ -143,7 +146,17 @@ int main(void)
 	ADD_TEST(haggle_test_sha);
 	
 	ADD_SEPA("------ Data object test suite        ------\n");
+	ADD_TEST(haggle_test_bloomfilterDelta);
+	ADD_TEST(haggle_test_bloomfilterScaling);
+	ADD_TEST(haggle_test_dataObjectId);
 	ADD_TEST(haggle_test_getputData);
+	ADD_TEST(haggle_test_putHeader);
+	ADD_TEST(haggle_test_putVerify);
+	ADD_TEST(haggle_test_rawMetadata);
+	
+	ADD_SEPA("------ Data store test suite         ------\n");
+	ADD_TEST(haggle_test_attributeIndex);
+	ADD_TEST(haggle_test_dataObjectCache);
 /*
 	ADD_SEPA("------ Haggle kernel test suite      ------\n");
 	ADD_TEST(haggle_test_hagglemain);